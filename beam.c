@@ -0,0 +1,223 @@
+/*
+    Implementation for module which finds an approximate best
+        colouring by beam search.
+
+    Each term keeps at most beamWidth states, a colour with its best
+    score and the state of the term before it came from. Every kept
+    state is run along the next term's allowed colours, reading its
+    row of the transition matrix in order, then quickselect finds the
+    beamWidth-th best score and a pass in colour order keeps what is
+    at least as good, so states stay in colour order without sorting.
+    Ties go to the lowest colour, as in latticeSolve, so once the beam
+    holds every allowed colour the result is exact.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "beam.h"
+#include "problemStruct.c"
+
+/* Keeps sums of non-allowed scores from drifting towards overflow. */
+#define CLAMP(score) (((score) < LATTICE_NONALLOWED) ? LATTICE_NONALLOWED : (score))
+
+/* Ranks below which insertion beats quickselect. */
+#define SMALL_RANK 8
+
+struct beamState
+{
+    int score;
+    int colour;
+    /* Index of the state of the term before among that term's states. */
+    int back;
+};
+
+/*
+    Returns the rank-th largest (from 0) of the count values, which it
+    reorders, by insertion into the first few for small ranks and by
+    quickselect otherwise.
+*/
+static int selectLargest(int *values, int count, int rank)
+{
+    if (rank < SMALL_RANK)
+    {
+        for (int i = 1; i < count; i++)
+        {
+            int value = values[i];
+            int j = (i <= rank) ? i : rank + 1;
+            if (j == rank + 1 && value <= values[rank])
+            {
+                continue;
+            }
+            while (j > 0 && values[j - 1] < value)
+            {
+                if (j <= rank)
+                {
+                    values[j] = values[j - 1];
+                }
+                j--;
+            }
+            values[j] = value;
+        }
+        return values[rank];
+    }
+    int low = 0;
+    int high = count - 1;
+    while (low < high)
+    {
+        int pivot = values[low + (high - low) / 2];
+        int i = low;
+        int j = high;
+        while (i <= j)
+        {
+            while (values[i] > pivot)
+            {
+                i++;
+            }
+            while (values[j] < pivot)
+            {
+                j--;
+            }
+            if (i <= j)
+            {
+                int swap = values[i];
+                values[i] = values[j];
+                values[j] = swap;
+                i++;
+                j--;
+            }
+        }
+        if (rank <= j)
+        {
+            high = j;
+        }
+        else if (rank >= i)
+        {
+            low = i;
+        }
+        else
+        {
+            return values[rank];
+        }
+    }
+    return values[rank];
+}
+
+int latticeSolveBeam(struct lattice *l, const int *termTables, int termCount,
+                     int beamWidth, int *colours)
+{
+    assert(beamWidth > 0);
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    int colourCount = l->colourCount;
+    /* No term has more states than colours, so a wider beam only wastes room. */
+    if (beamWidth > colourCount)
+    {
+        beamWidth = colourCount;
+    }
+    struct beamState *states = (struct beamState *)malloc(sizeof(struct beamState) *
+                                                          beamWidth * (size_t)termCount);
+    assert(states);
+    int *counts = (int *)malloc(sizeof(int) * termCount);
+    assert(counts);
+    /* Best score and state so far for each allowed colour of the term. */
+    int *best = (int *)malloc(sizeof(int) * colourCount);
+    assert(best);
+    int *back = (int *)malloc(sizeof(int) * colourCount);
+    assert(back);
+    int *scratch = (int *)malloc(sizeof(int) * colourCount);
+    assert(scratch);
+
+    for (int i = 0; i < termCount; i++)
+    {
+        int table = termTables[i];
+        const int *row = LATTICE_ROW(l, table);
+        const int *allowed = l->allowedColours + l->allowedStarts[table + 1];
+        int allowedCount = l->allowedStarts[table + 2] - l->allowedStarts[table + 1];
+        for (int a = 0; a < allowedCount; a++)
+        {
+            best[a] = (i == 0) ? 0 : LATTICE_NONALLOWED;
+            back[a] = 0;
+        }
+        if (i > 0)
+        {
+            /* States are in colour order, so keeping the first best breaks ties low. */
+            const struct beamState *previous = states + (size_t)(i - 1) * beamWidth;
+            for (int s = 0; s < counts[i - 1]; s++)
+            {
+                int score = previous[s].score;
+                const int *transitions = l->transitions + previous[s].colour * colourCount;
+                for (int a = 0; a < allowedCount; a++)
+                {
+                    int next = score + transitions[allowed[a]];
+                    int better = next > best[a];
+                    best[a] = better ? next : best[a];
+                    back[a] = better ? s : back[a];
+                }
+            }
+        }
+        struct beamState *current = states + (size_t)i * beamWidth;
+        for (int a = 0; a < allowedCount; a++)
+        {
+            best[a] = CLAMP(best[a] + row[allowed[a]]);
+        }
+        /* Keep what beats the beamWidth-th best score, then ties at it lowest colour first. */
+        int threshold = LATTICE_NONALLOWED;
+        int ties = allowedCount;
+        if (allowedCount > beamWidth)
+        {
+            memcpy(scratch, best, sizeof(int) * allowedCount);
+            threshold = selectLargest(scratch, allowedCount, beamWidth - 1);
+            ties = beamWidth;
+            for (int a = 0; a < allowedCount; a++)
+            {
+                ties -= best[a] > threshold;
+            }
+        }
+        counts[i] = 0;
+        for (int a = 0; a < allowedCount; a++)
+        {
+            if (best[a] > threshold || (best[a] == threshold && ties-- > 0))
+            {
+                current[counts[i]].colour = allowed[a];
+                current[counts[i]].score = best[a];
+                current[counts[i]].back = back[a];
+                counts[i]++;
+            }
+        }
+    }
+
+    const struct beamState *last = states + (size_t)(termCount - 1) * beamWidth;
+    int state = 0;
+    for (int s = 1; s < counts[termCount - 1]; s++)
+    {
+        if (last[s].score > last[state].score)
+        {
+            state = s;
+        }
+    }
+    int score = last[state].score;
+    for (int i = termCount - 1; colours && i >= 0; i--)
+    {
+        colours[i] = states[(size_t)i * beamWidth + state].colour;
+        state = states[(size_t)i * beamWidth + state].back;
+    }
+    free(scratch);
+    free(back);
+    free(best);
+    free(counts);
+    free(states);
+    return score;
+}
+
+void solveProblemBeam(struct problem *p, int beamWidth, int colourMode, FILE *outFile)
+{
+    struct lattice *l = newLattice(p);
+    int *colours = (int *)malloc(sizeof(int) * (p->termCount > 0 ? p->termCount : 1));
+    assert(colours);
+    latticeSolveBeam(l, p->termTables, p->termCount, beamWidth, colours);
+    outputColouring(outFile, p, colours, colourMode);
+    free(colours);
+    freeLattice(l);
+}
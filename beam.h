@@ -0,0 +1,29 @@
+/*
+    Header for module which finds an approximate best colouring of
+        a Part F problem, keeping only the best few colours of each
+        term, for tables with too many colours for an exact solve.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef BEAM_H
+#define BEAM_H 1
+
+/*
+    Same as latticeSolve, but each term only keeps the beamWidth best
+    of the colours its table allows, so a step costs beamWidth times
+    the colours allowed rather than the square of the colour count.
+    The score returned is that of the colouring found, at most the
+    optimal score and equal to it once beamWidth reaches the most
+    colours any table allows.
+*/
+int latticeSolveBeam(struct lattice *l, const int *termTables, int termCount,
+                     int beamWidth, int *colours);
+
+/*
+    Outputs the colouring latticeSolveBeam finds for the given Part F
+    problem as outputProblem does.
+*/
+void solveProblemBeam(struct problem *p, int beamWidth, int colourMode, FILE *outFile);
+
+#endif
@@ -0,0 +1,2777 @@
+/*
+    Benchmarks for the lattice solvers over synthetic tables and
+        documents.
+
+    Make using
+        make benchmark
+
+    Run using
+        ./benchmark [suite]
+
+    where suite picks a single benchmark to run, by default all
+    are run. Each benchmark checks its results against the plain
+    lattice solver before reporting times.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "lattice.h"
+#include "kernels.h"
+#include "scheduler.h"
+#include "kbest.h"
+#include "marginals.h"
+#include "semiring.h"
+#include "constraints.h"
+#include "beam.h"
+#include "runs.h"
+#include "loader.h"
+#include "matcher.h"
+#include "pattern.h"
+#include "tokenizer.h"
+#include "highlight.h"
+#include "planner.h"
+#include "counters.h"
+#include "narrow.h"
+#include "fold.h"
+#include "vocabulary.h"
+#include "cache.h"
+#include "incremental.h"
+#include "stream.h"
+#include "problem.h"
+#include "problemStruct.c"
+#include "solutionStruct.c"
+
+/* Proportion of terms (out of 100) which have a table. */
+#define MATCHED_PERCENT 30
+
+/* Number of term tables in synthetic lattices. */
+#define SYNTHETIC_TABLES 256
+
+struct corpus
+{
+    int documentCount;
+    int *termCounts;
+    int **termTables;
+};
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+    Builds a lattice with the given number of colours where each table
+    allows no colour and up to two others.
+*/
+static struct lattice *syntheticLattice(int colourCount, int tableCount)
+{
+    struct lattice *l = (struct lattice *)malloc(sizeof(struct lattice));
+    assert(l);
+    l->colourCount = colourCount;
+    l->rowCount = tableCount + 1;
+    l->shared = 0;
+    l->emissions = (int *)malloc(sizeof(int) * l->rowCount * colourCount);
+    assert(l->emissions);
+    for (int i = -1; i < tableCount; i++)
+    {
+        int *row = LATTICE_ROW(l, i);
+        for (int j = 0; j < colourCount; j++)
+        {
+            row[j] = LATTICE_NONALLOWED;
+        }
+        row[0] = 0;
+        if (i >= 0)
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                row[1 + rand() % (colourCount - 1)] = 1 + rand() % 10;
+            }
+        }
+    }
+    l->transitions = (int *)malloc(sizeof(int) * colourCount * colourCount);
+    assert(l->transitions);
+    for (int i = 0; i < colourCount * colourCount; i++)
+    {
+        l->transitions[i] = rand() % 11 - 5;
+    }
+    latticeListAllowed(l);
+    return l;
+}
+
+/* Builds documents with lengths between minTerms and maxTerms. */
+static struct corpus *syntheticCorpus(int documentCount, int minTerms,
+                                      int maxTerms, int tableCount)
+{
+    struct corpus *c = (struct corpus *)malloc(sizeof(struct corpus));
+    assert(c);
+    c->documentCount = documentCount;
+    c->termCounts = (int *)malloc(sizeof(int) * documentCount);
+    assert(c->termCounts);
+    c->termTables = (int **)malloc(sizeof(int *) * documentCount);
+    assert(c->termTables);
+    for (int i = 0; i < documentCount; i++)
+    {
+        c->termCounts[i] = minTerms + rand() % (maxTerms - minTerms + 1);
+        c->termTables[i] = (int *)malloc(sizeof(int) * c->termCounts[i]);
+        assert(c->termTables[i]);
+        for (int j = 0; j < c->termCounts[i]; j++)
+        {
+            c->termTables[i][j] = (rand() % 100 < MATCHED_PERCENT) ? rand() % tableCount : -1;
+        }
+    }
+    return c;
+}
+
+static void freeCorpus(struct corpus *c)
+{
+    for (int i = 0; i < c->documentCount; i++)
+    {
+        free(c->termTables[i]);
+    }
+    free(c->termTables);
+    free(c->termCounts);
+    free(c);
+}
+
+/* Long documents through the generic and the specialised kernels. */
+static void benchmarkKernels(void)
+{
+    int documentCount = 100;
+    int termCount = 10000;
+    printf("kernels: %d documents of %d terms\n", documentCount, termCount);
+    printf("%8s %16s %16s %8s\n", "colours", "generic terms/s", "special terms/s", "speedup");
+    int colourCounts[] = {4, 8, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], SYNTHETIC_TABLES);
+        struct corpus *c = syntheticCorpus(documentCount, termCount, termCount, SYNTHETIC_TABLES);
+        int *expected = (int *)malloc(sizeof(int) * termCount);
+        int *colours = (int *)malloc(sizeof(int) * termCount);
+        assert(expected && colours);
+        double generic = 0;
+        double special = 0;
+        for (int i = 0; i < documentCount; i++)
+        {
+            double start = now();
+            int expectedScore = latticeSolveGeneric(l, c->termTables[i], termCount, expected);
+            generic += now() - start;
+            start = now();
+            int score = latticeSolve(l, c->termTables[i], termCount, colours);
+            special += now() - start;
+            assert(score == expectedScore);
+            assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+        }
+        double terms = (double)documentCount * termCount;
+        printf("%8d %16.0f %16.0f %7.2fx\n", colourCounts[n], terms / generic,
+               terms / special, generic / special);
+        free(colours);
+        free(expected);
+        freeCorpus(c);
+        freeLattice(l);
+    }
+}
+
+/* A few huge documents among many short ones, solved one after another and by the scheduler. */
+static void benchmarkSchedule(void)
+{
+    int documentCount = 20000;
+    int workerCount = 4;
+    struct lattice *l = syntheticLattice(4, SYNTHETIC_TABLES);
+    struct corpus *c = syntheticCorpus(documentCount, 5, 200, SYNTHETIC_TABLES);
+    /* Make a handful of documents five orders of magnitude longer. */
+    for (int i = 0; i < 3; i++)
+    {
+        int index = rand() % documentCount;
+        free(c->termTables[index]);
+        c->termCounts[index] = 1000000 + rand() % 1000000;
+        c->termTables[index] = (int *)malloc(sizeof(int) * c->termCounts[index]);
+        assert(c->termTables[index]);
+        for (int j = 0; j < c->termCounts[index]; j++)
+        {
+            c->termTables[index][j] = (rand() % 100 < MATCHED_PERCENT) ? rand() % SYNTHETIC_TABLES : -1;
+        }
+    }
+    printf("schedule: %d documents of 5-200 terms and 3 of 1-2 million, %d workers\n",
+           documentCount, workerCount);
+    int *expected = (int *)malloc(sizeof(int) * documentCount);
+    int *scores = (int *)malloc(sizeof(int) * documentCount);
+    int **expectedColours = (int **)malloc(sizeof(int *) * documentCount);
+    int **colours = (int **)malloc(sizeof(int *) * documentCount);
+    assert(expected && scores && expectedColours && colours);
+    for (int i = 0; i < documentCount; i++)
+    {
+        expectedColours[i] = (int *)malloc(sizeof(int) * c->termCounts[i]);
+        colours[i] = (int *)malloc(sizeof(int) * c->termCounts[i]);
+        assert(expectedColours[i] && colours[i]);
+    }
+
+    double start = now();
+    for (int i = 0; i < documentCount; i++)
+    {
+        expected[i] = latticeSolve(l, c->termTables[i], c->termCounts[i], expectedColours[i]);
+    }
+    double sequential = now() - start;
+
+    struct schedulerStats stats;
+    solveScheduled(l, (const int *const *)c->termTables, c->termCounts, documentCount,
+                   workerCount, scores, colours, &stats);
+
+    for (int i = 0; i < documentCount; i++)
+    {
+        assert(scores[i] == expected[i]);
+        assert(memcmp(colours[i], expectedColours[i], sizeof(int) * c->termCounts[i]) == 0);
+        free(expectedColours[i]);
+        free(colours[i]);
+    }
+    printf("sequential %.3fs, scheduled %.3fs\n", sequential, stats.elapsed);
+    printSchedulerStats(stdout, &stats);
+
+    free(expectedColours);
+    free(colours);
+    free(scores);
+    free(expected);
+    freeCorpus(c);
+    freeLattice(l);
+}
+
+/*
+    Finds the k best scores by keeping the k best paths into every
+    term and colour, the straightforward way lazy k-best avoids.
+*/
+static int naiveKBest(struct lattice *l, const int *termTables, int termCount,
+                      int k, int *scores)
+{
+    int colourCount = l->colourCount;
+    /* Up to k scores, best first, for each colour of the current and next term. */
+    int *lists = (int *)malloc(sizeof(int) * colourCount * k);
+    int *nextLists = (int *)malloc(sizeof(int) * colourCount * k);
+    int *counts = (int *)malloc(sizeof(int) * colourCount);
+    int *nextCounts = (int *)malloc(sizeof(int) * colourCount);
+    int *heads = (int *)malloc(sizeof(int) * colourCount);
+    assert(lists && nextLists && counts && nextCounts && heads);
+    const int *row = LATTICE_ROW(l, termTables[0]);
+    for (int j = 0; j < colourCount; j++)
+    {
+        counts[j] = (row[j] != LATTICE_NONALLOWED);
+        lists[j * k] = row[j];
+    }
+    for (int i = 1; i < termCount; i++)
+    {
+        row = LATTICE_ROW(l, termTables[i]);
+        for (int j = 0; j < colourCount; j++)
+        {
+            nextCounts[j] = 0;
+            if (row[j] == LATTICE_NONALLOWED)
+            {
+                continue;
+            }
+            /* Merge every previous colour's list, best first, up to k. */
+            for (int c = 0; c < colourCount; c++)
+            {
+                heads[c] = 0;
+            }
+            for (int r = 0; r < k; r++)
+            {
+                int best = -1;
+                int bestScore = 0;
+                for (int c = 0; c < colourCount; c++)
+                {
+                    if (heads[c] < counts[c])
+                    {
+                        int score = lists[c * k + heads[c]] + l->transitions[c * colourCount + j];
+                        if (best < 0 || score > bestScore)
+                        {
+                            best = c;
+                            bestScore = score;
+                        }
+                    }
+                }
+                if (best < 0)
+                {
+                    break;
+                }
+                heads[best]++;
+                nextLists[j * k + r] = bestScore + row[j];
+                nextCounts[j]++;
+            }
+        }
+        int *swap = lists;
+        lists = nextLists;
+        nextLists = swap;
+        swap = counts;
+        counts = nextCounts;
+        nextCounts = swap;
+    }
+    int found = 0;
+    for (int r = 0; r < k; r++)
+    {
+        int best = -1;
+        for (int j = 0; j < colourCount; j++)
+        {
+            if (counts[j] > 0 && (best < 0 || lists[j * k] > lists[best * k]))
+            {
+                best = j;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        scores[found] = lists[best * k];
+        found++;
+        memmove(lists + best * k, lists + best * k + 1, sizeof(int) * (counts[best] - 1));
+        counts[best]--;
+    }
+    free(lists);
+    free(nextLists);
+    free(counts);
+    free(nextCounts);
+    free(heads);
+    return found;
+}
+
+/* The k best colourings of long documents, lazily and naively. */
+static void benchmarkKBest(void)
+{
+    int documentCount = 10;
+    int termCount = 10000;
+    printf("kbest: %d documents of %d terms\n", documentCount, termCount);
+    printf("%8s %8s %12s %12s %12s %8s\n", "colours", "k", "viterbi (s)", "lazy (s)", "naive (s)", "speedup");
+    int colourCounts[] = {4, 16};
+    int ks[] = {1, 10, 100};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])) * 3; n++)
+    {
+        int k = ks[n % 3];
+        struct lattice *l = syntheticLattice(colourCounts[n / 3], SYNTHETIC_TABLES);
+        struct corpus *c = syntheticCorpus(documentCount, termCount, termCount, SYNTHETIC_TABLES);
+        int *scores = (int *)malloc(sizeof(int) * k);
+        int *expected = (int *)malloc(sizeof(int) * k);
+        int **colours = (int **)malloc(sizeof(int *) * k);
+        assert(scores && expected && colours);
+        for (int r = 0; r < k; r++)
+        {
+            colours[r] = (int *)malloc(sizeof(int) * termCount);
+            assert(colours[r]);
+        }
+        int *best = (int *)malloc(sizeof(int) * termCount);
+        assert(best);
+        double viterbi = 0;
+        double lazy = 0;
+        double naive = 0;
+        for (int i = 0; i < documentCount; i++)
+        {
+            double start = now();
+            int bestScore = latticeSolve(l, c->termTables[i], termCount, best);
+            viterbi += now() - start;
+            start = now();
+            int found = latticeSolveKBest(l, c->termTables[i], termCount, k, scores, colours);
+            lazy += now() - start;
+            start = now();
+            int expectedFound = naiveKBest(l, c->termTables[i], termCount, k, expected);
+            naive += now() - start;
+
+            assert(found == expectedFound);
+            assert(memcmp(scores, expected, sizeof(int) * found) == 0);
+            assert(scores[0] == bestScore);
+            assert(memcmp(colours[0], best, sizeof(int) * termCount) == 0);
+            for (int r = 1; r < found; r++)
+            {
+                /* Colourings are distinct and score what they claim. */
+                assert(memcmp(colours[r], colours[r - 1], sizeof(int) * termCount) != 0);
+                int score = LATTICE_ROW(l, c->termTables[i][0])[colours[r][0]];
+                for (int t = 1; t < termCount; t++)
+                {
+                    score += l->transitions[colours[r][t - 1] * l->colourCount + colours[r][t]] +
+                             LATTICE_ROW(l, c->termTables[i][t])[colours[r][t]];
+                }
+                assert(score == scores[r]);
+            }
+        }
+        printf("%8d %8d %12.4f %12.4f %12.4f %7.2fx\n", colourCounts[n / 3], k, viterbi, lazy,
+               naive, naive / lazy);
+        if (k == 1)
+        {
+            /* The best colouring alone costs what Viterbi does. */
+            assert(lazy < 2 * viterbi);
+        }
+        for (int r = 0; r < k; r++)
+        {
+            free(colours[r]);
+        }
+        free(best);
+        free(colours);
+        free(expected);
+        free(scores);
+        freeCorpus(c);
+        freeLattice(l);
+    }
+}
+
+/* Returns log(exp(a) + exp(b)) for scores that may be -INFINITY. */
+static double logAdd(double a, double b)
+{
+    if (a == -INFINITY)
+    {
+        return b;
+    }
+    if (b == -INFINITY)
+    {
+        return a;
+    }
+    return (a > b) ? a + log1p(exp(b - a)) : b + log1p(exp(a - b));
+}
+
+/* Plain forward-backward in double with the standard library, returning log of the total weight. */
+static double naiveMarginals(struct lattice *l, const int *termTables, int termCount,
+                             double *marginals)
+{
+    int colourCount = l->colourCount;
+    double *alpha = (double *)malloc(sizeof(double) * termCount * colourCount);
+    double *beta = (double *)malloc(sizeof(double) * termCount * colourCount);
+    assert(alpha && beta);
+    for (int i = 0; i < termCount; i++)
+    {
+        const int *row = LATTICE_ROW(l, termTables[i]);
+        for (int j = 0; j < colourCount; j++)
+        {
+            double sum = (i == 0) ? 0 : -INFINITY;
+            for (int k = 0; i > 0 && k < colourCount; k++)
+            {
+                sum = logAdd(sum, alpha[(i - 1) * colourCount + k] + l->transitions[k * colourCount + j]);
+            }
+            alpha[i * colourCount + j] = (row[j] == LATTICE_NONALLOWED) ? -INFINITY : sum + row[j];
+        }
+    }
+    for (int i = termCount - 1; i >= 0; i--)
+    {
+        for (int j = 0; j < colourCount; j++)
+        {
+            double sum = (i == termCount - 1) ? 0 : -INFINITY;
+            for (int k = 0; i < termCount - 1 && k < colourCount; k++)
+            {
+                int next = LATTICE_ROW(l, termTables[i + 1])[k];
+                if (next != LATTICE_NONALLOWED)
+                {
+                    sum = logAdd(sum, l->transitions[j * colourCount + k] + next +
+                                          beta[(i + 1) * colourCount + k]);
+                }
+            }
+            beta[i * colourCount + j] = sum;
+        }
+    }
+    double total = -INFINITY;
+    for (int j = 0; j < colourCount; j++)
+    {
+        total = logAdd(total, alpha[(termCount - 1) * colourCount + j]);
+    }
+    for (int i = 0; i < termCount * colourCount; i++)
+    {
+        marginals[i] = exp(alpha[i] + beta[i] - total);
+    }
+    free(beta);
+    free(alpha);
+    return total;
+}
+
+/* Marginals in float and double against a Viterbi pass, checked against plain forward-backward. */
+static void benchmarkMarginals(void)
+{
+    int documentCount = 20;
+    int termCount = 10000;
+    printf("marginals: %d documents of %d terms\n", documentCount, termCount);
+    printf("%8s %12s %12s %12s %8s %8s %10s %10s\n", "colours", "viterbi (s)", "float (s)",
+           "double (s)", "float", "double", "float err", "double err");
+    int colourCounts[] = {4, 8, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        int colourCount = colourCounts[n];
+        struct lattice *l = syntheticLattice(colourCount, SYNTHETIC_TABLES);
+        struct corpus *c = syntheticCorpus(documentCount, termCount, termCount, SYNTHETIC_TABLES);
+        size_t size = (size_t)termCount * colourCount;
+        double *expected = (double *)malloc(sizeof(double) * size);
+        float *single = (float *)malloc(sizeof(float) * size);
+        double *marginals = (double *)malloc(sizeof(double) * size);
+        int *colours = (int *)malloc(sizeof(int) * termCount);
+        assert(expected && single && marginals && colours);
+        double viterbi = 0;
+        double singleTime = 0;
+        double doubleTime = 0;
+        double singleError = 0;
+        double doubleError = 0;
+        for (int i = 0; i < documentCount; i++)
+        {
+            double expectedWeight = naiveMarginals(l, c->termTables[i], termCount, expected);
+            double start = now();
+            latticeSolve(l, c->termTables[i], termCount, colours);
+            viterbi += now() - start;
+            start = now();
+            double singleWeight = latticeMarginalsFloat(l, c->termTables[i], termCount, single);
+            singleTime += now() - start;
+            start = now();
+            double doubleWeight = latticeMarginalsDouble(l, c->termTables[i], termCount, marginals);
+            doubleTime += now() - start;
+            assert(fabs(singleWeight - expectedWeight) < 1e-5 * fabs(expectedWeight) + 1e-3);
+            assert(fabs(doubleWeight - expectedWeight) < 1e-9 * fabs(expectedWeight) + 1e-9);
+            for (size_t j = 0; j < size; j++)
+            {
+                singleError = fmax(singleError, fabs(single[j] - expected[j]));
+                doubleError = fmax(doubleError, fabs(marginals[j] - expected[j]));
+            }
+        }
+        assert(singleError < 1e-4);
+        assert(doubleError < 1e-9);
+        printf("%8d %12.4f %12.4f %12.4f %7.2fx %7.2fx %10.2e %10.2e\n", colourCount, viterbi,
+               singleTime, doubleTime, singleTime / viterbi, doubleTime / viterbi, singleError,
+               doubleError);
+        free(colours);
+        free(marginals);
+        free(single);
+        free(expected);
+        freeCorpus(c);
+        freeLattice(l);
+    }
+}
+
+/* Enumerates every colouring of a short document for its best score, how many reach it and the log total weight. */
+static void bruteForce(struct lattice *l, const int *termTables, int termCount, int *best,
+                       unsigned long long *count, double *logWeight)
+{
+    int colourCount = l->colourCount;
+    int colours[16] = {0};
+    assert(termCount <= 16);
+    *best = LATTICE_NONALLOWED;
+    *count = 0;
+    *logWeight = -INFINITY;
+    while (1)
+    {
+        int score = 0;
+        int allowed = 1;
+        for (int i = 0; i < termCount && allowed; i++)
+        {
+            int emission = LATTICE_ROW(l, termTables[i])[colours[i]];
+            allowed = emission != LATTICE_NONALLOWED;
+            score += emission;
+            if (i > 0)
+            {
+                score += l->transitions[colours[i - 1] * colourCount + colours[i]];
+            }
+        }
+        if (allowed)
+        {
+            if (score > *best)
+            {
+                *best = score;
+                *count = 0;
+            }
+            if (score == *best)
+            {
+                (*count)++;
+            }
+            *logWeight = logAdd(*logWeight, score);
+        }
+        int i = 0;
+        while (i < termCount && ++colours[i] == colourCount)
+        {
+            colours[i] = 0;
+            i++;
+        }
+        if (i == termCount)
+        {
+            break;
+        }
+    }
+}
+
+/* Each semiring's pass over long documents, checked against enumeration on short ones. */
+static void benchmarkSemiring(void)
+{
+    struct lattice *small = syntheticLattice(4, 8);
+    /* Few distinct scores so that ties, and so counts above one, are common. */
+    for (int i = 0; i < small->rowCount * small->colourCount; i++)
+    {
+        if (small->emissions[i] != LATTICE_NONALLOWED)
+        {
+            small->emissions[i] %= 2;
+        }
+    }
+    for (int i = 0; i < small->colourCount * small->colourCount; i++)
+    {
+        small->transitions[i] %= 2;
+    }
+    struct corpus *shortCorpus = syntheticCorpus(2000, 1, 8, 8);
+    for (int i = 0; i < shortCorpus->documentCount; i++)
+    {
+        int best;
+        unsigned long long count;
+        double logWeight;
+        bruteForce(small, shortCorpus->termTables[i], shortCorpus->termCounts[i], &best, &count,
+                   &logWeight);
+        int score;
+        assert(latticeCountBest(small, shortCorpus->termTables[i], shortCorpus->termCounts[i],
+                                &score) == count);
+        assert(score == best);
+        assert(latticeScore(small, shortCorpus->termTables[i], shortCorpus->termCounts[i]) == best);
+        assert(fabs(latticeLogWeight(small, shortCorpus->termTables[i],
+                                     shortCorpus->termCounts[i]) - logWeight) < 1e-9);
+    }
+    freeCorpus(shortCorpus);
+    freeLattice(small);
+
+    int documentCount = 20;
+    int termCount = 10000;
+    printf("semiring: %d documents of %d terms, terms/s\n", documentCount, termCount);
+    printf("%8s %14s %14s %14s %14s\n", "colours", "max-plus", "argmax", "counting",
+           "log-sum-exp");
+    int colourCounts[] = {4, 8, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], SYNTHETIC_TABLES);
+        struct corpus *c = syntheticCorpus(documentCount, termCount, termCount, SYNTHETIC_TABLES);
+        int *colours = (int *)malloc(sizeof(int) * termCount);
+        double *marginals = (double *)malloc(sizeof(double) * termCount * colourCounts[n]);
+        assert(colours && marginals);
+        double times[4] = {0};
+        for (int i = 0; i < documentCount; i++)
+        {
+            int expected = latticeSolve(l, c->termTables[i], termCount, NULL);
+            double start = now();
+            int score = latticeScore(l, c->termTables[i], termCount);
+            times[0] += now() - start;
+            assert(score == expected);
+            start = now();
+            score = latticeSolveGeneric(l, c->termTables[i], termCount, colours);
+            times[1] += now() - start;
+            assert(score == expected);
+            start = now();
+            latticeCountBest(l, c->termTables[i], termCount, &score);
+            times[2] += now() - start;
+            assert(score == expected);
+            start = now();
+            double logWeight = latticeLogWeight(l, c->termTables[i], termCount);
+            times[3] += now() - start;
+            double expectedWeight = latticeMarginalsDouble(l, c->termTables[i], termCount,
+                                                           marginals);
+            assert(fabs(logWeight - expectedWeight) < 1e-9 * fabs(expectedWeight));
+        }
+        double terms = (double)documentCount * termCount;
+        printf("%8d %14.0f %14.0f %14.0f %14.0f\n", colourCounts[n], terms / times[0],
+               terms / times[1], terms / times[2], terms / times[3]);
+        free(marginals);
+        free(colours);
+        freeCorpus(c);
+        freeLattice(l);
+    }
+}
+
+/* Best score over every colouring of a short document which meets the constraints, by enumeration. */
+static int bruteForceConstrained(struct lattice *l, const int *termTables, int termCount,
+                                 const struct latticeConstraints *c)
+{
+    int colourCount = l->colourCount;
+    int colours[16] = {0};
+    int pins[16];
+    assert(termCount <= 16);
+    for (int i = 0; i < termCount; i++)
+    {
+        pins[i] = -1;
+    }
+    for (int i = 0; i < c->pinCount; i++)
+    {
+        pins[c->pinTerms[i]] = c->pinColours[i];
+    }
+    int best = LATTICE_NONALLOWED;
+    while (1)
+    {
+        int score = 0;
+        int allowed = 1;
+        for (int i = 0; i < termCount && allowed; i++)
+        {
+            int emission = LATTICE_ROW(l, termTables[i])[colours[i]];
+            if (pins[i] >= 0)
+            {
+                allowed = colours[i] == pins[i];
+                emission = (emission == LATTICE_NONALLOWED) ? 0 : emission;
+            }
+            allowed = allowed && emission != LATTICE_NONALLOWED;
+            score += emission;
+            for (int f = 0; i > 0 && f < c->forbidCount; f++)
+            {
+                allowed = allowed && !(colours[i - 1] == c->forbidPrevColours[f] &&
+                                       colours[i] == c->forbidColours[f]);
+            }
+            if (i > 0)
+            {
+                score += l->transitions[colours[i - 1] * colourCount + colours[i]];
+            }
+        }
+        if (allowed && score > best)
+        {
+            best = score;
+        }
+        int i = 0;
+        while (i < termCount && ++colours[i] == colourCount)
+        {
+            colours[i] = 0;
+            i++;
+        }
+        if (i == termCount)
+        {
+            break;
+        }
+    }
+    return best;
+}
+
+/* Fills in pinCount random pins over termCount terms and forbidCount random forbidden pairs of colours. */
+static void randomConstraints(struct latticeConstraints *c, int colourCount, int termCount,
+                              int pinCount, int forbidCount)
+{
+    c->pinCount = pinCount;
+    c->forbidCount = forbidCount;
+    for (int i = 0; i < pinCount; i++)
+    {
+        /* Distinct terms so each pin is the one which wins. */
+        c->pinTerms[i] = (int)((long long)i * termCount / pinCount) + rand() % (termCount / pinCount);
+        c->pinColours[i] = rand() % colourCount;
+    }
+    /* Leave no colour out, or runs of words without tables couldn't be coloured. */
+    for (int i = 0; i < forbidCount; i++)
+    {
+        c->forbidPrevColours[i] = 1 + rand() % (colourCount - 1);
+        c->forbidColours[i] = 1 + rand() % (colourCount - 1);
+    }
+}
+
+/* Constrained against unconstrained solves, checked by enumeration on short documents. */
+static void benchmarkConstraints(void)
+{
+    int maxPins = 100;
+    int maxForbids = 4;
+    struct latticeConstraints c;
+    c.pinTerms = (int *)malloc(sizeof(int) * maxPins);
+    c.pinColours = (int *)malloc(sizeof(int) * maxPins);
+    c.forbidPrevColours = (int *)malloc(sizeof(int) * maxForbids);
+    c.forbidColours = (int *)malloc(sizeof(int) * maxForbids);
+    assert(c.pinTerms && c.pinColours && c.forbidPrevColours && c.forbidColours);
+
+    struct lattice *small = syntheticLattice(4, 8);
+    struct corpus *shortCorpus = syntheticCorpus(2000, 2, 8, 8);
+    int colours[8];
+    for (int i = 0; i < shortCorpus->documentCount; i++)
+    {
+        int termCount = shortCorpus->termCounts[i];
+        randomConstraints(&c, 4, termCount, 1 + rand() % 2, rand() % 3);
+        int score = latticeSolveConstrained(small, shortCorpus->termTables[i], termCount, &c,
+                                            colours);
+        int expected = bruteForceConstrained(small, shortCorpus->termTables[i], termCount, &c);
+        assert(score == expected || (score < LATTICE_FORBIDDEN / 2 && expected == LATTICE_NONALLOWED));
+    }
+    freeCorpus(shortCorpus);
+    freeLattice(small);
+
+    int documentCount = 20;
+    int termCount = 10000;
+    printf("constraints: %d documents of %d terms, %d pins and %d forbidden pairs each\n",
+           documentCount, termCount, maxPins, maxForbids);
+    printf("%8s %14s %14s %8s\n", "colours", "free terms/s", "pinned terms/s", "ratio");
+    int colourCounts[] = {4, 8, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], SYNTHETIC_TABLES);
+        struct corpus *corpus = syntheticCorpus(documentCount, termCount, termCount, SYNTHETIC_TABLES);
+        int *expected = (int *)malloc(sizeof(int) * termCount);
+        int *constrained = (int *)malloc(sizeof(int) * termCount);
+        assert(expected && constrained);
+        double unconstrained = 0;
+        double pinned = 0;
+        for (int i = 0; i < documentCount; i++)
+        {
+            /* No constraints changes nothing. */
+            c.pinCount = 0;
+            c.forbidCount = 0;
+            int score = latticeSolveConstrained(l, corpus->termTables[i], termCount, &c, constrained);
+            double start = now();
+            int expectedScore = latticeSolve(l, corpus->termTables[i], termCount, expected);
+            unconstrained += now() - start;
+            assert(score == expectedScore);
+            assert(memcmp(constrained, expected, sizeof(int) * termCount) == 0);
+
+            randomConstraints(&c, colourCounts[n], termCount, maxPins, maxForbids);
+            start = now();
+            score = latticeSolveConstrained(l, corpus->termTables[i], termCount, &c, constrained);
+            pinned += now() - start;
+            for (int p = 0; p < c.pinCount; p++)
+            {
+                assert(constrained[c.pinTerms[p]] == c.pinColours[p]);
+            }
+            for (int t = 1; t < termCount && score >= LATTICE_FORBIDDEN / 2; t++)
+            {
+                for (int f = 0; f < c.forbidCount; f++)
+                {
+                    assert(constrained[t - 1] != c.forbidPrevColours[f] ||
+                           constrained[t] != c.forbidColours[f]);
+                }
+            }
+        }
+        double terms = (double)documentCount * termCount;
+        printf("%8d %14.0f %14.0f %7.2fx\n", colourCounts[n], terms / unconstrained, terms / pinned,
+               pinned / unconstrained);
+        free(constrained);
+        free(expected);
+        freeCorpus(corpus);
+        freeLattice(l);
+    }
+    free(c.forbidColours);
+    free(c.forbidPrevColours);
+    free(c.pinColours);
+    free(c.pinTerms);
+}
+
+/* Builds a lattice with the given number of colours where each table allows no colour and allowedCount others. */
+static struct lattice *wideLattice(int colourCount, int tableCount, int allowedCount)
+{
+    struct lattice *l = syntheticLattice(colourCount, tableCount);
+    for (int i = 0; i < tableCount; i++)
+    {
+        int *row = LATTICE_ROW(l, i);
+        for (int k = 0; k < allowedCount; k++)
+        {
+            row[1 + rand() % (colourCount - 1)] = 1 + rand() % 100;
+        }
+    }
+    free(l->allowedStarts);
+    free(l->allowedColours);
+    latticeListAllowed(l);
+    return l;
+}
+
+/* Beam widths against the exact solve on a large colour set where every term has a table. */
+static void benchmarkBeam(void)
+{
+    int colourCount = 256;
+    int allowedCount = 128;
+    int documentCount = 10;
+    int termCount = 2000;
+    struct lattice *l = wideLattice(colourCount, SYNTHETIC_TABLES, allowedCount);
+    int **termTables = (int **)malloc(sizeof(int *) * documentCount);
+    int *exactScores = (int *)malloc(sizeof(int) * documentCount);
+    int *colours = (int *)malloc(sizeof(int) * termCount);
+    int *expected = (int *)malloc(sizeof(int) * termCount);
+    assert(termTables && exactScores && colours && expected);
+    printf("beam: %d documents of %d terms, %d colours, tables allowing up to %d\n",
+           documentCount, termCount, colourCount, allowedCount + 1);
+    double exact = 0;
+    for (int i = 0; i < documentCount; i++)
+    {
+        termTables[i] = (int *)malloc(sizeof(int) * termCount);
+        assert(termTables[i]);
+        for (int j = 0; j < termCount; j++)
+        {
+            termTables[i][j] = rand() % SYNTHETIC_TABLES;
+        }
+        double start = now();
+        exactScores[i] = latticeSolve(l, termTables[i], termCount, expected);
+        exact += now() - start;
+        /* A beam as wide as any table is exact. */
+        assert(latticeSolveBeam(l, termTables[i], termCount, allowedCount + 1, colours) ==
+               exactScores[i]);
+        assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+    }
+    printf("%8s %10s %10s %8s %12s\n", "width", "exact (s)", "beam (s)", "speedup", "score gap");
+    int widths[] = {1, 4, 16, 64};
+    for (int w = 0; w < (int)(sizeof(widths) / sizeof(widths[0])); w++)
+    {
+        double beam = 0;
+        double gap = 0;
+        for (int i = 0; i < documentCount; i++)
+        {
+            double start = now();
+            int score = latticeSolveBeam(l, termTables[i], termCount, widths[w], colours);
+            beam += now() - start;
+            assert(score <= exactScores[i]);
+            gap += (double)(exactScores[i] - score) / exactScores[i];
+        }
+        printf("%8d %10.4f %10.4f %7.2fx %11.3f%%\n", widths[w], exact, beam, exact / beam,
+               100 * gap / documentCount);
+    }
+    for (int i = 0; i < documentCount; i++)
+    {
+        free(termTables[i]);
+    }
+    free(expected);
+    free(colours);
+    free(exactScores);
+    free(termTables);
+    freeLattice(l);
+}
+
+/*
+    Notes of mostly plain words solved with and without collapsing runs,
+    over the specialised 16 colour kernel and the generic one, then
+    with plain words allowing several colours so runs need full powers.
+*/
+static void benchmarkRuns(void)
+{
+    int documentCount = 100;
+    int termCount = 10000;
+    printf("runs: %d documents of %d terms\n", documentCount, termCount);
+    printf("%8s %8s %8s %14s %14s %8s\n", "colours", "plain", "matched", "full terms/s",
+           "runs terms/s", "speedup");
+    int colourCounts[] = {16, 64, 16};
+    int plainColours[] = {1, 1, 4};
+    int matchedPercents[] = {30, 10, 3};
+    int *termTables = (int *)malloc(sizeof(int) * termCount);
+    int *expected = (int *)malloc(sizeof(int) * termCount);
+    int *colours = (int *)malloc(sizeof(int) * termCount);
+    assert(termTables && expected && colours);
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], SYNTHETIC_TABLES);
+        int *plainRow = LATTICE_ROW(l, -1);
+        for (int k = 1; k < plainColours[n]; k++)
+        {
+            plainRow[k] = -(rand() % 3);
+        }
+        free(l->allowedStarts);
+        free(l->allowedColours);
+        latticeListAllowed(l);
+        struct latticeRuns *r = newLatticeRuns(l);
+        for (int m = 0; m < (int)(sizeof(matchedPercents) / sizeof(matchedPercents[0])); m++)
+        {
+            double full = 0;
+            double runs = 0;
+            for (int i = 0; i < documentCount; i++)
+            {
+                for (int j = 0; j < termCount; j++)
+                {
+                    termTables[j] = (rand() % 100 < matchedPercents[m]) ? rand() % SYNTHETIC_TABLES : -1;
+                }
+                double start = now();
+                int expectedScore = latticeSolve(l, termTables, termCount, expected);
+                full += now() - start;
+                start = now();
+                int score = latticeSolveRuns(r, termTables, termCount, colours);
+                runs += now() - start;
+                assert(score == expectedScore);
+                assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+                assert(latticeSolveRuns(r, termTables, termCount, NULL) == expectedScore);
+            }
+            double terms = (double)documentCount * termCount;
+            printf("%8d %8d %7d%% %14.0f %14.0f %7.2fx\n", colourCounts[n], plainColours[n],
+                   matchedPercents[m], terms / full, terms / runs, full / runs);
+        }
+        freeLatticeRuns(r);
+        freeLattice(l);
+    }
+    free(colours);
+    free(expected);
+    free(termTables);
+}
+
+/* Frees the given term colour tables. */
+static void freeColourTables(struct termColourTable *tables, int tableCount)
+{
+    for (int i = 0; i < tableCount; i++)
+    {
+        free(tables[i].term);
+        free(tables[i].colours);
+        free(tables[i].scores);
+    }
+    free(tables);
+}
+
+/*
+    A dictionary table file of millions of terms parsed and indexed on
+    one thread and on several, checking the tables and matches agree.
+*/
+static void benchmarkLoad(void)
+{
+    int termCount = 2000000;
+    /* Room for each line of up to three colours and a term of up to two words. */
+    char *text = (char *)malloc((size_t)termCount * 3 * 40 + 1);
+    assert(text);
+    int length = 0;
+    for (int i = 0; i < termCount; i++)
+    {
+        char term[32];
+        int termLength = 4 + rand() % 8;
+        for (int j = 0; j < termLength; j++)
+        {
+            term[j] = 'a' + rand() % 26;
+        }
+        if (rand() % 10 == 0)
+        {
+            /* Some terms are two words. */
+            term[termLength / 2] = ' ';
+        }
+        term[termLength] = '\0';
+        int colourCount = 1 + rand() % 3;
+        for (int j = 0; j < colourCount; j++)
+        {
+            length += sprintf(text + length, "%s,%d,%d\n", term, 1 + rand() % 3, rand() % 10);
+        }
+    }
+    printf("load: %d terms, %.1f MB of tables\n", termCount, length / 1e6);
+    printf("%8s %10s %10s %10s\n", "threads", "parse (s)", "index (s)", "tables");
+
+    struct termColourTable *expected = NULL;
+    int expectedCount = 0;
+    struct termMatcher *expectedMatcher = NULL;
+    int threadCounts[] = {1, 4, 16};
+    for (int n = 0; n < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); n++)
+    {
+        struct termColourTable *tables;
+        double start = now();
+        int tableCount = parseColourTables(text, length, threadCounts[n], &tables);
+        double parse = now() - start;
+        start = now();
+        struct termMatcher *m = newTermMatcher(tables, tableCount, threadCounts[n]);
+        double index = now() - start;
+        printf("%8d %10.3f %10.3f %10d\n", threadCounts[n], parse, index, tableCount);
+        if (!expected)
+        {
+            expected = tables;
+            expectedCount = tableCount;
+            expectedMatcher = m;
+            continue;
+        }
+        assert(tableCount == expectedCount);
+        for (int i = 0; i < tableCount; i++)
+        {
+            assert(strcmp(tables[i].term, expected[i].term) == 0);
+            assert(tables[i].colourCount == expected[i].colourCount);
+            assert(memcmp(tables[i].colours, expected[i].colours,
+                          sizeof(int) * tables[i].colourCount) == 0);
+            assert(memcmp(tables[i].scores, expected[i].scores,
+                          sizeof(int) * tables[i].colourCount) == 0);
+        }
+        for (int i = 0; i < tableCount; i += 97)
+        {
+            const char *term = tables[i].term;
+            int termLength = strlen(term);
+            int matchLength;
+            int expectedLength;
+            int match = matchTerm(m, tables, term, termLength, 0, &matchLength);
+            assert(match >= 0 && match <= i);
+            assert(match == matchTerm(expectedMatcher, expected, term, termLength, 0,
+                                      &expectedLength));
+            assert(matchLength == expectedLength);
+        }
+        freeTermMatcher(m);
+        freeColourTables(tables, tableCount);
+    }
+    freeTermMatcher(expectedMatcher);
+    freeColourTables(expected, expectedCount);
+    free(text);
+}
+
+/*
+    A long text of words and table terms, some of two words and a few
+    not in ASCII, split into terms on one thread and on several,
+    checking the terms agree with repeated nextTerm calls.
+*/
+static void benchmarkTokenize(void)
+{
+    int tableTermCount = 20000;
+    char *tableText = (char *)malloc((size_t)tableTermCount * 40 + 1);
+    assert(tableText);
+    int tableLength = 0;
+    for (int i = 0; i < tableTermCount; i++)
+    {
+        char term[32];
+        int termLength = 4 + rand() % 8;
+        for (int j = 0; j < termLength; j++)
+        {
+            term[j] = 'a' + rand() % 26;
+        }
+        if (rand() % 4 == 0)
+        {
+            /* Some terms are two words, like "Big Oh". */
+            term[termLength / 2] = ' ';
+        }
+        term[termLength] = '\0';
+        tableLength += sprintf(tableText + tableLength, "%s,%d,%d\n", term, 1 + rand() % 3,
+                               rand() % 10);
+    }
+    struct problem p;
+    memset(&p, 0, sizeof(p));
+    p.termColourTableCount = parseColourTables(tableText, tableLength, 1, &(p.colourTables));
+    p.matcher = newTermMatcher(p.colourTables, p.termColourTableCount, 1);
+
+    int textLength = 1 << 25;
+    char *text = (char *)malloc(textLength + 1);
+    assert(text);
+    int length = 0;
+    while (length < textLength - 40)
+    {
+        if (rand() % 3 == 0)
+        {
+            /* A table term, in capitals now and again. */
+            const char *term = p.colourTables[rand() % p.termColourTableCount].term;
+            int upper = (rand() % 8 == 0);
+            for (int j = 0; term[j] != '\0'; j++)
+            {
+                text[length++] = (upper && term[j] != ' ') ? term[j] - 'a' + 'A' : term[j];
+            }
+        }
+        else
+        {
+            int wordLength = 1 + rand() % 10;
+            for (int j = 0; j < wordLength; j++)
+            {
+                text[length++] = 'a' + rand() % 26;
+            }
+            if (rand() % 50 == 0)
+            {
+                /* Now and again a word of notes in another script. */
+                const char *word = (rand() % 2 == 0) ? "Stra\xc3\x9f" "e" : "\xd0\xbc\xd0\xb8\xd1\x80";
+                length += sprintf(text + length, " %s", word);
+            }
+        }
+        text[length++] = (rand() % 10 == 0) ? ',' : ' ';
+        if (rand() % 20 == 0)
+        {
+            text[length++] = '\n';
+        }
+    }
+    text[length] = '\0';
+
+    double start = now();
+    int expectedCount = 0;
+    int allocated = 1024;
+    struct termSpan *expected = (struct termSpan *)malloc(sizeof(struct termSpan) * allocated);
+    assert(expected);
+    char **expectedTerms = (char **)malloc(sizeof(char *) * allocated);
+    assert(expectedTerms);
+    int progress = 0;
+    while (nextTerm(&p, text, length, progress, &(expected[expectedCount])))
+    {
+        /* As the text was split before, strings and all. */
+        expectedTerms[expectedCount] = termString(&p, text, &(expected[expectedCount]));
+        progress = expected[expectedCount].end;
+        expectedCount++;
+        if (expectedCount >= allocated)
+        {
+            allocated *= 2;
+            expected = (struct termSpan *)realloc(expected, sizeof(struct termSpan) * allocated);
+            assert(expected);
+            expectedTerms = (char **)realloc(expectedTerms, sizeof(char *) * allocated);
+            assert(expectedTerms);
+        }
+    }
+    double serial = now() - start;
+    printf("tokenize: %.1f MB of text, %d terms, %d table terms\n", length / 1e6, expectedCount,
+           p.termColourTableCount);
+    printf("%8s %10s %10s\n", "threads", "time (s)", "speedup");
+    printf("%8s %10.3f %10s\n", "serial", serial, "1.00");
+
+    int threadCounts[] = {1, 4, 16, 64};
+    for (int n = 0; n < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); n++)
+    {
+        struct termSpan *spans;
+        char **terms;
+        start = now();
+        int count = findTerms(&p, text, length, threadCounts[n], &spans, &terms);
+        double elapsed = now() - start;
+        printf("%8d %10.3f %10.2f\n", threadCounts[n], elapsed, serial / elapsed);
+        assert(count == expectedCount);
+        assert(memcmp(spans, expected, sizeof(struct termSpan) * count) == 0);
+        for (int i = 0; i < count; i++)
+        {
+            if (!termStringOwned(&p, spans[i].table))
+            {
+                assert(terms[i] == p.colourTables[spans[i].table].term);
+            }
+            else
+            {
+                assert(strcmp(terms[i], expectedTerms[i]) == 0);
+                free(terms[i]);
+            }
+        }
+        free(terms);
+        free(spans);
+    }
+    for (int i = 0; i < expectedCount; i++)
+    {
+        if (termStringOwned(&p, expected[i].table))
+        {
+            free(expectedTerms[i]);
+        }
+    }
+    free(expectedTerms);
+    free(expected);
+    free(text);
+    freeTermMatcher(p.matcher);
+    freeColourTables(p.colourTables, p.termColourTableCount);
+    free(tableText);
+}
+
+/* Whether pattern matches all of text, '*' standing for any run of letters. */
+static int naiveWildcard(const char *pattern, const char *text, int textLength)
+{
+    if (*pattern == '\0')
+    {
+        return textLength == 0;
+    }
+    if (*pattern == PATTERN_WILDCARD)
+    {
+        for (int i = 0; i <= textLength; i++)
+        {
+            if (naiveWildcard(pattern + 1, text + i, textLength - i))
+            {
+                return 1;
+            }
+            if (i < textLength && !isalpha((unsigned char)text[i]))
+            {
+                return 0;
+            }
+        }
+        return 0;
+    }
+    return textLength > 0 && tolower((unsigned char)*pattern) == tolower((unsigned char)*text) &&
+           naiveWildcard(pattern + 1, text + 1, textLength - 1);
+}
+
+/* As matchPattern, trying every pattern at every length up to the lookahead. */
+static int naiveMatchPattern(const struct termColourTable *tables, int tableCount,
+                             const char *text, int textLength, int start, int lookahead,
+                             int *length)
+{
+    for (int end = textLength; end > start; end--)
+    {
+        if (end - start > lookahead || (end < textLength && isalpha((unsigned char)text[end])))
+        {
+            continue;
+        }
+        for (int i = 0; i < tableCount; i++)
+        {
+            if (tables[i].pattern && naiveWildcard(tables[i].term, text + start, end - start))
+            {
+                *length = end - start;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Loads tables from text into p, returning the seconds taken. */
+static double loadTables(struct problem *p, const char *text, int length)
+{
+    memset(p, 0, sizeof(*p));
+    double start = now();
+    p->termColourTableCount = parseColourTables(text, length, 1, &(p->colourTables));
+    p->matcher = newTermMatcher(p->colourTables, p->termColourTableCount, 1);
+    return now() - start;
+}
+
+/*
+    Random patterns with wildcards anywhere checked against a naive
+    matcher, then a vocabulary of stems each listed with its
+    inflections against the same stems as prefix patterns, comparing
+    the tables each needs and the time to load them and split a text.
+*/
+static void benchmarkPatterns(void)
+{
+    char tableText[4096];
+    int tableLength = 0;
+    for (int i = 0; i < 60; i++)
+    {
+        char term[16];
+        int termLength = 1 + rand() % 6;
+        for (int j = 0; j < termLength; j++)
+        {
+            term[j] = (rand() % 3 == 0) ? PATTERN_WILDCARD : "abcAB"[rand() % 5];
+        }
+        term[termLength] = '\0';
+        if (!strchr(term, PATTERN_WILDCARD))
+        {
+            /* Some literal terms, which the DFA leaves alone. */
+            term[rand() % termLength] = (rand() % 4 == 0) ? 'c' : PATTERN_WILDCARD;
+        }
+        tableLength += sprintf(tableText + tableLength, "%s,%d,%d\n", term, 1 + rand() % 3,
+                               rand() % 10);
+    }
+    struct problem p;
+    loadTables(&p, tableText, tableLength);
+    assert(p.matcher->patterns);
+    char text[4096];
+    for (int i = 0; i < (int)sizeof(text); i++)
+    {
+        text[i] = "abcabcABC ,-1"[rand() % 13];
+    }
+    /* A run of letters longer than any match may be. */
+    memset(text + 1000, 'a', 3 * PATTERN_WILDCARD_LOOKAHEAD);
+    for (int start = 0; start < (int)sizeof(text); start++)
+    {
+        int length = 0;
+        int expectedLength = 0;
+        int match = matchPattern(p.matcher->patterns, text, sizeof(text), start, &length);
+        int expected = naiveMatchPattern(p.colourTables, p.termColourTableCount, text,
+                                         sizeof(text), start, p.matcher->patterns->lookahead,
+                                         &expectedLength);
+        assert(match == expected);
+        assert(match < 0 || length == expectedLength);
+    }
+    freeTermMatcher(p.matcher);
+    freeColourTables(p.colourTables, p.termColourTableCount);
+
+    /* Remembering which of 20 letters were seen takes 2^20 states, too many to load. */
+    tableLength = 0;
+    for (int i = 0; i < 20; i++)
+    {
+        tableLength += sprintf(tableText + tableLength, "%c%c%c,1,1\n", PATTERN_WILDCARD,
+                               'a' + i, PATTERN_WILDCARD);
+    }
+    double tangled = loadTables(&p, tableText, tableLength);
+    assert(!p.matcher);
+    printf("patterns: 20 tangled patterns rejected in %.3f s\n", tangled);
+    freeColourTables(p.colourTables, p.termColourTableCount);
+
+    /* Stems from the first half of the alphabet and other words from the second never meet. */
+    const char *suffixes[] = {"", "s", "ed", "ing", "er", "ers", "ly", "ness", "ation",
+                              "ations", "able", "ment", "ments", "ist", "ists", "ism"};
+    int suffixCount = sizeof(suffixes) / sizeof(suffixes[0]);
+    int stemCount = 50000;
+    char *stems = (char *)malloc((size_t)stemCount * 16);
+    assert(stems);
+    char *inflected = (char *)malloc((size_t)stemCount * suffixCount * 32);
+    assert(inflected);
+    char *prefixes = (char *)malloc((size_t)stemCount * 32);
+    assert(prefixes);
+    int inflectedLength = 0;
+    int prefixesLength = 0;
+    for (int i = 0; i < stemCount; i++)
+    {
+        char *stem = stems + (size_t)i * 16;
+        int stemLength = 4 + rand() % 8;
+        for (int j = 0; j < stemLength; j++)
+        {
+            stem[j] = 'a' + rand() % 13;
+        }
+        stem[stemLength] = '\0';
+        int colour = 1 + rand() % 3;
+        int score = rand() % 10;
+        for (int k = 0; k < suffixCount; k++)
+        {
+            inflectedLength += sprintf(inflected + inflectedLength, "%s%s,%d,%d\n", stem,
+                                       suffixes[k], colour, score);
+        }
+        prefixesLength += sprintf(prefixes + prefixesLength, "%s%c,%d,%d\n", stem,
+                                  PATTERN_WILDCARD, colour, score);
+    }
+    int textLength = 1 << 23;
+    char *words = (char *)malloc(textLength + 1);
+    assert(words);
+    int length = 0;
+    while (length < textLength - 40)
+    {
+        if (rand() % 3 == 0)
+        {
+            length += sprintf(words + length, "%s%s", stems + (size_t)(rand() % stemCount) * 16,
+                              suffixes[rand() % suffixCount]);
+        }
+        else
+        {
+            int wordLength = 1 + rand() % 10;
+            for (int j = 0; j < wordLength; j++)
+            {
+                words[length++] = 'n' + rand() % 13;
+            }
+        }
+        words[length++] = (rand() % 10 == 0) ? ',' : ' ';
+    }
+    words[length] = '\0';
+
+    printf("patterns: %d stems, %d suffixes, %.1f MB of text\n", stemCount, suffixCount,
+           length / 1e6);
+    printf("%12s %10s %10s %10s %10s\n", "tables", "count", "load (s)", "split (s)", "matched");
+    struct termSpan *expected = NULL;
+    int expectedCount = 0;
+    const char *names[] = {"inflections", "prefixes"};
+    const char *files[] = {inflected, prefixes};
+    int fileLengths[] = {inflectedLength, prefixesLength};
+    for (int n = 0; n < 2; n++)
+    {
+        double load = loadTables(&p, files[n], fileLengths[n]);
+        struct termSpan *spans;
+        char **terms;
+        double start = now();
+        int count = findTerms(&p, words, length, 1, &spans, &terms);
+        double split = now() - start;
+        int matched = 0;
+        for (int i = 0; i < count; i++)
+        {
+            matched += (spans[i].table >= 0);
+            if (termStringOwned(&p, spans[i].table))
+            {
+                free(terms[i]);
+            }
+        }
+        free(terms);
+        printf("%12s %10d %10.3f %10.3f %10d\n", names[n], p.termColourTableCount, load, split,
+               matched);
+        if (!expected)
+        {
+            expected = spans;
+            expectedCount = count;
+        }
+        else
+        {
+            /* Every inflection is a whole word its stem's pattern matches too. */
+            assert(count == expectedCount);
+            for (int i = 0; i < count; i++)
+            {
+                assert(spans[i].start == expected[i].start && spans[i].end == expected[i].end);
+                assert(expected[i].table < 0 || spans[i].table >= 0);
+            }
+            free(spans);
+        }
+        freeTermMatcher(p.matcher);
+        freeColourTables(p.colourTables, p.termColourTableCount);
+    }
+    free(expected);
+    free(words);
+    free(prefixes);
+    free(inflected);
+    free(stems);
+}
+
+/* Counts the bytes outstanding from a benchmark allocator. */
+static void *countedAllocate(void *context, size_t size)
+{
+    size_t *block = (size_t *)malloc(size + 16);
+    if (!block)
+    {
+        return NULL;
+    }
+    block[0] = size;
+    __atomic_add_fetch((long long *)context, (long long)size, __ATOMIC_RELAXED);
+    return (char *)block + 16;
+}
+
+static void countedRelease(void *context, void *memory)
+{
+    if (memory)
+    {
+        size_t *block = (size_t *)((char *)memory - 16);
+        __atomic_sub_fetch((long long *)context, (long long)block[0], __ATOMIC_RELAXED);
+        free(block);
+    }
+}
+
+struct libraryWork
+{
+    const struct highlightTables *tables;
+    const struct highlightAllocator *allocator;
+    const char *text;
+    int textLength;
+    int repeats;
+    struct highlightResult result;
+};
+
+static void *libraryWorker(void *argument)
+{
+    struct libraryWork *w = (struct libraryWork *)argument;
+    for (int i = 0; i < w->repeats; i++)
+    {
+        highlightFreeResult(w->allocator, &(w->result));
+        int status = highlightText(w->tables, w->text, w->textLength, w->allocator,
+                                   &(w->result));
+        assert(status == HIGHLIGHT_OK);
+    }
+    return NULL;
+}
+
+/*
+    Texts highlighted through the library on several threads sharing
+    one set of compiled tables, checking each colouring against the
+    plain lattice solver, that the library rejects bad tables, and
+    that every byte it took from the caller's allocator comes back.
+*/
+static void benchmarkLibrary(void)
+{
+    int tableTermCount = 5000;
+    char *tableText = (char *)malloc((size_t)tableTermCount * 3 * 40 + 1);
+    assert(tableText);
+    int tableLength = 0;
+    for (int i = 0; i < tableTermCount; i++)
+    {
+        char term[32];
+        int termLength = 4 + rand() % 8;
+        for (int j = 0; j < termLength; j++)
+        {
+            term[j] = 'a' + rand() % 26;
+        }
+        term[termLength] = '\0';
+        int colourCount = 1 + rand() % 3;
+        for (int j = 0; j < colourCount; j++)
+        {
+            tableLength += sprintf(tableText + tableLength, "%s,%d,%d\n", term, 1 + rand() % 5,
+                                   rand() % 10);
+        }
+    }
+    char transitionText[1024];
+    int transitionLength = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        for (int j = 0; j < 6; j++)
+        {
+            transitionLength += sprintf(transitionText + transitionLength, "%d,%d,%d\n", i, j,
+                                        rand() % 7 - 3);
+        }
+    }
+
+    long long outstanding = 0;
+    struct highlightAllocator allocator = {countedAllocate, countedRelease, &outstanding};
+    struct highlightTables *tables;
+    assert(highlightCompile("term,1\n", 7, NULL, 0, &allocator, &tables) ==
+           HIGHLIGHT_BAD_TABLE);
+    assert(highlightCompile(tableText, tableLength, "0,1\n", 4, &allocator, &tables) ==
+           HIGHLIGHT_BAD_TRANSITIONS);
+    assert(outstanding == 0);
+    double start = now();
+    int status = highlightCompile(tableText, tableLength, transitionText, transitionLength,
+                                  &allocator, &tables);
+    double compile = now() - start;
+    assert(status == HIGHLIGHT_OK);
+
+    /* The same tables built the way the programs build them. */
+    struct problem p;
+    memset(&p, 0, sizeof(p));
+    p.termColourTableCount = parseColourTables(tableText, tableLength, 1, &(p.colourTables));
+    p.matcher = newTermMatcher(p.colourTables, p.termColourTableCount, 1);
+    struct colourTransitionTable ctt;
+    int prevColours[36];
+    int colours[36];
+    int scores[36];
+    int position = 0;
+    for (int i = 0; i < 36; i++)
+    {
+        int used;
+        sscanf(transitionText + position, "%d,%d,%d %n", &(prevColours[i]), &(colours[i]),
+               &(scores[i]), &used);
+        position += used;
+    }
+    ctt.transitionCount = 36;
+    ctt.prevColours = prevColours;
+    ctt.colours = colours;
+    ctt.scores = scores;
+    p.colourTransitionTable = &ctt;
+    struct lattice *l = newLattice(&p);
+
+    int threadCounts[] = {1, 4, 16};
+    int maxThreads = 16;
+    int textLength = 1 << 20;
+    int repeats = 4;
+    char **texts = (char **)malloc(sizeof(char *) * maxThreads);
+    assert(texts);
+    for (int t = 0; t < maxThreads; t++)
+    {
+        /* Not null-terminated, the library reads only textLength bytes. */
+        texts[t] = (char *)malloc(textLength);
+        assert(texts[t]);
+        int length = 0;
+        while (length < textLength - 40)
+        {
+            if (rand() % 3 == 0)
+            {
+                const char *term = p.colourTables[rand() % p.termColourTableCount].term;
+                int termLength = strlen(term);
+                memcpy(texts[t] + length, term, termLength);
+                length += termLength;
+            }
+            else
+            {
+                int wordLength = 1 + rand() % 10;
+                for (int j = 0; j < wordLength; j++)
+                {
+                    texts[t][length++] = 'a' + rand() % 26;
+                }
+            }
+            texts[t][length++] = (rand() % 10 == 0) ? ',' : ' ';
+        }
+        memset(texts[t] + length, ' ', textLength - length);
+    }
+    printf("library: %d tables compiled in %.3f s, %.1f MB of text per thread\n",
+           p.termColourTableCount, compile, textLength / 1e6);
+    printf("%8s %10s %10s\n", "threads", "time (s)", "MB/s");
+
+    struct libraryWork *work = (struct libraryWork *)malloc(sizeof(struct libraryWork) * maxThreads);
+    assert(work);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * maxThreads);
+    assert(threads);
+    for (int n = 0; n < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); n++)
+    {
+        int threadCount = threadCounts[n];
+        for (int t = 0; t < threadCount; t++)
+        {
+            work[t].tables = tables;
+            work[t].allocator = &allocator;
+            work[t].text = texts[t];
+            work[t].textLength = textLength;
+            work[t].repeats = repeats;
+            memset(&(work[t].result), 0, sizeof(struct highlightResult));
+        }
+        start = now();
+        for (int t = 1; t < threadCount; t++)
+        {
+            assert(pthread_create(&(threads[t]), NULL, libraryWorker, &(work[t])) == 0);
+        }
+        libraryWorker(&(work[0]));
+        for (int t = 1; t < threadCount; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+        double elapsed = now() - start;
+        printf("%8d %10.3f %10.1f\n", threadCount, elapsed,
+               (double)textLength * repeats * threadCount / 1e6 / elapsed);
+        for (int t = 0; t < threadCount; t++)
+        {
+            struct highlightResult *r = &(work[t].result);
+            int *expected = (int *)malloc(sizeof(int) * (r->termCount + 1));
+            assert(expected);
+            struct termSpan span;
+            int progress = 0;
+            int count = 0;
+            while (nextTerm(&p, texts[t], textLength, progress, &span))
+            {
+                assert(count < r->termCount);
+                assert(span.start == r->starts[count] && span.end == r->ends[count]);
+                assert(span.table == r->tables[count]);
+                progress = span.end;
+                count++;
+            }
+            assert(count == r->termCount);
+            assert(latticeSolve(l, r->tables, count, expected) == r->score);
+            assert(memcmp(expected, r->colours, sizeof(int) * count) == 0);
+            if (t == 0 && n == 0)
+            {
+                char *output;
+                size_t outputLength;
+                assert(highlightRender(tables, texts[t], textLength, r, 0, &allocator, &output,
+                                       &outputLength) == HIGHLIGHT_OK);
+                assert(output[outputLength - 1] == '\n' && output[outputLength] == '\0');
+                char *next = output;
+                for (int i = 0; i < count; i++)
+                {
+                    assert(strtol(next, &next, 10) == r->colours[i]);
+                }
+                allocator.release(allocator.context, output);
+            }
+            free(expected);
+            highlightFreeResult(&allocator, r);
+        }
+    }
+    highlightFreeTables(tables);
+    assert(outstanding == 0);
+
+    free(threads);
+    free(work);
+    for (int t = 0; t < maxThreads; t++)
+    {
+        free(texts[t]);
+    }
+    free(texts);
+    freeLattice(l);
+    freeTermMatcher(p.matcher);
+    freeColourTables(p.colourTables, p.termColourTableCount);
+    free(tableText);
+}
+
+/*
+    Documents solved by each strategy the planner can pick, checking
+    each matches latticeSolve, with the plan it picks under a few
+    memory budgets.
+*/
+static void benchmarkPlanner(void)
+{
+    /* Short and odd lengths and intervals, checked against latticeSolve. */
+    int colourCounts[] = {3, 4, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], 100);
+        struct corpus *c = syntheticCorpus(50, 1, 300, 100);
+        for (int i = 0; i < c->documentCount; i++)
+        {
+            int termCount = c->termCounts[i];
+            int *expected = (int *)malloc(sizeof(int) * termCount);
+            assert(expected);
+            int *colours = (int *)malloc(sizeof(int) * termCount);
+            assert(colours);
+            int expectedScore = latticeSolve(l, c->termTables[i], termCount, expected);
+            int intervals[] = {1, 2, 7, 64, termCount, termCount + 5};
+            for (int k = 0; k < (int)(sizeof(intervals) / sizeof(intervals[0])); k++)
+            {
+                int score = latticeSolveCheckpointed(l, c->termTables[i], termCount,
+                                                     intervals[k], colours);
+                assert(score == expectedScore);
+                assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+            }
+            free(colours);
+            free(expected);
+        }
+        freeCorpus(c);
+        freeLattice(l);
+    }
+
+    int termCount = 4000000;
+    int colourCount = 6;
+    struct lattice *l = syntheticLattice(colourCount, 1000);
+    struct corpus *c = syntheticCorpus(1, termCount, termCount, 1000);
+    int *expected = (int *)malloc(sizeof(int) * termCount);
+    assert(expected);
+    int *colours = (int *)malloc(sizeof(int) * termCount);
+    assert(colours);
+    double start = now();
+    int expectedScore = latticeSolve(l, c->termTables[0], termCount, expected);
+    double full = now() - start;
+    printf("planner: %d terms, %d colours, full pass %.3f s\n", termCount, colourCount, full);
+    printf("%14s %8s %14s %10s %10s\n", "budget (MB)", "threads", "strategy", "need (MB)",
+           "time (s)");
+    size_t budgets[] = {(size_t)1 << 30, (size_t)16 << 20, (size_t)1 << 20};
+    int threadCounts[] = {1, 4};
+    for (int b = 0; b < (int)(sizeof(budgets) / sizeof(budgets[0])); b++)
+    {
+        for (int t = 0; t < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); t++)
+        {
+            struct solvePlan plan;
+            planSolve(l, termCount, 0, budgets[b], threadCounts[t], &plan);
+            memset(colours, 0, sizeof(int) * termCount);
+            int score = solvePlanned(l, c->termTables[0], termCount, colours, &plan);
+            assert(score == expectedScore);
+            assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+            size_t need = (plan.strategy == SOLVE_FULL)           ? plan.fullBytes
+                          : (plan.strategy == SOLVE_CHECKPOINTED) ? plan.checkpointedBytes
+                                                                  : plan.chunkedBytes;
+            const char *names[] = {"full", "checkpointed", "chunked"};
+            printf("%14.1f %8d %14s %10.1f %10.3f\n", budgets[b] / 1048576.0, plan.threadCount,
+                   names[plan.strategy], need / 1048576.0, plan.elapsed);
+        }
+    }
+    free(colours);
+    free(expected);
+    freeCorpus(c);
+    freeLattice(l);
+}
+
+/*
+    Splitting a text, solving its terms and writing them out as spans,
+    with the processor's counters read around each phase and reported
+    per term, or the CPU time alone where they can't be read.
+*/
+static void benchmarkCounters(void)
+{
+    int tableTermCount = 20000;
+    char *tableText = (char *)malloc((size_t)tableTermCount * 40 + 1);
+    assert(tableText);
+    int tableLength = 0;
+    for (int i = 0; i < tableTermCount; i++)
+    {
+        char term[16];
+        int termLength = 4 + rand() % 8;
+        for (int j = 0; j < termLength; j++)
+        {
+            term[j] = 'a' + rand() % 26;
+        }
+        term[termLength] = '\0';
+        tableLength += sprintf(tableText + tableLength, "%s,%d,%d\n", term, 1 + rand() % 3,
+                               rand() % 10);
+    }
+    struct problem p;
+    loadTables(&p, tableText, tableLength);
+
+    int textLength = 1 << 24;
+    char *text = (char *)malloc(textLength + 1);
+    assert(text);
+    int length = 0;
+    while (length < textLength - 40)
+    {
+        if (rand() % 100 < MATCHED_PERCENT)
+        {
+            length += sprintf(text + length, "%s",
+                              p.colourTables[rand() % p.termColourTableCount].term);
+        }
+        else
+        {
+            int wordLength = 1 + rand() % 10;
+            for (int j = 0; j < wordLength; j++)
+            {
+                text[length++] = 'a' + rand() % 26;
+            }
+        }
+        text[length++] = (rand() % 20 == 0) ? '\n' : ' ';
+    }
+    text[length] = '\0';
+
+    struct perfCounters c;
+    openCounters(&c);
+    printf("counters: %.1f MB of text, %d table terms\n", length / 1e6, p.termColourTableCount);
+    printCountersHeader(stdout, &c);
+
+    struct termSpan *spans;
+    char **terms;
+    startCounters(&c);
+    int termCount = findTerms(&p, text, length, 1, &spans, &terms);
+    stopCounters(&c);
+    printCounters(stdout, "tokenize", &c, termCount);
+
+    int *termTables = (int *)malloc(sizeof(int) * termCount);
+    assert(termTables);
+    int *termStarts = (int *)malloc(sizeof(int) * termCount);
+    assert(termStarts);
+    int *termEnds = (int *)malloc(sizeof(int) * termCount);
+    assert(termEnds);
+    for (int i = 0; i < termCount; i++)
+    {
+        termTables[i] = spans[i].table;
+        termStarts[i] = spans[i].start;
+        termEnds[i] = spans[i].end;
+        if (termStringOwned(&p, spans[i].table))
+        {
+            free(terms[i]);
+        }
+    }
+    free(terms);
+    free(spans);
+
+    int colourCounts[] = {4, 6, 16};
+    int *colours = (int *)malloc(sizeof(int) * termCount);
+    assert(colours);
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], p.termColourTableCount);
+        char phase[32];
+        sprintf(phase, "viterbi %d", colourCounts[n]);
+        resetCounters(&c);
+        startCounters(&c);
+        latticeSolve(l, termTables, termCount, colours);
+        stopCounters(&c);
+        printCounters(stdout, phase, &c, termCount);
+        freeLattice(l);
+    }
+
+    resetCounters(&c);
+    startCounters(&c);
+    size_t size = formatSpans(NULL, text, length, termCount, termStarts, termEnds, colours,
+                              COLOUR_MODE_SPANS);
+    char *output = (char *)malloc(size);
+    assert(output);
+    size_t written = formatSpans(output, text, length, termCount, termStarts, termEnds,
+                                 colours, COLOUR_MODE_SPANS);
+    stopCounters(&c);
+    assert(written == size);
+    printCounters(stdout, "output", &c, termCount);
+    closeCounters(&c);
+
+    free(output);
+    free(colours);
+    free(termEnds);
+    free(termStarts);
+    free(termTables);
+    free(text);
+    freeTermMatcher(p.matcher);
+    freeColourTables(p.colourTables, p.termColourTableCount);
+    free(tableText);
+}
+
+/*
+    The 16-bit kernels against latticeSolve, on short documents with
+    negative scores renormalised every few terms and with scores too
+    wide to narrow, then on one long document at each colour count.
+*/
+static void benchmarkNarrow(void)
+{
+    int colourCounts[] = {4, 8, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], 100);
+        for (int i = 0; i < l->rowCount * l->colourCount; i++)
+        {
+            if (l->emissions[i] != LATTICE_NONALLOWED && rand() % 3 == 0)
+            {
+                l->emissions[i] = -l->emissions[i];
+            }
+        }
+        struct corpus *c = syntheticCorpus(50, 1, 300, 100);
+        struct narrowLattice *narrow = newNarrowLattice(l);
+        assert(narrow->interval > 0);
+        int intervals[] = {1, 2, 7, narrow->interval};
+        for (int i = 0; i < c->documentCount; i++)
+        {
+            int termCount = c->termCounts[i];
+            int *expected = (int *)malloc(sizeof(int) * termCount);
+            assert(expected);
+            int *colours = (int *)malloc(sizeof(int) * termCount);
+            assert(colours);
+            int expectedScore = latticeSolve(l, c->termTables[i], termCount, expected);
+            for (int k = 0; k < (int)(sizeof(intervals) / sizeof(intervals[0])); k++)
+            {
+                narrow->interval = intervals[k];
+                int score = latticeSolveNarrow(narrow, c->termTables[i], termCount, colours);
+                assert(narrow->narrowed);
+                assert(score == expectedScore);
+                assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+                assert(latticeSolveNarrow(narrow, c->termTables[i], termCount, NULL) ==
+                       expectedScore);
+            }
+            free(colours);
+            free(expected);
+        }
+        freeNarrowLattice(narrow);
+
+        /* Too wide to narrow, so solved in 32 bits just the same. */
+        for (int i = 0; i < l->colourCount * l->colourCount; i++)
+        {
+            l->transitions[i] *= 1000;
+        }
+        narrow = newNarrowLattice(l);
+        assert(narrow->interval == 0 && narrow->reason);
+        int *colours = (int *)malloc(sizeof(int) * c->termCounts[0]);
+        assert(colours);
+        int *expected = (int *)malloc(sizeof(int) * c->termCounts[0]);
+        assert(expected);
+        assert(latticeSolveNarrow(narrow, c->termTables[0], c->termCounts[0], colours) ==
+               latticeSolve(l, c->termTables[0], c->termCounts[0], expected));
+        assert(!narrow->narrowed);
+        assert(memcmp(colours, expected, sizeof(int) * c->termCounts[0]) == 0);
+        free(expected);
+        free(colours);
+        freeNarrowLattice(narrow);
+        freeCorpus(c);
+        freeLattice(l);
+    }
+
+    int termCount = 4000000;
+    printf("narrow: %d terms\n", termCount);
+    printf("%8s %10s %12s %12s %10s\n", "colours", "interval", "32-bit (s)", "16-bit (s)",
+           "speedup");
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], 1000);
+        struct corpus *c = syntheticCorpus(1, termCount, termCount, 1000);
+        struct narrowLattice *narrow = newNarrowLattice(l);
+        int *expected = (int *)malloc(sizeof(int) * termCount);
+        assert(expected);
+        int *colours = (int *)malloc(sizeof(int) * termCount);
+        assert(colours);
+        double start = now();
+        int expectedScore = latticeSolve(l, c->termTables[0], termCount, expected);
+        double wide = now() - start;
+        start = now();
+        int score = latticeSolveNarrow(narrow, c->termTables[0], termCount, colours);
+        double narrowed = now() - start;
+        assert(narrow->narrowed);
+        assert(score == expectedScore);
+        assert(memcmp(colours, expected, sizeof(int) * termCount) == 0);
+        printf("%8d %10d %12.3f %12.3f %10.2f\n", colourCounts[n], narrow->interval, wide,
+               narrowed, wide / narrowed);
+        free(colours);
+        free(expected);
+        freeNarrowLattice(narrow);
+        freeCorpus(c);
+        freeLattice(l);
+    }
+}
+
+/* Orders strings for qsort. */
+static int compareStrings(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+    Copying each of a long text's words, into its own allocation or
+    one after another as splitTerms does, against keeping one copy of
+    each spelling and against interning their words too, checking
+    that two spellings share an id exactly when their case foldings
+    match.
+*/
+static void benchmarkVocabulary(void)
+{
+    int distinctCount = 50000;
+    char **distinct = (char **)malloc(sizeof(char *) * distinctCount);
+    assert(distinct);
+    for (int i = 0; i < distinctCount; i++)
+    {
+        char word[32];
+        int wordLength = 2 + rand() % 10;
+        for (int j = 0; j < wordLength; j++)
+        {
+            word[j] = 'a' + rand() % 26;
+        }
+        word[wordLength] = '\0';
+        if (i % 100 == 0)
+        {
+            /* Now and again a word in another script. */
+            strcpy(word, (i % 200 == 0) ? "Stra\xc3\x9f" "e" : "\xd0\x9c\xd0\xb8\xd1\x80");
+            sprintf(word + strlen(word), "%d", i);
+        }
+        distinct[i] = strdup(word);
+        assert(distinct[i]);
+    }
+
+    /* Words drawn with a long tail, in capitals now and again. */
+    int tokenCount = 1 << 22;
+    int *starts = (int *)malloc(sizeof(int) * tokenCount);
+    assert(starts);
+    int *lengths = (int *)malloc(sizeof(int) * tokenCount);
+    assert(lengths);
+    char *text = (char *)malloc((size_t)tokenCount * 32);
+    assert(text);
+    int length = 0;
+    for (int i = 0; i < tokenCount; i++)
+    {
+        int r = rand() % distinctCount;
+        const char *word = distinct[(int)((long long)r * (rand() % distinctCount) / distinctCount)];
+        starts[i] = length;
+        int variant = rand() % 16;
+        for (int j = 0; word[j] != '\0'; j++)
+        {
+            char c = word[j];
+            if ((variant == 0 || (variant == 1 && j == 0)) && c >= 'a' && c <= 'z')
+            {
+                c = c - 'a' + 'A';
+            }
+            text[length++] = c;
+        }
+        lengths[i] = length - starts[i];
+        text[length++] = ' ';
+    }
+
+    double start = now();
+    char **copies = (char **)malloc(sizeof(char *) * tokenCount);
+    assert(copies);
+    for (int i = 0; i < tokenCount; i++)
+    {
+        copies[i] = strndup(text + starts[i], lengths[i]);
+        assert(copies[i]);
+    }
+    for (int i = 0; i < tokenCount; i++)
+    {
+        free(copies[i]);
+    }
+    double copied = now() - start;
+
+    start = now();
+    size_t blockLength = 0;
+    for (int i = 0; i < tokenCount; i++)
+    {
+        blockLength += lengths[i] + 1;
+    }
+    char *block = (char *)malloc(blockLength);
+    assert(block);
+    blockLength = 0;
+    for (int i = 0; i < tokenCount; i++)
+    {
+        copies[i] = block + blockLength;
+        memcpy(copies[i], text + starts[i], lengths[i]);
+        copies[i][lengths[i]] = '\0';
+        blockLength += lengths[i] + 1;
+    }
+    free(block);
+    double packed = now() - start;
+    free(copies);
+
+    start = now();
+    struct vocabulary *v = newVocabulary();
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * tokenCount);
+    assert(ids);
+    const char **spellings = (const char **)malloc(sizeof(const char *) * tokenCount);
+    assert(spellings);
+    for (int i = 0; i < tokenCount; i++)
+    {
+        ids[i] = vocabularyIntern(v, text + starts[i], lengths[i], &(spellings[i]));
+    }
+    double interned = now() - start;
+
+    /* All at once, as splitting a text does, the same ids and spellings. */
+    int *ends = (int *)malloc(sizeof(int) * tokenCount);
+    assert(ends);
+    for (int i = 0; i < tokenCount; i++)
+    {
+        ends[i] = starts[i] + lengths[i];
+    }
+    start = now();
+    struct vocabulary *all = newVocabulary();
+    uint32_t *allIds = (uint32_t *)malloc(sizeof(uint32_t) * tokenCount);
+    assert(allIds);
+    const char **allSpellings = (const char **)malloc(sizeof(const char *) * tokenCount);
+    assert(allSpellings);
+    vocabularyInternAll(all, text, starts, ends, tokenCount, allIds, allSpellings);
+    double internedAll = now() - start;
+    assert(memcmp(allIds, ids, sizeof(uint32_t) * tokenCount) == 0);
+    for (int i = 0; i < tokenCount; i++)
+    {
+        assert(strcmp(allSpellings[i], spellings[i]) == 0);
+    }
+    free(allSpellings);
+    free(allIds);
+    freeVocabulary(all);
+    free(ends);
+
+    printf("vocabulary: %d tokens, %u words, %u other spellings\n", tokenCount, v->wordCount,
+           v->spellingCount);
+    printf("%10s %12s %10s\n", "", "ns/token", "speedup");
+    printf("%10s %12.1f %10s\n", "strndup", copied * 1e9 / tokenCount, "1.00");
+    printf("%10s %12.1f %10.2f\n", "block", packed * 1e9 / tokenCount, copied / packed);
+    printf("%10s %12.1f %10.2f\n", "intern", interned * 1e9 / tokenCount, copied / interned);
+    printf("%10s %12.1f %10.2f\n", "all", internedAll * 1e9 / tokenCount,
+           copied / internedAll);
+
+    /* Each token's spelling is one copy of its bytes and its word their folding. */
+    char folded[64];
+    for (int i = 0; i < tokenCount; i++)
+    {
+        assert((int)strlen(spellings[i]) == lengths[i]);
+        assert(memcmp(spellings[i], text + starts[i], lengths[i]) == 0);
+        assert(ids[i] < v->wordCount);
+        const char *spelling;
+        assert(vocabularyIntern(v, spellings[i], lengths[i], &spelling) == ids[i]);
+        assert(spelling == spellings[i]);
+        for (int position = 0; position < lengths[i];)
+        {
+            position += foldAt(text + starts[i], lengths[i], position, folded + position);
+        }
+        folded[lengths[i]] = '\0';
+        assert(strcmp(vocabularyWord(v, ids[i]), folded) == 0);
+    }
+    /* No two ids share a folding, so ids match exactly when foldings do. */
+    const char **words = (const char **)malloc(sizeof(const char *) * v->wordCount);
+    assert(words);
+    for (uint32_t id = 0; id < v->wordCount; id++)
+    {
+        words[id] = vocabularyWord(v, id);
+    }
+    qsort(words, v->wordCount, sizeof(const char *), compareStrings);
+    for (uint32_t id = 1; id < v->wordCount; id++)
+    {
+        assert(strcmp(words[id - 1], words[id]) != 0);
+    }
+
+    free(words);
+    free(spellings);
+    free(ids);
+    freeVocabulary(v);
+    free(text);
+    free(lengths);
+    free(starts);
+    for (int i = 0; i < distinctCount; i++)
+    {
+        free(distinct[i]);
+    }
+    free(distinct);
+}
+
+/* Reads a Part F problem from the given table, transition table and text. */
+static struct problem *problemFromText(const char *tableText, const char *transitionText,
+                                       const char *text)
+{
+    FILE *tableFile = fmemopen((void *)tableText, strlen(tableText), "r");
+    assert(tableFile);
+    FILE *transitionFile = fmemopen((void *)transitionText, strlen(transitionText), "r");
+    assert(transitionFile);
+    FILE *textFile = fmemopen((void *)text, strlen(text), "r");
+    assert(textFile);
+    struct problem *p = readProblemF(textFile, tableFile, transitionFile);
+    fclose(textFile);
+    fclose(transitionFile);
+    fclose(tableFile);
+    return p;
+}
+
+/* Reads the given tables alone, for documents to borrow. */
+static struct problem *tablesFromText(const char *tableText, const char *transitionText)
+{
+    FILE *tableFile = fmemopen((void *)tableText, strlen(tableText), "r");
+    assert(tableFile);
+    FILE *transitionFile = fmemopen((void *)transitionText, strlen(transitionText), "r");
+    assert(transitionFile);
+    struct problem *p = readProblemTables(tableFile, transitionFile);
+    fclose(transitionFile);
+    fclose(tableFile);
+    return p;
+}
+
+/* Reads the given text as a document borrowing the given problem's tables. */
+static struct problem *documentFromText(const struct problem *tables, const char *text)
+{
+    FILE *textFile = fmemopen((void *)text, strlen(text), "r");
+    assert(textFile);
+    struct problem *p = readProblemDocument(tables, textFile);
+    fclose(textFile);
+    return p;
+}
+
+/*
+    Writes a table of tableCount random terms, a few of them two
+    words, with colours 1 to
+    colourCount - 1 into tableText, and every transition between them
+    into transitionText, returning the words.
+*/
+static char **syntheticTables(int tableCount, int colourCount, char *tableText,
+                              char *transitionText)
+{
+    char **words = (char **)malloc(sizeof(char *) * tableCount);
+    assert(words);
+    int length = 0;
+    for (int i = 0; i < tableCount; i++)
+    {
+        char word[16];
+        int wordLength = 3 + rand() % 6;
+        for (int j = 0; j < wordLength; j++)
+        {
+            word[j] = 'a' + rand() % 26;
+        }
+        if (wordLength > 4 && rand() % 5 == 0)
+        {
+            /* Some terms are two words, like "Big Oh". */
+            word[wordLength / 2] = ' ';
+        }
+        word[wordLength] = '\0';
+        words[i] = strdup(word);
+        assert(words[i]);
+        length += sprintf(tableText + length, "%s,%d,%d\n", word, 1 + rand() % (colourCount - 1),
+                          1 + rand() % 9);
+    }
+    length = 0;
+    for (int i = 0; i < colourCount; i++)
+    {
+        for (int j = 0; j < colourCount; j++)
+        {
+            length += sprintf(transitionText + length, "%d,%d,%d\n", i, j, rand() % 11 - 5);
+        }
+    }
+    return words;
+}
+
+/*
+    Writes a sentence of termCount words into text, each a table word
+    or, as often as not, a word without a table.
+*/
+static void syntheticSentence(char **words, int tableCount, int termCount, char *text)
+{
+    int length = 0;
+    for (int i = 0; i < termCount; i++)
+    {
+        if (rand() % 2 == 0)
+        {
+            length += sprintf(text + length, "%s ", words[rand() % tableCount]);
+        }
+        else
+        {
+            length += sprintf(text + length, "%c%c ", 'A' + rand() % 26, 'a' + rand() % 26);
+        }
+    }
+    text[length] = '\0';
+}
+
+/*
+    Solutions from the cache against fresh solves, a changed table
+    version and eviction, then flashcard documents, many repeating
+    earlier ones, scheduled with and without the cache.
+*/
+static void benchmarkCache(void)
+{
+    int tableCount = 40;
+    char tableText[40 * 32];
+    char transitionText[4 * 4 * 16];
+    char **words = syntheticTables(tableCount, 4, tableText, transitionText);
+
+    /* A handful of sentences, each asked for again and again, sharing one vocabulary. */
+    struct problem *tables = tablesFromText(tableText, transitionText);
+    int distinctCount = 50;
+    int documentCount = 2000;
+    struct problem **problems = (struct problem **)malloc(sizeof(struct problem *) * documentCount);
+    assert(problems);
+    char text[16 * 40];
+    unsigned int seeds[50];
+    for (int i = 0; i < distinctCount; i++)
+    {
+        seeds[i] = rand();
+    }
+    for (int i = 0; i < documentCount; i++)
+    {
+        /* Reseeding repeats the sentence, new words without tables and all. */
+        unsigned int next = rand();
+        srand(seeds[rand() % distinctCount]);
+        syntheticSentence(words, tableCount, 1 + rand() % 12, text);
+        problems[i] = documentFromText(tables, text);
+        srand(next);
+    }
+
+    struct solutionCache *cache = newSolutionCache(SOLUTION_CACHE_CAPACITY);
+    for (int i = 0; i < documentCount; i++)
+    {
+        struct solution *fresh = solveProblemF(problems[i]);
+        long hits = solutionCacheHits(cache);
+        struct solution *cached = solveProblemCached(cache, problems[i]);
+        assert(cached->score == fresh->score);
+        assert(memcmp(cached->termColours, fresh->termColours,
+                      sizeof(int) * problems[i]->termCount) == 0);
+        if (solutionCacheHits(cache) > hits)
+        {
+            /* Changed tables can't be answered by the old solution. */
+            problems[i]->tableVersion ^= 1;
+            assert(!solutionCacheLookup(cache, problems[i]));
+            problems[i]->tableVersion ^= 1;
+        }
+        freeSolution(cached, problems[i]);
+        freeSolution(fresh, problems[i]);
+    }
+    assert(solutionCacheHits(cache) > 0);
+    /* Ids from a vocabulary of its own mean other words. */
+    struct problem *alone = problemFromText(tableText, transitionText, problems[0]->text);
+    assert(!solutionCacheLookup(cache, alone));
+    freeProblem(alone);
+    freeSolutionCache(cache);
+
+    /* The least recently used goes first. */
+    cache = newSolutionCache(2);
+    struct problem *distinct[3];
+    int found = 0;
+    for (int i = 0; i < documentCount && found < 3; i++)
+    {
+        int repeated = 0;
+        for (int j = 0; j < found; j++)
+        {
+            repeated |= distinct[j]->termCount == problems[i]->termCount &&
+                        memcmp(distinct[j]->termTables, problems[i]->termTables,
+                               sizeof(int) * problems[i]->termCount) == 0;
+        }
+        if (!repeated)
+        {
+            distinct[found++] = problems[i];
+        }
+    }
+    assert(found == 3);
+    for (int j = 0; j < 3; j++)
+    {
+        freeSolution(solveProblemCached(cache, distinct[j]), distinct[j]);
+    }
+    struct solution *evicted = solutionCacheLookup(cache, distinct[0]);
+    assert(!evicted);
+    struct solution *kept = solutionCacheLookup(cache, distinct[2]);
+    assert(kept);
+    freeSolution(kept, distinct[2]);
+    freeSolutionCache(cache);
+
+    /*
+        Scheduled without the cache, then with it twice, the second
+        time answered from it alone, all printing the same.
+    */
+    char *outputs[3];
+    size_t sizes[3];
+    double times[3];
+    cache = newSolutionCache(SOLUTION_CACHE_CAPACITY);
+    for (int k = 0; k < 3; k++)
+    {
+        FILE *outFile = open_memstream(&(outputs[k]), &(sizes[k]));
+        assert(outFile);
+        double start = now();
+        solveProblemsScheduled(problems, documentCount, 1, 0, outFile, NULL, k ? cache : NULL);
+        times[k] = now() - start;
+        fclose(outFile);
+        assert(sizes[k] == sizes[0] && memcmp(outputs[k], outputs[0], sizes[0]) == 0);
+    }
+    printf("cache: %d documents of %d distinct sentences, %ld hits of %ld lookups\n",
+           documentCount, distinctCount, solutionCacheHits(cache),
+           solutionCacheHits(cache) + solutionCacheMisses(cache));
+    assert(solutionCacheHits(cache) == documentCount);
+    freeSolutionCache(cache);
+    printf("%10s %10s %10s\n", "", "time (ms)", "speedup");
+    printf("%10s %10.3f %10s\n", "uncached", times[0] * 1e3, "1.00");
+    printf("%10s %10.3f %10.2f\n", "repeats", times[1] * 1e3, times[0] / times[1]);
+    printf("%10s %10.3f %10.2f\n", "cached", times[2] * 1e3, times[0] / times[2]);
+
+    for (int k = 0; k < 3; k++)
+    {
+        free(outputs[k]);
+    }
+    for (int i = 0; i < documentCount; i++)
+    {
+        freeProblem(problems[i]);
+    }
+    freeProblem(tables);
+    free(problems);
+    for (int i = 0; i < tableCount; i++)
+    {
+        free(words[i]);
+    }
+    free(words);
+}
+
+/* Returns the score of the given colouring, LATTICE_NONALLOWED if it isn't allowed. */
+static int colouringScore(struct lattice *l, const int *termTables, int termCount,
+                          const int *colours)
+{
+    int score = 0;
+    for (int i = 0; i < termCount; i++)
+    {
+        int emission = LATTICE_ROW(l, termTables[i])[colours[i]];
+        if (emission == LATTICE_NONALLOWED)
+        {
+            return LATTICE_NONALLOWED;
+        }
+        score += emission;
+        if (i > 0)
+        {
+            score += l->transitions[colours[i - 1] * l->colourCount + colours[i]];
+        }
+    }
+    return score;
+}
+
+/*
+    Makes editCount edits near a cursor wandering through a document of
+    termCount terms, as typing does, checking every so often against
+    solving the text afresh. Returns the seconds per edit and sets full
+    to the seconds to solve the document afresh.
+*/
+static double localEdits(char **words, int tableCount, const char *tableText,
+                         const char *transitionText, int termCount, int editCount, double *full)
+{
+    const char *pieces[] = {" ", "e", "x", "Ab", ". ", "\n"};
+    int pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+    char *text = (char *)malloc(termCount * 16 + 1);
+    assert(text);
+    syntheticSentence(words, tableCount, termCount, text);
+    struct problem *p = problemFromText(tableText, transitionText, text);
+    free(text);
+    struct incrementalSolver *s = newIncrementalSolver(p);
+    incrementalScore(s);
+    int textLength = strlen(p->text);
+    int cursor = textLength / 2;
+    double elapsed = 0;
+    double fullTime = 0;
+    int solves = 0;
+    for (int e = 0; e < editCount; e++)
+    {
+        cursor += rand() % 81 - 40;
+        cursor = (cursor < 0) ? 0 : (cursor > textLength) ? textLength : cursor;
+        int length = (rand() % 3 == 0) ? rand() % 3 : 0;
+        if (length > textLength - cursor)
+        {
+            length = textLength - cursor;
+        }
+        const char *replacement = (rand() % 4 == 0) ? words[rand() % tableCount]
+                                                    : pieces[rand() % pieceCount];
+        double begin = now();
+        incrementalEdit(s, cursor, length, replacement);
+        int score = incrementalScore(s);
+        elapsed += now() - begin;
+        textLength += strlen(replacement) - length;
+        cursor += strlen(replacement);
+
+        if (e % 500 == 0)
+        {
+            struct problem *q = problemFromText(tableText, transitionText, incrementalProblem(s)->text);
+            begin = now();
+            struct solution *expected = solveProblemF(q);
+            fullTime += now() - begin;
+            solves++;
+            assert(q->termCount == p->termCount && score == expected->score);
+            freeSolution(expected, q);
+            freeProblem(q);
+        }
+    }
+    freeIncrementalSolver(s);
+    freeProblem(p);
+    *full = fullTime / solves;
+    return elapsed / editCount;
+}
+
+/*
+    Random edits to documents, checking after each that the terms,
+    score and colouring match solving the edited text afresh, and
+    reporting the lattice rows computed against re-solving in full.
+*/
+static void benchmarkIncremental(void)
+{
+    int tableCount = 40;
+    char tableText[40 * 32];
+    char transitionText[4 * 4 * 16];
+    char **words = syntheticTables(tableCount, 4, tableText, transitionText);
+    /* Pieces edits are made of, splitting, joining and punctuating terms. */
+    const char *pieces[] = {" ", ", ", "x", "Ab", "\n", "..."};
+    int pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+
+    long editCount = 0;
+    long rows = 0;
+    long fullRows = 0;
+    double incrementalTime = 0;
+    double fullTime = 0;
+    char text[160 * 40];
+    for (int d = 0; d < 300; d++)
+    {
+        syntheticSentence(words, tableCount, 1 + rand() % 150, text);
+        struct problem *p = problemFromText(tableText, transitionText, text);
+        struct incrementalSolver *s = newIncrementalSolver(p);
+        incrementalScore(s);
+        for (int e = 0; e < 20; e++)
+        {
+            int textLength = strlen(p->text);
+            int start = rand() % (textLength + 1);
+            int length = rand() % 8;
+            if (length > textLength - start)
+            {
+                length = textLength - start;
+            }
+            char replacement[64] = "";
+            for (int k = rand() % 4; k > 0; k--)
+            {
+                strcat(replacement, (rand() % 2 == 0) ? words[rand() % tableCount]
+                                                      : pieces[rand() % pieceCount]);
+            }
+            if (length == textLength && replacement[0] == '\0')
+            {
+                /* An empty text can't be read afresh. */
+                strcpy(replacement, "x");
+            }
+
+            long before = incrementalRowsComputed(s);
+            double begin = now();
+            incrementalEdit(s, start, length, replacement);
+            struct solution *solution = incrementalSolution(s);
+            int score = incrementalScore(s);
+            incrementalTime += now() - begin;
+            rows += incrementalRowsComputed(s) - before;
+
+            incrementalProblem(s);
+            struct problem *q = problemFromText(tableText, transitionText, p->text);
+            begin = now();
+            struct solution *expected = solveProblemF(q);
+            fullTime += now() - begin;
+            fullRows += q->termCount;
+            editCount++;
+
+            assert(q->termCount == p->termCount);
+            for (int i = 0; i < q->termCount; i++)
+            {
+                assert(q->termTables[i] == p->termTables[i]);
+                assert(q->termStarts[i] == p->termStarts[i] && q->termEnds[i] == p->termEnds[i]);
+                assert(strcmp(q->terms[i], p->terms[i]) == 0);
+            }
+            assert(score == expected->score && solution->score == expected->score);
+            /* Ties may be broken either way, but the colouring must score the best. */
+            struct lattice *l = newLattice(q);
+            assert(colouringScore(l, q->termTables, q->termCount, solution->termColours) ==
+                   expected->score);
+            freeLattice(l);
+            freeSolution(expected, q);
+            freeProblem(q);
+            freeSolution(solution, p);
+        }
+        freeIncrementalSolver(s);
+        freeProblem(p);
+    }
+    printf("incremental: %ld edits\n", editCount);
+    printf("%12s %12s %12s\n", "", "rows", "time (ms)");
+    printf("%12s %12ld %12.3f\n", "full", fullRows, fullTime * 1e3);
+    printf("%12s %12ld %12.3f\n", "incremental", rows, incrementalTime * 1e3);
+
+    /* Typing in long documents costs the same per edit however long they are. */
+    printf("%12s %12s %12s %12s\n", "terms", "edit (us)", "full (us)", "speedup");
+    double perEdit[2];
+    int sizes[] = {5000, 50000};
+    for (int i = 0; i < 2; i++)
+    {
+        double full;
+        perEdit[i] = localEdits(words, tableCount, tableText, transitionText, sizes[i], 20000, &full);
+        printf("%12d %12.3f %12.3f %12.1f\n", sizes[i], perEdit[i] * 1e6, full * 1e6,
+               full / perEdit[i]);
+        assert(perEdit[i] * 10 < full);
+    }
+    assert(perEdit[1] < perEdit[0] * 4);
+
+    for (int i = 0; i < tableCount; i++)
+    {
+        free(words[i]);
+    }
+    free(words);
+}
+
+struct streamOutput
+{
+    int *colours;
+    int count;
+};
+
+/* Records each colour the streaming solver commits, checking they come in order. */
+static void recordCommit(void *data, int index, int colour)
+{
+    struct streamOutput *output = (struct streamOutput *)data;
+    assert(index == output->count);
+    output->colours[index] = colour;
+    output->count++;
+}
+
+/*
+    The streaming solver against latticeSolve, matching it exactly with
+    no lag, and with each lag committing every term within that many
+    terms, reporting how often the lag forced a commit and what it cost.
+*/
+static void benchmarkStream(void)
+{
+    int lags[] = {0, 1, 2, 4, 8, 32};
+    int lagCount = sizeof(lags) / sizeof(lags[0]);
+    int colourCounts[] = {3, 6, 16};
+    for (int n = 0; n < (int)(sizeof(colourCounts) / sizeof(colourCounts[0])); n++)
+    {
+        struct lattice *l = syntheticLattice(colourCounts[n], 100);
+        struct corpus *c = syntheticCorpus(200, 1, 2000, 100);
+        printf("stream: %d colours, %d documents\n", colourCounts[n], c->documentCount);
+        printf("%6s %10s %10s %10s %12s %12s\n", "lag", "converged", "forced", "finished",
+               "mean wait", "score loss");
+        for (int k = 0; k < lagCount; k++)
+        {
+            struct streamStats total;
+            memset(&total, 0, sizeof(total));
+            long long loss = 0;
+            for (int i = 0; i < c->documentCount; i++)
+            {
+                int termCount = c->termCounts[i];
+                int *expected = (int *)malloc(sizeof(int) * termCount);
+                assert(expected);
+                struct streamOutput output;
+                output.colours = (int *)malloc(sizeof(int) * termCount);
+                assert(output.colours);
+                output.count = 0;
+                int expectedScore = latticeSolve(l, c->termTables[i], termCount, expected);
+
+                struct streamSolver *s = newStreamSolver(l, lags[k], recordCommit, &output);
+                for (int j = 0; j < termCount; j++)
+                {
+                    streamPush(s, c->termTables[i][j]);
+                    if (lags[k] > 0)
+                    {
+                        /* No term waits more than the lag behind the newest. */
+                        assert(output.count >= j + 1 - lags[k]);
+                    }
+                }
+                int score = streamFinish(s);
+                struct streamStats stats;
+                streamGetStats(s, &stats);
+                freeStreamSolver(s);
+
+                assert(output.count == termCount);
+                assert(stats.convergedCount + stats.forcedCount + stats.finishedCount == termCount);
+                assert(score == colouringScore(l, c->termTables[i], termCount, output.colours));
+                if (lags[k] == 0)
+                {
+                    assert(stats.forcedCount == 0);
+                    assert(score == expectedScore);
+                    assert(memcmp(output.colours, expected, sizeof(int) * termCount) == 0);
+                }
+                else
+                {
+                    assert(stats.maxLatency <= lags[k]);
+                    assert(score <= expectedScore);
+                }
+                loss += expectedScore - score;
+                total.termCount += stats.termCount;
+                total.convergedCount += stats.convergedCount;
+                total.forcedCount += stats.forcedCount;
+                total.finishedCount += stats.finishedCount;
+                total.totalLatency += stats.totalLatency;
+                free(output.colours);
+                free(expected);
+            }
+            printf("%6d %10ld %10ld %10ld %12.2f %12lld\n", lags[k], total.convergedCount,
+                   total.forcedCount, total.finishedCount,
+                   (double)total.totalLatency / total.termCount, loss);
+        }
+        freeCorpus(c);
+        freeLattice(l);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *suite = (argc > 1) ? argv[1] : NULL;
+    srand(20007);
+    if (!suite || strcmp(suite, "kernels") == 0)
+    {
+        benchmarkKernels();
+    }
+    if (!suite || strcmp(suite, "schedule") == 0)
+    {
+        benchmarkSchedule();
+    }
+    if (!suite || strcmp(suite, "kbest") == 0)
+    {
+        benchmarkKBest();
+    }
+    if (!suite || strcmp(suite, "marginals") == 0)
+    {
+        benchmarkMarginals();
+    }
+    if (!suite || strcmp(suite, "semiring") == 0)
+    {
+        benchmarkSemiring();
+    }
+    if (!suite || strcmp(suite, "constraints") == 0)
+    {
+        benchmarkConstraints();
+    }
+    if (!suite || strcmp(suite, "beam") == 0)
+    {
+        benchmarkBeam();
+    }
+    if (!suite || strcmp(suite, "runs") == 0)
+    {
+        benchmarkRuns();
+    }
+    if (!suite || strcmp(suite, "load") == 0)
+    {
+        benchmarkLoad();
+    }
+    if (!suite || strcmp(suite, "tokenize") == 0)
+    {
+        benchmarkTokenize();
+    }
+    if (!suite || strcmp(suite, "patterns") == 0)
+    {
+        benchmarkPatterns();
+    }
+    if (!suite || strcmp(suite, "library") == 0)
+    {
+        benchmarkLibrary();
+    }
+    if (!suite || strcmp(suite, "planner") == 0)
+    {
+        benchmarkPlanner();
+    }
+    if (!suite || strcmp(suite, "counters") == 0)
+    {
+        benchmarkCounters();
+    }
+    if (!suite || strcmp(suite, "narrow") == 0)
+    {
+        benchmarkNarrow();
+    }
+    if (!suite || strcmp(suite, "vocabulary") == 0)
+    {
+        benchmarkVocabulary();
+    }
+    if (!suite || strcmp(suite, "cache") == 0)
+    {
+        benchmarkCache();
+    }
+    if (!suite || strcmp(suite, "incremental") == 0)
+    {
+        benchmarkIncremental();
+    }
+    if (!suite || strcmp(suite, "stream") == 0)
+    {
+        benchmarkStream();
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,321 @@
+/*
+    Implementation for module which contains a bounded
+        least-recently-used cache of Part E and Part F
+        solutions.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "cache.h"
+#include "hash.h"
+#include "vocabulary.h"
+#include "problemStruct.c"
+#include "solutionStruct.c"
+
+/* Marker for the end of a chain or list. */
+#define NO_ENTRY (-1)
+
+struct cacheEntry
+{
+    /* Hash of the key, kept to avoid comparing full sequences. */
+    unsigned long long hash;
+    /* Table snapshot version the solution was computed against. */
+    unsigned long long tableVersion;
+    /* Part the solution was computed for. */
+    enum problemPart part;
+    /* The serial of the vocabulary the word ids are from. */
+    unsigned long long vocabulary;
+    /* The number of tokens in the key. */
+    int termCount;
+    /* The word id of each token. */
+    uint32_t *termIds;
+    /* The cached colouring and its score. */
+    int *termColours;
+    int score;
+    /* Next entry in the same hash bucket. */
+    int chain;
+    /* Neighbours in recency order, most recent first. */
+    int newer;
+    int older;
+};
+
+struct solutionCache
+{
+    int capacity;
+    int entryCount;
+    struct cacheEntry *entries;
+    /* Hash buckets, bucketCount is always a power of two. */
+    int bucketCount;
+    int *buckets;
+    /* Most and least recently used entries. */
+    int newest;
+    int oldest;
+    long hits;
+    long misses;
+};
+
+struct solutionCache *newSolutionCache(int capacity)
+{
+    struct solutionCache *cache = (struct solutionCache *)malloc(sizeof(struct solutionCache));
+    assert(cache);
+    cache->capacity = (capacity > 0) ? capacity : 0;
+    cache->entryCount = 0;
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->bucketCount = 0;
+    cache->newest = NO_ENTRY;
+    cache->oldest = NO_ENTRY;
+    cache->hits = 0;
+    cache->misses = 0;
+    if (cache->capacity > 0)
+    {
+        cache->entries = (struct cacheEntry *)malloc(sizeof(struct cacheEntry) * cache->capacity);
+        assert(cache->entries);
+        /* Keep buckets at most half full. */
+        cache->bucketCount = 1;
+        while (cache->bucketCount < cache->capacity * 2)
+        {
+            cache->bucketCount *= 2;
+        }
+        cache->buckets = (int *)malloc(sizeof(int) * cache->bucketCount);
+        assert(cache->buckets);
+        for (int i = 0; i < cache->bucketCount; i++)
+        {
+            cache->buckets[i] = NO_ENTRY;
+        }
+    }
+    return cache;
+}
+
+/*
+    Hashes the word ids of the given problem along with its tables.
+    The words fix each token's table, so the same ids against the
+    same tables have the same solution.
+*/
+static unsigned long long hashKey(struct problem *p)
+{
+    unsigned long long hash = HASH_SEED;
+    hash = hashInt(hash, (int)p->part);
+    hash = hashBytes(hash, &p->tableVersion, sizeof(p->tableVersion));
+    hash = hashBytes(hash, &p->vocabulary->serial, sizeof(p->vocabulary->serial));
+    hash = hashInt(hash, p->termCount);
+    return hashBytes(hash, p->termIds, sizeof(uint32_t) * p->termCount);
+}
+
+/* Returns 1 if the given entry was computed for the same input as p. */
+static int entryMatches(struct cacheEntry *entry, unsigned long long hash,
+                        struct problem *p)
+{
+    return entry->hash == hash && entry->part == p->part && entry->tableVersion == p->tableVersion && entry->vocabulary == p->vocabulary->serial && entry->termCount == p->termCount && memcmp(entry->termIds, p->termIds, sizeof(uint32_t) * p->termCount) == 0;
+}
+
+/* Removes the given entry from the recency list. */
+static void unlinkEntry(struct solutionCache *cache, int index)
+{
+    struct cacheEntry *entry = &(cache->entries[index]);
+    if (entry->newer != NO_ENTRY)
+    {
+        cache->entries[entry->newer].older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NO_ENTRY)
+    {
+        cache->entries[entry->older].newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+}
+
+/* Places the given entry at the front of the recency list. */
+static void pushNewest(struct solutionCache *cache, int index)
+{
+    struct cacheEntry *entry = &(cache->entries[index]);
+    entry->newer = NO_ENTRY;
+    entry->older = cache->newest;
+    if (cache->newest != NO_ENTRY)
+    {
+        cache->entries[cache->newest].newer = index;
+    }
+    cache->newest = index;
+    if (cache->oldest == NO_ENTRY)
+    {
+        cache->oldest = index;
+    }
+}
+
+/* Removes the given entry from its hash bucket. */
+static void unchainEntry(struct solutionCache *cache, int index)
+{
+    int *link = &(cache->buckets[cache->entries[index].hash & (cache->bucketCount - 1)]);
+    while (*link != index)
+    {
+        assert(*link != NO_ENTRY);
+        link = &(cache->entries[*link].chain);
+    }
+    *link = cache->entries[index].chain;
+}
+
+/* Builds a fresh solution from the given cache entry. */
+static struct solution *copyEntrySolution(struct cacheEntry *entry)
+{
+    struct solution *s = (struct solution *)malloc(sizeof(struct solution));
+    assert(s);
+    s->termCount = entry->termCount;
+    s->termColours = (int *)malloc(sizeof(int) * (entry->termCount > 0 ? entry->termCount : 1));
+    assert(s->termColours);
+    memcpy(s->termColours, entry->termColours, sizeof(int) * entry->termCount);
+    s->score = entry->score;
+    return s;
+}
+
+/* Runs the uncached solver for the part of the given problem. */
+static struct solution *solveUncached(struct problem *p)
+{
+    switch (p->part)
+    {
+    case PART_E:
+        return solveProblemE(p);
+    case PART_F:
+        return solveProblemF(p);
+    default:
+        /* Only the optimal parts are deterministic enough to cache. */
+        assert(p->part == PART_E || p->part == PART_F);
+        return NULL;
+    }
+}
+
+/* Returns the entry cached for the given problem, or NO_ENTRY. */
+static int findEntry(struct solutionCache *cache, unsigned long long hash, struct problem *p)
+{
+    int bucket = (int)(hash & (cache->bucketCount - 1));
+    for (int i = cache->buckets[bucket]; i != NO_ENTRY; i = cache->entries[i].chain)
+    {
+        if (entryMatches(&(cache->entries[i]), hash, p))
+        {
+            return i;
+        }
+    }
+    return NO_ENTRY;
+}
+
+struct solution *solutionCacheLookup(struct solutionCache *cache, struct problem *p)
+{
+    if (cache->capacity == 0)
+    {
+        cache->misses++;
+        return NULL;
+    }
+    int index = findEntry(cache, hashKey(p), p);
+    if (index == NO_ENTRY)
+    {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    unlinkEntry(cache, index);
+    pushNewest(cache, index);
+    return copyEntrySolution(&(cache->entries[index]));
+}
+
+void solutionCacheStore(struct solutionCache *cache, struct problem *p,
+                        const int *termColours, int score)
+{
+    if (cache->capacity == 0)
+    {
+        return;
+    }
+    unsigned long long hash = hashKey(p);
+    int index = findEntry(cache, hash, p);
+    if (index != NO_ENTRY)
+    {
+        /* Already cached, the same colouring as it's the same input. */
+        unlinkEntry(cache, index);
+        pushNewest(cache, index);
+        return;
+    }
+
+    /* Find a slot, evicting the least recently used entry if full. */
+    struct cacheEntry *entry;
+    if (cache->entryCount < cache->capacity)
+    {
+        index = cache->entryCount;
+        cache->entryCount++;
+        entry = &(cache->entries[index]);
+    }
+    else
+    {
+        index = cache->oldest;
+        unlinkEntry(cache, index);
+        unchainEntry(cache, index);
+        entry = &(cache->entries[index]);
+        free(entry->termIds);
+        free(entry->termColours);
+    }
+
+    int allocCount = (p->termCount > 0) ? p->termCount : 1;
+    entry->hash = hash;
+    entry->tableVersion = p->tableVersion;
+    entry->part = p->part;
+    entry->vocabulary = p->vocabulary->serial;
+    entry->termCount = p->termCount;
+    entry->termIds = (uint32_t *)malloc(sizeof(uint32_t) * allocCount);
+    assert(entry->termIds);
+    memcpy(entry->termIds, p->termIds, sizeof(uint32_t) * p->termCount);
+    entry->termColours = (int *)malloc(sizeof(int) * allocCount);
+    assert(entry->termColours);
+    memcpy(entry->termColours, termColours, sizeof(int) * p->termCount);
+    entry->score = score;
+
+    int bucket = (int)(hash & (cache->bucketCount - 1));
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = index;
+    pushNewest(cache, index);
+}
+
+struct solution *solveProblemCached(struct solutionCache *cache,
+                                    struct problem *p)
+{
+    struct solution *s = solutionCacheLookup(cache, p);
+    if (!s)
+    {
+        s = solveUncached(p);
+        solutionCacheStore(cache, p, s->termColours, s->score);
+    }
+    return s;
+}
+
+long solutionCacheHits(struct solutionCache *cache)
+{
+    return cache->hits;
+}
+
+long solutionCacheMisses(struct solutionCache *cache)
+{
+    return cache->misses;
+}
+
+void freeSolutionCache(struct solutionCache *cache)
+{
+    if (cache)
+    {
+        for (int i = 0; i < cache->entryCount; i++)
+        {
+            free(cache->entries[i].termIds);
+            free(cache->entries[i].termColours);
+        }
+        if (cache->entries)
+        {
+            free(cache->entries);
+        }
+        if (cache->buckets)
+        {
+            free(cache->buckets);
+        }
+        free(cache);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+    Header for module which contains a bounded least-recently-used
+        cache of Part E and Part F solutions, keyed by the sequence
+        of word ids of the tokens and the table snapshot version, so
+        only problems sharing a vocabulary (see readProblemDocument)
+        share solutions.
+*/
+#include "problem.h"
+
+#ifndef CACHE_H
+#define CACHE_H 1
+
+/* Solutions solveProblemsScheduled keeps between documents by default. */
+#ifndef SOLUTION_CACHE_CAPACITY
+#define SOLUTION_CACHE_CAPACITY 4096
+#endif
+
+struct solutionCache;
+
+/*
+    Creates an empty solution cache holding at most capacity
+    solutions. A capacity of 0 or less disables caching.
+*/
+struct solutionCache *newSolutionCache(int capacity);
+
+/*
+    Solves the given problem according to its part (E or F),
+    returning a copy of the cached solution if an identical token
+    sequence has been solved against the same tables before. The
+    returned solution is owned by the caller and should be freed
+    with freeSolution.
+*/
+struct solution *solveProblemCached(struct solutionCache *cache,
+                                    struct problem *p);
+
+/*
+    Returns a copy of the solution cached for an identical token
+    sequence against the same tables as the given problem, owned by
+    the caller, or NULL if there is none, for callers which solve the
+    misses themselves and store them with solutionCacheStore.
+*/
+struct solution *solutionCacheLookup(struct solutionCache *cache,
+                                     struct problem *p);
+
+/*
+    Caches a copy of the given colouring and score of the given
+    problem, evicting the least recently used solution if full.
+*/
+void solutionCacheStore(struct solutionCache *cache, struct problem *p,
+                        const int *termColours, int score);
+
+/* Returns the number of lookups answered from the cache. */
+long solutionCacheHits(struct solutionCache *cache);
+
+/* Returns the number of lookups which had to run the solver. */
+long solutionCacheMisses(struct solutionCache *cache);
+
+/*
+    Frees the given solution cache and all cached solutions.
+*/
+void freeSolutionCache(struct solutionCache *cache);
+
+#endif
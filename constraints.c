@@ -0,0 +1,183 @@
+/*
+    Implementation for module which solves a Part F problem under
+        per-document constraints.
+
+    Rather than fixing up a colouring afterwards, the constraints
+    become part of the lattice the solver runs over: a copy of the
+    transition matrix scores forbidden pairs as LATTICE_FORBIDDEN, and
+    each pinned term points at an extra emission row allowing only its
+    colour. The solve itself is then the same pass, with the same
+    specialised kernels, as without constraints; the copy costs one
+    pass over the tables.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "constraints.h"
+#include "problemStruct.c"
+
+/* Number of constraints to allocate space for initially. */
+#define INITIALCONSTRAINTS 16
+
+/* Longest constraint kind read, pin or forbid. */
+#define KINDLENGTH 15
+
+static void addConstraint(int *count, int *allocated, int **first, int **second,
+                          int firstValue, int secondValue)
+{
+    if (*count >= *allocated)
+    {
+        *allocated = (*allocated == 0) ? INITIALCONSTRAINTS : *allocated * 2;
+        *first = (int *)realloc(*first, sizeof(int) * *allocated);
+        assert(*first);
+        *second = (int *)realloc(*second, sizeof(int) * *allocated);
+        assert(*second);
+    }
+    (*first)[*count] = firstValue;
+    (*second)[*count] = secondValue;
+    (*count)++;
+}
+
+struct latticeConstraints *readConstraints(FILE *constraintFile)
+{
+    struct latticeConstraints *c = (struct latticeConstraints *)malloc(sizeof(struct latticeConstraints));
+    assert(c);
+    c->pinCount = 0;
+    c->pinTerms = NULL;
+    c->pinColours = NULL;
+    c->forbidCount = 0;
+    c->forbidPrevColours = NULL;
+    c->forbidColours = NULL;
+    int pinAllocated = 0;
+    int forbidAllocated = 0;
+
+    char kind[KINDLENGTH + 1];
+    int first;
+    int second;
+    int read;
+    while ((read = fscanf(constraintFile, " %15[^,],%d,%d", kind, &first, &second)) != EOF)
+    {
+        if (read == 3 && strcmp(kind, "pin") == 0)
+        {
+            addConstraint(&c->pinCount, &pinAllocated, &c->pinTerms, &c->pinColours,
+                          first, second);
+        }
+        else if (read == 3 && strcmp(kind, "forbid") == 0)
+        {
+            addConstraint(&c->forbidCount, &forbidAllocated, &c->forbidPrevColours,
+                          &c->forbidColours, first, second);
+        }
+        else
+        {
+            fprintf(stderr, "Constraint %d is not pin,term,colour or forbid,prevColour,colour\n",
+                    c->pinCount + c->forbidCount + 1);
+            freeConstraints(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+struct lattice *newConstrainedLattice(struct lattice *l, const struct latticeConstraints *c,
+                                      const int *termTables, int termCount,
+                                      int *constrainedTables)
+{
+    int colourCount = l->colourCount;
+    struct lattice *constrained = (struct lattice *)malloc(sizeof(struct lattice));
+    assert(constrained);
+    constrained->colourCount = colourCount;
+    constrained->shared = 0;
+    /* Every pin may need a row of its own after the tables. */
+    constrained->rowCount = l->rowCount + c->pinCount;
+
+    size_t tableSize = sizeof(int) * l->rowCount * colourCount;
+    constrained->emissions = (int *)malloc(tableSize + sizeof(int) * c->pinCount * colourCount);
+    assert(constrained->emissions);
+    memcpy(constrained->emissions, l->emissions, tableSize);
+    constrained->transitions = (int *)malloc(sizeof(int) * colourCount * colourCount);
+    assert(constrained->transitions);
+    memcpy(constrained->transitions, l->transitions, sizeof(int) * colourCount * colourCount);
+    for (int i = 0; i < c->forbidCount; i++)
+    {
+        int prevColour = c->forbidPrevColours[i];
+        int colour = c->forbidColours[i];
+        if (prevColour >= 0 && prevColour < colourCount && colour >= 0 && colour < colourCount)
+        {
+            constrained->transitions[prevColour * colourCount + colour] = LATTICE_FORBIDDEN;
+        }
+    }
+
+    memcpy(constrainedTables, termTables, sizeof(int) * termCount);
+    /* Table index of the first pin row. */
+    int firstPin = l->rowCount - 1;
+    int pinRows = 0;
+    for (int i = 0; i < c->pinCount; i++)
+    {
+        int term = c->pinTerms[i];
+        int colour = c->pinColours[i];
+        if (term < 0 || term >= termCount || colour < 0 || colour >= colourCount)
+        {
+            continue;
+        }
+        /* A term pinned again reuses its row. */
+        int table = constrainedTables[term];
+        if (table < firstPin)
+        {
+            table = firstPin + pinRows;
+            pinRows++;
+        }
+        const int *base = LATTICE_ROW(l, termTables[term]);
+        int *row = LATTICE_ROW(constrained, table);
+        for (int j = 0; j < colourCount; j++)
+        {
+            row[j] = LATTICE_NONALLOWED;
+        }
+        row[colour] = (base[colour] == LATTICE_NONALLOWED) ? 0 : base[colour];
+        constrainedTables[term] = table;
+    }
+    constrained->rowCount = l->rowCount + pinRows;
+
+    latticeListAllowed(constrained);
+    return constrained;
+}
+
+int latticeSolveConstrained(struct lattice *l, const int *termTables, int termCount,
+                            const struct latticeConstraints *c, int *colours)
+{
+    int *constrainedTables = (int *)malloc(sizeof(int) * (termCount > 0 ? termCount : 1));
+    assert(constrainedTables);
+    struct lattice *constrained = newConstrainedLattice(l, c, termTables, termCount,
+                                                        constrainedTables);
+    int score = latticeSolve(constrained, constrainedTables, termCount, colours);
+    freeLattice(constrained);
+    free(constrainedTables);
+    return score;
+}
+
+void solveProblemConstrained(struct problem *p, const struct latticeConstraints *c,
+                             int colourMode, FILE *outFile)
+{
+    struct lattice *l = newLattice(p);
+    int *colours = (int *)malloc(sizeof(int) * (p->termCount > 0 ? p->termCount : 1));
+    assert(colours);
+    int score = latticeSolveConstrained(l, p->termTables, p->termCount, c, colours);
+    if (score < LATTICE_FORBIDDEN / 2)
+    {
+        fprintf(stderr, "No colouring meets every constraint, using a forbidden pair\n");
+    }
+    outputColouring(outFile, p, colours, colourMode);
+    free(colours);
+    freeLattice(l);
+}
+
+void freeConstraints(struct latticeConstraints *c)
+{
+    if (c)
+    {
+        free(c->pinTerms);
+        free(c->pinColours);
+        free(c->forbidPrevColours);
+        free(c->forbidColours);
+        free(c);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+    Header for module which solves a Part F problem under per-document
+        constraints, pinning terms to colours and forbidding colour
+        pairs, by masking a copy of the lattice.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef CONSTRAINTS_H
+#define CONSTRAINTS_H 1
+
+/*
+    Transition score for forbidden colour pairs, low enough never to
+    be chosen over an allowed path but high enough that a path through
+    several still sums without overflow.
+*/
+#define LATTICE_FORBIDDEN (LATTICE_NONALLOWED / 2)
+
+struct latticeConstraints
+{
+    /* Term pinTerms[i] must take colour pinColours[i]. */
+    int pinCount;
+    int *pinTerms;
+    int *pinColours;
+    /* Colour forbidPrevColours[i] may not be followed by forbidColours[i]. */
+    int forbidCount;
+    int *forbidPrevColours;
+    int *forbidColours;
+};
+
+/*
+    Reads constraints from the given file, one per line, either
+    pin,term,colour with term the index of the term in the text, or
+    forbid,prevColour,colour. Returns NULL after printing the line
+    to stderr if a line is neither.
+*/
+struct latticeConstraints *readConstraints(FILE *constraintFile);
+
+/*
+    Returns a copy of the given lattice with the given constraints
+    applied as masks: forbidden transitions score LATTICE_FORBIDDEN
+    and each pinned term gets a row of its own allowing only its pinned
+    colour, at its table's score or 0 if the table doesn't allow it.
+    Sets constrainedTables to termTables with pinned terms moved to
+    their rows. Pins outside the text or the lattice's colours are
+    ignored, the last pin of a term wins.
+*/
+struct lattice *newConstrainedLattice(struct lattice *l, const struct latticeConstraints *c,
+                                      const int *termTables, int termCount,
+                                      int *constrainedTables);
+
+/*
+    Same as latticeSolve, but meeting the given constraints. A score
+    below LATTICE_FORBIDDEN / 2 means no colouring meets them all, the
+    colouring returned then uses a forbidden pair.
+*/
+int latticeSolveConstrained(struct lattice *l, const int *termTables, int termCount,
+                            const struct latticeConstraints *c, int *colours);
+
+/*
+    Outputs the optimal colouring of the given Part F problem under
+    the given constraints as outputProblem does, warning on stderr if
+    the constraints can't all be met.
+*/
+void solveProblemConstrained(struct problem *p, const struct latticeConstraints *c,
+                             int colourMode, FILE *outFile);
+
+/*
+    Frees the given constraints and all memory allocated for them.
+*/
+void freeConstraints(struct latticeConstraints *c);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+    Implementation for module which reads the processor's performance
+        counters around a phase of work.
+
+    Each counter is opened on its own rather than as a group, so a
+    processor which has some but not others still reports those it
+    has, and the kernel may share the hardware counters between them
+    in turn, which the times enabled and running read with each count
+    correct for. Counters inherit into threads started after they are
+    opened, whose counts join the opener's when they exit.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "counters.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* The event type and config of each counter. */
+static const struct
+{
+    unsigned int type;
+    unsigned long long config;
+} events[COUNTER_COUNT] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int openCounters(struct perfCounters *c)
+{
+    int opened = 0;
+    memset(c, 0, sizeof(struct perfCounters));
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        c->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (c->fds[i] >= 0)
+        {
+            opened++;
+        }
+        else if (i == COUNTER_CYCLES)
+        {
+            c->error = errno;
+        }
+    }
+    return opened;
+}
+
+/* Reads the count, time enabled and time running of the given counter. */
+static int readCounter(int fd, unsigned long long reading[3])
+{
+    return read(fd, reading, sizeof(unsigned long long) * 3) ==
+           (ssize_t)(sizeof(unsigned long long) * 3);
+}
+
+void startCounters(struct perfCounters *c)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (c->fds[i] >= 0)
+        {
+            if (!readCounter(c->fds[i], c->started[i]))
+            {
+                memset(c->started[i], 0, sizeof(c->started[i]));
+            }
+            ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void stopCounters(struct perfCounters *c)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (c->fds[i] < 0)
+        {
+            continue;
+        }
+        ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        unsigned long long reading[3];
+        if (!readCounter(c->fds[i], reading))
+        {
+            continue;
+        }
+        unsigned long long count = reading[0] - c->started[i][0];
+        unsigned long long enabled = reading[1] - c->started[i][1];
+        unsigned long long running = reading[2] - c->started[i][2];
+        if (running > 0 && running < enabled)
+        {
+            count = (unsigned long long)((double)count * enabled / running);
+        }
+        c->values[i] += (long long)count;
+    }
+}
+
+void closeCounters(struct perfCounters *c)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (c->fds[i] >= 0)
+        {
+            close(c->fds[i]);
+            c->fds[i] = -1;
+        }
+    }
+}
+
+#else
+
+/* No perf_event_open, so every counter reads as unavailable. */
+int openCounters(struct perfCounters *c)
+{
+    memset(c, 0, sizeof(struct perfCounters));
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        c->fds[i] = -1;
+    }
+    c->error = ENOSYS;
+    return 0;
+}
+
+void startCounters(struct perfCounters *c)
+{
+}
+
+void stopCounters(struct perfCounters *c)
+{
+}
+
+void closeCounters(struct perfCounters *c)
+{
+}
+
+#endif
+
+void resetCounters(struct perfCounters *c)
+{
+    memset(c->values, 0, sizeof(c->values));
+}
+
+/* Says why the processor's counters couldn't be opened. */
+static const char *counterError(int error)
+{
+    switch (error)
+    {
+    case ENOENT:
+    case EOPNOTSUPP:
+        return "none on this processor or virtual machine";
+    case EACCES:
+    case EPERM:
+        return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+    case ENOSYS:
+        return "not supported on this system";
+    default:
+        return strerror(error);
+    }
+}
+
+void printCountersHeader(FILE *outFile, const struct perfCounters *c)
+{
+    if (c->error)
+    {
+        fprintf(outFile, "counters: processor counters unavailable (%s), CPU time only\n",
+                counterError(c->error));
+    }
+    fprintf(outFile, "%12s %10s %10s %10s %10s %8s %10s %10s %10s\n", "phase", "units",
+            "cpu ns/u", "cycles/u", "instr/u", "IPC", "L1 miss/u", "LLC miss/u", "br miss/u");
+}
+
+/* Prints the given count per unit in a column, or "-" if it wasn't counted. */
+static void printColumn(FILE *outFile, const struct perfCounters *c, int counter, double units)
+{
+    if (c->fds[counter] < 0)
+    {
+        fprintf(outFile, " %10s", "-");
+    }
+    else
+    {
+        fprintf(outFile, " %10.2f", c->values[counter] / units);
+    }
+}
+
+void printCounters(FILE *outFile, const char *phase, const struct perfCounters *c,
+                   long long units)
+{
+    double perUnit = (units > 0) ? (double)units : 1.0;
+    fprintf(outFile, "%12s %10lld", phase, units);
+    printColumn(outFile, c, COUNTER_TASK_CLOCK, perUnit);
+    printColumn(outFile, c, COUNTER_CYCLES, perUnit);
+    printColumn(outFile, c, COUNTER_INSTRUCTIONS, perUnit);
+    if (c->fds[COUNTER_CYCLES] < 0 || c->fds[COUNTER_INSTRUCTIONS] < 0 ||
+        c->values[COUNTER_CYCLES] == 0)
+    {
+        fprintf(outFile, " %8s", "-");
+    }
+    else
+    {
+        fprintf(outFile, " %8.2f",
+                (double)c->values[COUNTER_INSTRUCTIONS] / c->values[COUNTER_CYCLES]);
+    }
+    printColumn(outFile, c, COUNTER_L1_MISSES, perUnit);
+    printColumn(outFile, c, COUNTER_LLC_MISSES, perUnit);
+    printColumn(outFile, c, COUNTER_BRANCH_MISSES, perUnit);
+    fprintf(outFile, "\n");
+}
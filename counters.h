@@ -0,0 +1,78 @@
+/*
+    Header for module which reads the processor's performance
+        counters around a phase of work, such as tokenizing, solving
+        or printing, so a change which slows a phase down can be
+        told apart by the cycles, instructions, cache misses and
+        branch mispredictions it costs each term.
+*/
+#include <stdio.h>
+
+#ifndef COUNTERS_H
+#define COUNTERS_H 1
+
+enum counter
+{
+    /* CPU time of the thread and the threads it starts, in nanoseconds. */
+    COUNTER_TASK_CLOCK = 0,
+    COUNTER_CYCLES = 1,
+    COUNTER_INSTRUCTIONS = 2,
+    /* Level 1 data cache read misses. */
+    COUNTER_L1_MISSES = 3,
+    /* Last level cache misses. */
+    COUNTER_LLC_MISSES = 4,
+    COUNTER_BRANCH_MISSES = 5,
+    COUNTER_COUNT = 6
+};
+
+struct perfCounters
+{
+    /* The open counter of each kind, or -1 where it can't be read. */
+    int fds[COUNTER_COUNT];
+    /* Counts between each startCounters and stopCounters, summed. */
+    long long values[COUNTER_COUNT];
+    /* Each counter's count, time enabled and time running at startCounters. */
+    unsigned long long started[COUNTER_COUNT][3];
+    /* The error opening the cycle counter, or 0 if it opened. */
+    int error;
+};
+
+/*
+    Opens every counter the kernel and processor allow for the
+    calling thread and the threads it starts afterwards, counting user
+    space only. Counters which can't be opened, as in a virtual
+    machine without them or where perf_event_paranoid forbids them,
+    are left out and read as -1. Returns the number opened.
+*/
+int openCounters(struct perfCounters *c);
+
+/* Zeroes the counts. */
+void resetCounters(struct perfCounters *c);
+
+/* Starts counting. */
+void startCounters(struct perfCounters *c);
+
+/*
+    Stops counting, adding the counts since startCounters to those
+    kept, scaled up where the kernel had to share the processor's
+    counters between more events than it has.
+*/
+void stopCounters(struct perfCounters *c);
+
+/*
+    Prints the names of the columns printCounters prints, after a line
+    saying why if the processor's counters couldn't be opened.
+*/
+void printCountersHeader(FILE *outFile, const struct perfCounters *c);
+
+/*
+    Prints the counts for the named phase on one line, each divided by
+    units (such as its terms) where units is positive, with "-" for
+    counters which couldn't be opened.
+*/
+void printCounters(FILE *outFile, const char *phase, const struct perfCounters *c,
+                   long long units);
+
+/* Closes the counters. */
+void closeCounters(struct perfCounters *c);
+
+#endif
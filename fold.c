@@ -0,0 +1,208 @@
+/*
+    Implementation for module which classifies and case folds UTF-8
+        characters.
+
+    ASCII characters are looked up in two small tables. Others are
+    decoded and looked up in the tables of foldTables.c, and folding
+    one writes it back in as many bytes as it had.
+*/
+#include "fold.h"
+#include "foldTables.c"
+
+#define S FOLD_SPACE
+#define L FOLD_LETTER
+const unsigned char foldAsciiClasses[128] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, S, S, S, S, S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+    L, L, L, L, L, L, L, L, L, L, L, 0, 0, 0, 0, 0,
+    0, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+    L, L, L, L, L, L, L, L, L, L, L, 0, 0, 0, 0, 0,
+};
+#undef S
+#undef L
+
+const char foldAsciiCases[128] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    ' ', '!', '"', '#', '$', '%', '&', '\'', '(', ')', '*', '+', ',', '-', '.', '/',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ':', ';', '<', '=', '>', '?',
+    '@', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '[', '\\', ']', '^', '_',
+    '`', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '{', '|', '}', '~', 0x7f,
+};
+
+int foldDecode(const char *text, int length, int position, int *character)
+{
+    const unsigned char *bytes = (const unsigned char *)text + position;
+    int remaining = length - position;
+    if (bytes[0] < 0x80)
+    {
+        *character = bytes[0];
+        return 1;
+    }
+    int count;
+    int value;
+    int least;
+    if (bytes[0] >= 0xc2 && bytes[0] <= 0xdf)
+    {
+        count = 2;
+        value = bytes[0] & 0x1f;
+        least = 0x80;
+    }
+    else if (bytes[0] >= 0xe0 && bytes[0] <= 0xef)
+    {
+        count = 3;
+        value = bytes[0] & 0x0f;
+        least = 0x800;
+    }
+    else if (bytes[0] >= 0xf0 && bytes[0] <= 0xf4)
+    {
+        count = 4;
+        value = bytes[0] & 0x07;
+        least = 0x10000;
+    }
+    else
+    {
+        *character = -1;
+        return 1;
+    }
+    if (remaining < count)
+    {
+        *character = -1;
+        return 1;
+    }
+    for (int i = 1; i < count; i++)
+    {
+        if ((bytes[i] & 0xc0) != 0x80)
+        {
+            *character = -1;
+            return 1;
+        }
+        value = (value << 6) | (bytes[i] & 0x3f);
+    }
+    /* Overlong forms, surrogates and characters past Unicode aren't valid. */
+    if (value < least || (value >= 0xd800 && value <= 0xdfff) || value > 0x10ffff)
+    {
+        *character = -1;
+        return 1;
+    }
+    *character = value;
+    return count;
+}
+
+int foldClass(int character)
+{
+    if (character < 0)
+    {
+        return 0;
+    }
+    if (character < 0x80)
+    {
+        return foldAsciiClasses[character];
+    }
+    switch (character)
+    {
+    case 0x85:
+    case 0xa0:
+    case 0x1680:
+    case 0x2028:
+    case 0x2029:
+    case 0x202f:
+    case 0x205f:
+    case 0x3000:
+        return FOLD_SPACE;
+    }
+    if (character >= 0x2000 && character <= 0x200a)
+    {
+        return FOLD_SPACE;
+    }
+    if (character < 0x10000)
+    {
+        const unsigned int *page = foldLetterPages[foldLetterIndex[character >> 8]];
+        int bit = character & 0xff;
+        return ((page[bit >> 5] >> (bit & 31)) & 1) ? FOLD_LETTER : 0;
+    }
+    int low = 0;
+    int high = FOLD_WIDE_LETTERS - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        if (character < foldWideLetters[middle][0])
+        {
+            high = middle - 1;
+        }
+        else if (character > foldWideLetters[middle][1])
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            return FOLD_LETTER;
+        }
+    }
+    return 0;
+}
+
+int foldCase(int character)
+{
+    if (character < 0)
+    {
+        return character;
+    }
+    if (character < 0x10000)
+    {
+        return character + foldCasePages[foldCaseIndex[character >> 8]][character & 0xff];
+    }
+    for (int i = 0; i < FOLD_WIDE_CASES; i++)
+    {
+        if (character >= foldWideCases[i][0] && character <= foldWideCases[i][1])
+        {
+            return character + foldWideCases[i][2];
+        }
+    }
+    return character;
+}
+
+int foldAt(const char *text, int length, int position, char *folded)
+{
+    unsigned char c = (unsigned char)text[position];
+    if (c < 0x80)
+    {
+        folded[0] = foldAsciiCases[c];
+        return 1;
+    }
+    int character;
+    int bytes = foldDecode(text, length, position, &character);
+    if (character < 0)
+    {
+        folded[0] = (char)c;
+        return 1;
+    }
+    character = foldCase(character);
+    /* The folding is encoded in the same number of bytes. */
+    switch (bytes)
+    {
+    case 2:
+        folded[0] = (char)(0xc0 | (character >> 6));
+        folded[1] = (char)(0x80 | (character & 0x3f));
+        break;
+    case 3:
+        folded[0] = (char)(0xe0 | (character >> 12));
+        folded[1] = (char)(0x80 | ((character >> 6) & 0x3f));
+        folded[2] = (char)(0x80 | (character & 0x3f));
+        break;
+    default:
+        folded[0] = (char)(0xf0 | (character >> 18));
+        folded[1] = (char)(0x80 | ((character >> 12) & 0x3f));
+        folded[2] = (char)(0x80 | ((character >> 6) & 0x3f));
+        folded[3] = (char)(0x80 | (character & 0x3f));
+        break;
+    }
+    return bytes;
+}
@@ -0,0 +1,109 @@
+/*
+    Header for module which classifies and case folds the UTF-8
+        characters of a text, for finding words and matching terms
+        without the C library's locale-dependent calls.
+*/
+
+#include <string.h>
+
+#ifndef FOLD_H
+#define FOLD_H 1
+
+/* Class bits of a character. */
+#define FOLD_LETTER 1
+#define FOLD_SPACE 2
+
+/* Class bits of each ASCII character. */
+extern const unsigned char foldAsciiClasses[128];
+
+/* Each ASCII character folded to lowercase. */
+extern const char foldAsciiCases[128];
+
+/*
+    Decodes the UTF-8 character at position in the text of the given
+    length, setting character to it and returning how many bytes it
+    takes. A byte which doesn't start a valid character is taken on
+    its own as character -1, which is neither a letter nor a space.
+*/
+int foldDecode(const char *text, int length, int position, int *character);
+
+/* Returns the class bits of the given character. */
+int foldClass(int character);
+
+/*
+    Returns the case folding of the given character, which is encoded
+    in as many bytes as the character itself.
+*/
+int foldCase(int character);
+
+/*
+    Returns the class bits of the character at position in the text of
+    the given length, setting bytes to how many bytes it takes. ASCII
+    characters take a table lookup.
+*/
+static inline int foldClassAt(const char *text, int length, int position, int *bytes)
+{
+    unsigned char c = (unsigned char)text[position];
+    if (c < 0x80)
+    {
+        *bytes = 1;
+        return foldAsciiClasses[c];
+    }
+    int character;
+    *bytes = foldDecode(text, length, position, &character);
+    return foldClass(character);
+}
+
+/*
+    Writes the case folding of the character at position in the text
+    of the given length to folded, returning how many bytes it and the
+    character take.
+*/
+int foldAt(const char *text, int length, int position, char *folded);
+
+/* Sixteen bytes of text, checked together for ASCII. */
+typedef unsigned long long foldBlock __attribute__((vector_size(16)));
+
+/* The top bit of every byte of a word. */
+#define FOLD_HIGH_BITS 0x8080808080808080ULL
+
+/*
+    Whether the first length bytes of the text are all ASCII, checking
+    them sixteen at a time and a short text as two overlapping words.
+*/
+static inline int foldIsAscii(const char *text, int length)
+{
+    unsigned long long bits = 0;
+    if (length >= 16)
+    {
+        foldBlock blocks = {0, 0};
+        for (int position = 0; position < length - 16; position += 16)
+        {
+            foldBlock block;
+            memcpy(&block, text + position, sizeof(block));
+            blocks |= block;
+        }
+        foldBlock block;
+        memcpy(&block, text + length - 16, sizeof(block));
+        blocks |= block;
+        bits = blocks[0] | blocks[1];
+    }
+    else if (length >= 8)
+    {
+        unsigned long long first;
+        unsigned long long last;
+        memcpy(&first, text, sizeof(first));
+        memcpy(&last, text + length - 8, sizeof(last));
+        bits = first | last;
+    }
+    else
+    {
+        for (int position = 0; position < length; position++)
+        {
+            bits |= (unsigned char)text[position];
+        }
+    }
+    return (bits & FOLD_HIGH_BITS) == 0;
+}
+
+#endif
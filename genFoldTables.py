@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""
+    Writes foldTables.c, the case folding and letter tables of the fold
+    module, from the Unicode character database:
+
+        python3 genFoldTables.py UnicodeData.txt CaseFolding.txt > foldTables.c
+
+    Both files come from the same version of the database, for example
+    https://www.unicode.org/Public/14.0.0/ucd/.
+"""
+import re
+import sys
+
+LIMIT = 0x110000
+
+
+def readCategories(path):
+    """The general category of each character, from UnicodeData.txt, with
+    the simple lowercase mapping of those that have one."""
+    categories = {}
+    lowers = {}
+    first = None
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            fields = line.rstrip("\n").split(";")
+            if len(fields) < 15:
+                continue
+            code = int(fields[0], 16)
+            # Large blocks are given as a First and a Last line.
+            if fields[1].endswith(", First>"):
+                first = code
+                continue
+            if fields[1].endswith(", Last>"):
+                for c in range(first, code + 1):
+                    categories[c] = fields[2]
+                first = None
+                continue
+            categories[code] = fields[2]
+            if fields[13]:
+                lowers[code] = int(fields[13], 16)
+    return categories, lowers
+
+
+def readFoldings(path):
+    """The common and simple case foldings, from CaseFolding.txt, the
+    characters with only a full folding, and the version of the database
+    from its first line."""
+    foldings = {}
+    full = set()
+    version = None
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            if version is None:
+                match = re.match(r"#\s*CaseFolding-([0-9.]+)\.txt", line)
+                if match:
+                    version = match.group(1)
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            code, status, mapping = [x.strip() for x in line.split(";")[:3]]
+            if status in ("C", "S"):
+                foldings[int(code, 16)] = int(mapping, 16)
+            elif status == "F":
+                full.add(int(code, 16))
+    return foldings, full - set(foldings), version
+
+
+def utf8Length(code):
+    return 1 if code < 0x80 else 2 if code < 0x800 else 3 if code < 0x10000 else 4
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: genFoldTables.py UnicodeData.txt CaseFolding.txt")
+    categories, lowers = readCategories(sys.argv[1])
+    foldings, full, version = readFoldings(sys.argv[2])
+
+    def isLetter(code):
+        category = categories.get(code, "Cn")
+        return category[0] == "L" or category in ("Mn", "Mc")
+
+    def fold(code):
+        # Characters whose folding is several characters fall back to
+        # their lowercase mapping; those not listed fold to themselves.
+        if code in foldings:
+            folded = foldings[code]
+        elif code in full:
+            folded = lowers.get(code, code)
+        else:
+            folded = code
+        return folded if utf8Length(folded) == utf8Length(code) else code
+
+    out = []
+    w = out.append
+
+    def array(declaration, values, fmt):
+        w(declaration + " =\n{")
+        for i in range(0, len(values), 16):
+            w("    " + ", ".join(fmt % v for v in values[i:i + 16]) + ",")
+        w("};\n")
+
+    w("""/*
+    Case folding and letter tables for the fold module, for Unicode
+        %s.
+    Generated by
+        python3 genFoldTables.py UnicodeData.txt CaseFolding.txt > foldTables.c
+
+    Letters are the characters of the letter categories (L*) and the
+    combining marks (Mn, Mc), which carry on a word. A character folds
+    to its case folding where that is a single character (so final
+    sigma folds to sigma), otherwise to its lowercase mapping, as long
+    as that is encoded in as many UTF-8 bytes as the character itself,
+    so folding never changes the length of a text. Others, such as the
+    Kelvin sign, fold to themselves.
+
+    Characters below 0x10000 are looked up in pages of 256 by their top
+    byte, pages which are the same being shared. Others are in sorted
+    ranges.
+*/
+""" % version)
+
+    letterPages = []
+    letterIndex = []
+    casePages = []
+    caseIndex = []
+    for top in range(256):
+        bits = [0] * 8
+        for i in range(256):
+            if isLetter(top * 256 + i):
+                bits[i >> 5] |= 1 << (i & 31)
+        page = tuple(bits)
+        if page not in letterPages:
+            letterPages.append(page)
+        letterIndex.append(letterPages.index(page))
+        page = tuple(fold(top * 256 + i) - (top * 256 + i) for i in range(256))
+        if page not in casePages:
+            casePages.append(page)
+        caseIndex.append(casePages.index(page))
+
+    w("/* Number of distinct pages of letter bits. */\n#define FOLD_LETTER_PAGES %d\n" % len(letterPages))
+    w("/* Number of distinct pages of case folding offsets. */\n#define FOLD_CASE_PAGES %d\n" % len(casePages))
+    array("/* The page of letter bits for each top byte. */\n"
+          "static const unsigned char foldLetterIndex[256]", letterIndex, "%2d")
+    w("/* A bit for each character of the page, set for letters. */\n"
+      "static const unsigned int foldLetterPages[FOLD_LETTER_PAGES][8] =\n{")
+    for page in letterPages:
+        w("    {" + ", ".join("0x%08x" % v for v in page) + "},")
+    w("};\n")
+    array("/* The page of case folding offsets for each top byte. */\n"
+          "static const unsigned char foldCaseIndex[256]", caseIndex, "%2d")
+    w("/* What to add to each character of the page to fold it. */\n"
+      "static const int foldCasePages[FOLD_CASE_PAGES][256] =\n{")
+    for page in casePages:
+        w("    {")
+        for i in range(0, 256, 16):
+            w("        " + ", ".join("%d" % v for v in page[i:i + 16]) + ",")
+        w("    },")
+    w("};\n")
+
+    letters = []
+    start = None
+    for code in range(0x10000, LIMIT + 1):
+        if code < LIMIT and isLetter(code):
+            if start is None:
+                start = code
+        elif start is not None:
+            letters.append((start, code - 1))
+            start = None
+    w("/* Number of ranges of letters from 0x10000. */\n#define FOLD_WIDE_LETTERS %d\n" % len(letters))
+    w("/* The first and last character of each range of letters from 0x10000. */\n"
+      "static const int foldWideLetters[FOLD_WIDE_LETTERS][2] =\n{")
+    for i in range(0, len(letters), 4):
+        w("    " + " ".join("{0x%05x, 0x%05x}," % r for r in letters[i:i + 4]))
+    w("};\n")
+
+    cases = []
+    for code in range(0x10000, LIMIT):
+        offset = fold(code) - code
+        if offset == 0:
+            continue
+        if cases and cases[-1][1] == code - 1 and cases[-1][2] == offset:
+            cases[-1][1] = code
+        else:
+            cases.append([code, code, offset])
+    w("/* Number of ranges of characters from 0x10000 which fold to others. */\n"
+      "#define FOLD_WIDE_CASES %d\n" % len(cases))
+    w("/* The first and last character of each range and what to add to fold them. */\n"
+      "static const int foldWideCases[FOLD_WIDE_CASES][3] =\n{")
+    for i in range(0, len(cases), 3):
+        w("    " + " ".join("{0x%05x, 0x%05x, %d}," % tuple(r) for r in cases[i:i + 3]))
+    w("};")
+
+    sys.stdout.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
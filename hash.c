@@ -0,0 +1,23 @@
+/*
+    Implementation for module which contains the hashing
+        helpers shared by the table snapshot version and
+        the solution cache.
+*/
+#include "hash.h"
+
+unsigned long long hashBytes(unsigned long long hash, const void *data,
+                             size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+unsigned long long hashInt(unsigned long long hash, int value)
+{
+    return hashBytes(hash, &value, sizeof(value));
+}
@@ -0,0 +1,30 @@
+/*
+    Header for module which contains the hashing helpers
+        shared by the table snapshot version and the
+        solution cache.
+*/
+#include <stddef.h>
+
+#ifndef HASH_H
+#define HASH_H 1
+
+/* Initial value for a hash before any data has been mixed in. */
+#define HASH_SEED (14695981039346656037ULL)
+
+/* 64-bit FNV prime, each byte is mixed in as hash = (hash ^ byte) * HASH_PRIME. */
+#define HASH_PRIME (1099511628211ULL)
+
+/*
+    Mixes the given bytes into the given 64-bit FNV-1a hash
+    and returns the updated hash.
+*/
+unsigned long long hashBytes(unsigned long long hash, const void *data,
+                             size_t length);
+
+/*
+    Mixes the given integer into the given 64-bit FNV-1a hash
+    and returns the updated hash.
+*/
+unsigned long long hashInt(unsigned long long hash, int value);
+
+#endif
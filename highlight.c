@@ -0,0 +1,528 @@
+/*
+    Implementation for module which highlights text in-process.
+
+    Compiling checks the table and transition text line by line before
+    building anything from them, then builds the tables as
+    readProblemF does and packs them, with their term index and
+    compiled lattice, into one block from the caller's allocator (see
+    packTables). The parsing and indexing in between are the loader's
+    and matcher's, with their own malloc and threads. Highlighting
+    only reads them: it tokenizes with nextTerm and runs the Viterbi
+    pass with the lattice's own steps, keeping the back pointers in
+    memory from the caller's allocator, so nothing on that path
+    allocates behind the caller's back.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include "highlight.h"
+#include "problem.h"
+#include "hash.h"
+#include "loader.h"
+#include "matcher.h"
+#include "segment.h"
+#include "tokenizer.h"
+#include "lattice.h"
+#include "problemStruct.c"
+
+/* Number of spans to allocate space for initially. */
+#define INITIALSPANS 64
+
+/* The packed tables start on a multiple of this, as packTables needs. */
+#define HIGHLIGHT_ALIGN 16
+
+struct highlightTables
+{
+    struct highlightAllocator allocator;
+    /* The problem the packed tables are unpacked into, with no text. */
+    struct problem problem;
+};
+
+static void *defaultAllocate(void *context, size_t size)
+{
+    return malloc(size);
+}
+
+static void defaultRelease(void *context, void *memory)
+{
+    free(memory);
+}
+
+static const struct highlightAllocator defaultAllocator = {defaultAllocate, defaultRelease, NULL};
+
+/* Returns the given allocator, or the malloc one if it is NULL. */
+static const struct highlightAllocator *allocatorOf(const struct highlightAllocator *allocator)
+{
+    return allocator ? allocator : &defaultAllocator;
+}
+
+/* Whether a number, as strtol reads it, starts at position. */
+static int readNumber(const char *text, int length, int *position, int *value)
+{
+    int i = *position;
+    while (i < length && (text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r')))
+    {
+        i++;
+    }
+    int negative = 0;
+    if (i < length && (text[i] == '-' || text[i] == '+'))
+    {
+        negative = (text[i] == '-');
+        i++;
+    }
+    if (i >= length || text[i] < '0' || text[i] > '9')
+    {
+        return 0;
+    }
+    long long number = 0;
+    while (i < length && text[i] >= '0' && text[i] <= '9')
+    {
+        if (number <= INT_MAX)
+        {
+            number = number * 10 + (text[i] - '0');
+        }
+        i++;
+    }
+    if (number > INT_MAX)
+    {
+        number = INT_MAX;
+    }
+    *value = (int)(negative ? -number : number);
+    *position = i;
+    return 1;
+}
+
+/* Skips whitespace at position, as the " " of a scanf format does. */
+static int skipSpace(const char *text, int length, int position)
+{
+    while (position < length && (text[position] == ' ' ||
+                                 (text[position] >= '\t' && text[position] <= '\r')))
+    {
+        position++;
+    }
+    return position;
+}
+
+/*
+    Whether every line of the given table text is term,colour,score
+    as the loader reads them, with a colour it can take.
+*/
+static int checkTableText(const char *text, int length)
+{
+    int position = 0;
+    while (position < length)
+    {
+        int termEnd = position;
+        while (termEnd < length && text[termEnd] != ',' && text[termEnd] != '\0')
+        {
+            termEnd++;
+        }
+        if (termEnd == position || termEnd >= length || text[termEnd] != ',')
+        {
+            return 0;
+        }
+        position = termEnd + 1;
+        int colour;
+        int score;
+        if (!readNumber(text, length, &position, &colour) || position >= length ||
+            text[position] != ',')
+        {
+            return 0;
+        }
+        position++;
+        if (!readNumber(text, length, &position, &score))
+        {
+            return 0;
+        }
+        if (colour < 0 || colour >= HIGHLIGHT_MAX_COLOURS)
+        {
+            return 0;
+        }
+        position = skipSpace(text, length, position);
+    }
+    return 1;
+}
+
+/*
+    Reads the transition text into the given table, with arrays from
+    the given allocator, or leaves it empty and returns a status.
+*/
+static int readTransitionText(const char *text, int length, const struct highlightAllocator *a,
+                              struct colourTransitionTable *ctt)
+{
+    ctt->transitionCount = 0;
+    ctt->prevColours = NULL;
+    ctt->colours = NULL;
+    ctt->scores = NULL;
+    /* Count the lines first so the arrays are allocated once. */
+    int count = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int position = skipSpace(text, length, 0);
+        int transition = 0;
+        while (position < length)
+        {
+            int values[3];
+            for (int i = 0; i < 3; i++)
+            {
+                if (!readNumber(text, length, &position, &(values[i])) ||
+                    (i < 2 && (position >= length || text[position++] != ',')))
+                {
+                    return HIGHLIGHT_BAD_TRANSITIONS;
+                }
+            }
+            if (values[0] < 0 || values[0] >= HIGHLIGHT_MAX_COLOURS || values[1] < 0 ||
+                values[1] >= HIGHLIGHT_MAX_COLOURS)
+            {
+                return HIGHLIGHT_BAD_TRANSITIONS;
+            }
+            if (pass == 1)
+            {
+                ctt->prevColours[transition] = values[0];
+                ctt->colours[transition] = values[1];
+                ctt->scores[transition] = values[2];
+            }
+            transition++;
+            position = skipSpace(text, length, position);
+        }
+        if (pass == 0)
+        {
+            count = transition;
+            if (count == 0)
+            {
+                break;
+            }
+            size_t size = sizeof(int) * count;
+            ctt->prevColours = (int *)a->allocate(a->context, size);
+            ctt->colours = (int *)a->allocate(a->context, size);
+            ctt->scores = (int *)a->allocate(a->context, size);
+            if (!ctt->prevColours || !ctt->colours || !ctt->scores)
+            {
+                a->release(a->context, ctt->prevColours);
+                a->release(a->context, ctt->colours);
+                a->release(a->context, ctt->scores);
+                return HIGHLIGHT_NO_MEMORY;
+            }
+        }
+    }
+    ctt->transitionCount = count;
+    return HIGHLIGHT_OK;
+}
+
+/* Frees tables read by the loader. */
+static void freeLoadedTables(struct termColourTable *tables, int tableCount)
+{
+    for (int i = 0; i < tableCount; i++)
+    {
+        free(tables[i].term);
+        free(tables[i].colours);
+        free(tables[i].scores);
+    }
+    free(tables);
+}
+
+int highlightCompile(const char *tableText, size_t tableLength, const char *transitionText,
+                     size_t transitionLength, const struct highlightAllocator *allocator,
+                     struct highlightTables **tables)
+{
+    const struct highlightAllocator *a = allocatorOf(allocator);
+    if (!tableText || !tables || tableLength >= INT_MAX || transitionLength >= INT_MAX)
+    {
+        return HIGHLIGHT_BAD_ARGUMENT;
+    }
+    *tables = NULL;
+    if (!checkTableText(tableText, (int)tableLength))
+    {
+        return HIGHLIGHT_BAD_TABLE;
+    }
+    struct colourTransitionTable ctt;
+    if (transitionText)
+    {
+        int status = readTransitionText(transitionText, (int)transitionLength, a, &ctt);
+        if (status != HIGHLIGHT_OK)
+        {
+            return status;
+        }
+    }
+
+    /* The loader reads up to a null byte. */
+    char *text = (char *)a->allocate(a->context, tableLength + 1);
+    if (!text)
+    {
+        if (transitionText)
+        {
+            a->release(a->context, ctt.prevColours);
+            a->release(a->context, ctt.colours);
+            a->release(a->context, ctt.scores);
+        }
+        return HIGHLIGHT_NO_MEMORY;
+    }
+    memcpy(text, tableText, tableLength);
+    text[tableLength] = '\0';
+
+    struct problem loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    int threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    loaded.termColourTableCount = parseColourTables(text, (int)tableLength, threadCount,
+                                                    &(loaded.colourTables));
+    a->release(a->context, text);
+    loaded.matcher = newTermMatcher(loaded.colourTables, loaded.termColourTableCount,
+                                    threadCount);
+    if (!loaded.matcher)
+    {
+        freeLoadedTables(loaded.colourTables, loaded.termColourTableCount);
+        if (transitionText)
+        {
+            a->release(a->context, ctt.prevColours);
+            a->release(a->context, ctt.colours);
+            a->release(a->context, ctt.scores);
+        }
+        return HIGHLIGHT_BAD_PATTERNS;
+    }
+    loaded.colourTransitionTable = transitionText ? &ctt : NULL;
+    loaded.tableVersion = hashBytes(HASH_SEED, tableText, tableLength);
+    if (transitionText)
+    {
+        loaded.tableVersion = hashBytes(loaded.tableVersion, transitionText, transitionLength);
+    }
+
+    /* One block, the tables struct then the packed tables. */
+    size_t headerSize = (sizeof(struct highlightTables) + HIGHLIGHT_ALIGN - 1) /
+                        HIGHLIGHT_ALIGN * HIGHLIGHT_ALIGN;
+    size_t packedSize = packTables(&loaded, NULL, 0);
+    char *block = (char *)a->allocate(a->context, headerSize + packedSize + HIGHLIGHT_ALIGN);
+    int status = HIGHLIGHT_NO_MEMORY;
+    if (block)
+    {
+        char *packed = block + headerSize;
+        packed += (HIGHLIGHT_ALIGN - (uintptr_t)packed % HIGHLIGHT_ALIGN) % HIGHLIGHT_ALIGN;
+        packTables(&loaded, packed, (uintptr_t)packed);
+        struct highlightTables *t = (struct highlightTables *)block;
+        t->allocator = *a;
+        memset(&(t->problem), 0, sizeof(t->problem));
+        unpackTables(&(t->problem), packed);
+        t->problem.part = PART_F;
+        *tables = t;
+        status = HIGHLIGHT_OK;
+    }
+
+    freeTermMatcher(loaded.matcher);
+    freeLoadedTables(loaded.colourTables, loaded.termColourTableCount);
+    if (transitionText)
+    {
+        a->release(a->context, ctt.prevColours);
+        a->release(a->context, ctt.colours);
+        a->release(a->context, ctt.scores);
+    }
+    return status;
+}
+
+int highlightText(const struct highlightTables *tables, const char *text, size_t textLength,
+                  const struct highlightAllocator *allocator, struct highlightResult *result)
+{
+    const struct highlightAllocator *a = allocatorOf(allocator);
+    if (!tables || !result || (!text && textLength > 0) || textLength >= INT_MAX)
+    {
+        return HIGHLIGHT_BAD_ARGUMENT;
+    }
+    memset(result, 0, sizeof(struct highlightResult));
+    /* Only read, nextTerm and the lattice steps just don't say so. */
+    struct problem *p = (struct problem *)&(tables->problem);
+    struct lattice *l = p->compiledLattice;
+    int length = (int)textLength;
+
+    int spanCount = 0;
+    int allocatedSpans = 0;
+    struct termSpan *spans = NULL;
+    struct termSpan span;
+    int progress = 0;
+    while (nextTerm(p, text, length, progress, &span))
+    {
+        if (spanCount >= allocatedSpans)
+        {
+            int allocated = (allocatedSpans == 0) ? INITIALSPANS : allocatedSpans * 2;
+            struct termSpan *grown = (struct termSpan *)a->allocate(
+                a->context, sizeof(struct termSpan) * allocated);
+            if (!grown)
+            {
+                a->release(a->context, spans);
+                return HIGHLIGHT_NO_MEMORY;
+            }
+            if (spans)
+            {
+                memcpy(grown, spans, sizeof(struct termSpan) * spanCount);
+                a->release(a->context, spans);
+            }
+            spans = grown;
+            allocatedSpans = allocated;
+        }
+        spans[spanCount] = span;
+        spanCount++;
+        progress = span.end;
+    }
+    if (spanCount == 0)
+    {
+        return HIGHLIGHT_OK;
+    }
+
+    /* The result's arrays, one allocation released through starts. */
+    int *arrays = (int *)a->allocate(a->context, sizeof(int) * 4 * spanCount);
+    int colourCount = l->colourCount;
+    int *scores = (int *)a->allocate(a->context, sizeof(int) * 2 * colourCount);
+    int *back = (int *)a->allocate(a->context, sizeof(int) * colourCount * spanCount);
+    if (!arrays || !scores || !back)
+    {
+        a->release(a->context, arrays);
+        a->release(a->context, scores);
+        a->release(a->context, back);
+        a->release(a->context, spans);
+        return HIGHLIGHT_NO_MEMORY;
+    }
+    result->termCount = spanCount;
+    result->starts = arrays;
+    result->ends = arrays + spanCount;
+    result->tables = arrays + 2 * spanCount;
+    result->colours = arrays + 3 * spanCount;
+    for (int i = 0; i < spanCount; i++)
+    {
+        result->starts[i] = spans[i].start;
+        result->ends[i] = spans[i].end;
+        result->tables[i] = spans[i].table;
+    }
+    a->release(a->context, spans);
+
+    /* Viterbi pass, ties broken as latticeSolve does. */
+    int *prevScores = scores;
+    int *nextScores = scores + colourCount;
+    latticeStart(l, result->tables[0], prevScores);
+    for (int i = 1; i < spanCount; i++)
+    {
+        latticeForwardStep(l, prevScores, result->tables[i], nextScores,
+                           back + (size_t)i * colourCount);
+        int *swap = prevScores;
+        prevScores = nextScores;
+        nextScores = swap;
+    }
+    int colour = latticeBestColour(l, prevScores);
+    result->score = prevScores[colour];
+    for (int i = spanCount - 1; i >= 0; i--)
+    {
+        result->colours[i] = colour;
+        if (i > 0)
+        {
+            colour = back[(size_t)i * colourCount + colour];
+        }
+    }
+    a->release(a->context, back);
+    a->release(a->context, scores);
+    return HIGHLIGHT_OK;
+}
+
+/* Formats term i of the result, as outputProblem prints it. */
+static int formatResultTerm(const struct highlightTables *tables, const char *text,
+                            const struct highlightResult *result, int i, int colourMode,
+                            char *buffer, size_t size)
+{
+    const char *term = text + result->starts[i];
+    int termLength = result->ends[i] - result->starts[i];
+    if (result->tables[i] >= 0 && !tables->problem.colourTables[result->tables[i]].pattern)
+    {
+        term = tables->problem.colourTables[result->tables[i]].term;
+        termLength = strlen(term);
+    }
+    return formatTerm(buffer, size, i, term, termLength, result->colours[i], colourMode);
+}
+
+int highlightRender(const struct highlightTables *tables, const char *text, size_t textLength,
+                    const struct highlightResult *result, int colourMode,
+                    const struct highlightAllocator *allocator, char **output,
+                    size_t *outputLength)
+{
+    const struct highlightAllocator *a = allocatorOf(allocator);
+    if (!tables || !result || !output || !outputLength || (!text && textLength > 0) ||
+        textLength >= INT_MAX)
+    {
+        return HIGHLIGHT_BAD_ARGUMENT;
+    }
+    if (colourMode >= COLOUR_MODE_SPANS)
+    {
+        size_t length = formatSpans(NULL, text, (int)textLength, result->termCount,
+                                    result->starts, result->ends, result->colours,
+                                    colourMode);
+        char *buffer = (char *)a->allocate(a->context, length + 1);
+        if (!buffer)
+        {
+            return HIGHLIGHT_NO_MEMORY;
+        }
+        formatSpans(buffer, text, (int)textLength, result->termCount, result->starts,
+                    result->ends, result->colours, colourMode);
+        buffer[length] = '\0';
+        *output = buffer;
+        *outputLength = length;
+        return HIGHLIGHT_OK;
+    }
+    /* Measure, then write each term straight into place. */
+    size_t length = 0;
+    for (int i = 0; i < result->termCount; i++)
+    {
+        length += formatResultTerm(tables, text, result, i, colourMode, NULL, 0);
+    }
+    char *buffer = (char *)a->allocate(a->context, length + 2);
+    if (!buffer)
+    {
+        return HIGHLIGHT_NO_MEMORY;
+    }
+    size_t written = 0;
+    for (int i = 0; i < result->termCount; i++)
+    {
+        written += formatResultTerm(tables, text, result, i, colourMode, buffer + written,
+                                    length + 2 - written);
+    }
+    buffer[written] = '\n';
+    buffer[written + 1] = '\0';
+    *output = buffer;
+    *outputLength = written + 1;
+    return HIGHLIGHT_OK;
+}
+
+void highlightFreeResult(const struct highlightAllocator *allocator,
+                         struct highlightResult *result)
+{
+    if (result)
+    {
+        const struct highlightAllocator *a = allocatorOf(allocator);
+        a->release(a->context, result->starts);
+        memset(result, 0, sizeof(struct highlightResult));
+    }
+}
+
+void highlightFreeTables(struct highlightTables *tables)
+{
+    if (tables)
+    {
+        struct highlightAllocator a = tables->allocator;
+        a.release(a.context, tables);
+    }
+}
+
+const char *highlightStatusString(int status)
+{
+    switch (status)
+    {
+    case HIGHLIGHT_OK:
+        return "success";
+    case HIGHLIGHT_NO_MEMORY:
+        return "out of memory";
+    case HIGHLIGHT_BAD_ARGUMENT:
+        return "bad argument";
+    case HIGHLIGHT_BAD_TABLE:
+        return "table line is not term,colour,score";
+    case HIGHLIGHT_BAD_TRANSITIONS:
+        return "transition line is not colour,colour,score";
+    case HIGHLIGHT_BAD_PATTERNS:
+        return "table patterns need too many states";
+    }
+    return "unknown status";
+}
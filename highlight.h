@@ -0,0 +1,119 @@
+/*
+    Header for module which highlights text in-process, for services
+        which can't run a program per text. Tables and texts are
+        memory buffers, failures are returned as status codes rather
+        than printed or asserted, memory comes from the caller's
+        allocator, and compiled tables are never written after
+        highlightCompile returns, so any number of threads can
+        highlight with the same tables at once. The exception is
+        highlightCompile's scratch: it parses and indexes the tables
+        with the loader and matcher, which use malloc and threads of
+        their own and assert if either fails.
+*/
+#include <stddef.h>
+
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H 1
+
+/* What a call to the library returns. */
+enum highlightStatus
+{
+    HIGHLIGHT_OK = 0,
+    /* The allocator returned NULL. */
+    HIGHLIGHT_NO_MEMORY = 1,
+    /* A required pointer was NULL or a buffer was over 2GB. */
+    HIGHLIGHT_BAD_ARGUMENT = 2,
+    /* The table text has a line which isn't term,colour,score. */
+    HIGHLIGHT_BAD_TABLE = 3,
+    /* The transition text has a line which isn't colour,colour,score. */
+    HIGHLIGHT_BAD_TRANSITIONS = 4,
+    /* The table has patterns too tangled to compile into one DFA. */
+    HIGHLIGHT_BAD_PATTERNS = 5
+};
+
+/* Tables or transitions with a colour at or above this are bad. */
+#define HIGHLIGHT_MAX_COLOURS 1024
+
+struct highlightAllocator
+{
+    /* Returns size bytes aligned for any type, or NULL if there's no room. */
+    void *(*allocate)(void *context, size_t size);
+    /* Gives back memory from allocate, NULL is ignored. */
+    void (*release)(void *context, void *memory);
+    /* Passed to both, e.g. an arena. */
+    void *context;
+};
+
+struct highlightTables;
+
+struct highlightResult
+{
+    int termCount;
+    /* Offset of the first character of each term in the text. */
+    int *starts;
+    /* Offset one past the last character of each term. */
+    int *ends;
+    /* The index of each term's table, or -1 for a word without one. */
+    int *tables;
+    /* The best colour of each term. */
+    int *colours;
+    /* The score of the colouring. */
+    int score;
+};
+
+/*
+    Compiles the given table text, lines of term,colour,score as in
+    the table files, and transition text, lines of
+    prevColour,colour,score (or NULL for none), into tables set to
+    tables. Memory for them comes from the given allocator, or malloc
+    if it is NULL, in a single block. The tables are parsed and indexed
+    on the way with malloc and a thread per processor, which assert
+    rather than return HIGHLIGHT_NO_MEMORY if they fail. Returns
+    HIGHLIGHT_OK, or the reason no tables were compiled.
+*/
+int highlightCompile(const char *tableText, size_t tableLength, const char *transitionText,
+                     size_t transitionLength, const struct highlightAllocator *allocator,
+                     struct highlightTables **tables);
+
+/*
+    Splits the given text of textLength bytes into terms with the given
+    tables and finds their best colouring as problem2f does, filling in
+    result. Memory for the result comes from the given allocator, or
+    malloc if it is NULL. Returns HIGHLIGHT_OK, or the reason there is
+    no result.
+*/
+int highlightText(const struct highlightTables *tables, const char *text, size_t textLength,
+                  const struct highlightAllocator *allocator, struct highlightResult *result);
+
+/*
+    Sets output to the given result for the given text of textLength
+    bytes written out as problem2f prints it, the colours, (if
+    colourMode is 1) the highlighted terms, or (if it is
+    COLOUR_MODE_SPANS or COLOUR_MODE_HTML of problem.h) the text with
+    runs of a colour in spans, ending in a newline, with a null byte
+    after, and outputLength to its length without the null byte. Output is
+    released with the allocator it came from. Returns HIGHLIGHT_OK, or
+    the reason there is no output.
+*/
+int highlightRender(const struct highlightTables *tables, const char *text, size_t textLength,
+                    const struct highlightResult *result, int colourMode,
+                    const struct highlightAllocator *allocator, char **output,
+                    size_t *outputLength);
+
+/*
+    Gives back the memory of the given result to the allocator it came
+    from, leaving it with no terms.
+*/
+void highlightFreeResult(const struct highlightAllocator *allocator,
+                         struct highlightResult *result);
+
+/*
+    Gives back the memory of the given tables to the allocator they
+    were compiled with. No thread may be using them.
+*/
+void highlightFreeTables(struct highlightTables *tables);
+
+/* Returns a description of the given status. */
+const char *highlightStatusString(int status);
+
+#endif
@@ -0,0 +1,545 @@
+/*
+    Implementation for module which re-solves Part F problems
+        incrementally after local text edits.
+
+    The forward lattice holds, for each token and colour, the best
+    score of the text up to and including that token, the backward
+    lattice the best score of the text after it. An edit invalidates
+    forward rows from the first affected token and backward rows up
+    to the last, so re-solving extends each lattice across the edited
+    rows and joins them there.
+
+    The text is kept in a gap buffer, and the terms with their lattice
+    rows in another, so an edit only moves what lies between it and
+    the last one. Terms after the gap keep their offsets from the end
+    of the text, which an edit before them leaves as they were.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "incremental.h"
+#include "lattice.h"
+#include "tokenizer.h"
+#include "vocabulary.h"
+#include "problemStruct.c"
+#include "solutionStruct.c"
+
+/* A term of the text, as the problem holds it across its arrays. */
+struct incrementalTerm
+{
+    char *term;
+    uint32_t id;
+    int table;
+    /* Offsets of the term in the text, from its end for terms after the gap. */
+    int start;
+    int end;
+};
+
+struct incrementalSolver
+{
+    struct problem *p;
+    struct lattice *l;
+    /* The number of characters after a term's start it depends on. */
+    int lookahead;
+    /* The text, with textGapLength unused bytes at offset textGap, then a '\0'. */
+    char *text;
+    int textLength;
+    int textGap;
+    int textGapLength;
+    /* The terms, with termGapLength unused before term termGap. */
+    struct incrementalTerm *terms;
+    int termCount;
+    int termGap;
+    int termGapLength;
+    /* Forward scores and the previous colour giving them, a row for each term's slot. */
+    int *forward;
+    int *back;
+    /* Backward scores and the next colour giving them. */
+    int *backward;
+    int *next;
+    /* Rows [0, forwardValid) of forward and [backwardValid, termCount) of backward are current. */
+    int forwardValid;
+    int backwardValid;
+    /* The first term of the last edit, where the lattices are best joined. */
+    int editRow;
+    /* The row the lattices were last joined at and its best colour. */
+    int joinRow;
+    int joinColour;
+    int score;
+    long rowsComputed;
+};
+
+/* Returns the slot term i is kept in, past the gap for terms after it. */
+static int termSlot(const struct incrementalSolver *s, int i)
+{
+    return (i < s->termGap) ? i : i + s->termGapLength;
+}
+
+static int termStart(const struct incrementalSolver *s, int i)
+{
+    int start = s->terms[termSlot(s, i)].start;
+    return (i < s->termGap) ? start : start + s->textLength;
+}
+
+static int termEnd(const struct incrementalSolver *s, int i)
+{
+    int end = s->terms[termSlot(s, i)].end;
+    return (i < s->termGap) ? end : end + s->textLength;
+}
+
+static int termTable(const struct incrementalSolver *s, int i)
+{
+    return s->terms[termSlot(s, i)].table;
+}
+
+/* Returns the row of the given lattice array for term i. */
+static int *termRow(const struct incrementalSolver *s, int *rows, int i)
+{
+    return rows + (size_t)termSlot(s, i) * s->l->colourCount;
+}
+
+/* Moves slots [from, from + count) of the terms and each lattice array to start at slot to. */
+static void moveSlots(struct incrementalSolver *s, int from, int to, int count)
+{
+    size_t rowSize = sizeof(int) * s->l->colourCount;
+    int *arrays[] = {s->forward, s->back, s->backward, s->next};
+    memmove(s->terms + to, s->terms + from, sizeof(struct incrementalTerm) * count);
+    for (int a = 0; a < 4; a++)
+    {
+        memmove((char *)arrays[a] + rowSize * to, (char *)arrays[a] + rowSize * from,
+                rowSize * count);
+    }
+}
+
+/* Moves the terms' gap to before term i, taking the offsets of those after it from the end. */
+static void moveTermGap(struct incrementalSolver *s, int i)
+{
+    if (i < s->termGap)
+    {
+        int count = s->termGap - i;
+        moveSlots(s, i, i + s->termGapLength, count);
+        for (int j = i + s->termGapLength; j < s->termGap + s->termGapLength; j++)
+        {
+            s->terms[j].start -= s->textLength;
+            s->terms[j].end -= s->textLength;
+        }
+    }
+    else if (i > s->termGap)
+    {
+        int count = i - s->termGap;
+        moveSlots(s, s->termGap + s->termGapLength, s->termGap, count);
+        for (int j = s->termGap; j < i; j++)
+        {
+            s->terms[j].start += s->textLength;
+            s->terms[j].end += s->textLength;
+        }
+    }
+    s->termGap = i;
+}
+
+/* Makes room for the given number of terms, keeping the gap where it is. */
+static void reserveTerms(struct incrementalSolver *s, int termCount)
+{
+    int capacity = s->termCount + s->termGapLength;
+    if (termCount <= capacity)
+    {
+        return;
+    }
+    int grown = 2 * termCount;
+    size_t rowSize = sizeof(int) * s->l->colourCount;
+    s->terms = (struct incrementalTerm *)realloc(s->terms, sizeof(struct incrementalTerm) * grown);
+    assert(s->terms);
+    s->forward = (int *)realloc(s->forward, rowSize * grown);
+    assert(s->forward);
+    s->back = (int *)realloc(s->back, rowSize * grown);
+    assert(s->back);
+    s->backward = (int *)realloc(s->backward, rowSize * grown);
+    assert(s->backward);
+    s->next = (int *)realloc(s->next, rowSize * grown);
+    assert(s->next);
+    int after = s->termCount - s->termGap;
+    moveSlots(s, capacity - after, grown - after, after);
+    s->termGapLength += grown - capacity;
+}
+
+/* Moves the text's gap to the given offset. */
+static void moveTextGap(struct incrementalSolver *s, int offset)
+{
+    if (offset < s->textGap)
+    {
+        memmove(s->text + offset + s->textGapLength, s->text + offset, s->textGap - offset);
+    }
+    else
+    {
+        memmove(s->text + s->textGap, s->text + s->textGap + s->textGapLength,
+                offset - s->textGap);
+    }
+    s->textGap = offset;
+}
+
+/* Makes room for the given number of characters, keeping the gap where it is. */
+static void reserveText(struct incrementalSolver *s, int textLength)
+{
+    int capacity = s->textLength + s->textGapLength;
+    if (textLength <= capacity)
+    {
+        return;
+    }
+    int grown = 2 * textLength;
+    s->text = (char *)realloc(s->text, grown + 1);
+    assert(s->text);
+    int after = s->textLength - s->textGap;
+    /* The '\0' moves with the text after the gap. */
+    memmove(s->text + grown - after, s->text + capacity - after, after + 1);
+    s->textGapLength += grown - capacity;
+}
+
+struct incrementalSolver *newIncrementalSolver(struct problem *p)
+{
+    struct incrementalSolver *s = (struct incrementalSolver *)malloc(sizeof(struct incrementalSolver));
+    assert(s);
+    s->p = p;
+    s->l = newLattice(p);
+    s->lookahead = termLookahead(p);
+    s->textLength = strlen(p->text);
+    s->text = strdup(p->text);
+    assert(s->text);
+    s->textGap = s->textLength;
+    s->textGapLength = 0;
+    int capacity = (p->termCount > 0) ? p->termCount : 1;
+    size_t rowSize = sizeof(int) * s->l->colourCount;
+    s->terms = (struct incrementalTerm *)malloc(sizeof(struct incrementalTerm) * capacity);
+    assert(s->terms);
+    s->forward = (int *)malloc(rowSize * capacity);
+    assert(s->forward);
+    s->back = (int *)malloc(rowSize * capacity);
+    assert(s->back);
+    s->backward = (int *)malloc(rowSize * capacity);
+    assert(s->backward);
+    s->next = (int *)malloc(rowSize * capacity);
+    assert(s->next);
+    for (int i = 0; i < p->termCount; i++)
+    {
+        s->terms[i].term = p->terms[i];
+        s->terms[i].id = p->termIds[i];
+        s->terms[i].table = p->termTables[i];
+        s->terms[i].start = p->termStarts[i];
+        s->terms[i].end = p->termEnds[i];
+    }
+    s->termCount = p->termCount;
+    s->termGap = p->termCount;
+    s->termGapLength = capacity - p->termCount;
+    s->forwardValid = 0;
+    s->backwardValid = p->termCount;
+    s->editRow = 0;
+    s->joinRow = -1;
+    s->joinColour = 0;
+    s->score = 0;
+    s->rowsComputed = 0;
+    return s;
+}
+
+void incrementalEdit(struct incrementalSolver *s, int start, int length,
+                     const char *replacement)
+{
+    struct problem *p = s->p;
+    assert(start >= 0 && length >= 0 && start + length <= s->textLength);
+    int replacementLength = strlen(replacement);
+
+    /*
+        The first term which looked at any character from the edit
+        onwards, found by bisection as the last character a term looks
+        at only grows along the text.
+    */
+    int first = 0;
+    int last = s->termCount;
+    while (first < last)
+    {
+        int middle = first + (last - first) / 2;
+        int examined = termEnd(s, middle) + 1;
+        if (termStart(s, middle) + s->lookahead > examined)
+        {
+            examined = termStart(s, middle) + s->lookahead;
+        }
+        if (examined > start)
+        {
+            last = middle;
+        }
+        else
+        {
+            first = middle + 1;
+        }
+    }
+
+    /* Terms from there on are kept from the end of the text, so move with the edit. */
+    moveTermGap(s, first);
+
+    /* Splice the replacement into the text. */
+    moveTextGap(s, start);
+    s->textGapLength += length;
+    s->textLength -= length;
+    reserveText(s, s->textLength + replacementLength);
+    memcpy(s->text + s->textGap, replacement, replacementLength);
+    s->textGap += replacementLength;
+    s->textGapLength -= replacementLength;
+    s->textLength += replacementLength;
+
+    /*
+        Re-tokenize from the end of the last unaffected term, with the
+        text from there on in one piece after the gap, until a term
+        starts on an old term's start past the edit, after which the
+        old terms are unchanged.
+    */
+    int progress = (first > 0) ? termEnd(s, first - 1) : 0;
+    moveTextGap(s, progress);
+    /* Offsets from progress on index the text after the gap. */
+    const char *text = s->text + s->textGapLength;
+    int capacity = 16;
+    int newCount = 0;
+    struct termSpan *spans = (struct termSpan *)malloc(sizeof(struct termSpan) * capacity);
+    assert(spans);
+    int resume = s->termCount;
+    int old = first;
+    struct termSpan span;
+    while (nextTerm(p, text, s->textLength, progress, &span))
+    {
+        if (span.start >= start + replacementLength)
+        {
+            while (old < s->termCount && termStart(s, old) < span.start)
+            {
+                old++;
+            }
+            if (old < s->termCount && termStart(s, old) == span.start &&
+                termStart(s, old) >= start + replacementLength)
+            {
+                resume = old;
+                break;
+            }
+        }
+        if (newCount == capacity)
+        {
+            capacity *= 2;
+            spans = (struct termSpan *)realloc(spans, sizeof(struct termSpan) * capacity);
+            assert(spans);
+        }
+        spans[newCount] = span;
+        newCount++;
+        progress = span.end;
+    }
+
+    /*
+        The replaced terms are dropped from after the gap and the new
+        ones added before it, leaving the still-current backward rows
+        in the slots of their terms.
+    */
+    int termCount = s->termCount - (resume - first) + newCount;
+    s->termGapLength += resume - first;
+    s->termCount -= resume - first;
+    reserveTerms(s, termCount);
+    /* Replaced words stay in the vocabulary, which only grows. */
+    for (int i = 0; i < newCount; i++)
+    {
+        struct incrementalTerm *term = &(s->terms[s->termGap + i]);
+        const char *spelling;
+        term->id = vocabularyIntern(p->vocabulary, text + spans[i].start,
+                                    spans[i].end - spans[i].start, &spelling);
+        term->term = termStringOwned(p, spans[i].table) ? (char *)spelling
+                                                        : p->colourTables[spans[i].table].term;
+        term->table = spans[i].table;
+        term->start = spans[i].start;
+        term->end = spans[i].end;
+    }
+    s->termGap += newCount;
+    s->termGapLength -= newCount;
+    s->termCount = termCount;
+    free(spans);
+
+    if (s->forwardValid > first)
+    {
+        s->forwardValid = first;
+    }
+    if (s->backwardValid < resume)
+    {
+        s->backwardValid = resume;
+    }
+    s->backwardValid += newCount - (resume - first);
+    s->editRow = first;
+    s->joinRow = -1;
+}
+
+struct problem *incrementalProblem(struct incrementalSolver *s)
+{
+    struct problem *p = s->p;
+    p->text = (char *)realloc(p->text, s->textLength + 1);
+    assert(p->text);
+    memcpy(p->text, s->text, s->textGap);
+    memcpy(p->text + s->textGap, s->text + s->textGap + s->textGapLength,
+           s->textLength - s->textGap + 1);
+    int allocCount = (s->termCount > 0) ? s->termCount : 1;
+    p->terms = (char **)realloc(p->terms, sizeof(char *) * allocCount);
+    assert(p->terms);
+    p->termIds = (uint32_t *)realloc(p->termIds, sizeof(uint32_t) * allocCount);
+    assert(p->termIds);
+    p->termTables = (int *)realloc(p->termTables, sizeof(int) * allocCount);
+    assert(p->termTables);
+    p->termStarts = (int *)realloc(p->termStarts, sizeof(int) * allocCount);
+    assert(p->termStarts);
+    p->termEnds = (int *)realloc(p->termEnds, sizeof(int) * allocCount);
+    assert(p->termEnds);
+    for (int i = 0; i < s->termCount; i++)
+    {
+        struct incrementalTerm *term = &(s->terms[termSlot(s, i)]);
+        p->terms[i] = term->term;
+        p->termIds[i] = term->id;
+        p->termTables[i] = term->table;
+        p->termStarts[i] = termStart(s, i);
+        p->termEnds[i] = termEnd(s, i);
+    }
+    p->termCount = s->termCount;
+    return p;
+}
+
+/* Extends the lattices until both are current at a common row and joins them. */
+static void join(struct incrementalSolver *s)
+{
+    struct lattice *l = s->l;
+    int colourCount = l->colourCount;
+    int termCount = s->termCount;
+    if (s->joinRow >= 0 || termCount == 0)
+    {
+        if (termCount == 0)
+        {
+            s->score = 0;
+        }
+        return;
+    }
+
+    /*
+        Any row from the last current forward row to the first current
+        backward one (or between them, where the lattices overlap)
+        costs the same to join at, so join at the edit, leaving both
+        lattices current up to it for the next edit nearby.
+    */
+    int low = s->forwardValid - 1;
+    int high = s->backwardValid;
+    if (high < low)
+    {
+        low = s->backwardValid;
+        high = s->forwardValid - 1;
+    }
+    int row = (s->editRow < low) ? low : (s->editRow > high) ? high : s->editRow;
+    if (row < 0)
+    {
+        row = 0;
+    }
+    if (row >= termCount)
+    {
+        row = termCount - 1;
+    }
+    while (s->forwardValid <= row)
+    {
+        int i = s->forwardValid;
+        if (i == 0)
+        {
+            latticeStart(l, termTable(s, 0), termRow(s, s->forward, 0));
+        }
+        else
+        {
+            latticeForwardStep(l, termRow(s, s->forward, i - 1), termTable(s, i),
+                               termRow(s, s->forward, i), termRow(s, s->back, i));
+        }
+        s->forwardValid++;
+        s->rowsComputed++;
+    }
+    while (s->backwardValid > row)
+    {
+        int i = s->backwardValid - 1;
+        if (i == termCount - 1)
+        {
+            int *backward = termRow(s, s->backward, i);
+            for (int j = 0; j < colourCount; j++)
+            {
+                backward[j] = 0;
+            }
+        }
+        else
+        {
+            latticeBackwardStep(l, termRow(s, s->backward, i + 1), termTable(s, i + 1),
+                                termRow(s, s->backward, i), termRow(s, s->next, i));
+        }
+        s->backwardValid--;
+        s->rowsComputed++;
+    }
+
+    int *forward = termRow(s, s->forward, row);
+    int *backward = termRow(s, s->backward, row);
+    int bestColour = 0;
+    int best = forward[0] + backward[0];
+    for (int j = 1; j < colourCount; j++)
+    {
+        if (forward[j] != LATTICE_NONALLOWED && forward[j] + backward[j] > best)
+        {
+            best = forward[j] + backward[j];
+            bestColour = j;
+        }
+    }
+    s->joinRow = row;
+    s->joinColour = bestColour;
+    s->score = best;
+}
+
+int incrementalScore(struct incrementalSolver *s)
+{
+    join(s);
+    return s->score;
+}
+
+struct solution *incrementalSolution(struct incrementalSolver *s)
+{
+    join(s);
+    int termCount = s->termCount;
+    struct solution *solution = (struct solution *)malloc(sizeof(struct solution));
+    assert(solution);
+    solution->termCount = termCount;
+    solution->termColours = (int *)malloc(sizeof(int) * (termCount > 0 ? termCount : 1));
+    assert(solution->termColours);
+    solution->score = s->score;
+    if (termCount == 0)
+    {
+        return solution;
+    }
+    int colour = s->joinColour;
+    solution->termColours[s->joinRow] = colour;
+    for (int i = s->joinRow; i > 0; i--)
+    {
+        colour = termRow(s, s->back, i)[colour];
+        solution->termColours[i - 1] = colour;
+    }
+    colour = s->joinColour;
+    for (int i = s->joinRow; i < termCount - 1; i++)
+    {
+        colour = termRow(s, s->next, i)[colour];
+        solution->termColours[i + 1] = colour;
+    }
+    return solution;
+}
+
+long incrementalRowsComputed(struct incrementalSolver *s)
+{
+    return s->rowsComputed;
+}
+
+void freeIncrementalSolver(struct incrementalSolver *s)
+{
+    if (s)
+    {
+        freeLattice(s->l);
+        free(s->text);
+        free(s->terms);
+        free(s->forward);
+        free(s->back);
+        free(s->backward);
+        free(s->next);
+        free(s);
+    }
+}
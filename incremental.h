@@ -0,0 +1,60 @@
+/*
+    Header for module which keeps the forward and backward Viterbi
+        lattices of a Part F problem so that local edits to the text
+        can be re-solved by recomputing only the affected rows.
+*/
+#include "problem.h"
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H 1
+
+struct incrementalSolver;
+
+/*
+    Creates an incremental solver for the given problem, which must
+    have been read with a transition table (Part B onwards). The
+    solver edits its own copy of the problem's text and tokens, which
+    incrementalProblem writes back, the problem must outlive the
+    solver and is still freed with freeProblem.
+*/
+struct incrementalSolver *newIncrementalSolver(struct problem *p);
+
+/*
+    Replaces length characters of the text starting at the given
+    offset with the given replacement, re-tokenizing only the terms
+    the edit can affect and invalidating only the lattice rows that
+    depend on them. The work is in the size of the edit and its
+    distance from the last one, not the length of the text.
+*/
+void incrementalEdit(struct incrementalSolver *s, int start, int length,
+                     const char *replacement);
+
+/*
+    Brings the text and tokens of the solver's problem up to date with
+    the edits so far and returns it, for reading or printing. This
+    copies the whole text, so is for after a run of edits.
+*/
+struct problem *incrementalProblem(struct incrementalSolver *s);
+
+/*
+    Returns the optimal score of the current text, extending the
+    forward and backward lattices across the edited rows and joining
+    them there.
+*/
+int incrementalScore(struct incrementalSolver *s);
+
+/*
+    Returns the optimal colouring of the current text in a fresh
+    solution, to be freed with freeSolution.
+*/
+struct solution *incrementalSolution(struct incrementalSolver *s);
+
+/* Returns the number of lattice rows computed so far. */
+long incrementalRowsComputed(struct incrementalSolver *s);
+
+/*
+    Frees the given incremental solver, leaving its problem intact.
+*/
+void freeIncrementalSolver(struct incrementalSolver *s);
+
+#endif
@@ -0,0 +1,522 @@
+/*
+    Implementation for module which finds the k best colourings of a
+        Part F problem by lazily exploring sidetracks from the best
+        path, after Eppstein.
+
+    The forward pass's back pointers give every term and colour its
+    best path back to the start. Any other colouring can be described
+    by where it leaves those paths: a sidetrack is a step into a term
+    and colour from a previous colour other than its back pointer,
+    and costs the score lost by taking it. Each term and colour gets a
+    heap of the cheapest sidetrack at itself and at every term and
+    colour on its best path back, shared with the heap of the node its
+    back pointer leads to by persistent insertion. Heaps are only built
+    for the nodes the search reaches.
+
+    Colourings are then taken best first from a priority queue. Each
+    popped colouring leads to at most four more: swapping its last
+    sidetrack for one of the two children in its heap, for the next
+    cheapest sidetrack at the same term and colour, or adding the
+    cheapest sidetrack on the best path back from it. The cost is a
+    Viterbi pass, building the heaps, and then about log k per
+    colouring plus reading its colours out. The best colouring alone
+    is just latticeSolve, and the heaps are only built for a second.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "kbest.h"
+#include "problemStruct.c"
+
+/* The first number of heap entries and colourings to allocate space for. */
+#define INITIALENTRIES 64
+
+/* Marks a node whose heap hasn't been built yet. */
+#define UNBUILT (-2)
+
+/* An entry of a persistent leftist heap of sidetracks, ordered by cost. */
+struct sidetrackHeap
+{
+    int cost;
+    /* Term * colourCount + colour of the sidetrack's end. */
+    int node;
+    /* Length of the shortest path to a missing child. */
+    int rank;
+    int left;
+    int right;
+};
+
+struct sidetrack
+{
+    int cost;
+    /* The previous colour taken. */
+    int previous;
+};
+
+/* A colouring, described by its last sidetrack and the colouring it was added to. */
+struct kbestState
+{
+    long long cost;
+    /* Heap entry whose node the last sidetrack ends at. */
+    int heap;
+    /* Which of that node's sidetracks, cheapest first. */
+    int rank;
+    /* The colouring without the last sidetrack, -1 for the best. */
+    int parent;
+};
+
+struct kbestSearch
+{
+    struct lattice *l;
+    const int *termTables;
+    int termCount;
+    /* Best score and previous colour of each term and colour. */
+    int *forward;
+    int *back;
+    /* The best score and final colour. */
+    int best;
+    int bestColour;
+    /* Heap of each term and colour, and the end (node termCount * colourCount). */
+    int *roots;
+    /* Scratch space for the nodes of a best path back. */
+    int *path;
+    struct sidetrackHeap *heap;
+    int heapCount;
+    int heapAllocated;
+    /* Scratch space for the sidetracks of one node. */
+    struct sidetrack *sidetracks;
+    /* Colourings found or waiting, and a min queue of the waiting ones. */
+    struct kbestState *states;
+    int stateCount;
+    int statesAllocated;
+    int *queue;
+    int queueCount;
+};
+
+/* Whether heap entry a comes before entry b. */
+static int heapBefore(struct kbestSearch *s, int a, int b)
+{
+    if (s->heap[a].cost != s->heap[b].cost)
+    {
+        return s->heap[a].cost < s->heap[b].cost;
+    }
+    return s->heap[a].node < s->heap[b].node;
+}
+
+static int heapRank(struct kbestSearch *s, int entry)
+{
+    return (entry < 0) ? 0 : s->heap[entry].rank;
+}
+
+/* Adds a copy of the given heap entry, returning its index. */
+static int copyEntry(struct kbestSearch *s, const struct sidetrackHeap *entry)
+{
+    if (s->heapCount == s->heapAllocated)
+    {
+        s->heapAllocated *= 2;
+        s->heap = (struct sidetrackHeap *)realloc(s->heap, sizeof(struct sidetrackHeap) * s->heapAllocated);
+        assert(s->heap);
+    }
+    s->heap[s->heapCount] = *entry;
+    s->heapCount++;
+    return s->heapCount - 1;
+}
+
+/* Merges two heaps, copying rather than changing the entries of either. */
+static int mergeHeaps(struct kbestSearch *s, int a, int b)
+{
+    if (a < 0)
+    {
+        return b;
+    }
+    if (b < 0)
+    {
+        return a;
+    }
+    if (heapBefore(s, b, a))
+    {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+    struct sidetrackHeap entry = s->heap[a];
+    /* Leftist heaps keep the right spine short, so this only recurses log n deep. */
+    int right = mergeHeaps(s, entry.right, b);
+    entry.right = right;
+    if (heapRank(s, entry.left) < heapRank(s, entry.right))
+    {
+        entry.right = entry.left;
+        entry.left = right;
+    }
+    entry.rank = heapRank(s, entry.right) + 1;
+    return copyEntry(s, &entry);
+}
+
+static int compareSidetracks(const void *a, const void *b)
+{
+    const struct sidetrack *x = (const struct sidetrack *)a;
+    const struct sidetrack *y = (const struct sidetrack *)b;
+    if (x->cost != y->cost)
+    {
+        return (x->cost < y->cost) ? -1 : 1;
+    }
+    return x->previous - y->previous;
+}
+
+/*
+    Fills in the sidetracks ending at the given node, returning how
+    many there are. They are sorted cheapest first if sorted is 1,
+    otherwise only the first is the cheapest. The end node's
+    sidetracks are the final colours other than the best.
+*/
+static int findSidetracks(struct kbestSearch *s, int node, int sorted)
+{
+    struct lattice *l = s->l;
+    int colourCount = l->colourCount;
+    int i = node / colourCount;
+    int colour = node % colourCount;
+    const int *previousScores = s->forward + (size_t)(i - 1) * colourCount;
+    int best = s->best;
+    int bestPrevious = s->bestColour;
+    const int *transitions = NULL;
+    int emission = 0;
+    if (i < s->termCount)
+    {
+        best = s->forward[node];
+        bestPrevious = s->back[node];
+        transitions = l->transitions + colour;
+        emission = LATTICE_ROW(l, s->termTables[i])[colour];
+    }
+    int count = 0;
+    for (int k = 0; k < colourCount; k++)
+    {
+        if (k == bestPrevious || previousScores[k] == LATTICE_NONALLOWED)
+        {
+            continue;
+        }
+        int score = previousScores[k] + emission;
+        if (transitions)
+        {
+            score += transitions[k * colourCount];
+        }
+        s->sidetracks[count].cost = best - score;
+        s->sidetracks[count].previous = k;
+        if (!sorted && count > 0 && s->sidetracks[count].cost < s->sidetracks[0].cost)
+        {
+            struct sidetrack swap = s->sidetracks[0];
+            s->sidetracks[0] = s->sidetracks[count];
+            s->sidetracks[count] = swap;
+        }
+        count++;
+    }
+    if (sorted && count > 1)
+    {
+        qsort(s->sidetracks, count, sizeof(struct sidetrack), compareSidetracks);
+    }
+    return count;
+}
+
+/*
+    Returns the heap of the given node, building it and the heaps of
+    the nodes on its best path back which aren't yet built. Most nodes
+    are never needed, and best paths back soon join ones already built.
+*/
+static int buildHeap(struct kbestSearch *s, int node)
+{
+    int colourCount = s->l->colourCount;
+    int count = 0;
+    int v = node;
+    while (s->roots[v] == UNBUILT)
+    {
+        s->path[count] = v;
+        count++;
+        int i = v / colourCount;
+        int previous = (i == s->termCount) ? s->bestColour : s->back[v];
+        v = (i - 1) * colourCount + previous;
+    }
+    /* Build from the oldest back, each adding to the heap before it. */
+    for (int n = count - 1; n >= 0; n--)
+    {
+        v = s->path[n];
+        int i = v / colourCount;
+        int previous = (i == s->termCount) ? s->bestColour : s->back[v];
+        int root = s->roots[(i - 1) * colourCount + previous];
+        if (findSidetracks(s, v, 0) > 0)
+        {
+            struct sidetrackHeap entry;
+            entry.cost = s->sidetracks[0].cost;
+            entry.node = v;
+            entry.rank = 1;
+            entry.left = -1;
+            entry.right = -1;
+            root = mergeHeaps(s, copyEntry(s, &entry), root);
+        }
+        s->roots[v] = root;
+    }
+    return s->roots[node];
+}
+
+/* Whether queued state a comes before state b, ties go to the older state. */
+static int stateBefore(struct kbestSearch *s, int a, int b)
+{
+    if (s->states[a].cost != s->states[b].cost)
+    {
+        return s->states[a].cost < s->states[b].cost;
+    }
+    return a < b;
+}
+
+static void pushState(struct kbestSearch *s, long long cost, int heap, int rank,
+                      int parent)
+{
+    if (s->stateCount == s->statesAllocated)
+    {
+        s->statesAllocated *= 2;
+        s->states = (struct kbestState *)realloc(s->states, sizeof(struct kbestState) * s->statesAllocated);
+        assert(s->states);
+        s->queue = (int *)realloc(s->queue, sizeof(int) * s->statesAllocated);
+        assert(s->queue);
+    }
+    int x = s->stateCount;
+    s->stateCount++;
+    s->states[x].cost = cost;
+    s->states[x].heap = heap;
+    s->states[x].rank = rank;
+    s->states[x].parent = parent;
+    int i = s->queueCount;
+    s->queueCount++;
+    while (i > 0 && stateBefore(s, x, s->queue[(i - 1) / 2]))
+    {
+        s->queue[i] = s->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->queue[i] = x;
+}
+
+static int popState(struct kbestSearch *s)
+{
+    int top = s->queue[0];
+    s->queueCount--;
+    int last = s->queue[s->queueCount];
+    int i = 0;
+    while (2 * i + 1 < s->queueCount)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < s->queueCount && stateBefore(s, s->queue[child + 1], s->queue[child]))
+        {
+            child++;
+        }
+        if (!stateBefore(s, s->queue[child], last))
+        {
+            break;
+        }
+        s->queue[i] = s->queue[child];
+        i = child;
+    }
+    s->queue[i] = last;
+    return top;
+}
+
+/*
+    Reads out the colouring of the given state (-1 for the best) into
+    colours, using taken and takenNodes as scratch space.
+*/
+static void stateColours(struct kbestSearch *s, int state, struct sidetrack *taken,
+                         int *takenNodes, int *colours)
+{
+    int colourCount = s->l->colourCount;
+    /* Gather the sidetracks, the last added is nearest the start. */
+    int count = 0;
+    for (int x = state; x >= 0; x = s->states[x].parent)
+    {
+        int node = s->heap[s->states[x].heap].node;
+        findSidetracks(s, node, 1);
+        taken[count] = s->sidetracks[s->states[x].rank];
+        takenNodes[count] = node;
+        count++;
+    }
+    /* Follow back pointers from the end, except where a sidetrack is taken. */
+    int next = count - 1;
+    int node = s->termCount * colourCount;
+    for (int i = s->termCount; i > 0; i--)
+    {
+        int colour;
+        if (next >= 0 && takenNodes[next] == node)
+        {
+            colour = taken[next].previous;
+            next--;
+        }
+        else if (i == s->termCount)
+        {
+            colour = s->bestColour;
+        }
+        else
+        {
+            colour = s->back[node];
+        }
+        colours[i - 1] = colour;
+        node = (i - 1) * colourCount + colour;
+    }
+    assert(next < 0);
+}
+
+int latticeSolveKBest(struct lattice *l, const int *termTables, int termCount,
+                      int k, int *scores, int **colours)
+{
+    if (k <= 0)
+    {
+        return 0;
+    }
+    if (termCount == 0)
+    {
+        /* Only the empty colouring. */
+        scores[0] = 0;
+        return 1;
+    }
+    if (k == 1)
+    {
+        /* The best colouring alone is a plain Viterbi solve, with no heaps. */
+        scores[0] = latticeSolve(l, termTables, termCount, colours ? colours[0] : NULL);
+        return 1;
+    }
+    int colourCount = l->colourCount;
+    size_t nodeCount = (size_t)colourCount * termCount + 1;
+    struct kbestSearch s;
+    s.l = l;
+    s.termTables = termTables;
+    s.termCount = termCount;
+    s.forward = (int *)malloc(sizeof(int) * nodeCount);
+    assert(s.forward);
+    s.back = (int *)calloc(nodeCount, sizeof(int));
+    assert(s.back);
+    s.heapAllocated = INITIALENTRIES;
+    s.heap = (struct sidetrackHeap *)malloc(sizeof(struct sidetrackHeap) * s.heapAllocated);
+    assert(s.heap);
+    s.heapCount = 0;
+    s.sidetracks = (struct sidetrack *)malloc(sizeof(struct sidetrack) * colourCount);
+    assert(s.sidetracks);
+    s.statesAllocated = INITIALENTRIES;
+    s.states = (struct kbestState *)malloc(sizeof(struct kbestState) * s.statesAllocated);
+    assert(s.states);
+    s.queue = (int *)malloc(sizeof(int) * s.statesAllocated);
+    assert(s.queue);
+    s.stateCount = 0;
+    s.queueCount = 0;
+
+    latticeStart(l, termTables[0], s.forward);
+    for (int i = 1; i < termCount; i++)
+    {
+        latticeForwardStep(l, s.forward + (size_t)(i - 1) * colourCount, termTables[i],
+                           s.forward + (size_t)i * colourCount,
+                           s.back + (size_t)i * colourCount);
+    }
+    s.bestColour = latticeBestColour(l, s.forward + (size_t)(termCount - 1) * colourCount);
+    s.best = s.forward[(size_t)(termCount - 1) * colourCount + s.bestColour];
+    int end = termCount * colourCount;
+
+    struct sidetrack *taken = (struct sidetrack *)malloc(sizeof(struct sidetrack) * (termCount + 1));
+    assert(taken);
+    int *takenNodes = (int *)malloc(sizeof(int) * (termCount + 1));
+    assert(takenNodes);
+
+    /* Best first search, the best colouring has no sidetracks. */
+    scores[0] = s.best;
+    if (colours)
+    {
+        stateColours(&s, -1, taken, takenNodes, colours[0]);
+    }
+    int found = 1;
+    /* A second colouring is wanted, so the heaps are. The first term has no sidetracks. */
+    s.roots = (int *)malloc(sizeof(int) * nodeCount);
+    assert(s.roots);
+    for (size_t v = 0; v < nodeCount; v++)
+    {
+        s.roots[v] = (v < (size_t)colourCount) ? -1 : UNBUILT;
+    }
+    s.path = (int *)malloc(sizeof(int) * (termCount + 1));
+    assert(s.path);
+    int root = buildHeap(&s, end);
+    if (root >= 0)
+    {
+        pushState(&s, s.heap[root].cost, root, 0, -1);
+    }
+    while (found < k && s.queueCount > 0)
+    {
+        int x = popState(&s);
+        struct kbestState state = s.states[x];
+        scores[found] = (int)(s.best - state.cost);
+        if (colours)
+        {
+            stateColours(&s, x, taken, takenNodes, colours[found]);
+        }
+        found++;
+
+        struct sidetrackHeap entry = s.heap[state.heap];
+        int sidetrackCount = findSidetracks(&s, entry.node, 1);
+        long long before = state.cost - s.sidetracks[state.rank].cost;
+        int previous = s.sidetracks[state.rank].previous;
+        if (state.rank + 1 < sidetrackCount)
+        {
+            /* The next cheapest sidetrack at the same node. */
+            pushState(&s, before + s.sidetracks[state.rank + 1].cost, state.heap,
+                      state.rank + 1, state.parent);
+        }
+        if (state.rank == 0)
+        {
+            /* The sidetracks after this one in its heap. */
+            if (entry.left >= 0)
+            {
+                pushState(&s, before + s.heap[entry.left].cost, entry.left, 0, state.parent);
+            }
+            if (entry.right >= 0)
+            {
+                pushState(&s, before + s.heap[entry.right].cost, entry.right, 0, state.parent);
+            }
+        }
+        root = buildHeap(&s, (entry.node / colourCount - 1) * colourCount + previous);
+        if (root >= 0)
+        {
+            /* A further sidetrack on the best path back from this one. */
+            pushState(&s, state.cost + s.heap[root].cost, root, 0, x);
+        }
+    }
+
+    free(taken);
+    free(takenNodes);
+    free(s.states);
+    free(s.queue);
+    free(s.sidetracks);
+    free(s.heap);
+    free(s.roots);
+    free(s.path);
+    free(s.back);
+    free(s.forward);
+    return found;
+}
+
+void solveProblemKBest(struct problem *p, int k, int colourMode, FILE *outFile)
+{
+    struct lattice *l = newLattice(p);
+    int *scores = (int *)malloc(sizeof(int) * (k > 0 ? k : 1));
+    assert(scores);
+    int **colours = (int **)malloc(sizeof(int *) * (k > 0 ? k : 1));
+    assert(colours);
+    for (int r = 0; r < k; r++)
+    {
+        colours[r] = (int *)malloc(sizeof(int) * (p->termCount > 0 ? p->termCount : 1));
+        assert(colours[r]);
+    }
+    int found = latticeSolveKBest(l, p->termTables, p->termCount, k, scores, colours);
+    for (int r = 0; r < found; r++)
+    {
+        fprintf(outFile, "%d: ", scores[r]);
+        outputColouring(outFile, p, colours[r], colourMode);
+    }
+    for (int r = 0; r < k; r++)
+    {
+        free(colours[r]);
+    }
+    free(colours);
+    free(scores);
+    freeLattice(l);
+}
@@ -0,0 +1,30 @@
+/*
+    Header for module which finds the k best distinct colourings of
+        a Part F problem, working out paths past the best only as
+        they are needed.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef KBEST_H
+#define KBEST_H 1
+
+/*
+    Finds up to k best colourings of the given sequence of table
+    indices, best first, storing the score of the r-th in scores[r]
+    and, if colours is not NULL, the colouring in colours[r], which
+    must have room for termCount colours. Returns the number found,
+    fewer than k only if there are no more colourings. The first
+    matches latticeSolve.
+*/
+int latticeSolveKBest(struct lattice *l, const int *termTables, int termCount,
+                      int k, int *scores, int **colours);
+
+/*
+    Outputs the k best colourings of the given Part F problem to
+    outFile, one line each starting with its score, otherwise as
+    outputProblem does.
+*/
+void solveProblemKBest(struct problem *p, int k, int colourMode, FILE *outFile);
+
+#endif
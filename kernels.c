@@ -0,0 +1,167 @@
+/*
+    Implementation for module which contains Viterbi kernels
+        specialised at compile time for common colour counts.
+
+    Each kernel keeps the scores of all colours in vectors of at most
+    eight lanes. Row k of the transition matrix is held the same way as
+    the scores of moving from colour k to every colour, so a step is a
+    fixed run of vector adds, compares and selects with no branches.
+    Terms which allow a single colour, as words without a table do,
+    take a scalar path over just the colours the term before allows,
+    and a run of them carries a single score along, one add per term.
+    Back pointers fit in a byte per colour, and only those a colouring
+    can reach back through are written.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "kernels.h"
+
+/* Defines latticeSolveN, holding N colours in N / W vectors of W lanes. */
+#define DEFINE_KERNEL(N, W)                                                         \
+    typedef int kernelVector##N __attribute__((vector_size(W * sizeof(int))));      \
+    typedef unsigned char kernelBytes##N __attribute__((vector_size(W)));           \
+                                                                                    \
+    KERNEL_CLONES int                                                               \
+    latticeSolve##N(struct lattice *l, const int *termTables, int termCount,        \
+                    int *colours)                                                   \
+    {                                                                               \
+        assert(l->colourCount == N);                                                \
+        if (termCount == 0)                                                         \
+        {                                                                           \
+            return 0;                                                               \
+        }                                                                           \
+        kernelVector##N transitions[N][N / W];                                      \
+        memcpy(transitions, l->transitions, sizeof(transitions));                   \
+        unsigned char *back = NULL;                                                 \
+        if (colours)                                                                \
+        {                                                                           \
+            back = (unsigned char *)malloc((size_t)N * termCount);                  \
+            assert(back);                                                           \
+        }                                                                           \
+        kernelVector##N scores[N / W];                                              \
+        memcpy(scores, LATTICE_ROW(l, termTables[0]), sizeof(scores));              \
+        for (int i = 1; i < termCount; i++)                                         \
+        {                                                                           \
+            int table = termTables[i];                                              \
+            int allowedStart = l->allowedStarts[table + 1];                         \
+            if (l->allowedStarts[table + 2] - allowedStart == 1)                    \
+            {                                                                       \
+                /* Only one colour allowed, as for words without a table. */        \
+                int only = l->allowedColours[allowedStart];                         \
+                int previousTable = termTables[i - 1];                              \
+                int onlyBest = LATTICE_NONALLOWED;                                  \
+                int onlyColour = 0;                                                 \
+                for (int a = l->allowedStarts[previousTable + 1];                   \
+                     a < l->allowedStarts[previousTable + 2]; a++)                  \
+                {                                                                   \
+                    int k = l->allowedColours[a];                                   \
+                    int score = scores[k / W][k % W] +                              \
+                                l->transitions[k * N + only];                       \
+                    if (score > onlyBest)                                           \
+                    {                                                               \
+                        onlyBest = score;                                           \
+                        onlyColour = k;                                             \
+                    }                                                               \
+                }                                                                   \
+                onlyBest += LATTICE_ROW(l, table)[only];                            \
+                if (onlyBest < LATTICE_NONALLOWED)                                  \
+                {                                                                   \
+                    onlyBest = LATTICE_NONALLOWED;                                  \
+                }                                                                   \
+                if (back)                                                           \
+                {                                                                   \
+                    back[(size_t)i * N + only] = onlyColour;                        \
+                }                                                                   \
+                /* A run of such terms only ever has one colour to come from. */    \
+                while (i + 1 < termCount &&                                         \
+                       l->allowedStarts[termTables[i + 1] + 2] -                    \
+                       l->allowedStarts[termTables[i + 1] + 1] == 1)                \
+                {                                                                   \
+                    i++;                                                            \
+                    int nextStart = l->allowedStarts[termTables[i] + 1];            \
+                    int next = l->allowedColours[nextStart];                        \
+                    onlyBest += l->transitions[only * N + next] +                   \
+                                LATTICE_ROW(l, termTables[i])[next];                \
+                    if (onlyBest < LATTICE_NONALLOWED)                              \
+                    {                                                               \
+                        onlyBest = LATTICE_NONALLOWED;                              \
+                    }                                                               \
+                    if (back)                                                       \
+                    {                                                               \
+                        back[(size_t)i * N + next] = only;                          \
+                    }                                                               \
+                    only = next;                                                    \
+                }                                                                   \
+                for (int h = 0; h < N / W; h++)                                     \
+                {                                                                   \
+                    scores[h] = (kernelVector##N){0} + LATTICE_NONALLOWED;          \
+                }                                                                   \
+                scores[only / W][only % W] = onlyBest;                              \
+                continue;                                                           \
+            }                                                                       \
+            kernelVector##N emission[N / W];                                        \
+            memcpy(emission, LATTICE_ROW(l, table), sizeof(emission));              \
+            kernelVector##N best[N / W];                                            \
+            kernelVector##N bestColour[N / W];                                      \
+            /* Only the colours the term before allows can lead here. */            \
+            int previousStart = l->allowedStarts[termTables[i - 1] + 1];            \
+            int previousEnd = l->allowedStarts[termTables[i - 1] + 2];              \
+            int first = l->allowedColours[previousStart];                           \
+            for (int h = 0; h < N / W; h++)                                         \
+            {                                                                       \
+                best[h] = scores[first / W][first % W] + transitions[first][h];     \
+                bestColour[h] = (kernelVector##N){0} + first;                       \
+            }                                                                       \
+            for (int a = previousStart + 1; a < previousEnd; a++)                   \
+            {                                                                       \
+                int k = l->allowedColours[a];                                       \
+                int previous = scores[k / W][k % W];                                \
+                for (int h = 0; h < N / W; h++)                                     \
+                {                                                                   \
+                    kernelVector##N score = previous + transitions[k][h];           \
+                    kernelVector##N better = score > best[h];                       \
+                    best[h] = (score & better) | (best[h] & ~better);               \
+                    bestColour[h] = (k & better) | (bestColour[h] & ~better);       \
+                }                                                                   \
+            }                                                                       \
+            for (int h = 0; h < N / W; h++)                                         \
+            {                                                                       \
+                kernelVector##N next = best[h] + emission[h];                       \
+                kernelVector##N low = next < LATTICE_NONALLOWED;                    \
+                next = (LATTICE_NONALLOWED & low) | (next & ~low);                  \
+                kernelVector##N allowed = emission[h] != LATTICE_NONALLOWED;        \
+                scores[h] = (next & allowed) | (LATTICE_NONALLOWED & ~allowed);     \
+                if (back)                                                           \
+                {                                                                   \
+                    kernelBytes##N bytes = __builtin_convertvector(bestColour[h],   \
+                                                                   kernelBytes##N); \
+                    memcpy(back + (size_t)i * N + h * W, &bytes, W);                \
+                }                                                                   \
+            }                                                                       \
+        }                                                                           \
+        int colour = 0;                                                             \
+        for (int j = 1; j < N; j++)                                                 \
+        {                                                                           \
+            if (scores[j / W][j % W] > scores[colour / W][colour % W])              \
+            {                                                                       \
+                colour = j;                                                         \
+            }                                                                       \
+        }                                                                           \
+        int score = scores[colour / W][colour % W];                                 \
+        if (colours)                                                                \
+        {                                                                           \
+            for (int i = termCount - 1; i > 0; i--)                                 \
+            {                                                                       \
+                colours[i] = colour;                                                \
+                colour = back[(size_t)i * N + colour];                              \
+            }                                                                       \
+            colours[0] = colour;                                                    \
+            free(back);                                                             \
+        }                                                                           \
+        return score;                                                               \
+    }
+
+DEFINE_KERNEL(4, 4)
+DEFINE_KERNEL(8, 8)
+DEFINE_KERNEL(16, 8)
@@ -0,0 +1,35 @@
+/*
+    Header for module which contains Viterbi kernels specialised at
+        compile time for the common colour counts, used by latticeSolve
+        when the loaded tables have exactly that many colours.
+*/
+#include "lattice.h"
+
+#ifndef KERNELS_H
+#define KERNELS_H 1
+
+/*
+    Builds the function it marks for AVX2 as well as the baseline on
+    x86, picking one when the program loads. Elsewhere the function is
+    built once, for the baseline.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define KERNEL_CLONES
+#endif
+
+/*
+    Each of these is latticeSolve for a lattice with exactly the given
+    number of colours, holding the transition matrix in vector registers
+    with the loop over previous colours fully unrolled. Results are
+    identical to latticeSolveGeneric.
+*/
+int latticeSolve4(struct lattice *l, const int *termTables, int termCount,
+                  int *colours);
+int latticeSolve8(struct lattice *l, const int *termTables, int termCount,
+                  int *colours);
+int latticeSolve16(struct lattice *l, const int *termTables, int termCount,
+                   int *colours);
+
+#endif
@@ -0,0 +1,210 @@
+/*
+    Implementation for module which compiles problem tables
+        into dense score matrices and provides the Viterbi
+        steps over them.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include "lattice.h"
+#include "kernels.h"
+#include "semiring.h"
+#include "problemStruct.c"
+
+/* -1 to show the colour hasn't been set, as in the table reader. */
+#define DEFAULTCOLOUR (-1)
+
+struct lattice *newLattice(struct problem *p)
+{
+    struct lattice *l = (struct lattice *)malloc(sizeof(struct lattice));
+    assert(l);
+    if (p->compiledLattice)
+    {
+        *l = *(p->compiledLattice);
+        return l;
+    }
+    l->shared = 0;
+
+    /* Find the number of colours used anywhere. */
+    int colourCount = 1;
+    for (int i = 0; i < p->termColourTableCount; i++)
+    {
+        if (p->colourTables[i].colourCount > colourCount)
+        {
+            colourCount = p->colourTables[i].colourCount;
+        }
+    }
+    struct colourTransitionTable *ctt = p->colourTransitionTable;
+    if (ctt)
+    {
+        for (int i = 0; i < ctt->transitionCount; i++)
+        {
+            if (ctt->prevColours[i] >= colourCount)
+            {
+                colourCount = ctt->prevColours[i] + 1;
+            }
+            if (ctt->colours[i] >= colourCount)
+            {
+                colourCount = ctt->colours[i] + 1;
+            }
+        }
+    }
+    l->colourCount = colourCount;
+    l->rowCount = p->termColourTableCount + 1;
+
+    l->emissions = (int *)malloc(sizeof(int) * l->rowCount * colourCount);
+    assert(l->emissions);
+    for (int i = -1; i < p->termColourTableCount; i++)
+    {
+        int *row = LATTICE_ROW(l, i);
+        for (int j = 0; j < colourCount; j++)
+        {
+            row[j] = LATTICE_NONALLOWED;
+        }
+        row[0] = 0;
+        if (i < 0)
+        {
+            continue;
+        }
+        struct termColourTable *table = &(p->colourTables[i]);
+        for (int j = 0; j < table->colourCount; j++)
+        {
+            if (table->colours[j] != DEFAULTCOLOUR)
+            {
+                row[j] = table->scores[j];
+            }
+        }
+    }
+
+    l->transitions = (int *)calloc(colourCount * colourCount, sizeof(int));
+    assert(l->transitions);
+    if (ctt)
+    {
+        /* Walk backwards so the first listed transition wins, as in lookups. */
+        for (int i = ctt->transitionCount - 1; i >= 0; i--)
+        {
+            if (ctt->prevColours[i] >= 0 && ctt->colours[i] >= 0)
+            {
+                l->transitions[ctt->prevColours[i] * colourCount + ctt->colours[i]] = ctt->scores[i];
+            }
+        }
+    }
+
+    latticeListAllowed(l);
+
+    return l;
+}
+
+void latticeListAllowed(struct lattice *l)
+{
+    int colourCount = l->colourCount;
+    l->allowedStarts = (int *)malloc(sizeof(int) * (l->rowCount + 1));
+    assert(l->allowedStarts);
+    int allowedCount = 0;
+    for (int i = 0; i < l->rowCount * colourCount; i++)
+    {
+        if (l->emissions[i] != LATTICE_NONALLOWED)
+        {
+            allowedCount++;
+        }
+    }
+    l->allowedColours = (int *)malloc(sizeof(int) * (allowedCount > 0 ? allowedCount : 1));
+    assert(l->allowedColours);
+    allowedCount = 0;
+    for (int i = 0; i < l->rowCount; i++)
+    {
+        l->allowedStarts[i] = allowedCount;
+        const int *row = l->emissions + i * colourCount;
+        for (int j = 0; j < colourCount; j++)
+        {
+            if (row[j] != LATTICE_NONALLOWED)
+            {
+                l->allowedColours[allowedCount] = j;
+                allowedCount++;
+            }
+        }
+    }
+    l->allowedStarts[l->rowCount] = allowedCount;
+}
+
+void latticeStart(struct lattice *l, int table, int *scores)
+{
+    const int *row = LATTICE_ROW(l, table);
+    for (int j = 0; j < l->colourCount; j++)
+    {
+        scores[j] = row[j];
+    }
+}
+
+void latticeForwardStep(struct lattice *l, const int *prevScores, int table,
+                        int *scores, int *back)
+{
+    if (back)
+    {
+        semiringStepArgmax(l, prevScores, SEMIRING_ALL_COLOURS, table,
+                           1, 1, scores, back);
+    }
+    else
+    {
+        semiringStepMaxPlus(l, prevScores, SEMIRING_ALL_COLOURS, table,
+                            1, 1, scores);
+    }
+}
+
+void latticeBackwardStep(struct lattice *l, const int *nextScores,
+                         int nextTable, int *scores, int *forward)
+{
+    if (forward)
+    {
+        semiringStepArgmax(l, nextScores, nextTable, SEMIRING_ALL_COLOURS, 0, 1, scores,
+                           forward);
+    }
+    else
+    {
+        semiringStepMaxPlus(l, nextScores, nextTable, SEMIRING_ALL_COLOURS, 0, 1, scores);
+    }
+}
+
+int latticeBestColour(struct lattice *l, const int *scores)
+{
+    int bestColour = 0;
+    for (int j = 1; j < l->colourCount; j++)
+    {
+        if (scores[j] > scores[bestColour])
+        {
+            bestColour = j;
+        }
+    }
+    return bestColour;
+}
+
+int latticeSolve(struct lattice *l, const int *termTables, int termCount,
+                 int *colours)
+{
+    switch (l->colourCount)
+    {
+    case 4:
+        return latticeSolve4(l, termTables, termCount, colours);
+    case 8:
+        return latticeSolve8(l, termTables, termCount, colours);
+    case 16:
+        return latticeSolve16(l, termTables, termCount, colours);
+    default:
+        return latticeSolveGeneric(l, termTables, termCount, colours);
+    }
+}
+
+void freeLattice(struct lattice *l)
+{
+    if (l && l->shared)
+    {
+        free(l);
+    }
+    else if (l)
+    {
+        free(l->emissions);
+        free(l->transitions);
+        free(l->allowedStarts);
+        free(l->allowedColours);
+        free(l);
+    }
+}
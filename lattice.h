@@ -0,0 +1,107 @@
+/*
+    Header for module which compiles the term colour tables and
+        colour transition table of a problem into dense score
+        matrices and provides the Viterbi steps over them.
+*/
+#include "problem.h"
+
+#ifndef LATTICE_H
+#define LATTICE_H 1
+
+struct lattice
+{
+    /* The number of colours, including no colour. */
+    int colourCount;
+    /* The number of emission rows, one per table plus one for words without a table. */
+    int rowCount;
+    /*
+        The score for each colour of each table, row 0 is used for
+        words without a table. Colours a term can't take are
+        LATTICE_NONALLOWED.
+    */
+    int *emissions;
+    /* The score of moving from colour i to colour j at [i * colourCount + j]. */
+    int *transitions;
+    /*
+        The colours each row allows in increasing order, row i's are
+        allowedColours[allowedStarts[i]] up to allowedColours[allowedStarts[i + 1]].
+    */
+    int *allowedStarts;
+    int *allowedColours;
+    /* Whether the arrays are in a table segment, which freeLattice leaves alone. */
+    int shared;
+};
+
+/* Marker for non-allowed colours, low enough that sums of two don't overflow. */
+#define LATTICE_NONALLOWED (-1073741824)
+
+/* Gets the emission row for the given table index (-1 for no table). */
+#define LATTICE_ROW(l, table) ((l)->emissions + ((table) + 1) * (l)->colourCount)
+
+/*
+    Compiles the tables of the given problem into a lattice. Colour 0
+    (no colour) is always allowed, scoring 0 unless the table gives it
+    a score, and transitions missing from the transition table score 0.
+    Problems attached to a table segment get the lattice compiled into
+    it instead.
+*/
+struct lattice *newLattice(struct problem *p);
+
+/*
+    Fills in the allowed colour lists of the given lattice from its
+    emission rows, newLattice does this itself.
+*/
+void latticeListAllowed(struct lattice *l);
+
+/*
+    Sets scores to the scores of starting a sentence with a term
+    of the given table in each colour.
+*/
+void latticeStart(struct lattice *l, int table, int *scores);
+
+/*
+    Sets scores to the best score of each colour for a term of the
+    given table which follows a term with prevScores, and back (if
+    not NULL) to the previous colour giving that score. Ties go to
+    the lowest previous colour.
+*/
+void latticeForwardStep(struct lattice *l, const int *prevScores, int table,
+                        int *scores, int *back);
+
+/*
+    Sets scores to the best score of the rest of the sentence for each
+    colour of a term followed by a term of nextTable with nextScores,
+    and forward (if not NULL) to the next colour giving that score.
+*/
+void latticeBackwardStep(struct lattice *l, const int *nextScores,
+                         int nextTable, int *scores, int *forward);
+
+/*
+    Returns the colour with the best score in scores, ties go to the
+    lowest colour.
+*/
+int latticeBestColour(struct lattice *l, const int *scores);
+
+/*
+    Finds the optimal colouring of the given sequence of table indices
+    with a full Viterbi pass, storing it in colours (if not NULL) and
+    returning its score. Ties go to the lowest colour at the last term
+    and the lowest previous colour along the path. Lattices with 4, 8
+    or 16 colours use a kernel specialised for that count.
+*/
+int latticeSolve(struct lattice *l, const int *termTables, int termCount,
+                 int *colours);
+
+/*
+    Same as latticeSolve, but always uses the kernel which works for
+    any number of colours.
+*/
+int latticeSolveGeneric(struct lattice *l, const int *termTables,
+                        int termCount, int *colours);
+
+/*
+    Frees the given lattice and all memory allocated for it.
+*/
+void freeLattice(struct lattice *l);
+
+#endif
@@ -0,0 +1,262 @@
+/*
+    Implementation for module which parses the term colour table file
+        into term colour tables.
+
+    The text is cut into one chunk per thread, each cut moved on to the
+    start of the next line, and every thread builds the tables of its
+    chunk as the single-threaded reader would. Joining the chunks'
+    tables in order gives the same tables, except where a term's lines
+    were cut between two chunks: the later chunk's first table is then
+    merged into the earlier chunk's last, its colours set after the
+    earlier ones as they would have been line by line.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "loader.h"
+#include "pattern.h"
+#include "problemStruct.c"
+
+/* Number of terms to allocate space for initially. */
+#define INITIALTERMS 64
+
+/* -1 to show the colour hasn't been set. */
+#define DEFAULTCOLOUR (-1)
+/* -1 to be lower than zero to highlight in case accidentally used. */
+#define DEFAULTSCORE (-1)
+
+struct loaderChunk
+{
+    const char *text;
+    /* Offsets of the chunk in the text, start at a line and end at the next chunk. */
+    int start;
+    int end;
+    int tableCount;
+    int allocatedTables;
+    struct termColourTable *tables;
+};
+
+/*
+    Reads one line of term,colour,score at progress in the given text,
+    as sscanf's "%m[^,],%d,%d %n" does, so trailing whitespace and
+    blank lines after it are skipped. Returns the offset after it, or
+    -1 if the line is not in that form.
+*/
+static int parseTableLine(const char *text, int progress, char **token, int *colour,
+                          int *score)
+{
+    int tokenEnd = progress;
+    while (text[tokenEnd] != ',' && text[tokenEnd] != '\0')
+    {
+        tokenEnd++;
+    }
+    if (tokenEnd == progress || text[tokenEnd] != ',')
+    {
+        return -1;
+    }
+    const char *numberStart = text + tokenEnd + 1;
+    char *numberEnd;
+    *colour = (int)strtol(numberStart, &numberEnd, 10);
+    if (numberEnd == numberStart || *numberEnd != ',')
+    {
+        return -1;
+    }
+    numberStart = numberEnd + 1;
+    *score = (int)strtol(numberStart, &numberEnd, 10);
+    if (numberEnd == numberStart)
+    {
+        return -1;
+    }
+    while (isspace((unsigned char)*numberEnd))
+    {
+        numberEnd++;
+    }
+    *token = strndup(text + progress, tokenEnd - progress);
+    assert(*token);
+    return numberEnd - text;
+}
+
+/* Sets the score of the given colour in the given table, growing it if needed. */
+static void setColour(struct termColourTable *table, int colour, int score)
+{
+    if (table->colourCount <= colour)
+    {
+        int lastCount = table->colourCount;
+        table->colours = (int *)realloc(table->colours, sizeof(int) * (colour + 1));
+        assert(table->colours);
+        table->scores = (int *)realloc(table->scores, sizeof(int) * (colour + 1));
+        assert(table->scores);
+        for (int i = lastCount; i < colour; i++)
+        {
+            table->colours[i] = DEFAULTCOLOUR;
+            table->scores[i] = DEFAULTSCORE;
+        }
+        table->colourCount = colour + 1;
+    }
+    table->colours[colour] = colour;
+    table->scores[colour] = score;
+}
+
+/* Builds the tables of one chunk, a new table whenever the term changes. */
+static void *parseChunk(void *arg)
+{
+    struct loaderChunk *c = (struct loaderChunk *)arg;
+    struct termColourTable *lastTable = NULL;
+    int progress = c->start;
+    while (progress < c->end)
+    {
+        char *token;
+        int colour;
+        int score;
+        progress = parseTableLine(c->text, progress, &token, &colour, &score);
+        /* Make sure a token, colour and score are grabbed for each line. */
+        assert(progress > 0);
+        assert(colour >= 0);
+
+        if (lastTable == NULL || strcmp(token, lastTable->term) != 0)
+        {
+            if (c->tableCount >= c->allocatedTables)
+            {
+                c->allocatedTables = (c->allocatedTables == 0) ? INITIALTERMS
+                                                               : c->allocatedTables * 2;
+                c->tables = (struct termColourTable *)realloc(c->tables,
+                                                              sizeof(struct termColourTable) *
+                                                                  c->allocatedTables);
+                assert(c->tables);
+            }
+            lastTable = &(c->tables[c->tableCount]);
+            c->tableCount++;
+            lastTable->term = token;
+            lastTable->pattern = (strchr(token, PATTERN_WILDCARD) != NULL);
+            lastTable->colourCount = 0;
+            lastTable->colours = NULL;
+            lastTable->scores = NULL;
+        }
+        else
+        {
+            /* Same term as the last line, the table already has it. */
+            free(token);
+        }
+        setColour(lastTable, colour, score);
+    }
+    return NULL;
+}
+
+int parseColourTables(const char *tableText, int textLength, int threadCount,
+                      struct termColourTable **tables)
+{
+    if (threadCount > textLength / LOADER_MIN_CHUNK)
+    {
+        threadCount = textLength / LOADER_MIN_CHUNK;
+    }
+    if (threadCount > LOADER_MAX_THREADS)
+    {
+        threadCount = LOADER_MAX_THREADS;
+    }
+    if (threadCount < 1)
+    {
+        threadCount = 1;
+    }
+
+    struct loaderChunk chunks[LOADER_MAX_THREADS];
+    int start = 0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        chunks[i].text = tableText;
+        chunks[i].start = start;
+        chunks[i].tableCount = 0;
+        chunks[i].allocatedTables = 0;
+        chunks[i].tables = NULL;
+        int end = textLength;
+        if (i + 1 < threadCount)
+        {
+            end = (int)((long long)textLength * (i + 1) / threadCount);
+            if (end < start)
+            {
+                end = start;
+            }
+            /* Move on past the end of the line and the whitespace after it, as the reader does. */
+            while (end < textLength && tableText[end] != '\n')
+            {
+                end++;
+            }
+            while (end < textLength && isspace((unsigned char)tableText[end]))
+            {
+                end++;
+            }
+        }
+        chunks[i].end = end;
+        start = end;
+    }
+
+    pthread_t threads[LOADER_MAX_THREADS];
+    for (int i = 1; i < threadCount; i++)
+    {
+        int created = pthread_create(&(threads[i]), NULL, parseChunk, &(chunks[i]));
+        assert(created == 0);
+    }
+    /* This thread parses the first chunk. */
+    parseChunk(&(chunks[0]));
+    for (int i = 1; i < threadCount; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Join the chunks, the first chunk's tables are already in place. */
+    int tableCount = 0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        tableCount += chunks[i].tableCount;
+    }
+    struct termColourTable *joined = chunks[0].tables;
+    int joinedCount = chunks[0].tableCount;
+    if (threadCount > 1 && tableCount > 0)
+    {
+        joined = (struct termColourTable *)realloc(joined, sizeof(struct termColourTable) *
+                                                               tableCount);
+        assert(joined);
+    }
+    for (int i = 1; i < threadCount; i++)
+    {
+        struct termColourTable *chunkTables = chunks[i].tables;
+        int first = 0;
+        if (chunks[i].tableCount > 0 && joinedCount > 0 &&
+            strcmp(chunkTables[0].term, joined[joinedCount - 1].term) == 0)
+        {
+            /* The term's lines were split between chunks. */
+            struct termColourTable *split = &(chunkTables[0]);
+            for (int j = 0; j < split->colourCount; j++)
+            {
+                if (split->colours[j] != DEFAULTCOLOUR)
+                {
+                    setColour(&(joined[joinedCount - 1]), j, split->scores[j]);
+                }
+            }
+            free(split->term);
+            free(split->colours);
+            free(split->scores);
+            first = 1;
+        }
+        memcpy(joined + joinedCount, chunkTables + first,
+               sizeof(struct termColourTable) * (chunks[i].tableCount - first));
+        joinedCount += chunks[i].tableCount - first;
+        free(chunkTables);
+    }
+
+    /* Compress table to not have empty tables. */
+    if (joined && joinedCount > 0)
+    {
+        joined = (struct termColourTable *)realloc(joined, sizeof(struct termColourTable) *
+                                                               joinedCount);
+        assert(joined);
+    }
+    else
+    {
+        free(joined);
+        joined = NULL;
+    }
+    *tables = joined;
+    return joinedCount;
+}
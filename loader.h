@@ -0,0 +1,32 @@
+/*
+    Header for module which parses the term colour table file into
+        term colour tables, splitting large files across threads.
+*/
+
+#ifndef LOADER_H
+#define LOADER_H 1
+
+struct termColourTable;
+
+/* The most threads parseColourTables runs. */
+#define LOADER_MAX_THREADS 64
+
+/* Each thread parses at least this many bytes of the table file. */
+#ifndef LOADER_MIN_CHUNK
+#define LOADER_MIN_CHUNK (1 << 20)
+#endif
+
+/*
+    Parses the given table text of textLength characters, lines of
+    term,colour,score with each term's lines together, into term colour
+    tables, setting tables to them (NULL if there are none) and
+    returning how many there are. The text is split at line boundaries
+    across up to threadCount threads (including the calling one) and
+    their tables joined in order, merging a term whose lines were split
+    between two threads, so the tables are the same for any threadCount.
+    A term with a PATTERN_WILDCARD in it is a pattern.
+*/
+int parseColourTables(const char *tableText, int textLength, int threadCount,
+                      struct termColourTable **tables);
+
+#endif
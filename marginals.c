@@ -0,0 +1,681 @@
+/*
+    Implementation for module which finds per-term colour marginals
+        by forward-backward.
+
+    The log-sum-exp over previous colours is done as a scaled sum:
+    forward and backward weights are held as exps relative to a
+    running shift, so each step is a matrix-vector product of the
+    weights into exp of the transition matrix, times exp of the
+    term's emission scores. The shift only moves, by a power of two
+    so nothing is rounded, when the largest weight leaves a band
+    around 1, and is summed in double for the log of the total
+    weight; float32 then holds up over long texts. Keeping exp and
+    log out of the step matters as each step waits on the last.
+    Each step only sums over the colours the previous (or next) term
+    allows, which for words without a table is just one.
+
+    Exps of transitions and emissions, which don't depend on the
+    weights, are worked out once, those of emissions for each table
+    when a term first has it, and shared by both passes. They use a
+    polynomial approximation over GCC vectors: it splits off a power
+    of two, moving it into the exponent bits through the bits of a
+    large constant as AVX2 has no 64-bit conversions, and takes the
+    Taylor series of the remainder with as many terms as each type's
+    precision needs. Exps below the
+    smallest normal number are taken as 0; if that leaves a term
+    with no weight at all, the step is redone exactly in the log
+    domain by the log-sum-exp semiring.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "marginals.h"
+#include "semiring.h"
+#include "kernels.h"
+#include "problemStruct.c"
+
+/* Vector size in bytes, one AVX2 register. */
+#define MARGINAL_BYTES 32
+
+#define LOG2E 1.44269504088896340736
+#define LN2HI 6.93145751953125e-1
+#define LN2LO 1.42860682030941723212e-6
+
+/*
+    Lanes of a where mask is set and of b elsewhere, for vectors of
+    any type. A macro rather than a function, since a function taking
+    32-byte vectors by value has a different ABI with AVX than without.
+*/
+#define MARGINAL_SELECT(mask, a, b)                                                     \
+    ((__typeof__(a))(((__typeof__(mask))(a) & (mask)) | ((__typeof__(mask))(b) & ~(mask))))
+
+/*
+    Defines latticeMarginalsS over T held in vectors of W lanes, with
+    integer type I of the same size, MANTISSA bits of mantissa and
+    exponent BIAS, and EXPTERMS terms in the exp series, taking exps
+    of anything below LOW as 0. Weights are rescaled when the largest
+    leaves [RESCALE_LOW, RESCALE_HIGH], and redone exactly if it has
+    fallen below EXACT_BELOW.
+*/
+#define DEFINE_MARGINALS(S, T, I, W, MANTISSA, BIAS, EXPTERMS, LOW, RESCALE_LOW,        \
+                         RESCALE_HIGH, EXACT_BELOW)                                     \
+    typedef T marginalVector##S __attribute__((vector_size(MARGINAL_BYTES)));           \
+    typedef I marginalBits##S __attribute__((vector_size(MARGINAL_BYTES)));             \
+                                                                                        \
+    /* Sets x to its exp, through a pointer so no vector is passed by value. */         \
+    static inline __attribute__((always_inline)) void fastExp##S(marginalVector##S *v)  \
+    {                                                                                   \
+        marginalVector##S x = *v;                                                       \
+        marginalBits##S under = x < (T)(LOW);                                           \
+        x = MARGINAL_SELECT(under, (marginalVector##S){0} + (T)(LOW), x);               \
+        /* Adding 1.5 * 2^MANTISSA rounds to an integer held in the low bits. */        \
+        const T shifter = (T)((I)3 << ((MANTISSA) - 1));                                \
+        marginalVector##S k = x * (T)LOG2E + shifter;                                   \
+        marginalBits##S n = (marginalBits##S)k -                                        \
+                            (marginalBits##S)((marginalVector##S){0} + shifter);        \
+        k -= shifter;                                                                   \
+        marginalVector##S r = x - k * (T)LN2HI - k * (T)LN2LO;                          \
+        marginalVector##S series = (marginalVector##S){0} + (T)1;                       \
+        _Pragma("GCC unroll 16") for (int d = EXPTERMS; d >= 1; d--)                    \
+        {                                                                               \
+            series = (T)1 + series * (r * ((T)1 / d));                                  \
+        }                                                                               \
+        marginalVector##S scale = (marginalVector##S)((n + (BIAS)) << (MANTISSA));      \
+        *v = MARGINAL_SELECT(under, (marginalVector##S){0}, series * scale);            \
+    }                                                                                   \
+                                                                                        \
+    /* Swaps lanes step apart, for reducing across a vector in log2 W steps. */         \
+    static inline __attribute__((always_inline)) void                                   \
+    swapLanes##S(const marginalVector##S *v, int step, marginalVector##S *swapped)      \
+    {                                                                                   \
+        marginalBits##S mask;                                                           \
+        for (int j = 0; j < W; j++)                                                     \
+        {                                                                               \
+            mask[j] = j ^ step;                                                         \
+        }                                                                               \
+        *swapped = __builtin_shuffle(*v, mask);                                         \
+    }                                                                                   \
+                                                                                        \
+    static inline __attribute__((always_inline)) T                                      \
+    horizontalMax##S(const marginalVector##S *v, int vectors)                           \
+    {                                                                                   \
+        marginalVector##S best = v[0];                                                  \
+        for (int h = 1; h < vectors; h++)                                               \
+        {                                                                               \
+            best = MARGINAL_SELECT(v[h] > best, v[h], best);                            \
+        }                                                                               \
+        _Pragma("GCC unroll 8") for (int step = W / 2; step > 0; step /= 2)             \
+        {                                                                               \
+            marginalVector##S swapped;                                                  \
+            swapLanes##S(&best, step, &swapped);                                        \
+            best = MARGINAL_SELECT(swapped > best, swapped, best);                      \
+        }                                                                               \
+        return best[0];                                                                 \
+    }                                                                                   \
+                                                                                        \
+    static inline __attribute__((always_inline)) T                                      \
+    horizontalSum##S(const marginalVector##S *v, int vectors)                           \
+    {                                                                                   \
+        marginalVector##S sum = v[0];                                                   \
+        for (int h = 1; h < vectors; h++)                                               \
+        {                                                                               \
+            sum += v[h];                                                                \
+        }                                                                               \
+        _Pragma("GCC unroll 8") for (int step = W / 2; step > 0; step /= 2)             \
+        {                                                                               \
+            marginalVector##S swapped;                                                  \
+            swapLanes##S(&sum, step, &swapped);                                         \
+            sum += swapped;                                                             \
+        }                                                                               \
+        return sum[0];                                                                  \
+    }                                                                                   \
+                                                                                        \
+    static marginalVector##S *allocVectors##S(size_t count)                             \
+    {                                                                                   \
+        marginalVector##S *vectors = (marginalVector##S *)aligned_alloc(                \
+            sizeof(marginalVector##S), sizeof(marginalVector##S) * (count > 0 ? count : 1)); \
+        assert(vectors);                                                                \
+        return vectors;                                                                 \
+    }                                                                                   \
+                                                                                        \
+    /*                                                                                  \
+        Redoes weights which have all but underflowed exactly, from the                 \
+        weights of the term before (forward) or after (backward), of                    \
+        fromTable, with the largest taken out as a log added to logShift.               \
+        Table is the table of the term the weights are for.                             \
+    */                                                                                  \
+    static void redoExactly##S(struct lattice *l, const marginalVector##S *from,        \
+                               int fromTable, int table, int forward,                   \
+                               marginalVector##S *weights, double *logShift)            \
+    {                                                                                   \
+        int colourCount = l->colourCount;                                               \
+        const int *row = LATTICE_ROW(l, table);                                         \
+        const int *next = LATTICE_ROW(l, fromTable);                                    \
+        double *exact = (double *)calloc(colourCount * 2, sizeof(double));              \
+        assert(exact);                                                                  \
+        const int *shiftRow = forward ? row : next;                                     \
+        int rowBest = LATTICE_NONALLOWED;                                               \
+        for (int k = 0; k < colourCount; k++)                                           \
+        {                                                                               \
+            if (shiftRow[k] > rowBest)                                                  \
+            {                                                                           \
+                rowBest = shiftRow[k];                                                  \
+            }                                                                           \
+        }                                                                               \
+        for (int k = 0; k < colourCount; k++)                                           \
+        {                                                                               \
+            exact[k] = log((double)((const T *)from)[k]);                               \
+            if (!forward)                                                               \
+            {                                                                           \
+                exact[k] += (next[k] == LATTICE_NONALLOWED) ? -INFINITY                 \
+                                                            : next[k] - rowBest;        \
+            }                                                                           \
+        }                                                                               \
+        double *logs = exact + colourCount;                                             \
+        semiringStepLogSumExp(l, exact, fromTable, table, forward, 0, logs);            \
+        double best = -INFINITY;                                                        \
+        for (int j = 0; j < colourCount; j++)                                           \
+        {                                                                               \
+            best = (logs[j] > best) ? logs[j] : best;                                   \
+        }                                                                               \
+        for (int j = 0; j < colourCount; j++)                                           \
+        {                                                                               \
+            double emission = (forward && row[j] != LATTICE_NONALLOWED) ?               \
+                                  row[j] - rowBest : 0;                                 \
+            ((T *)weights)[j] = (T)exp(logs[j] + emission - best);                      \
+        }                                                                               \
+        *logShift += best;                                                              \
+        free(exact);                                                                    \
+    }                                                                                   \
+                                                                                        \
+    /*                                                                                  \
+        Returns the power of two which brings largest back to [1, 2),                   \
+        having multiplied weights by its inverse. Powers are exact, so                  \
+        this needs no log.                                                              \
+    */                                                                                  \
+    static inline __attribute__((always_inline)) int                                    \
+    rescale##S(int vectors, T largest, marginalVector##S *weights)                      \
+    {                                                                                   \
+        I bits;                                                                         \
+        memcpy(&bits, &largest, sizeof(bits));                                          \
+        int power = (int)(bits >> (MANTISSA)) - (BIAS);                                 \
+        I scaleBits = (I)((BIAS) - power) << (MANTISSA);                                \
+        T scale;                                                                        \
+        memcpy(&scale, &scaleBits, sizeof(scale));                                      \
+        for (int h = 0; h < vectors; h++)                                               \
+        {                                                                               \
+            weights[h] *= scale;                                                        \
+        }                                                                               \
+        return power;                                                                   \
+    }                                                                                   \
+                                                                                        \
+    /* Copies lane k of v into every lane of lane. */                                   \
+    static inline __attribute__((always_inline)) void                                   \
+    broadcastLane##S(const marginalVector##S *v, int k, marginalVector##S *lane)        \
+    {                                                                                   \
+        *lane = __builtin_shuffle(v[(unsigned)k / W], (marginalBits##S){0} + (unsigned)k % W); \
+    }                                                                                   \
+                                                                                        \
+    /* Sets weights to value in lane only and 0 elsewhere. */                           \
+    static inline __attribute__((always_inline)) void                                   \
+    placeLane##S(int vectors, int only, T value, marginalVector##S *weights)            \
+    {                                                                                   \
+        marginalBits##S lane;                                                           \
+        for (int j = 0; j < W; j++)                                                     \
+        {                                                                               \
+            lane[j] = j;                                                                \
+        }                                                                               \
+        for (int h = 0; h < vectors; h++)                                               \
+        {                                                                               \
+            weights[h] = MARGINAL_SELECT(lane + h * W == only,                          \
+                                         (marginalVector##S){0} + value,                \
+                                         (marginalVector##S){0});                       \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    /*                                                                                  \
+        Sets emission to exp of each colour's score for terms of the                    \
+        given table less the largest, which it returns, or 0 for colours                \
+        the table doesn't allow. Built in registers rather than by lane.                \
+    */                                                                                  \
+    static inline __attribute__((always_inline)) int                                    \
+    emissionWeights##S(struct lattice *l, int table, int vectors,                       \
+                       marginalVector##S *emission)                                     \
+    {                                                                                   \
+        const int *row = LATTICE_ROW(l, table);                                         \
+        int start = l->allowedStarts[table + 1];                                        \
+        int end = l->allowedStarts[table + 2];                                          \
+        marginalBits##S lane;                                                           \
+        for (int j = 0; j < W; j++)                                                     \
+        {                                                                               \
+            lane[j] = j;                                                                \
+        }                                                                               \
+        if (end - start == 1)                                                           \
+        {                                                                               \
+            placeLane##S(vectors, l->allowedColours[start], 1, emission);               \
+            return row[l->allowedColours[start]];                                       \
+        }                                                                               \
+        int rowBest = LATTICE_NONALLOWED;                                               \
+        for (int a = start; a < end; a++)                                               \
+        {                                                                               \
+            if (row[l->allowedColours[a]] > rowBest)                                    \
+            {                                                                           \
+                rowBest = row[l->allowedColours[a]];                                    \
+            }                                                                           \
+        }                                                                               \
+        for (int h = 0; h < vectors; h++)                                               \
+        {                                                                               \
+            marginalVector##S scores = (marginalVector##S){0} - (T)INFINITY;            \
+            for (int a = start; a < end; a++)                                           \
+            {                                                                           \
+                int j = l->allowedColours[a];                                           \
+                scores = MARGINAL_SELECT(lane + h * W == j,                             \
+                                         (marginalVector##S){0} + (T)(row[j] - rowBest), \
+                                         scores);                                       \
+            }                                                                           \
+            fastExp##S(&scores);                                                        \
+            emission[h] = scores;                                                       \
+        }                                                                               \
+        return rowBest;                                                                 \
+    }                                                                                   \
+                                                                                        \
+    /* The emission weights of each table, worked out when first needed. */             \
+    struct marginalEmissions##S                                                         \
+    {                                                                                   \
+        marginalVector##S *weights;                                                     \
+        int *largest;                                                                   \
+        unsigned char *ready;                                                           \
+    };                                                                                  \
+                                                                                        \
+    /* Returns the emission weights of the given table, setting largest as they do. */  \
+    static inline __attribute__((always_inline)) const marginalVector##S *             \
+    tableEmission##S(struct lattice *l, struct marginalEmissions##S *e, int table,      \
+                     int vectors, int *largest)                                         \
+    {                                                                                   \
+        size_t row = (size_t)(table + 1);                                               \
+        if (!e->ready[row])                                                             \
+        {                                                                               \
+            e->largest[row] = emissionWeights##S(l, table, vectors,                     \
+                                                 e->weights + row * vectors);           \
+            e->ready[row] = 1;                                                          \
+        }                                                                               \
+        *largest = e->largest[row];                                                     \
+        return e->weights + row * vectors;                                              \
+    }                                                                                   \
+                                                                                        \
+    /*                                                                                  \
+        Fills in alpha for every term, returning the power of two taken                 \
+        out of the weights. Inlined with vectors fixed at 1 for lattices                \
+        with few colours, so the step stays in registers.                               \
+    */                                                                                  \
+    static inline __attribute__((always_inline)) long long                              \
+    forwardPass##S(struct lattice *l, const int *termTables, int termCount,             \
+                   int vectors, const marginalVector##S *forwardRows,                   \
+                   struct marginalEmissions##S *emissions, marginalVector##S *alpha,    \
+                   double *logShift)                                                    \
+    {                                                                                   \
+        long long power = 0;                                                            \
+        for (int i = 0; i < termCount; i++)                                             \
+        {                                                                               \
+            int table = termTables[i];                                                  \
+            const int *row = LATTICE_ROW(l, table);                                     \
+            marginalVector##S *current = alpha + (size_t)i * vectors;                   \
+            int start = l->allowedStarts[table + 1];                                    \
+            if (i > 0 && l->allowedStarts[table + 2] - start == 1)                      \
+            {                                                                           \
+                /* A single colour needs just its own sum, as a scalar. */              \
+                int only = l->allowedColours[start];                                    \
+                *logShift += row[only];                                                 \
+                const T *previous = (const T *)(current - vectors);                     \
+                int previousTable = termTables[i - 1];                                  \
+                T value = 0;                                                            \
+                for (int a = l->allowedStarts[previousTable + 1];                       \
+                     a < l->allowedStarts[previousTable + 2]; a++)                      \
+                {                                                                       \
+                    int k = l->allowedColours[a];                                       \
+                    value += previous[k] * ((const T *)forwardRows)[(size_t)k * vectors * W + only]; \
+                }                                                                       \
+                placeLane##S(vectors, only, value, current);                            \
+                if (value < (T)(RESCALE_LOW) || value > (T)(RESCALE_HIGH))              \
+                {                                                                       \
+                    if (value < (T)(EXACT_BELOW))                                       \
+                    {                                                                   \
+                        redoExactly##S(l, current - vectors, termTables[i - 1], table, 1, \
+                                       current, logShift);                              \
+                        value = ((const T *)current)[only];                             \
+                    }                                                                   \
+                    power += rescale##S(vectors, value, current);                       \
+                }                                                                       \
+                continue;                                                               \
+            }                                                                           \
+            int largestEmission;                                                        \
+            const marginalVector##S *emission =                                         \
+                tableEmission##S(l, emissions, table, vectors, &largestEmission);       \
+            *logShift += largestEmission;                                               \
+            if (i == 0)                                                                 \
+            {                                                                           \
+                for (int h = 0; h < vectors; h++)                                       \
+                {                                                                       \
+                    current[h] = emission[h];                                           \
+                }                                                                       \
+                continue;                                                               \
+            }                                                                           \
+            const marginalVector##S *previous = current - vectors;                      \
+            int previousTable = termTables[i - 1];                                      \
+            for (int h = 0; h < vectors; h++)                                           \
+            {                                                                           \
+                current[h] = (marginalVector##S){0};                                    \
+            }                                                                           \
+            for (int a = l->allowedStarts[previousTable + 1];                           \
+                 a < l->allowedStarts[previousTable + 2]; a++)                          \
+            {                                                                           \
+                int k = l->allowedColours[a];                                           \
+                marginalVector##S weight;                                               \
+                broadcastLane##S(previous, k, &weight);                                 \
+                const marginalVector##S *transitions = forwardRows + (size_t)k * vectors; \
+                for (int h = 0; h < vectors; h++)                                       \
+                {                                                                       \
+                    current[h] += weight * transitions[h];                              \
+                }                                                                       \
+            }                                                                           \
+            for (int h = 0; h < vectors; h++)                                           \
+            {                                                                           \
+                current[h] *= emission[h];                                              \
+            }                                                                           \
+            T largest = horizontalMax##S(current, vectors);                             \
+            if (largest < (T)(RESCALE_LOW) || largest > (T)(RESCALE_HIGH))              \
+            {                                                                           \
+                if (largest < (T)(EXACT_BELOW))                                         \
+                {                                                                       \
+                    redoExactly##S(l, previous, termTables[i - 1], table, 1, current,   \
+                                   logShift);                                           \
+                    largest = horizontalMax##S(current, vectors);                       \
+                }                                                                       \
+                power += rescale##S(vectors, largest, current);                         \
+            }                                                                           \
+        }                                                                               \
+        return power;                                                                   \
+    }                                                                                   \
+                                                                                        \
+    /*                                                                                  \
+        Works backward from the last term, setting the marginals of each                \
+        term from its forward and backward weights. beta has space for                  \
+        three terms' weights.                                                           \
+    */                                                                                  \
+    static inline __attribute__((always_inline)) void                                   \
+    backwardPass##S(struct lattice *l, const int *termTables, int termCount,            \
+                    int vectors, const marginalVector##S *backwardRows,                 \
+                    struct marginalEmissions##S *emissions,                             \
+                    const marginalVector##S *alpha, marginalVector##S *beta,            \
+                    T *marginals)                                                       \
+    {                                                                                   \
+        int colourCount = l->colourCount;                                               \
+        marginalVector##S *next = beta;                                                 \
+        marginalVector##S *current = beta + vectors;                                    \
+        marginalVector##S *gamma = beta + vectors * 2;                                  \
+        for (int h = 0; h < vectors; h++)                                               \
+        {                                                                               \
+            current[h] = (marginalVector##S){0} + (T)1;                                 \
+        }                                                                               \
+        int largestEmission;                                                            \
+        const marginalVector##S *emission =                                             \
+            tableEmission##S(l, emissions, termTables[termCount - 1], vectors,          \
+                             &largestEmission);                                         \
+        double ignored = 0;                                                             \
+        for (int i = termCount - 1; i >= 0; i--)                                        \
+        {                                                                               \
+            if (i < termCount - 1)                                                      \
+            {                                                                           \
+                marginalVector##S *swap = next;                                         \
+                next = current;                                                         \
+                current = swap;                                                         \
+                const marginalVector##S *nextEmission = emission;                       \
+                emission = tableEmission##S(l, emissions, termTables[i], vectors,       \
+                                            &largestEmission);                          \
+                int nextTable = termTables[i + 1];                                      \
+                int start = l->allowedStarts[termTables[i] + 1];                        \
+                if (l->allowedStarts[termTables[i] + 2] - start == 1)                   \
+                {                                                                       \
+                    /* A single colour needs just its own sum, as a scalar. */          \
+                    int only = l->allowedColours[start];                                \
+                    T value = 0;                                                        \
+                    for (int a = l->allowedStarts[nextTable + 1];                       \
+                         a < l->allowedStarts[nextTable + 2]; a++)                      \
+                    {                                                                   \
+                        int k = l->allowedColours[a];                                   \
+                        value += ((const T *)next)[k] * ((const T *)nextEmission)[k] *  \
+                                 ((const T *)backwardRows)[(size_t)k * vectors * W + only]; \
+                    }                                                                   \
+                    placeLane##S(vectors, only, value, current);                        \
+                    if (value < (T)(RESCALE_LOW) || value > (T)(RESCALE_HIGH))          \
+                    {                                                                   \
+                        if (value < (T)(EXACT_BELOW))                                   \
+                        {                                                               \
+                            redoExactly##S(l, next, nextTable, termTables[i], 0,        \
+                                           current, &ignored);                          \
+                            value = ((const T *)current)[only];                         \
+                        }                                                               \
+                        rescale##S(vectors, value, current);                            \
+                    }                                                                   \
+                    T *row = marginals + (size_t)i * colourCount;                       \
+                    for (int j = 0; j < colourCount; j++)                               \
+                    {                                                                   \
+                        row[j] = 0;                                                     \
+                    }                                                                   \
+                    row[only] = 1;                                                      \
+                    continue;                                                           \
+                }                                                                       \
+                /* Weight of each next colour including its emission. */                \
+                for (int h = 0; h < vectors; h++)                                       \
+                {                                                                       \
+                    gamma[h] = next[h] * nextEmission[h];                               \
+                    current[h] = (marginalVector##S){0};                                \
+                }                                                                       \
+                for (int a = l->allowedStarts[nextTable + 1];                           \
+                     a < l->allowedStarts[nextTable + 2]; a++)                          \
+                {                                                                       \
+                    int k = l->allowedColours[a];                                       \
+                    marginalVector##S weight;                                           \
+                    broadcastLane##S(gamma, k, &weight);                                \
+                    const marginalVector##S *transitions = backwardRows + (size_t)k * vectors; \
+                    for (int h = 0; h < vectors; h++)                                   \
+                    {                                                                   \
+                        current[h] += weight * transitions[h];                          \
+                    }                                                                   \
+                }                                                                       \
+                /* Only colours this term allows count towards the largest. */          \
+                for (int h = 0; h < vectors; h++)                                       \
+                {                                                                       \
+                    gamma[h] = MARGINAL_SELECT(emission[h] > 0, current[h],             \
+                                               (marginalVector##S){0});                 \
+                }                                                                       \
+                T largest = horizontalMax##S(gamma, vectors);                           \
+                if (largest < (T)(RESCALE_LOW) || largest > (T)(RESCALE_HIGH))          \
+                {                                                                       \
+                    if (largest < (T)(EXACT_BELOW))                                     \
+                    {                                                                   \
+                        redoExactly##S(l, next, nextTable, termTables[i], 0, current,   \
+                                       &ignored);                                       \
+                        for (int h = 0; h < vectors; h++)                               \
+                        {                                                               \
+                            gamma[h] = MARGINAL_SELECT(emission[h] > 0, current[h],     \
+                                                       (marginalVector##S){0});         \
+                        }                                                               \
+                        largest = horizontalMax##S(gamma, vectors);                     \
+                    }                                                                   \
+                    rescale##S(vectors, largest, current);                              \
+                }                                                                       \
+            }                                                                           \
+            /* Marginals of term i, normalised on their own. */                         \
+            T *row = marginals + (size_t)i * colourCount;                               \
+            int start = l->allowedStarts[termTables[i] + 1];                            \
+            if (l->allowedStarts[termTables[i] + 2] - start == 1)                       \
+            {                                                                           \
+                for (int j = 0; j < colourCount; j++)                                   \
+                {                                                                       \
+                    row[j] = 0;                                                         \
+                }                                                                       \
+                row[l->allowedColours[start]] = 1;                                      \
+                continue;                                                               \
+            }                                                                           \
+            const marginalVector##S *forward = alpha + (size_t)i * vectors;             \
+            for (int h = 0; h < vectors; h++)                                           \
+            {                                                                           \
+                gamma[h] = forward[h] * current[h];                                     \
+            }                                                                           \
+            T scale = (T)1 / horizontalSum##S(gamma, vectors);                          \
+            for (int j = 0; j < colourCount; j++)                                       \
+            {                                                                           \
+                row[j] = ((const T *)gamma)[j] * scale;                                 \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    KERNEL_CLONES double                                                                \
+    latticeMarginals##S(struct lattice *l, const int *termTables, int termCount,        \
+                        T *marginals)                                                   \
+    {                                                                                   \
+        if (termCount == 0)                                                             \
+        {                                                                               \
+            return 0;                                                                   \
+        }                                                                               \
+        int colourCount = l->colourCount;                                               \
+        int vectors = (colourCount + W - 1) / W;                                        \
+        int lanes = vectors * W;                                                        \
+        /*                                                                              \
+            exp of each transition less the largest, by previous colour                 \
+            going forward and by next colour going backward.                            \
+        */                                                                              \
+        int largestTransition = l->transitions[0];                                      \
+        for (int i = 1; i < colourCount * colourCount; i++)                             \
+        {                                                                               \
+            if (l->transitions[i] > largestTransition)                                  \
+            {                                                                           \
+                largestTransition = l->transitions[i];                                  \
+            }                                                                           \
+        }                                                                               \
+        marginalVector##S *forwardRows = allocVectors##S((size_t)colourCount * vectors); \
+        marginalVector##S *backwardRows = allocVectors##S((size_t)colourCount * vectors); \
+        for (int k = 0; k < colourCount; k++)                                           \
+        {                                                                               \
+            T *forwardRow = (T *)(forwardRows + (size_t)k * vectors);                   \
+            T *backwardRow = (T *)(backwardRows + (size_t)k * vectors);                 \
+            for (int j = 0; j < lanes; j++)                                             \
+            {                                                                           \
+                forwardRow[j] = (j < colourCount)                                       \
+                                    ? l->transitions[k * colourCount + j] - largestTransition \
+                                    : -(T)INFINITY;                                     \
+                backwardRow[j] = (j < colourCount)                                      \
+                                     ? l->transitions[j * colourCount + k] - largestTransition \
+                                     : -(T)INFINITY;                                    \
+            }                                                                           \
+            for (int h = 0; h < vectors; h++)                                           \
+            {                                                                           \
+                fastExp##S(&(forwardRows[(size_t)k * vectors + h]));                    \
+                fastExp##S(&(backwardRows[(size_t)k * vectors + h]));                   \
+            }                                                                           \
+        }                                                                               \
+                                                                                        \
+        marginalVector##S *alpha = allocVectors##S((size_t)termCount * vectors);        \
+        marginalVector##S *beta = allocVectors##S((size_t)vectors * 3);                 \
+        /* Pages of tables no term has are never touched. */                            \
+        struct marginalEmissions##S emissions;                                          \
+        emissions.weights = allocVectors##S((size_t)l->rowCount * vectors);             \
+        emissions.largest = (int *)malloc(sizeof(int) * l->rowCount);                   \
+        assert(emissions.largest);                                                      \
+        emissions.ready = (unsigned char *)calloc(l->rowCount, 1);                      \
+        assert(emissions.ready);                                                        \
+        double logShift = (double)largestTransition * (termCount - 1);                  \
+        long long power;                                                                \
+        if (vectors == 1)                                                               \
+        {                                                                               \
+            power = forwardPass##S(l, termTables, termCount, 1, forwardRows,            \
+                                   &emissions, alpha, &logShift);                       \
+            backwardPass##S(l, termTables, termCount, 1, backwardRows, &emissions,      \
+                            alpha, beta, marginals);                                    \
+        }                                                                               \
+        else if (vectors == 2)                                                          \
+        {                                                                               \
+            power = forwardPass##S(l, termTables, termCount, 2, forwardRows,            \
+                                   &emissions, alpha, &logShift);                       \
+            backwardPass##S(l, termTables, termCount, 2, backwardRows, &emissions,      \
+                            alpha, beta, marginals);                                    \
+        }                                                                               \
+        else                                                                            \
+        {                                                                               \
+            power = forwardPass##S(l, termTables, termCount, vectors, forwardRows,      \
+                                   &emissions, alpha, &logShift);                       \
+            backwardPass##S(l, termTables, termCount, vectors, backwardRows,            \
+                            &emissions, alpha, beta, marginals);                        \
+        }                                                                               \
+        const marginalVector##S *last = alpha + (size_t)(termCount - 1) * vectors;      \
+        double logWeight = logShift + power * M_LN2 +                                   \
+                           log((double)horizontalSum##S(last, vectors));                \
+                                                                                        \
+        free(emissions.ready);                                                          \
+        free(emissions.largest);                                                        \
+        free(emissions.weights);                                                        \
+        free(beta);                                                                     \
+        free(alpha);                                                                    \
+        free(backwardRows);                                                             \
+        free(forwardRows);                                                              \
+        return logWeight;                                                               \
+    }
+
+DEFINE_MARGINALS(Float, float, int32_t, 8, 23, 127, 6, -87, 0x1p-40, 0x1p40, 0x1p-60)
+DEFINE_MARGINALS(Double, double, int64_t, 4, 52, 1023, 12, -708, 0x1p-300, 0x1p300, 0x1p-450)
+
+void solveProblemMarginals(struct problem *p, enum marginalPrecision precision,
+                           int colourMode, FILE *outFile)
+{
+    struct lattice *l = newLattice(p);
+    int colourCount = l->colourCount;
+    size_t size = (size_t)(p->termCount > 0 ? p->termCount : 1) * colourCount;
+    double *marginals = (double *)malloc(sizeof(double) * size);
+    assert(marginals);
+    if (precision == MARGINAL_FLOAT)
+    {
+        float *single = (float *)malloc(sizeof(float) * size);
+        assert(single);
+        latticeMarginalsFloat(l, p->termTables, p->termCount, single);
+        for (size_t i = 0; i < (size_t)p->termCount * colourCount; i++)
+        {
+            marginals[i] = single[i];
+        }
+        free(single);
+    }
+    else
+    {
+        latticeMarginalsDouble(l, p->termTables, p->termCount, marginals);
+    }
+    for (int i = 0; i < p->termCount; i++)
+    {
+        const double *row = marginals + (size_t)i * colourCount;
+        int likeliest = 0;
+        for (int j = 1; j < colourCount; j++)
+        {
+            if (row[j] > row[likeliest])
+            {
+                likeliest = j;
+            }
+        }
+        if (colourMode)
+        {
+            outputTerm(outFile, 0, p->terms[i], likeliest, colourMode);
+        }
+        else
+        {
+            fprintf(outFile, "%s", p->terms[i]);
+        }
+        for (int j = 0; j < colourCount; j++)
+        {
+            fprintf(outFile, " %.4f", row[j]);
+        }
+        fprintf(outFile, "\n");
+    }
+    free(marginals);
+    freeLattice(l);
+}
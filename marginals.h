@@ -0,0 +1,44 @@
+/*
+    Header for module which finds how likely each colour is for each
+        term of a Part F problem by forward-backward, treating the
+        table and transition scores as log-potentials.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef MARGINALS_H
+#define MARGINALS_H 1
+
+#ifndef MARGINALPRECISIONENUM_DEF
+#define MARGINALPRECISIONENUM_DEF 1
+enum marginalPrecision
+{
+    MARGINAL_FLOAT = 0,
+    MARGINAL_DOUBLE = 1
+};
+#endif
+
+/*
+    Weighting every colouring of the given sequence of table indices by
+    e to the power of its score, sets marginals[i * colourCount + j] to
+    the probability term i has colour j and returns the log of the sum
+    of the weights. Exps and logs are vectorised approximations good to
+    about the precision of the type. A forward and a backward pass
+    cost several Viterbi passes, measured at 2.5 to 4 times in float
+    and 2.3 to 5.5 times in double from 4 to 16 colours (see
+    ./benchmark marginals).
+*/
+double latticeMarginalsFloat(struct lattice *l, const int *termTables,
+                             int termCount, float *marginals);
+double latticeMarginalsDouble(struct lattice *l, const int *termTables,
+                              int termCount, double *marginals);
+
+/*
+    Outputs each term of the given Part F problem on its own line
+    followed by the probability of each colour. In colour mode the
+    term is drawn in its most likely colour.
+*/
+void solveProblemMarginals(struct problem *p, enum marginalPrecision precision,
+                           int colourMode, FILE *outFile);
+
+#endif
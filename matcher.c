@@ -0,0 +1,366 @@
+/*
+    Implementation for module which indexes the terms of the term
+        colour tables by their case-folded hash.
+
+    Terms are kept in an open-addressed table of slots split into
+    shards by the top bits of the term's hash, probing linearly within
+    a shard. Building runs twice over the threads: first each hashes a
+    range of the terms, then each fills in its own shards, going over
+    all the hashes in table order so the lowest of equal terms wins
+    without any locking. Terms and text are hashed as their case-folded
+    UTF-8 bytes, which are as long as the unfolded ones. A lookup hashes
+    the text one character at a time from the start and tries the index
+    at every letter boundary some term's length reaches, keeping the
+    longest hit, taking bytes straight through the ASCII tables when the
+    text it can reach is all ASCII. Pattern terms are left to their
+    DFA, whose match is taken over the index's only if it is longer.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include "matcher.h"
+#include "hash.h"
+#include "fold.h"
+#include "pattern.h"
+#include "problemStruct.c"
+
+/* Fewest slots in a shard. */
+#define MINSHARDSLOTS 16
+
+struct matcherBuild
+{
+    struct termMatcher *m;
+    const struct termColourTable *tables;
+    int tableCount;
+    unsigned long long *hashes;
+    int *lengths;
+    int threadCount;
+    /* The thread's range of tables to hash, and its longest term. */
+    int index;
+    int start;
+    int end;
+    int longestTerm;
+};
+
+/* Mixes the given bytes of a folded character into the given hash. */
+static inline unsigned long long foldBytes(unsigned long long hash, const char *folded, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        hash = (hash ^ (unsigned char)folded[i]) * HASH_PRIME;
+    }
+    return hash;
+}
+
+/* Whether the first length bytes of the text and term match ignoring case. */
+static int sameTerm(const char *text, const char *term, int length)
+{
+    int i = 0;
+    while (i < length)
+    {
+        unsigned char c = (unsigned char)text[i];
+        unsigned char d = (unsigned char)term[i];
+        if ((c | d) < 0x80)
+        {
+            if (foldAsciiCases[c] != foldAsciiCases[d])
+            {
+                return 0;
+            }
+            i++;
+            continue;
+        }
+        char textFolded[4];
+        char termFolded[4];
+        int bytes = foldAt(text, length, i, textFolded);
+        if (foldAt(term, length, i, termFolded) != bytes ||
+            memcmp(textFolded, termFolded, bytes) != 0)
+        {
+            return 0;
+        }
+        i += bytes;
+    }
+    return 1;
+}
+
+static inline int shardOf(const struct termMatcher *m, unsigned long long hash)
+{
+    return (m->shardBits == 0) ? 0 : (int)(hash >> (64 - m->shardBits));
+}
+
+static void *hashTerms(void *arg)
+{
+    struct matcherBuild *b = (struct matcherBuild *)arg;
+    b->longestTerm = 0;
+    for (int i = b->start; i < b->end; i++)
+    {
+        if (b->tables[i].pattern)
+        {
+            b->lengths[i] = 0;
+            continue;
+        }
+        const char *term = b->tables[i].term;
+        unsigned long long hash = HASH_SEED;
+        int length = strlen(term);
+        int position = 0;
+        while (position < length)
+        {
+            char folded[4];
+            int bytes = foldAt(term, length, position, folded);
+            hash = foldBytes(hash, folded, bytes);
+            position += bytes;
+        }
+        b->hashes[i] = hash;
+        b->lengths[i] = length;
+        if (length > b->longestTerm)
+        {
+            b->longestTerm = length;
+        }
+    }
+    return NULL;
+}
+
+static void *fillShards(void *arg)
+{
+    struct matcherBuild *b = (struct matcherBuild *)arg;
+    struct termMatcher *m = b->m;
+    int mask = m->shardSlots - 1;
+    for (int i = 0; i < b->tableCount; i++)
+    {
+        if (b->tables[i].pattern)
+        {
+            continue;
+        }
+        int shard = shardOf(m, b->hashes[i]);
+        if (shard % b->threadCount != b->index)
+        {
+            continue;
+        }
+        struct matcherSlot *slots = m->slots + (size_t)shard * m->shardSlots;
+        int slot = (int)(b->hashes[i] & mask);
+        while (slots[slot].table != -1)
+        {
+            if (slots[slot].hash == b->hashes[i] && slots[slot].length == b->lengths[i] &&
+                sameTerm(b->tables[i].term, b->tables[slots[slot].table].term, b->lengths[i]))
+            {
+                /* An earlier table has the same term. */
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot].table == -1)
+        {
+            slots[slot].hash = b->hashes[i];
+            slots[slot].table = i;
+            slots[slot].length = b->lengths[i];
+        }
+    }
+    return NULL;
+}
+
+struct termMatcher *newTermMatcher(const struct termColourTable *tables, int tableCount,
+                                   int threadCount)
+{
+    if (threadCount > tableCount / MATCHER_MIN_TERMS)
+    {
+        threadCount = tableCount / MATCHER_MIN_TERMS;
+    }
+    if (threadCount > MATCHER_MAX_THREADS)
+    {
+        threadCount = MATCHER_MAX_THREADS;
+    }
+    if (threadCount < 1)
+    {
+        threadCount = 1;
+    }
+    struct termMatcher *m = (struct termMatcher *)malloc(sizeof(struct termMatcher));
+    assert(m);
+    /* A shard for each thread, at most half full. */
+    m->shardBits = 0;
+    while ((1 << m->shardBits) < threadCount)
+    {
+        m->shardBits++;
+    }
+    int shardCount = 1 << m->shardBits;
+    m->shardSlots = MINSHARDSLOTS;
+    while ((long long)m->shardSlots * shardCount < 2LL * tableCount)
+    {
+        m->shardSlots *= 2;
+    }
+    size_t slotCount = (size_t)m->shardSlots * shardCount;
+    m->slots = (struct matcherSlot *)malloc(sizeof(struct matcherSlot) * slotCount);
+    assert(m->slots);
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        m->slots[i].table = -1;
+    }
+
+    unsigned long long *hashes = (unsigned long long *)malloc(sizeof(unsigned long long) *
+                                                              (tableCount > 0 ? tableCount : 1));
+    assert(hashes);
+    int *lengths = (int *)malloc(sizeof(int) * (tableCount > 0 ? tableCount : 1));
+    assert(lengths);
+    struct matcherBuild builds[MATCHER_MAX_THREADS];
+    for (int i = 0; i < threadCount; i++)
+    {
+        builds[i].m = m;
+        builds[i].tables = tables;
+        builds[i].tableCount = tableCount;
+        builds[i].hashes = hashes;
+        builds[i].lengths = lengths;
+        builds[i].threadCount = threadCount;
+        builds[i].index = i;
+        builds[i].start = (int)((long long)tableCount * i / threadCount);
+        builds[i].end = (int)((long long)tableCount * (i + 1) / threadCount);
+    }
+
+    void *(*phases[])(void *) = {hashTerms, fillShards};
+    pthread_t threads[MATCHER_MAX_THREADS];
+    for (int phase = 0; phase < 2; phase++)
+    {
+        for (int i = 1; i < threadCount; i++)
+        {
+            int created = pthread_create(&(threads[i]), NULL, phases[phase], &(builds[i]));
+            assert(created == 0);
+        }
+        /* This thread takes the first share. */
+        phases[phase](&(builds[0]));
+        for (int i = 1; i < threadCount; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    m->longestTerm = 0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (builds[i].longestTerm > m->longestTerm)
+        {
+            m->longestTerm = builds[i].longestTerm;
+        }
+    }
+    m->hasLength = (unsigned char *)calloc(m->longestTerm + 1, sizeof(unsigned char));
+    assert(m->hasLength);
+    for (int i = 0; i < tableCount; i++)
+    {
+        if (!tables[i].pattern)
+        {
+            m->hasLength[lengths[i]] = 1;
+        }
+    }
+    free(lengths);
+    free(hashes);
+    if (newPatternDfa(tables, tableCount, &(m->patterns)) != 0)
+    {
+        freeTermMatcher(m);
+        return NULL;
+    }
+    return m;
+}
+
+/* Returns the table of the term of the given length and hash at the text, or -1. */
+static inline int findTerm(const struct termMatcher *m, const struct termColourTable *tables,
+                           const char *text, unsigned long long hash, int termLength)
+{
+    int mask = m->shardSlots - 1;
+    const struct matcherSlot *slots = m->slots + (size_t)shardOf(m, hash) * m->shardSlots;
+    for (int slot = (int)(hash & mask); slots[slot].table != -1; slot = (slot + 1) & mask)
+    {
+        if (slots[slot].hash == hash && slots[slot].length == termLength &&
+            sameTerm(text, tables[slots[slot].table].term, termLength))
+        {
+            return slots[slot].table;
+        }
+    }
+    return -1;
+}
+
+/* Returns the table of the longest indexed term at start, as matchTerm does. */
+static inline int matchIndexed(const struct termMatcher *m, const struct termColourTable *tables,
+                               const char *text, int textLength, int start, int *length)
+{
+    int last = start + m->longestTerm;
+    if (last > textLength)
+    {
+        last = textLength;
+    }
+    int match = -1;
+    unsigned long long hash = HASH_SEED;
+    /* The character after the longest term is checked for a word boundary too. */
+    int window = ((last < textLength) ? last + 1 : last) - start;
+    if (foldIsAscii(text + start, window))
+    {
+        for (int end = start; end < last; end++)
+        {
+            hash = (hash ^ (unsigned char)foldAsciiCases[(unsigned char)text[end]]) * HASH_PRIME;
+            int termLength = end + 1 - start;
+            /* Terms only match up to a character which isn't a letter. */
+            if ((end + 1 < textLength && (foldAsciiClasses[(unsigned char)text[end + 1]] &
+                                          FOLD_LETTER)) ||
+                !m->hasLength[termLength])
+            {
+                continue;
+            }
+            int table = findTerm(m, tables, text + start, hash, termLength);
+            if (table >= 0)
+            {
+                match = table;
+                *length = termLength;
+            }
+        }
+        return match;
+    }
+    int end = start;
+    while (end < last)
+    {
+        char folded[4];
+        int bytes = foldAt(text, textLength, end, folded);
+        hash = foldBytes(hash, folded, bytes);
+        end += bytes;
+        if (end > last)
+        {
+            break;
+        }
+        int nextBytes;
+        if ((end < textLength && (foldClassAt(text, textLength, end, &nextBytes) & FOLD_LETTER)) ||
+            !m->hasLength[end - start])
+        {
+            continue;
+        }
+        int table = findTerm(m, tables, text + start, hash, end - start);
+        if (table >= 0)
+        {
+            match = table;
+            *length = end - start;
+        }
+    }
+    return match;
+}
+
+int matchTerm(const struct termMatcher *m, const struct termColourTable *tables,
+              const char *text, int textLength, int start, int *length)
+{
+    int match = matchIndexed(m, tables, text, textLength, start, length);
+    if (m->patterns)
+    {
+        int patternLength;
+        int pattern = matchPattern(m->patterns, text, textLength, start, &patternLength);
+        if (pattern >= 0 && (match < 0 || patternLength > *length))
+        {
+            match = pattern;
+            *length = patternLength;
+        }
+    }
+    return match;
+}
+
+void freeTermMatcher(struct termMatcher *m)
+{
+    if (m)
+    {
+        free(m->slots);
+        free(m->hasLength);
+        freePatternDfa(m->patterns);
+        free(m);
+    }
+}
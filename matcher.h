@@ -0,0 +1,70 @@
+/*
+    Header for module which indexes the terms of the term colour
+        tables by their case-folded hash, so the tokenizer finds the
+        longest term at a position without trying every table.
+*/
+
+#ifndef MATCHER_H
+#define MATCHER_H 1
+
+struct termColourTable;
+
+struct patternDfa;
+
+/* The most threads newTermMatcher runs. */
+#define MATCHER_MAX_THREADS 64
+
+/* Each thread indexes at least this many terms. */
+#define MATCHER_MIN_TERMS 65536
+
+struct matcherSlot
+{
+    /* Case-folded hash of the term, only meaningful if table is not -1. */
+    unsigned long long hash;
+    /* The table of the term, or -1 for an empty slot. */
+    int table;
+    int length;
+};
+
+struct termMatcher
+{
+    /* Slots are split into 2^shardBits shards by the top bits of the hash. */
+    int shardBits;
+    /* Slots per shard, a power of two. */
+    int shardSlots;
+    struct matcherSlot *slots;
+    /* The length of the longest term. */
+    int longestTerm;
+    /* Whether any term has each length up to longestTerm. */
+    unsigned char *hasLength;
+    /* The DFA the pattern terms are compiled into, or NULL if there are none. */
+    struct patternDfa *patterns;
+};
+
+/*
+    Indexes the terms of the given tables on up to threadCount threads
+    (including the calling one), each filling in its own shards. Where
+    terms are the same ignoring case, the lowest table is indexed.
+    Pattern terms aren't indexed but compiled into a DFA. Returns NULL
+    if the patterns need more than PATTERN_MAX_STATES DFA states.
+*/
+struct termMatcher *newTermMatcher(const struct termColourTable *tables, int tableCount,
+                                   int threadCount);
+
+/*
+    Returns the table of the longest term which matches the given text
+    at start ignoring case and is followed by a character which isn't
+    a letter, setting length to the term's length, or -1 if none does.
+    The terms are those of the tables the matcher was built from, where
+    a term and a pattern match the same text the term is taken. No
+    more than textLength characters of the text are read.
+*/
+int matchTerm(const struct termMatcher *m, const struct termColourTable *tables,
+              const char *text, int textLength, int start, int *length);
+
+/*
+    Frees the given matcher and all memory allocated for it.
+*/
+void freeTermMatcher(struct termMatcher *m);
+
+#endif
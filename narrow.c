@@ -0,0 +1,335 @@
+/*
+    Implementation for module which solves a lattice with its scores
+        held in 16 bits.
+
+    The kernels are those of kernels.c over shorts rather than ints,
+    so the 16 colours which took two vectors of eight lanes take one
+    of sixteen. Sums stay narrow because the scores of a term are
+    never far apart: any allowed colour can be reached from the best
+    colour of the term before, so it scores at most two steps' worth
+    below the best, a step being the widest transition and emission
+    together. Taking the scores relative to the best leaves them
+    between that and 0, and each term after moves the best by at most
+    a step, so the interval between renormalisations is the number of
+    steps which fit in NARROW_LIMIT with two to spare. The subtracted
+    bests add up to the total in a long long, checked against an int
+    at the end. A run of terms allowing one colour carries its score
+    in a long long and leaves that colour at 0.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include "narrow.h"
+#include "kernels.h"
+#include "problemStruct.c"
+
+/* Gets the narrow emission row for the given table index (-1 for no table). */
+#define NARROW_ROW(n, table) ((n)->emissions + ((table) + 1) * (n)->l->colourCount)
+
+/*
+    Defines narrowSolveN, latticeSolve for N colours in N / W vectors
+    of W shorts, returning 0 without a colouring if the total doesn't
+    fit an int.
+*/
+#define DEFINE_NARROW_KERNEL(N, W)                                                  \
+    typedef short narrowVector##N __attribute__((vector_size(W * sizeof(short))));  \
+    typedef unsigned char narrowBytes##N __attribute__((vector_size(W)));           \
+                                                                                    \
+    /* Takes the best of scores from all its allowed scores, adding it to total. */ \
+    static inline void renormalise##N(narrowVector##N scores[N / W],                \
+                                      long long *total)                             \
+    {                                                                               \
+        short best = NARROW_NONALLOWED;                                             \
+        for (int j = 0; j < N; j++)                                                 \
+        {                                                                           \
+            if (scores[j / W][j % W] > best)                                        \
+            {                                                                       \
+                best = scores[j / W][j % W];                                        \
+            }                                                                       \
+        }                                                                           \
+        for (int h = 0; h < N / W; h++)                                             \
+        {                                                                           \
+            narrowVector##N allowed = scores[h] != NARROW_NONALLOWED;               \
+            scores[h] = ((scores[h] - best) & allowed) |                            \
+                        (NARROW_NONALLOWED & ~allowed);                             \
+        }                                                                           \
+        *total += best;                                                             \
+    }                                                                               \
+                                                                                    \
+    KERNEL_CLONES static int                                                        \
+    narrowSolve##N(struct narrowLattice *n, const int *termTables, int termCount,   \
+                   int *colours, int *score)                                        \
+    {                                                                               \
+        struct lattice *l = n->l;                                                   \
+        narrowVector##N transitions[N][N / W];                                      \
+        memcpy(transitions, n->transitions, sizeof(transitions));                   \
+        unsigned char *back = NULL;                                                 \
+        if (colours)                                                                \
+        {                                                                           \
+            back = (unsigned char *)malloc((size_t)N * termCount);                  \
+            assert(back);                                                           \
+        }                                                                           \
+        long long total = 0;                                                        \
+        int sinceRenormalised = 0;                                                  \
+        narrowVector##N scores[N / W];                                              \
+        memcpy(scores, NARROW_ROW(n, termTables[0]), sizeof(scores));               \
+        renormalise##N(scores, &total);                                             \
+        for (int i = 1; i < termCount; i++)                                         \
+        {                                                                           \
+            int table = termTables[i];                                              \
+            int allowedStart = l->allowedStarts[table + 1];                         \
+            if (l->allowedStarts[table + 2] - allowedStart == 1)                    \
+            {                                                                       \
+                /* Only one colour allowed, as for words without a table. */        \
+                int only = l->allowedColours[allowedStart];                         \
+                int previousTable = termTables[i - 1];                              \
+                int onlyBest = INT_MIN;                                             \
+                int onlyColour = 0;                                                 \
+                for (int a = l->allowedStarts[previousTable + 1];                   \
+                     a < l->allowedStarts[previousTable + 2]; a++)                  \
+                {                                                                   \
+                    int k = l->allowedColours[a];                                   \
+                    int score = scores[k / W][k % W] +                              \
+                                n->transitions[k * N + only];                       \
+                    if (score > onlyBest)                                           \
+                    {                                                               \
+                        onlyBest = score;                                           \
+                        onlyColour = k;                                             \
+                    }                                                               \
+                }                                                                   \
+                long long runBest = onlyBest + NARROW_ROW(n, table)[only];          \
+                if (back)                                                           \
+                {                                                                   \
+                    back[(size_t)i * N + only] = onlyColour;                        \
+                }                                                                   \
+                /* A run of such terms only ever has one colour to come from. */    \
+                while (i + 1 < termCount &&                                         \
+                       l->allowedStarts[termTables[i + 1] + 2] -                    \
+                       l->allowedStarts[termTables[i + 1] + 1] == 1)                \
+                {                                                                   \
+                    i++;                                                            \
+                    int nextStart = l->allowedStarts[termTables[i] + 1];            \
+                    int next = l->allowedColours[nextStart];                        \
+                    runBest += n->transitions[only * N + next] +                    \
+                               NARROW_ROW(n, termTables[i])[next];                  \
+                    if (back)                                                       \
+                    {                                                               \
+                        back[(size_t)i * N + next] = only;                          \
+                    }                                                               \
+                    only = next;                                                    \
+                }                                                                   \
+                for (int h = 0; h < N / W; h++)                                     \
+                {                                                                   \
+                    scores[h] = (narrowVector##N){0} + NARROW_NONALLOWED;           \
+                }                                                                   \
+                scores[only / W][only % W] = 0;                                     \
+                total += runBest;                                                   \
+                sinceRenormalised = 0;                                              \
+                continue;                                                           \
+            }                                                                       \
+            narrowVector##N emission[N / W];                                        \
+            memcpy(emission, NARROW_ROW(n, table), sizeof(emission));               \
+            narrowVector##N best[N / W];                                            \
+            narrowVector##N bestColour[N / W];                                      \
+            /* Only the colours the term before allows can lead here. */            \
+            int previousStart = l->allowedStarts[termTables[i - 1] + 1];            \
+            int previousEnd = l->allowedStarts[termTables[i - 1] + 2];              \
+            int first = l->allowedColours[previousStart];                           \
+            for (int h = 0; h < N / W; h++)                                         \
+            {                                                                       \
+                best[h] = scores[first / W][first % W] + transitions[first][h];     \
+                bestColour[h] = (narrowVector##N){0} + (short)first;                \
+            }                                                                       \
+            for (int a = previousStart + 1; a < previousEnd; a++)                   \
+            {                                                                       \
+                short k = l->allowedColours[a];                                     \
+                short previous = scores[k / W][k % W];                              \
+                for (int h = 0; h < N / W; h++)                                     \
+                {                                                                   \
+                    narrowVector##N score = previous + transitions[k][h];           \
+                    narrowVector##N better = score > best[h];                       \
+                    best[h] = (score & better) | (best[h] & ~better);               \
+                    bestColour[h] = (k & better) | (bestColour[h] & ~better);       \
+                }                                                                   \
+            }                                                                       \
+            for (int h = 0; h < N / W; h++)                                         \
+            {                                                                       \
+                narrowVector##N next = best[h] + emission[h];                       \
+                narrowVector##N low = next < NARROW_NONALLOWED;                     \
+                next = (NARROW_NONALLOWED & low) | (next & ~low);                   \
+                narrowVector##N allowed = emission[h] != NARROW_NONALLOWED;         \
+                scores[h] = (next & allowed) | (NARROW_NONALLOWED & ~allowed);      \
+                if (back)                                                           \
+                {                                                                   \
+                    narrowBytes##N bytes = __builtin_convertvector(bestColour[h],   \
+                                                                   narrowBytes##N); \
+                    memcpy(back + (size_t)i * N + h * W, &bytes, W);                \
+                }                                                                   \
+            }                                                                       \
+            if (++sinceRenormalised >= n->interval)                                 \
+            {                                                                       \
+                renormalise##N(scores, &total);                                     \
+                sinceRenormalised = 0;                                              \
+            }                                                                       \
+        }                                                                           \
+        int colour = 0;                                                             \
+        for (int j = 1; j < N; j++)                                                 \
+        {                                                                           \
+            if (scores[j / W][j % W] > scores[colour / W][colour % W])              \
+            {                                                                       \
+                colour = j;                                                         \
+            }                                                                       \
+        }                                                                           \
+        total += scores[colour / W][colour % W];                                    \
+        if (total < INT_MIN || total > INT_MAX)                                     \
+        {                                                                           \
+            free(back);                                                             \
+            return 0;                                                               \
+        }                                                                           \
+        *score = (int)total;                                                        \
+        if (colours)                                                                \
+        {                                                                           \
+            for (int i = termCount - 1; i > 0; i--)                                 \
+            {                                                                       \
+                colours[i] = colour;                                                \
+                colour = back[(size_t)i * N + colour];                              \
+            }                                                                       \
+            colours[0] = colour;                                                    \
+            free(back);                                                             \
+        }                                                                           \
+        return 1;                                                                   \
+    }
+
+DEFINE_NARROW_KERNEL(4, 4)
+DEFINE_NARROW_KERNEL(8, 8)
+DEFINE_NARROW_KERNEL(16, 16)
+
+struct narrowLattice *newNarrowLattice(struct lattice *l)
+{
+    struct narrowLattice *n = (struct narrowLattice *)malloc(sizeof(struct narrowLattice));
+    assert(n);
+    int colourCount = l->colourCount;
+    n->l = l;
+    n->emissions = NULL;
+    n->transitions = NULL;
+    n->interval = 0;
+    n->reason = NULL;
+    n->narrowed = 0;
+    if (colourCount != 4 && colourCount != 8 && colourCount != 16)
+    {
+        n->reason = "no narrow kernel for this many colours";
+        return n;
+    }
+
+    /* The widest step, a transition then an emission. */
+    long long widestTransition = 0;
+    for (int i = 0; i < colourCount * colourCount; i++)
+    {
+        long long width = llabs(l->transitions[i]);
+        if (width > widestTransition)
+        {
+            widestTransition = width;
+        }
+    }
+    long long widestEmission = 0;
+    for (int i = 0; i < l->rowCount * colourCount; i++)
+    {
+        if (l->emissions[i] != LATTICE_NONALLOWED)
+        {
+            long long width = llabs(l->emissions[i]);
+            if (width > widestEmission)
+            {
+                widestEmission = width;
+            }
+        }
+    }
+    long long step = widestTransition + widestEmission;
+    /* The scores of a term span two steps, and one more is taken per term. */
+    if (step > 0 && NARROW_LIMIT / step - 2 < 1)
+    {
+        n->reason = "scores too wide for 16 bits";
+        return n;
+    }
+    n->interval = (step > 0) ? (int)(NARROW_LIMIT / step - 2) : INT_MAX;
+
+    n->transitions = (short *)malloc(sizeof(short) * colourCount * colourCount);
+    assert(n->transitions);
+    for (int i = 0; i < colourCount * colourCount; i++)
+    {
+        n->transitions[i] = (short)l->transitions[i];
+    }
+    n->emissions = (short *)malloc(sizeof(short) * l->rowCount * colourCount);
+    assert(n->emissions);
+    for (int i = 0; i < l->rowCount * colourCount; i++)
+    {
+        n->emissions[i] = (l->emissions[i] == LATTICE_NONALLOWED) ? NARROW_NONALLOWED
+                                                                  : (short)l->emissions[i];
+    }
+    return n;
+}
+
+int latticeSolveNarrow(struct narrowLattice *n, const int *termTables, int termCount,
+                       int *colours)
+{
+    int score = 0;
+    n->narrowed = (n->interval > 0);
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    if (n->narrowed)
+    {
+        n->narrowed = 0;
+        switch (n->l->colourCount)
+        {
+        case 4:
+            n->narrowed = narrowSolve4(n, termTables, termCount, colours, &score);
+            break;
+        case 8:
+            n->narrowed = narrowSolve8(n, termTables, termCount, colours, &score);
+            break;
+        case 16:
+            n->narrowed = narrowSolve16(n, termTables, termCount, colours, &score);
+            break;
+        }
+    }
+    if (!n->narrowed)
+    {
+        score = latticeSolve(n->l, termTables, termCount, colours);
+    }
+    return score;
+}
+
+void solveProblemNarrow(struct problem *p, int colourMode, FILE *outFile, FILE *statsFile)
+{
+    struct lattice *l = newLattice(p);
+    struct narrowLattice *n = newNarrowLattice(l);
+    int *colours = (int *)malloc(sizeof(int) * (p->termCount > 0 ? p->termCount : 1));
+    assert(colours);
+    latticeSolveNarrow(n, p->termTables, p->termCount, colours);
+    if (statsFile && n->narrowed)
+    {
+        fprintf(statsFile, "narrow: 16-bit scores over %d colours, renormalised every %d terms\n",
+                l->colourCount, n->interval);
+    }
+    else if (statsFile)
+    {
+        fprintf(statsFile, "narrow: 32-bit scores, %s\n",
+                n->reason ? n->reason : "total too large for an int");
+    }
+    outputColouring(outFile, p, colours, colourMode);
+    free(colours);
+    freeNarrowLattice(n);
+    freeLattice(l);
+}
+
+void freeNarrowLattice(struct narrowLattice *n)
+{
+    if (n)
+    {
+        free(n->emissions);
+        free(n->transitions);
+        free(n);
+    }
+}
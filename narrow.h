@@ -0,0 +1,77 @@
+/*
+    Header for module which solves a lattice with its emission and
+        transition scores held in 16 bits rather than 32, so a vector
+        holds twice as many colours, taking the scores of each term
+        relative to the best now and again to keep them narrow.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef NARROW_H
+#define NARROW_H 1
+
+/*
+    Marker for non-allowed colours in narrow scores, low enough that a
+    score, a transition and an emission sum without leaving 16 bits.
+*/
+#define NARROW_NONALLOWED (-8192)
+
+/* Most any allowed narrow score may be from the best of its term. */
+#define NARROW_LIMIT 8191
+
+/*
+    The scores of a lattice narrowed to 16 bits. Not safe to share
+    between threads.
+*/
+struct narrowLattice
+{
+    struct lattice *l;
+    /* As in l, with LATTICE_NONALLOWED as NARROW_NONALLOWED. */
+    short *emissions;
+    short *transitions;
+    /*
+        Terms which may pass before the scores have to be taken
+        relative to the best again, 0 if l can't be narrowed, because
+        its scores are too wide or there's no narrow kernel for its
+        number of colours.
+    */
+    int interval;
+    /* Why l can't be narrowed, NULL if it can. */
+    const char *reason;
+    /* Whether the last solve was narrow rather than falling back. */
+    int narrowed;
+};
+
+/*
+    Returns the given lattice narrowed if it has 4, 8 or 16 colours
+    and the widest transition and emission scores together leave room
+    to take a few terms between renormalisations, or with an interval
+    of 0 otherwise. The lattice must outlive it.
+*/
+struct narrowLattice *newNarrowLattice(struct lattice *l);
+
+/*
+    Same as latticeSolve, but in the narrow scores, subtracting the
+    best score of a term from all its scores every interval terms and
+    adding them back up for the total. Falls back to latticeSolve if
+    the lattice couldn't be narrowed or the total doesn't fit an int.
+    Results are identical to latticeSolve unless a score falls to
+    LATTICE_NONALLOWED.
+*/
+int latticeSolveNarrow(struct narrowLattice *n, const int *termTables, int termCount,
+                       int *colours);
+
+/*
+    Outputs the colouring latticeSolveNarrow finds for the given Part F
+    problem as outputProblem does, saying on statsFile, if not NULL,
+    whether it was narrow or why not.
+*/
+void solveProblemNarrow(struct problem *p, int colourMode, FILE *outFile, FILE *statsFile);
+
+/*
+    Frees the given narrowed lattice and all memory allocated for it,
+    but not its lattice.
+*/
+void freeNarrowLattice(struct narrowLattice *n);
+
+#endif
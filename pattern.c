@@ -0,0 +1,503 @@
+/*
+    Implementation for module which compiles the pattern terms of the
+        term colour tables into one DFA.
+
+    Each pattern is a sequence of folded characters and wildcards,
+    and together they make an NFA with a state for each position in
+    each pattern: a character moves on to the next position, while a
+    wildcard can be skipped or loop on any letter. The DFA is built
+    from it by subset construction over character classes, each
+    character of the patterns in a class of its own and every other
+    letter or other character sharing one, so the transition table
+    stays small however many characters the text has. Bytes which
+    aren't valid UTF-8 are taken as characters past Unicode, so they
+    only match themselves.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "pattern.h"
+#include "hash.h"
+#include "fold.h"
+#include "problemStruct.c"
+
+/* Items of the NFA which aren't characters. */
+#define ITEM_WILDCARD -1
+#define ITEM_END -2
+
+/* Invalid bytes are characters from here up. */
+#define INVALID_CHARACTERS 0x110000
+
+/* Classes for characters not in a pattern. */
+#define CLASS_OTHER 0
+#define CLASS_LETTER 1
+
+/* Number of DFA states to allocate space for initially. */
+#define INITIALSTATES 64
+
+struct patternBuild
+{
+    /* Each NFA state's character, or ITEM_WILDCARD or ITEM_END. */
+    int *items;
+    /* The class of each character item, and table of each end item. */
+    int *itemClasses;
+    int *itemTables;
+    int itemCount;
+    int *classLetters;
+    /* The sets of NFA states each DFA state stands for, one after another. */
+    int *sets;
+    int setsUsed;
+    int setsAllocated;
+    int *setStarts;
+    int *setSizes;
+    int statesAllocated;
+    /* Open-addressed index of the sets, by their hash, to their state. */
+    int *index;
+    int indexSlots;
+    /* Scratch for making a set, stamped to mark its members. */
+    int *members;
+    int *stamps;
+    int stamp;
+};
+
+static int compareInts(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns the class of the given folded character, from those in the patterns. */
+static int classOf(const struct patternDfa *d, int character)
+{
+    if (character < 128)
+    {
+        return d->asciiClasses[character];
+    }
+    int low = 0;
+    int high = d->wideCount - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        if (character < d->wideCharacters[middle])
+        {
+            high = middle - 1;
+        }
+        else if (character > d->wideCharacters[middle])
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            return d->wideClasses[middle];
+        }
+    }
+    if (character >= INVALID_CHARACTERS)
+    {
+        return CLASS_OTHER;
+    }
+    return (foldClass(character) & FOLD_LETTER) ? CLASS_LETTER : CLASS_OTHER;
+}
+
+/* Adds the given NFA state and those reached by skipping wildcards to the members. */
+static void addMember(struct patternBuild *b, int *memberCount, int item)
+{
+    while (b->stamps[item] != b->stamp)
+    {
+        b->stamps[item] = b->stamp;
+        b->members[(*memberCount)++] = item;
+        if (b->items[item] != ITEM_WILDCARD)
+        {
+            break;
+        }
+        item++;
+    }
+}
+
+static unsigned long long hashSet(const int *set, int size)
+{
+    return hashBytes(HASH_SEED, set, sizeof(int) * size);
+}
+
+/*
+    Returns the DFA state for the given sorted set, adding it if it's
+    new, or -1 if the DFA already has PATTERN_MAX_STATES states.
+*/
+static int findState(struct patternDfa *d, struct patternBuild *b, const int *set, int size)
+{
+    int mask = b->indexSlots - 1;
+    int slot = (int)(hashSet(set, size) & mask);
+    while (b->index[slot] != -1)
+    {
+        int state = b->index[slot];
+        if (b->setSizes[state] == size &&
+            memcmp(b->sets + b->setStarts[state], set, sizeof(int) * size) == 0)
+        {
+            return state;
+        }
+        slot = (slot + 1) & mask;
+    }
+    int state = d->stateCount;
+    /* Past this, the patterns are too tangled to load. */
+    if (state >= PATTERN_MAX_STATES)
+    {
+        return -1;
+    }
+    d->stateCount++;
+    if (state >= b->statesAllocated)
+    {
+        b->statesAllocated *= 2;
+        b->setStarts = (int *)realloc(b->setStarts, sizeof(int) * b->statesAllocated);
+        assert(b->setStarts);
+        b->setSizes = (int *)realloc(b->setSizes, sizeof(int) * b->statesAllocated);
+        assert(b->setSizes);
+        d->accepts = (int *)realloc(d->accepts, sizeof(int) * b->statesAllocated);
+        assert(d->accepts);
+        d->next = (int *)realloc(d->next, sizeof(int) * b->statesAllocated * d->classCount);
+        assert(d->next);
+    }
+    if (b->setsUsed + size > b->setsAllocated)
+    {
+        while (b->setsUsed + size > b->setsAllocated)
+        {
+            b->setsAllocated *= 2;
+        }
+        b->sets = (int *)realloc(b->sets, sizeof(int) * b->setsAllocated);
+        assert(b->sets);
+    }
+    memcpy(b->sets + b->setsUsed, set, sizeof(int) * size);
+    b->setStarts[state] = b->setsUsed;
+    b->setSizes[state] = size;
+    b->setsUsed += size;
+    d->accepts[state] = -1;
+    for (int i = 0; i < size; i++)
+    {
+        int table = b->itemTables[set[i]];
+        if (table >= 0 && (d->accepts[state] < 0 || table < d->accepts[state]))
+        {
+            d->accepts[state] = table;
+        }
+    }
+    b->index[slot] = state;
+
+    /* Keep the index at most half full. */
+    if (2 * d->stateCount > b->indexSlots)
+    {
+        b->indexSlots *= 2;
+        b->index = (int *)realloc(b->index, sizeof(int) * b->indexSlots);
+        assert(b->index);
+        for (int i = 0; i < b->indexSlots; i++)
+        {
+            b->index[i] = -1;
+        }
+        mask = b->indexSlots - 1;
+        for (int s = 0; s < d->stateCount; s++)
+        {
+            int s2 = (int)(hashSet(b->sets + b->setStarts[s], b->setSizes[s]) & mask);
+            while (b->index[s2] != -1)
+            {
+                s2 = (s2 + 1) & mask;
+            }
+            b->index[s2] = s;
+        }
+    }
+    return state;
+}
+
+int newPatternDfa(const struct termColourTable *tables, int tableCount, struct patternDfa **dfa)
+{
+    *dfa = NULL;
+    int itemCount = 0;
+    for (int i = 0; i < tableCount; i++)
+    {
+        if (tables[i].pattern)
+        {
+            itemCount += strlen(tables[i].term) + 1;
+        }
+    }
+    if (itemCount == 0)
+    {
+        return 0;
+    }
+    struct patternDfa *d = (struct patternDfa *)malloc(sizeof(struct patternDfa));
+    assert(d);
+    struct patternBuild b;
+    b.items = (int *)malloc(sizeof(int) * itemCount);
+    assert(b.items);
+    b.itemTables = (int *)malloc(sizeof(int) * itemCount);
+    assert(b.itemTables);
+    int *firsts = (int *)malloc(sizeof(int) * itemCount);
+    assert(firsts);
+    int patternCount = 0;
+
+    /* Each pattern's folded characters, wildcards and end. */
+    b.itemCount = 0;
+    d->lookahead = 0;
+    for (int i = 0; i < tableCount; i++)
+    {
+        if (!tables[i].pattern)
+        {
+            continue;
+        }
+        const char *term = tables[i].term;
+        int length = strlen(term);
+        int lookahead = 0;
+        firsts[patternCount++] = b.itemCount;
+        int position = 0;
+        while (position < length)
+        {
+            if (term[position] == PATTERN_WILDCARD)
+            {
+                /* Wildcards in a row are one wildcard. */
+                if (b.itemCount == firsts[patternCount - 1] ||
+                    b.items[b.itemCount - 1] != ITEM_WILDCARD)
+                {
+                    b.itemTables[b.itemCount] = -1;
+                    b.items[b.itemCount++] = ITEM_WILDCARD;
+                }
+                lookahead += PATTERN_WILDCARD_LOOKAHEAD;
+                position++;
+                continue;
+            }
+            int character;
+            int bytes = foldDecode(term, length, position, &character);
+            character = (character < 0) ? INVALID_CHARACTERS + (unsigned char)term[position]
+                                        : foldCase(character);
+            b.itemTables[b.itemCount] = -1;
+            b.items[b.itemCount++] = character;
+            lookahead += bytes;
+            position += bytes;
+        }
+        b.itemTables[b.itemCount] = i;
+        b.items[b.itemCount++] = ITEM_END;
+        if (lookahead > d->lookahead)
+        {
+            d->lookahead = lookahead;
+        }
+    }
+
+    /* A class for each distinct character, ASCII ones through the table. */
+    int *characters = (int *)malloc(sizeof(int) * b.itemCount);
+    assert(characters);
+    int characterCount = 0;
+    for (int i = 0; i < b.itemCount; i++)
+    {
+        if (b.items[i] >= 0)
+        {
+            characters[characterCount++] = b.items[i];
+        }
+    }
+    qsort(characters, characterCount, sizeof(int), compareInts);
+    int distinct = 0;
+    for (int i = 0; i < characterCount; i++)
+    {
+        if (distinct == 0 || characters[distinct - 1] != characters[i])
+        {
+            characters[distinct++] = characters[i];
+        }
+    }
+    d->classCount = 2 + distinct;
+    b.classLetters = (int *)malloc(sizeof(int) * d->classCount);
+    assert(b.classLetters);
+    b.classLetters[CLASS_OTHER] = 0;
+    b.classLetters[CLASS_LETTER] = 1;
+    int asciiCount = 0;
+    while (asciiCount < distinct && characters[asciiCount] < 128)
+    {
+        asciiCount++;
+    }
+    d->wideCount = distinct - asciiCount;
+    d->wideCharacters = (int *)malloc(sizeof(int) * (d->wideCount > 0 ? d->wideCount : 1));
+    assert(d->wideCharacters);
+    d->wideClasses = (int *)malloc(sizeof(int) * (d->wideCount > 0 ? d->wideCount : 1));
+    assert(d->wideClasses);
+    for (int i = 0; i < distinct; i++)
+    {
+        b.classLetters[2 + i] = (characters[i] < INVALID_CHARACTERS) &&
+                                (foldClass(characters[i]) & FOLD_LETTER);
+        if (i >= asciiCount)
+        {
+            d->wideCharacters[i - asciiCount] = characters[i];
+            d->wideClasses[i - asciiCount] = 2 + i;
+        }
+    }
+    for (int c = 0; c < 128; c++)
+    {
+        int folded = (unsigned char)foldAsciiCases[c];
+        d->asciiClasses[c] = (foldAsciiClasses[c] & FOLD_LETTER) ? CLASS_LETTER : CLASS_OTHER;
+        for (int i = 0; i < asciiCount; i++)
+        {
+            if (characters[i] == folded)
+            {
+                d->asciiClasses[c] = 2 + i;
+            }
+        }
+    }
+    free(characters);
+    b.itemClasses = (int *)malloc(sizeof(int) * b.itemCount);
+    assert(b.itemClasses);
+    for (int i = 0; i < b.itemCount; i++)
+    {
+        b.itemClasses[i] = (b.items[i] >= 0) ? classOf(d, b.items[i]) : -1;
+    }
+
+    /* Subset construction, the start state being every pattern's start. */
+    d->stateCount = 0;
+    b.statesAllocated = INITIALSTATES;
+    b.setStarts = (int *)malloc(sizeof(int) * b.statesAllocated);
+    assert(b.setStarts);
+    b.setSizes = (int *)malloc(sizeof(int) * b.statesAllocated);
+    assert(b.setSizes);
+    d->accepts = (int *)malloc(sizeof(int) * b.statesAllocated);
+    assert(d->accepts);
+    d->next = (int *)malloc(sizeof(int) * b.statesAllocated * d->classCount);
+    assert(d->next);
+    b.setsAllocated = b.itemCount * 4;
+    b.sets = (int *)malloc(sizeof(int) * b.setsAllocated);
+    assert(b.sets);
+    b.setsUsed = 0;
+    b.indexSlots = INITIALSTATES * 2;
+    b.index = (int *)malloc(sizeof(int) * b.indexSlots);
+    assert(b.index);
+    for (int i = 0; i < b.indexSlots; i++)
+    {
+        b.index[i] = -1;
+    }
+    b.members = (int *)malloc(sizeof(int) * b.itemCount);
+    assert(b.members);
+    b.stamps = (int *)calloc(b.itemCount, sizeof(int));
+    assert(b.stamps);
+    b.stamp = 1;
+
+    int memberCount = 0;
+    for (int i = 0; i < patternCount; i++)
+    {
+        addMember(&b, &memberCount, firsts[i]);
+    }
+    qsort(b.members, memberCount, sizeof(int), compareInts);
+    findState(d, &b, b.members, memberCount);
+    free(firsts);
+
+    int status = 0;
+    for (int state = 0; state < d->stateCount && status == 0; state++)
+    {
+        for (int c = 0; c < d->classCount && status == 0; c++)
+        {
+            b.stamp++;
+            memberCount = 0;
+            int size = b.setSizes[state];
+            for (int i = 0; i < size; i++)
+            {
+                /* The set may move as states are added, so look it up each time. */
+                int item = b.sets[b.setStarts[state] + i];
+                if (b.items[item] == ITEM_WILDCARD)
+                {
+                    if (b.classLetters[c])
+                    {
+                        addMember(&b, &memberCount, item);
+                    }
+                }
+                else if (b.items[item] != ITEM_END && b.itemClasses[item] == c)
+                {
+                    addMember(&b, &memberCount, item + 1);
+                }
+            }
+            int next = -1;
+            if (memberCount > 0)
+            {
+                qsort(b.members, memberCount, sizeof(int), compareInts);
+                next = findState(d, &b, b.members, memberCount);
+                if (next < 0)
+                {
+                    status = -1;
+                }
+            }
+            d->next[(size_t)state * d->classCount + c] = next;
+        }
+    }
+
+    free(b.stamps);
+    free(b.members);
+    free(b.index);
+    free(b.sets);
+    free(b.setSizes);
+    free(b.setStarts);
+    free(b.itemClasses);
+    free(b.classLetters);
+    free(b.itemTables);
+    free(b.items);
+    if (status != 0)
+    {
+        freePatternDfa(d);
+        return status;
+    }
+    *dfa = d;
+    return 0;
+}
+
+int matchPattern(const struct patternDfa *d, const char *text, int textLength, int start,
+                 int *length)
+{
+    int match = -1;
+    int state = 0;
+    int position = start;
+    while (1)
+    {
+        /* The class of the next character, and whether it ends a word. */
+        int class = CLASS_OTHER;
+        int letter = 0;
+        int bytes = 1;
+        if (position < textLength)
+        {
+            unsigned char c = (unsigned char)text[position];
+            if (c < 0x80)
+            {
+                class = d->asciiClasses[c];
+                letter = foldAsciiClasses[c] & FOLD_LETTER;
+            }
+            else
+            {
+                int character;
+                bytes = foldDecode(text, textLength, position, &character);
+                if (character < 0)
+                {
+                    class = classOf(d, INVALID_CHARACTERS + c);
+                }
+                else
+                {
+                    letter = foldClass(character) & FOLD_LETTER;
+                    class = classOf(d, foldCase(character));
+                }
+            }
+        }
+        if (d->accepts[state] >= 0 && !letter && position > start)
+        {
+            match = d->accepts[state];
+            *length = position - start;
+        }
+        /* Nothing past the lookahead is read, as streaming callers rely on. */
+        if (position >= textLength || position + bytes - start > d->lookahead)
+        {
+            break;
+        }
+        state = d->next[(size_t)state * d->classCount + class];
+        if (state < 0)
+        {
+            break;
+        }
+        position += bytes;
+    }
+    return match;
+}
+
+void freePatternDfa(struct patternDfa *d)
+{
+    if (d)
+    {
+        free(d->next);
+        free(d->accepts);
+        free(d->wideCharacters);
+        free(d->wideClasses);
+        free(d);
+    }
+}
@@ -0,0 +1,79 @@
+/*
+    Header for module which compiles the terms of the term colour
+        tables which are patterns, such as "algorithm*", into one DFA
+        over case-folded characters, so every pattern is tried in a
+        single pass over the text.
+*/
+
+#ifndef PATTERN_H
+#define PATTERN_H 1
+
+struct termColourTable;
+
+/* Matches any run of letters, including none, in a table term. */
+#define PATTERN_WILDCARD '*'
+
+/* The most states a DFA may have before newPatternDfa gives up. */
+#ifndef PATTERN_MAX_STATES
+#define PATTERN_MAX_STATES (1 << 18)
+#endif
+
+/*
+    Letters a wildcard is taken to match when working out how far
+    ahead of a term a streamed text must be read. Matches longer than
+    that lookahead aren't taken, so a text is split the same however
+    it is read.
+*/
+#ifndef PATTERN_WILDCARD_LOOKAHEAD
+#define PATTERN_WILDCARD_LOOKAHEAD 64
+#endif
+
+struct patternDfa
+{
+    int stateCount;
+    /*
+        Characters are matched by class: 0 for any character which
+        isn't a letter and 1 for any letter not in a pattern, then one
+        for each character in the patterns.
+    */
+    int classCount;
+    /* The next state for each state and class, -1 once no pattern can match. */
+    int *next;
+    /* The table of the pattern matched on reaching each state, or -1. */
+    int *accepts;
+    /* The class of each ASCII character, once folded. */
+    int asciiClasses[128];
+    /* Folded characters past ASCII in the patterns, ascending, and their classes. */
+    int wideCount;
+    int *wideCharacters;
+    int *wideClasses;
+    /* Bytes a pattern may need to see, counting each wildcard as PATTERN_WILDCARD_LOOKAHEAD. */
+    int lookahead;
+};
+
+/*
+    Compiles the patterns among the given tables, those whose term
+    holds a PATTERN_WILDCARD, into a DFA, setting dfa to it, or to NULL
+    if there are none. Where several patterns match the same text, the
+    lowest table is taken. Returns 0, or -1 with dfa NULL if the DFA
+    would need more than PATTERN_MAX_STATES states.
+*/
+int newPatternDfa(const struct termColourTable *tables, int tableCount, struct patternDfa **dfa);
+
+/*
+    Returns the table of the pattern matching the longest text at
+    start ignoring case which is followed by a character which isn't
+    a letter, setting length to the length of that text, or -1 if no
+    pattern matches. No more than textLength characters are read, nor
+    any past the DFA's lookahead bytes and the character after them,
+    so no longer text matches.
+*/
+int matchPattern(const struct patternDfa *d, const char *text, int textLength, int start,
+                 int *length);
+
+/*
+    Frees the given DFA and all memory allocated for it.
+*/
+void freePatternDfa(struct patternDfa *d);
+
+#endif
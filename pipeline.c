@@ -0,0 +1,303 @@
+/*
+    Implementation for module which solves Part F as a pipeline
+        of threads.
+
+    The reader passes blocks of text to the tokenizer, which holds
+    back any term the rest of the text could still change. Batches
+    of terms go to the solver, which commits colours once every
+    surviving path agrees on them (a streaming solver with no lag)
+    and passes batches of coloured terms on to the writer.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "queue.h"
+#include "tokenizer.h"
+#include "lattice.h"
+#include "stream.h"
+#include "vocabulary.h"
+#include "problemStruct.c"
+
+/* Bytes of text read at a time. */
+#define READ_BLOCK 65536
+
+/* Terms passed between stages at a time. */
+#define PIPELINE_BATCH 256
+
+/* Items each queue holds. */
+#define QUEUE_CAPACITY 16
+
+struct textBlock
+{
+    char *text;
+    int length;
+};
+
+struct pipelineTerm
+{
+    /* The term string, the table's term or the vocabulary's spelling. */
+    const char *term;
+    int table;
+    int colour;
+};
+
+struct termBatch
+{
+    int count;
+    struct pipelineTerm terms[PIPELINE_BATCH];
+};
+
+struct pipeline
+{
+    struct problem *p;
+    FILE *textFile;
+    FILE *outFile;
+    int colourMode;
+    struct queue *blocks;
+    struct queue *terms;
+    struct queue *colours;
+    /*
+        One copy of each spelling in the text so far, so a long stream
+        holds only its distinct words, added to by the tokenizer alone.
+        Their strings never move, so the writer reads them freely once
+        their batch has passed through the queues.
+    */
+    struct vocabulary *vocabulary;
+    /* Terms pushed to the solver but not yet committed. */
+    struct pipelineTerm *pending;
+    int pendingHead;
+    int pendingEnd;
+    int pendingAllocated;
+    /* Batch of committed terms being filled for the writer. */
+    struct termBatch output;
+};
+
+static void *readText(void *data)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    while (1)
+    {
+        struct textBlock block;
+        block.text = (char *)malloc(READ_BLOCK);
+        assert(block.text);
+        block.length = fread(block.text, 1, READ_BLOCK, pl->textFile);
+        /* Text ends at the first null character, as in readProblemA. */
+        char *end = memchr(block.text, '\0', block.length);
+        if (end)
+        {
+            block.length = end - block.text;
+        }
+        if (block.length == 0)
+        {
+            free(block.text);
+            break;
+        }
+        queuePush(pl->blocks, &block);
+        if (end)
+        {
+            break;
+        }
+    }
+    queueClose(pl->blocks);
+    return NULL;
+}
+
+/*
+    Pushes the terms of text from progress on, stopping before any term
+    which more text could extend or turn into a table match unless the
+    text is final. Returns the progress made.
+*/
+static int tokenizeText(struct pipeline *pl, const char *text, int length,
+                        int progress, int final, struct termBatch *batch)
+{
+    int lookahead = termLookahead(pl->p);
+    struct termSpan span;
+    while (nextTerm(pl->p, text, length, progress, &span))
+    {
+        if (!final && (span.end >= length || span.start + lookahead > length))
+        {
+            break;
+        }
+        struct pipelineTerm *term = &(batch->terms[batch->count]);
+        if (termStringOwned(pl->p, span.table))
+        {
+            vocabularyIntern(pl->vocabulary, text + span.start, span.end - span.start,
+                             &(term->term));
+        }
+        else
+        {
+            term->term = pl->p->colourTables[span.table].term;
+        }
+        term->table = span.table;
+        batch->count++;
+        if (batch->count == PIPELINE_BATCH)
+        {
+            queuePush(pl->terms, batch);
+            batch->count = 0;
+        }
+        progress = span.end;
+    }
+    return progress;
+}
+
+static void *tokenizeBlocks(void *data)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    /* Text not yet tokenized, kept null terminated for nextTerm. */
+    int allocated = READ_BLOCK + 1;
+    char *text = (char *)malloc(allocated);
+    assert(text);
+    int length = 0;
+    int progress = 0;
+    struct termBatch batch;
+    batch.count = 0;
+    struct textBlock block;
+    while (queuePop(pl->blocks, &block))
+    {
+        /* Drop the tokenized text before adding the block. */
+        memmove(text, text + progress, length - progress);
+        length -= progress;
+        progress = 0;
+        if (length + block.length + 1 > allocated)
+        {
+            allocated = (length + block.length + 1) * 2;
+            text = (char *)realloc(text, allocated);
+            assert(text);
+        }
+        memcpy(text + length, block.text, block.length);
+        length += block.length;
+        text[length] = '\0';
+        free(block.text);
+        progress = tokenizeText(pl, text, length, progress, 0, &batch);
+    }
+    tokenizeText(pl, text, length, progress, 1, &batch);
+    if (batch.count > 0)
+    {
+        queuePush(pl->terms, &batch);
+    }
+    queueClose(pl->terms);
+    free(text);
+    return NULL;
+}
+
+/* Passes a committed term on to the writer. */
+static void emitTerm(void *data, int index, int colour)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    assert(pl->pendingHead < pl->pendingEnd);
+    struct pipelineTerm *term = &(pl->output.terms[pl->output.count]);
+    *term = pl->pending[pl->pendingHead];
+    term->colour = colour;
+    pl->pendingHead++;
+    pl->output.count++;
+    if (pl->output.count == PIPELINE_BATCH)
+    {
+        queuePush(pl->colours, &(pl->output));
+        pl->output.count = 0;
+    }
+}
+
+static void *writeTerms(void *data)
+{
+    struct pipeline *pl = (struct pipeline *)data;
+    struct termBatch batch;
+    int index = 0;
+    while (queuePop(pl->colours, &batch))
+    {
+        for (int i = 0; i < batch.count; i++)
+        {
+            struct pipelineTerm *term = &(batch.terms[i]);
+            outputTerm(pl->outFile, index, term->term, term->colour, pl->colourMode);
+            index++;
+        }
+    }
+    fprintf(pl->outFile, "\n");
+    return NULL;
+}
+
+int solvePipelined(struct problem *p, FILE *textFile, FILE *outFile,
+                   int colourMode, FILE *statsFile)
+{
+    struct pipeline pl;
+    pl.p = p;
+    pl.textFile = textFile;
+    pl.outFile = outFile;
+    pl.colourMode = colourMode;
+    pl.blocks = newQueue(QUEUE_CAPACITY, sizeof(struct textBlock));
+    pl.terms = newQueue(QUEUE_CAPACITY, sizeof(struct termBatch));
+    pl.colours = newQueue(QUEUE_CAPACITY, sizeof(struct termBatch));
+    pl.vocabulary = newVocabulary();
+    pl.pendingHead = 0;
+    pl.pendingEnd = 0;
+    pl.pendingAllocated = PIPELINE_BATCH;
+    pl.pending = (struct pipelineTerm *)malloc(sizeof(struct pipelineTerm) * pl.pendingAllocated);
+    assert(pl.pending);
+    pl.output.count = 0;
+
+    pthread_t reader;
+    pthread_t tokenizer;
+    pthread_t writer;
+    int created = pthread_create(&reader, NULL, readText, &pl);
+    assert(created == 0);
+    created = pthread_create(&tokenizer, NULL, tokenizeBlocks, &pl);
+    assert(created == 0);
+    created = pthread_create(&writer, NULL, writeTerms, &pl);
+    assert(created == 0);
+
+    /* This thread is the solver. */
+    struct lattice *l = newLattice(p);
+    struct streamSolver *s = newStreamSolver(l, 0, emitTerm, &pl);
+    struct termBatch batch;
+    while (queuePop(pl.terms, &batch))
+    {
+        for (int i = 0; i < batch.count; i++)
+        {
+            if (pl.pendingEnd == pl.pendingAllocated)
+            {
+                /* Reuse the space of committed terms, or grow if most are uncommitted. */
+                if (pl.pendingHead > pl.pendingAllocated / 2)
+                {
+                    pl.pendingEnd -= pl.pendingHead;
+                    memmove(pl.pending, pl.pending + pl.pendingHead,
+                            sizeof(struct pipelineTerm) * pl.pendingEnd);
+                    pl.pendingHead = 0;
+                }
+                else
+                {
+                    pl.pendingAllocated *= 2;
+                    pl.pending = (struct pipelineTerm *)realloc(pl.pending, sizeof(struct pipelineTerm) * pl.pendingAllocated);
+                    assert(pl.pending);
+                }
+            }
+            pl.pending[pl.pendingEnd] = batch.terms[i];
+            pl.pendingEnd++;
+            streamPush(s, batch.terms[i].table);
+        }
+    }
+    int score = streamFinish(s);
+    if (pl.output.count > 0)
+    {
+        queuePush(pl.colours, &(pl.output));
+    }
+    queueClose(pl.colours);
+
+    pthread_join(reader, NULL);
+    pthread_join(tokenizer, NULL);
+    pthread_join(writer, NULL);
+    if (statsFile)
+    {
+        struct streamStats stats;
+        streamGetStats(s, &stats);
+        printStreamStats(statsFile, &stats);
+    }
+    freeStreamSolver(s);
+    freeLattice(l);
+    free(pl.pending);
+    freeQueue(pl.blocks);
+    freeQueue(pl.terms);
+    freeQueue(pl.colours);
+    freeVocabulary(pl.vocabulary);
+    return score;
+}
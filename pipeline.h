@@ -0,0 +1,24 @@
+/*
+    Header for module which solves Part F as a pipeline of reader,
+        tokenizer, solver and writer threads joined by bounded queues,
+        so reading, solving and writing a large text overlap.
+*/
+#include <stdio.h>
+#include "problem.h"
+
+#ifndef PIPELINE_H
+#define PIPELINE_H 1
+
+/*
+    Reads text from textFile, tokenizes it against the tables of the
+    given problem (read with readProblemTables) and solves it with a
+    streaming Viterbi pass, writing colours to outFile as they are
+    committed in the same format as outputProblem. Returns the score
+    of the colouring, which matches latticeSolve over the whole text.
+    If statsFile is not NULL the streaming solver's commits and
+    latencies are printed to it.
+*/
+int solvePipelined(struct problem *p, FILE *textFile, FILE *outFile,
+                   int colourMode, FILE *statsFile);
+
+#endif
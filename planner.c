@@ -0,0 +1,212 @@
+/*
+    Implementation for module which picks how to solve a single
+        document.
+
+    The full pass keeps a back pointer for every colour of every term,
+    a byte each in the specialised kernels and an int each otherwise.
+    The chunked solve keeps int back pointers for the whole document
+    as well, so it only pays when more than one processor is idle. The
+    checkpointed pass keeps the scores of every interval-th term and
+    the back pointers of one interval, so with an interval of about
+    the square root of the terms it needs two square roots' worth,
+    and does the forward work twice.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "planner.h"
+#include "semiring.h"
+#include "problemStruct.c"
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int plannerIdleThreads(void)
+{
+    int processors = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double load;
+    int idle = processors;
+    if (getloadavg(&load, 1) == 1)
+    {
+        idle = processors - (int)(load + 0.5);
+    }
+    if (idle > SCHEDULER_MAX_WORKERS)
+    {
+        idle = SCHEDULER_MAX_WORKERS;
+    }
+    return (idle < 1) ? 1 : idle;
+}
+
+void planSolve(struct lattice *l, int termCount, int scoreOnly, size_t memoryBudget,
+               int idleThreads, struct solvePlan *plan)
+{
+    int colourCount = l->colourCount;
+    size_t row = sizeof(int) * colourCount;
+    plan->termCount = termCount;
+    plan->colourCount = colourCount;
+    plan->scoreOnly = scoreOnly;
+    plan->idleThreads = idleThreads;
+    plan->threadCount = 1;
+    plan->memoryBudget = memoryBudget;
+    plan->elapsed = 0;
+    plan->interval = (int)ceil(sqrt((double)termCount));
+    if (plan->interval < 1)
+    {
+        plan->interval = 1;
+    }
+    if (scoreOnly)
+    {
+        /* Only the scores of the last term are kept either way. */
+        plan->fullBytes = 2 * row;
+        plan->checkpointedBytes = 0;
+        plan->chunkedBytes = row * ((size_t)termCount / SCHEDULER_CHUNK + 1);
+    }
+    else
+    {
+        int byteKernel = (colourCount == 4 || colourCount == 8 || colourCount == 16);
+        plan->fullBytes = (byteKernel ? (size_t)colourCount : row) * termCount;
+        plan->checkpointedBytes = row * ((size_t)(termCount - 1) / plan->interval + 1 +
+                                         plan->interval);
+        plan->chunkedBytes = row * termCount +
+                             row * ((size_t)termCount / SCHEDULER_CHUNK + 1);
+    }
+
+    if (idleThreads > 1 && termCount >= PLANNER_PARALLEL_TERMS &&
+        plan->chunkedBytes <= memoryBudget)
+    {
+        plan->strategy = SOLVE_CHUNKED;
+        plan->threadCount = idleThreads;
+    }
+    else if (plan->fullBytes <= memoryBudget || scoreOnly)
+    {
+        plan->strategy = SOLVE_FULL;
+    }
+    else
+    {
+        /* Over budget even so, but as little over as it can be. */
+        plan->strategy = SOLVE_CHECKPOINTED;
+    }
+}
+
+int solvePlanned(struct lattice *l, const int *termTables, int termCount, int *colours,
+                 struct solvePlan *plan)
+{
+    double start = now();
+    int score;
+    if (plan->scoreOnly)
+    {
+        colours = NULL;
+    }
+    switch (plan->strategy)
+    {
+    case SOLVE_CHUNKED:
+        solveScheduled(l, &termTables, &termCount, 1, plan->threadCount, &score,
+                       colours ? &colours : NULL, NULL);
+        break;
+    case SOLVE_CHECKPOINTED:
+        score = latticeSolveCheckpointed(l, termTables, termCount, plan->interval, colours);
+        break;
+    default:
+        score = colours ? latticeSolve(l, termTables, termCount, colours)
+                        : latticeScore(l, termTables, termCount);
+        break;
+    }
+    plan->elapsed = now() - start;
+    return score;
+}
+
+int latticeSolveCheckpointed(struct lattice *l, const int *termTables, int termCount,
+                             int interval, int *colours)
+{
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    if (!colours)
+    {
+        return latticeScore(l, termTables, termCount);
+    }
+    int colourCount = l->colourCount;
+    int checkpointCount = (termCount - 1) / interval + 1;
+    /* Checkpoint k holds the scores of term k * interval. */
+    int *checkpoints = (int *)malloc(sizeof(int) * colourCount * checkpointCount);
+    assert(checkpoints);
+    int *scores = (int *)malloc(sizeof(int) * 2 * colourCount);
+    assert(scores);
+    int *back = (int *)malloc(sizeof(int) * colourCount * interval);
+    assert(back);
+
+    latticeStart(l, termTables[0], checkpoints);
+    const int *prevScores = checkpoints;
+    int *spare = scores;
+    for (int i = 1; i < termCount; i++)
+    {
+        int *nextScores = (i % interval == 0)
+                              ? checkpoints + (size_t)(i / interval) * colourCount
+                              : spare;
+        latticeForwardStep(l, prevScores, termTables[i], nextScores, NULL);
+        if (nextScores == spare)
+        {
+            spare = (spare == scores) ? scores + colourCount : scores;
+        }
+        prevScores = nextScores;
+    }
+    int colour = latticeBestColour(l, prevScores);
+    int score = prevScores[colour];
+    colours[termCount - 1] = colour;
+
+    /* Each interval's back pointers lead into the one before it. */
+    for (int k = checkpointCount - 1; k >= 0; k--)
+    {
+        int first = k * interval;
+        int last = (first + interval < termCount - 1) ? first + interval : termCount - 1;
+        prevScores = checkpoints + (size_t)k * colourCount;
+        spare = scores;
+        for (int i = first + 1; i <= last; i++)
+        {
+            latticeForwardStep(l, prevScores, termTables[i], spare,
+                               back + (size_t)(i - first - 1) * colourCount);
+            prevScores = spare;
+            spare = (spare == scores) ? scores + colourCount : scores;
+        }
+        for (int i = last; i > first; i--)
+        {
+            colours[i - 1] = back[(size_t)(i - first - 1) * colourCount + colours[i]];
+        }
+    }
+    free(back);
+    free(scores);
+    free(checkpoints);
+    return score;
+}
+
+static const char *strategyName(enum solveStrategy strategy)
+{
+    switch (strategy)
+    {
+    case SOLVE_CHECKPOINTED:
+        return "checkpointed";
+    case SOLVE_CHUNKED:
+        return "chunked";
+    default:
+        return "full";
+    }
+}
+
+void printSolvePlan(FILE *outFile, const struct solvePlan *plan)
+{
+    fprintf(outFile, "plan: %s on %d of %d idle threads, %.3fs, %d terms, %d colours%s, "
+                     "budget %.1f MB (full %.1f MB, checkpointed %.1f MB every %d terms, "
+                     "chunked %.1f MB)\n",
+            strategyName(plan->strategy), plan->threadCount, plan->idleThreads, plan->elapsed,
+            plan->termCount, plan->colourCount, plan->scoreOnly ? ", score only" : "",
+            plan->memoryBudget / 1048576.0, plan->fullBytes / 1048576.0,
+            plan->checkpointedBytes / 1048576.0, plan->interval,
+            plan->chunkedBytes / 1048576.0);
+}
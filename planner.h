@@ -0,0 +1,96 @@
+/*
+    Header for module which picks how to solve a single Part E or
+        Part F document from its size, the lattice's colour count, a
+        memory budget and the processors left idle: a full Viterbi
+        pass, a checkpointed pass which keeps only some of the scores
+        and recomputes the back pointers a stretch at a time, or
+        chunks spread over worker threads.
+*/
+#include <stdio.h>
+#include <stddef.h>
+#include "lattice.h"
+#include "scheduler.h"
+
+#ifndef PLANNER_H
+#define PLANNER_H 1
+
+/* Bytes a solve may use for its back pointers unless told otherwise. */
+#ifndef PLANNER_MEMORY_BUDGET
+#define PLANNER_MEMORY_BUDGET ((size_t)512 << 20)
+#endif
+
+/* Documents of fewer terms than this aren't worth splitting over threads. */
+#ifndef PLANNER_PARALLEL_TERMS
+#define PLANNER_PARALLEL_TERMS (4 * SCHEDULER_CHUNK)
+#endif
+
+enum solveStrategy
+{
+    /* latticeSolve, or latticeScore for a score alone. */
+    SOLVE_FULL = 0,
+    /* latticeSolveCheckpointed. */
+    SOLVE_CHECKPOINTED = 1,
+    /* solveScheduled with the document split into chunks. */
+    SOLVE_CHUNKED = 2
+};
+
+struct solvePlan
+{
+    enum solveStrategy strategy;
+    int termCount;
+    int colourCount;
+    /* Whether only the score is wanted, as for Part E. */
+    int scoreOnly;
+    /* Idle processors the plan could use, and the threads it does. */
+    int idleThreads;
+    int threadCount;
+    size_t memoryBudget;
+    /* Bytes each strategy would take, 0 where it isn't needed. */
+    size_t fullBytes;
+    size_t checkpointedBytes;
+    size_t chunkedBytes;
+    /* Terms between checkpoints for SOLVE_CHECKPOINTED. */
+    int interval;
+    /* Wall time of the solve in seconds, set by solvePlanned. */
+    double elapsed;
+};
+
+/*
+    Returns the number of processors not busy by the one minute load
+    average, at least 1.
+*/
+int plannerIdleThreads(void);
+
+/*
+    Fills in plan for solving a document of termCount terms over the
+    given lattice, with up to idleThreads threads and memoryBudget
+    bytes for back pointers. Documents long enough to split go to
+    threads when there is more than one and they fit the budget,
+    others get a full pass if it fits, and any left over are
+    checkpointed, which needs about the square root of the memory.
+*/
+void planSolve(struct lattice *l, int termCount, int scoreOnly, size_t memoryBudget,
+               int idleThreads, struct solvePlan *plan);
+
+/*
+    Solves the given sequence of table indices by the given plan,
+    storing the colouring in colours unless the plan is for the score
+    alone, and returning the score. Results match latticeSolve
+    whichever strategy the plan has. Sets the plan's elapsed time.
+*/
+int solvePlanned(struct lattice *l, const int *termTables, int termCount, int *colours,
+                 struct solvePlan *plan);
+
+/*
+    Finds the same colouring and score as latticeSolve, keeping the
+    scores of only every interval-th term on the way forward, then
+    recomputing the back pointers of one interval at a time from the
+    last back to the first.
+*/
+int latticeSolveCheckpointed(struct lattice *l, const int *termTables, int termCount,
+                             int interval, int *colours);
+
+/* Prints the given plan on one line, with what each strategy would need. */
+void printSolvePlan(FILE *outFile, const struct solvePlan *plan);
+
+#endif
@@ -15,13 +15,21 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <unistd.h>
 #include "problem.h"
+#include "hash.h"
+#include "loader.h"
+#include "matcher.h"
+#include "pattern.h"
+#include "segment.h"
+#include "tokenizer.h"
+#include "vocabulary.h"
+#include "lattice.h"
+#include "semiring.h"
+#include "planner.h"
 #include "problemStruct.c"
 #include "solutionStruct.c"
 
-/* Number of terms to allocate space for initially. */
-#define INITIALTERMS 64
-
 /* Number of colour transitions to allocate space for initially. */
 #define INITIALTRANSITIONS 16
 
@@ -46,45 +54,27 @@ int get_max_colour(struct problem *p, int index, char *word, int *score);
 int get_transition(struct problem *p, int index,
                    int prev_colour, int curr_colour);
 
-/*Returns the maximum color given 2 scores for 2 colors*/
-int max(int score_a, int score_b, int a_colour, int b_colour);
-
-int is_term(struct problem *p, int index);
-
 /* Sets up a solution for the given problem. */
 struct solution *newSolution(struct problem *problem);
 
 /*
-    Reads the given text file into a set of tokens in a sentence
-    and the given table file into a set of structs.
-
-    Assumption: Tables are always contiguous, meaning the table never
-    needs to be constructed
+    Reads the given table file into the term colour tables of the
+    given problem, takes a snapshot version of them and indexes
+    their terms for the tokenizer.
 */
-struct problem *readProblemA(FILE *textFile, FILE *tableFile)
+static void readColourTables(struct problem *p, FILE *tableFile)
 {
-    struct problem *p = (struct problem *)malloc(sizeof(struct problem));
-    assert(p);
-
-    /* Part B onwards so set as empty. */
-    p->colourTransitionTable = NULL;
-
-    int termCount = 0;
-    char *text = NULL;
-    char **terms = NULL;
-
     int termColourTableCount = 0;
     struct termColourTable *colourTables = NULL;
 
-    /* Read in text. */
+    char *tableText = NULL;
     size_t allocated = 0;
-    /* Exit if we read no characters or an error caught. */
-    int success = getdelim(&text, &allocated, '\0', textFile);
+    int success = getdelim(&tableText, &allocated, '\0', tableFile);
 
     if (success == -1)
     {
         /* Encountered an error. */
-        perror("Encountered error reading text file");
+        perror("Encountered error reading table file");
         exit(EXIT_FAILURE);
     }
     else
@@ -93,15 +83,61 @@ struct problem *readProblemA(FILE *textFile, FILE *tableFile)
         assert(success > 0);
     }
 
-    char *tableText = NULL;
-    /* Reset allocated marker. */
-    allocated = 0;
-    success = getdelim(&tableText, &allocated, '\0', tableFile);
+    /* Read term table first, spread over the processors for large tables. */
+    int threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    termColourTableCount = parseColourTables(tableText, strlen(tableText), threadCount,
+                                             &colourTables);
+
+    /* Take a snapshot version of the tables so solutions can be reused. */
+    unsigned long long tableVersion = HASH_SEED;
+    for (int i = 0; i < termColourTableCount; i++)
+    {
+        tableVersion = hashBytes(tableVersion, colourTables[i].term,
+                                 strlen(colourTables[i].term) + 1);
+        tableVersion = hashInt(tableVersion, colourTables[i].colourCount);
+        for (int j = 0; j < colourTables[i].colourCount; j++)
+        {
+            tableVersion = hashInt(tableVersion, colourTables[i].colours[j]);
+            tableVersion = hashInt(tableVersion, colourTables[i].scores[j]);
+        }
+    }
+
+    /* Done with tableText */
+    if (tableText)
+    {
+        free(tableText);
+    }
+
+    p->termColourTableCount = termColourTableCount;
+    p->colourTables = colourTables;
+    p->tableVersion = tableVersion;
+    p->matcher = newTermMatcher(colourTables, termColourTableCount, threadCount);
+    if (!p->matcher)
+    {
+        fprintf(stderr, "Table patterns need more than %d states to match\n",
+                PATTERN_MAX_STATES);
+        exit(EXIT_FAILURE);
+    }
+    p->segment = NULL;
+    p->compiledLattice = NULL;
+    p->tableOwner = NULL;
+    p->vocabulary = newVocabulary();
+}
+
+/* Reads the whole of the given text file. */
+static char *readText(FILE *textFile)
+{
+    char *text = NULL;
+
+    /* Read in text. */
+    size_t allocated = 0;
+    /* Exit if we read no characters or an error caught. */
+    int success = getdelim(&text, &allocated, '\0', textFile);
 
     if (success == -1)
     {
         /* Encountered an error. */
-        perror("Encountered error reading table file");
+        perror("Encountered error reading text file");
         exit(EXIT_FAILURE);
     }
     else
@@ -110,216 +146,100 @@ struct problem *readProblemA(FILE *textFile, FILE *tableFile)
         assert(success > 0);
     }
 
-    /* Read term table first. */
-    int allocatedColourTables = 0;
-    /* Progress through string. */
-    int progress = 0;
-    /* Table string length. */
-    int tableTextLength = strlen(tableText);
-    char *lastToken = NULL;
-    struct termColourTable *lastTable = NULL;
-
-    while (progress < tableTextLength)
-    {
-        char *token = NULL;
-        int score;
-        int colour;
-        int nextProgress;
-        /* Make sure a token, colour and score are grabbed for each line. For simplicity, freshly allocate the token. */
-        assert(sscanf(tableText + progress, "%m[^,],%d,%d %n", &token, &colour, &score, &nextProgress) == 3);
-        assert(nextProgress > 0);
-        progress += nextProgress;
-
-        if (lastToken == NULL || strcmp(token, lastToken) != 0)
-        {
-            /* New token, so build new table and add it to problem. */
-            // fprintf(stderr, "New token: %s (colour #%d) (%d)\n", token, colour, score);
-            lastToken = token;
-
-            if (termColourTableCount == 0)
-            {
-                /* Allocate initial. */
-                colourTables = (struct termColourTable *)malloc(sizeof(struct termColourTable) * INITIALTERMS);
-                assert(colourTables);
-                allocatedColourTables = INITIALTERMS;
-            }
-            else
-            {
-                if ((termColourTableCount + 1) >= allocatedColourTables)
-                {
-                    /* Need more space for next table. */
-                    colourTables = (struct termColourTable *)realloc(colourTables, sizeof(struct termColourTable) * allocatedColourTables * 2);
-                    assert(colourTables);
-                    allocatedColourTables = allocatedColourTables * 2;
-                }
-            }
-            /* Set last table as fresh table. */
-            lastTable = &(colourTables[termColourTableCount]);
-            termColourTableCount++;
-            /* Initialise table. */
-            lastTable->term = token;
-            lastTable->colourCount = 0;
-            lastTable->colours = NULL;
-            lastTable->scores = NULL;
-        }
-        else
-        {
-            /* Same as last token add info to new table. */
-            // fprintf(stderr, "Same token: %s (colour #%d) (%d)\n", token, colour, score);
-            /* Don't need token so free it. */
-            free(token);
-            token = NULL;
-            /* Connect with existing token. */
-            token = lastTable->term;
-        }
-        /* See if we need to increase the space for colours and scores for those colours. */
-        if (lastTable->colourCount <= colour)
-        {
-            int lastCount = lastTable->colourCount;
-            lastTable->colours = (int *)realloc(lastTable->colours, sizeof(int) * (colour + 1));
-            assert(lastTable->colours);
-            lastTable->scores = (int *)realloc(lastTable->scores, sizeof(int) * (colour + 1));
-            assert(lastTable->scores);
-            for (int i = lastCount; i < colour; i++)
-            {
-                lastTable->colours[i] = DEFAULTCOLOUR;
-                lastTable->scores[i] = DEFAULTSCORE;
-            }
-            lastTable->colourCount = colour + 1;
-        }
-        /* Store info. */
-        (lastTable->colours)[colour] = colour;
-        (lastTable->scores)[colour] = score;
+    return text;
+}
 
-        /* Print new updated table */
-        // fprintf(stderr, "Term: %s\n", lastTable->term);
-        // fprintf(stderr, "Colour | Score\n");
-        // for(int i = 0; i < lastTable->colourCount; i++){
-        //     fprintf(stderr, "%6d | %d\n", lastTable->colours[i], lastTable->scores[i]);
-        // }
-    }
+/*
+    Splits the given text into the terms of the given problem, which
+    must already have its tables, on all the processors, and takes
+    ownership of the text.
+*/
+static void splitTerms(struct problem *p, char *text)
+{
+    int termCount = 0;
+    char **terms = NULL;
+    uint32_t *termIds = NULL;
+    int *termTables = NULL;
+    int *termStarts = NULL;
+    int *termEnds = NULL;
 
-    /* Compress table to not have empty tables. */
-    if (colourTables)
+    /* Now split into terms */
+    struct termSpan *spans;
+    int threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    termCount = findTerms(p, text, strlen(text), threadCount, &spans, NULL);
+    if (termCount > 0)
     {
-        colourTables = (struct termColourTable *)realloc(colourTables, sizeof(struct termColourTable) * termColourTableCount);
-        assert(colourTables);
-        allocatedColourTables = termColourTableCount;
+        terms = (char **)malloc(sizeof(char *) * termCount);
+        assert(terms);
+        termIds = (uint32_t *)malloc(sizeof(uint32_t) * termCount);
+        assert(termIds);
+        termTables = (int *)malloc(sizeof(int) * termCount);
+        assert(termTables);
+        termStarts = (int *)malloc(sizeof(int) * termCount);
+        assert(termStarts);
+        termEnds = (int *)malloc(sizeof(int) * termCount);
+        assert(termEnds);
     }
-
-    /* Done with tableText */
-    if (tableText)
+    for (int i = 0; i < termCount; i++)
     {
-        free(tableText);
+        termTables[i] = spans[i].table;
+        termStarts[i] = spans[i].start;
+        termEnds[i] = spans[i].end;
     }
-
-    /* Now split into terms */
-    progress = 0;
-    int termsAllocated = 0;
-    int textLength = strlen(text);
-    while (progress < textLength)
-    {
-        /* This does greedy term matching - this generally follows the specification
-            but also allows for more complex cases (e.g. "Big Oh"). */
-        char *nextTerm = NULL;
-        int start;
-        int maxLengthGreedyMatch = 0;
-        int nextProgress;
-        while (text[progress] != '\0' && !isalpha(text[progress]))
-        {
-            progress++;
-        }
-        start = progress;
-        /* Calculate remaining character count to avoid edge case complications */
-        int remChars = textLength - start;
-        /* See if any of the terms in the table match. */
-        for (int i = 0; i < termColourTableCount; i++)
-        {
-            char *term = colourTables[i].term;
-            int termLen = strlen(term);
-            if (termLen > remChars)
-            {
-                /* Not enough characters to fit term. */
-                continue;
-            }
-            /* Check if word boundary. */
-            if (!isalpha(text[progress + termLen]))
-            {
-                /* Yep! See if the term matches */
-                int matching = 1;
-                for (int j = 0; j < termLen; j++)
-                {
-                    if (tolower(text[progress + j]) != tolower(term[j]))
-                    {
-                        /* Non-match */
-                        matching = 0;
-                        break;
-                    }
-                }
-                if (matching)
-                {
-                    /* Match, see if better than our current best. */
-                    if (termLen > maxLengthGreedyMatch)
-                    {
-                        maxLengthGreedyMatch = termLen;
-                        nextTerm = term;
-                    }
-                }
-            }
-        }
-        if (!nextTerm)
-        {
-            /* No match found, try finding word. This may consume punctuation,
-                this doesn't really matter. */
-            assert(sscanf(text + start, " %ms %n", &nextTerm, &nextProgress) == 1);
-            progress += nextProgress;
-        }
-        else
-        {
-            progress += maxLengthGreedyMatch;
-            /* Move over punctuation if needed. */
-            while (text[progress] != '\0' && !isalpha(text[progress]))
-            {
-                progress++;
-            }
-        }
-        if (termsAllocated == 0)
-        {
-            terms = (char **)malloc(sizeof(char *) * INITIALTERMS);
-            assert(terms);
-            termsAllocated = INITIALTERMS;
-        }
-        else if (termCount >= termsAllocated)
+    free(spans);
+    /* One copy of each spelling, shared by its tokens, and the id of its word. */
+    vocabularyInternAll(p->vocabulary, text, termStarts, termEnds, termCount, termIds,
+                        (const char **)terms);
+    for (int i = 0; i < termCount; i++)
+    {
+        if (!termStringOwned(p, termTables[i]))
         {
-            terms = (char **)realloc(terms, sizeof(char *) * termsAllocated * 2);
-            assert(terms);
-            termsAllocated = termsAllocated * 2;
+            terms[i] = p->colourTables[termTables[i]].term;
         }
-        terms[termCount] = nextTerm;
-        // fprintf(stderr, "(%s) ", nextTerm);
-        termCount++;
     }
-    // fprintf(stderr, "\n");
 
     p->termCount = termCount;
     p->text = text;
     p->terms = terms;
+    p->termIds = termIds;
+    p->termTables = termTables;
+    p->termStarts = termStarts;
+    p->termEnds = termEnds;
+}
 
-    p->termColourTableCount = termColourTableCount;
-    p->colourTables = colourTables;
+/*
+    Reads the given text file into a set of tokens in a sentence
+    and the given table file into a set of structs.
+
+    Assumption: Tables are always contiguous, meaning the table never
+    needs to be constructed
+*/
+struct problem *readProblemA(FILE *textFile, FILE *tableFile)
+{
+    struct problem *p = (struct problem *)malloc(sizeof(struct problem));
+    assert(p);
+
+    /* Part B onwards so set as empty. */
+    p->colourTransitionTable = NULL;
+
+    char *text = readText(textFile);
+
+    /* Tokenizing uses the tables. */
+    readColourTables(p, tableFile);
+
+    splitTerms(p, text);
 
     p->part = PART_A;
 
     return p;
 }
 
-struct problem *readProblemB(FILE *textFile, FILE *tableFile,
-                             FILE *transTable)
+/*
+    Reads the given colour transition table into the given problem,
+    mixing each transition into its snapshot version.
+*/
+static void readTransitions(struct problem *p, FILE *transTable)
 {
-    /* Fill in Part A sections. */
-    struct problem *p = readProblemA(textFile, tableFile);
-
-    /* Fill in Part B sections. */
     p->colourTransitionTable = (struct colourTransitionTable *)malloc(sizeof(struct colourTransitionTable));
     assert(p->colourTransitionTable);
     int transitionCount = 0;
@@ -358,12 +278,27 @@ struct problem *readProblemB(FILE *textFile, FILE *tableFile,
         colours[transitionCount] = colour;
         scores[transitionCount] = score;
         transitionCount++;
+
+        /* Transitions are part of the table snapshot. */
+        p->tableVersion = hashInt(p->tableVersion, prevColour);
+        p->tableVersion = hashInt(p->tableVersion, colour);
+        p->tableVersion = hashInt(p->tableVersion, score);
     }
 
     p->colourTransitionTable->transitionCount = transitionCount;
     p->colourTransitionTable->prevColours = prevColours;
     p->colourTransitionTable->colours = colours;
     p->colourTransitionTable->scores = scores;
+}
+
+struct problem *readProblemB(FILE *textFile, FILE *tableFile,
+                             FILE *transTable)
+{
+    /* Fill in Part A sections. */
+    struct problem *p = readProblemA(textFile, tableFile);
+
+    /* Fill in Part B sections. */
+    readTransitions(p, transTable);
 
     p->part = PART_B;
     return p;
@@ -389,9 +324,98 @@ struct problem *readProblemF(FILE *textFile, FILE *tableFile,
     return p;
 }
 
+struct problem *readProblemTables(FILE *tableFile, FILE *transTable)
+{
+    struct problem *p = (struct problem *)malloc(sizeof(struct problem));
+    assert(p);
+
+    /* No text, the caller tokenizes it as it arrives. */
+    p->termCount = 0;
+    p->text = NULL;
+    p->terms = NULL;
+    p->termIds = NULL;
+    p->termTables = NULL;
+    p->termStarts = NULL;
+    p->termEnds = NULL;
+
+    readColourTables(p, tableFile);
+    readTransitions(p, transTable);
+
+    p->part = PART_F;
+    return p;
+}
+
+struct problem *readProblemShared(FILE *textFile, const char *segmentName)
+{
+    struct problem *p = (struct problem *)malloc(sizeof(struct problem));
+    assert(p);
+
+    p->termCount = 0;
+    p->text = NULL;
+    p->terms = NULL;
+    p->termIds = NULL;
+    p->termTables = NULL;
+    p->termStarts = NULL;
+    p->termEnds = NULL;
+    p->tableOwner = NULL;
+    p->vocabulary = newVocabulary();
+
+    /* Read the text first, as if the tables came from files. */
+    char *text = textFile ? readText(textFile) : NULL;
+    if (attachTables(p, segmentName) != 0)
+    {
+        free(text);
+        freeVocabulary(p->vocabulary);
+        free(p);
+        return NULL;
+    }
+    if (text)
+    {
+        splitTerms(p, text);
+    }
+
+    p->part = PART_F;
+    return p;
+}
+
+struct problem *readProblemDocument(const struct problem *tables, FILE *textFile)
+{
+    struct problem *p = (struct problem *)malloc(sizeof(struct problem));
+    assert(p);
+    *p = *tables;
+
+    p->termCount = 0;
+    p->text = NULL;
+    p->terms = NULL;
+    p->termIds = NULL;
+    p->termTables = NULL;
+    p->termStarts = NULL;
+    p->termEnds = NULL;
+    /* Whichever problem the tables came from frees them. */
+    p->tableOwner = tables->tableOwner ? tables->tableOwner : tables;
+
+    if (textFile)
+    {
+        splitTerms(p, readText(textFile));
+    }
+    return p;
+}
+
+void readProblemText(struct problem *p, FILE *textFile)
+{
+    splitTerms(p, readText(textFile));
+}
+
+int problemTermCount(struct problem *p)
+{
+    return p->termCount;
+}
+
 /*
     Outputs the given solution to the given file. If colourMode is 1, the
-    sentence in the problem is coloured with the given solution colours.
+    sentence in the problem is coloured with the given solution colours,
+    and if it is COLOUR_MODE_SPANS or COLOUR_MODE_HTML the text is
+    written with runs of a colour in spans (see outputColouring).
 */
 void outputProblem(struct problem *problem, struct solution *solution, FILE *stdout,
                    int colourMode)
@@ -422,30 +446,198 @@ void outputProblem(struct problem *problem, struct solution *solution, FILE *std
     }
     else
     {
-        const char *(COLOURS_FG[]) = {"\033[38;5;0m", "\033[38;5;0m", "\033[38;5;0m", "\033[38;5;0m"};
-        const char *(COLOURS_BG[]) = {"\033[48;5;231m", "\033[48;5;10m", "\033[48;5;11m", "\033[48;5;12m"};
-        const char *COLOURS_FG_ERROR = "\033[38;5;1m";
-        const char *ENDCODE = "\033[0m";
-        const int colourCount = (int)(sizeof(COLOURS_FG) / sizeof(COLOURS_FG[0]));
+        outputColouring(stdout, problem, solution->termColours, colourMode);
+    }
+}
+
+/* Terminal codes for each colour a term can be highlighted in. */
+static const char *(COLOURS_FG[]) = {"\033[38;5;0m", "\033[38;5;0m", "\033[38;5;0m", "\033[38;5;0m"};
+static const char *(COLOURS_BG[]) = {"\033[48;5;231m", "\033[48;5;10m", "\033[48;5;11m", "\033[48;5;12m"};
+static const char *COLOURS_FG_ERROR = "\033[38;5;1m";
+static const char *ENDCODE = "\033[0m";
+#define COLOURCOUNT ((int)(sizeof(COLOURS_FG) / sizeof(COLOURS_FG[0])))
+
+void outputTerm(FILE *outFile, int index, const char *term, int colour,
+                int colourMode)
+{
+    const int colourCount = COLOURCOUNT;
+
+    if (index != 0)
+    {
+        fprintf(outFile, " ");
+    }
+    if (!colourMode)
+    {
+        fprintf(outFile, "%d", colour);
+    }
+    /* Place colour code */
+    else if (colour < 0 || colour >= colourCount)
+    {
+        fprintf(outFile, "%s%s%s", COLOURS_FG_ERROR, term, ENDCODE);
+    }
+    else
+    {
+        fprintf(outFile, "%s%s%s%s", COLOURS_FG[colour], COLOURS_BG[colour], term, ENDCODE);
+    }
+}
+
+int formatTerm(char *buffer, size_t size, int index, const char *term, int termLength,
+               int colour, int colourMode)
+{
+    const char *separator = (index != 0) ? " " : "";
+    if (!colourMode)
+    {
+        return snprintf(buffer, size, "%s%d", separator, colour);
+    }
+    else if (colour < 0 || colour >= COLOURCOUNT)
+    {
+        return snprintf(buffer, size, "%s%s%.*s%s", separator, COLOURS_FG_ERROR, termLength,
+                        term, ENDCODE);
+    }
+    return snprintf(buffer, size, "%s%s%s%.*s%s", separator, COLOURS_FG[colour],
+                    COLOURS_BG[colour], termLength, term, ENDCODE);
+}
+
+/* Where formatSpans writes to, or NULL when it only measures. */
+struct spanWriter
+{
+    char *buffer;
+    size_t length;
+};
+
+static void writeBytes(struct spanWriter *w, const char *bytes, size_t count)
+{
+    if (w->buffer)
+    {
+        memcpy(w->buffer + w->length, bytes, count);
+    }
+    w->length += count;
+}
 
-        for (int i = 0; i < problem->termCount; i++)
+/* Writes the given text, escaped for HTML if html is 1. */
+static void writeText(struct spanWriter *w, const char *text, size_t count, int html)
+{
+    if (!html)
+    {
+        writeBytes(w, text, count);
+        return;
+    }
+    size_t from = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *entity;
+        switch (text[i])
         {
-            if (i != 0)
-            {
-                printf(" ");
-            }
-            /* Place colour code */
-            if (solution->termColours[i] < 0 || solution->termColours[i] >= colourCount)
-            {
-                printf("%s%s%s", COLOURS_FG_ERROR, problem->terms[i], ENDCODE);
-            }
-            else
-            {
-                printf("%s%s%s%s", COLOURS_FG[solution->termColours[i]], COLOURS_BG[solution->termColours[i]], problem->terms[i], ENDCODE);
-            }
+        case '&':
+            entity = "&amp;";
+            break;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        default:
+            continue;
         }
-        printf("\n");
+        writeBytes(w, text + from, i - from);
+        writeBytes(w, entity, strlen(entity));
+        from = i + 1;
+    }
+    writeBytes(w, text + from, count - from);
+}
+
+/* Writes the codes which open a span of the given colour. */
+static void writeSpanStart(struct spanWriter *w, int colour, int html)
+{
+    if (html)
+    {
+        char tag[48];
+        int length = snprintf(tag, sizeof(tag), "<mark class=\"colour-%d\">", colour);
+        writeBytes(w, tag, length);
+    }
+    else if (colour < 0 || colour >= COLOURCOUNT)
+    {
+        writeBytes(w, COLOURS_FG_ERROR, strlen(COLOURS_FG_ERROR));
+    }
+    else
+    {
+        writeBytes(w, COLOURS_FG[colour], strlen(COLOURS_FG[colour]));
+        writeBytes(w, COLOURS_BG[colour], strlen(COLOURS_BG[colour]));
+    }
+}
+
+size_t formatSpans(char *buffer, const char *text, int textLength, int termCount,
+                   const int *termStarts, const int *termEnds, const int *colours,
+                   int colourMode)
+{
+    struct spanWriter w = {buffer, 0};
+    int html = (colourMode == COLOUR_MODE_HTML);
+    const char *endCode = html ? "</mark>" : ENDCODE;
+    size_t endLength = strlen(endCode);
+    int written = 0;
+    int i = 0;
+    while (i < termCount)
+    {
+        /* Extend the run while the colour holds and no line ends. */
+        int last = i;
+        while (last + 1 < termCount && colours[last + 1] == colours[i] &&
+               !memchr(text + termEnds[last], '\n', termStarts[last + 1] - termEnds[last]))
+        {
+            last++;
+        }
+        writeText(&w, text + written, termStarts[i] - written, html);
+        /* Colour 0 is no highlight, left as plain text in HTML. */
+        int marked = !html || colours[i] != 0;
+        if (marked)
+        {
+            writeSpanStart(&w, colours[i], html);
+        }
+        writeText(&w, text + termStarts[i], termEnds[last] - termStarts[i], html);
+        if (marked)
+        {
+            writeBytes(&w, endCode, endLength);
+        }
+        written = termEnds[last];
+        i = last + 1;
+    }
+    writeText(&w, text + written, textLength - written, html);
+    if (textLength == 0 || text[textLength - 1] != '\n')
+    {
+        writeBytes(&w, "\n", 1);
+    }
+    return w.length;
+}
+
+/*
+    Writes the text of the given problem with the given colours in
+    spans, measuring it first so it goes out in one write.
+*/
+static void outputSpans(FILE *outFile, struct problem *p, const int *colours, int colourMode)
+{
+    int textLength = strlen(p->text);
+    size_t length = formatSpans(NULL, p->text, textLength, p->termCount, p->termStarts,
+                                p->termEnds, colours, colourMode);
+    char *buffer = (char *)malloc(length);
+    assert(buffer);
+    formatSpans(buffer, p->text, textLength, p->termCount, p->termStarts, p->termEnds, colours,
+                colourMode);
+    fwrite(buffer, 1, length, outFile);
+    free(buffer);
+}
+
+void outputColouring(FILE *outFile, struct problem *p, const int *colours, int colourMode)
+{
+    if (colourMode >= COLOUR_MODE_SPANS && p->text)
+    {
+        outputSpans(outFile, p, colours, colourMode);
+        return;
     }
+    for (int i = 0; i < p->termCount; i++)
+    {
+        outputTerm(outFile, i, p->terms[i], colours[i], colourMode);
+    }
+    fprintf(outFile, "\n");
 }
 
 /*
@@ -470,49 +662,52 @@ void freeProblem(struct problem *problem)
 {
     if (problem)
     {
-        /* Free terms. */
-        for (int i = 0; i < problem->termCount; i++)
-        {
-            /* Don't free terms in colour table as we'll get them later. */
-            int inTable = 0;
-            for (int j = 0; j < problem->termColourTableCount; j++)
-            {
-                /* Note we do == because we care about the pointer not the contents. */
-                if (problem->terms[i] == problem->colourTables[j].term)
-                {
-                    inTable = 1;
-                    break;
-                }
-            }
-            if (!inTable)
-            {
-                free(problem->terms[i]);
-            }
-        }
+        /* Terms not in the colour table are the vocabulary's. */
         if (problem->terms)
         {
             free(problem->terms);
+            free(problem->termIds);
         }
-
-        for (int i = 0; i < problem->termColourTableCount; i++)
+        if (!problem->tableOwner)
         {
-            free(problem->colourTables[i].term);
-            if (problem->colourTables[i].colours)
-            {
-                free(problem->colourTables[i].colours);
-                free(problem->colourTables[i].scores);
-            }
+            freeVocabulary(problem->vocabulary);
         }
-        if (problem->colourTables)
+        if (problem->termTables)
+        {
+            free(problem->termTables);
+            free(problem->termStarts);
+            free(problem->termEnds);
+        }
+
+        /* Borrowed tables belong to the problem they were borrowed from. */
+        if (problem->segment && !problem->tableOwner)
         {
-            free(problem->colourTables);
+            /* The tables belong to the segment. */
+            detachTables(problem);
         }
-        if (problem->colourTransitionTable)
+        else if (!problem->tableOwner)
         {
-            free(problem->colourTransitionTable->prevColours);
-            free(problem->colourTransitionTable->colours);
-            free(problem->colourTransitionTable->scores);
-            free(problem->colourTransitionTable);
+            for (int i = 0; i < problem->termColourTableCount; i++)
+            {
+                free(problem->colourTables[i].term);
+                if (problem->colourTables[i].colours)
+                {
+                    free(problem->colourTables[i].colours);
+                    free(problem->colourTables[i].scores);
+                }
+            }
+            if (problem->colourTables)
+            {
+                free(problem->colourTables);
+            }
+            freeTermMatcher(problem->matcher);
+            if (problem->colourTransitionTable)
+            {
+                free(problem->colourTransitionTable->prevColours);
+                free(problem->colourTransitionTable->colours);
+                free(problem->colourTransitionTable->scores);
+                free(problem->colourTransitionTable);
+            }
         }
         if (problem->text)
         {
@@ -579,18 +774,6 @@ int get_max_colour(struct problem *p, int index, char *word, int *score)
     }
     return colour;
 }
-int max(int score_a, int score_b, int a_colour, int b_colour)
-{
-    //Comparator function to call based on scores and colours
-    if (score_a > score_b)
-    {
-        return a_colour;
-    }
-    else
-    {
-        return b_colour;
-    }
-}
 struct solution *solveProblemB(struct problem *p)
 {
     struct solution *s = newSolution(p);
@@ -599,19 +782,11 @@ struct solution *solveProblemB(struct problem *p)
     for (int i = 0; i < p->termCount; i++)
     {
         int max = 0;
-        int term_no = -1;
         //Getting the term number of the current word
-        for (int j = 0; j < p->termColourTableCount; j++)
-        {
-            if (p->colourTables[j].term == p->terms[i])
-            {
-                term_no = j;
-                break;
-            }
-        }
+        int term_no = p->termTables[i];
         int colour = 0;
         //Looping through the colour tables and finding the max sum
-        for (int j = 0; j < p->colourTables[term_no].colourCount; j++)
+        for (int j = 0; term_no >= 0 && j < p->colourTables[term_no].colourCount; j++)
         {
             int transition_score = get_transition(p, i, prev_colour, j);
             // get the score for that term and this colour
@@ -644,167 +819,29 @@ int get_transition(struct problem *p, int index, int prev_colour, int curr_colou
     }
     return max_colour;
 }
-int is_term(struct problem *p, int index)
-{
-    //Helper function to find the term colour table index of a specific word
-    for (int j = 0; j < p->termColourTableCount; j++)
-    {
-        if (p->colourTables[j].term == p->terms[index])
-        {
-            return j;
-        }
-    }
-    return -1;
-}
+/*
+    Parts E and F share the lattice: E is the best score and F the
+    best colouring. Part B keeps its own greedy loop above.
+*/
 struct solution *solveProblemE(struct problem *p)
 {
-    struct solution *s = newSolution(p);
-    int best_scores[p->termCount][4];
-    int max_score = 0;
-    int best_score;
-    int prev_term = 0;
-    for (int i = 0; i < p->termCount; i++)
-    {
-        //Get the term number
-        int term_no = is_term(p, i);
-        //Looping through each possible prev colour
-        for (int j = 0; j < 4; j++)
-        {
-            best_score = -1;
-            //Provision for the first word where best is just the word score
-            if (i == 0)
-            {
-                best_score = p->colourTables[term_no].scores[j];
-                best_score = (best_score < 0) ? 0 : best_score;
-                best_scores[i][j] = best_score;
-                continue;
-            }
-            //Finding the max score for each prev colour
-            //Looping through each possible curr colour
-            for (int k = 0; k < 4; k++)
-            {
-                int transition_score = get_transition(p, term_no, k, j);
-                int colour_score = 0;
-                int prev_score = best_scores[i - 1][k];
-                colour_score = p->colourTables[term_no].scores[j];
-                if (p->colourTables[prev_term].colours[k] == -1 
-                    || (k > p->colourTables[prev_term].colourCount))
-                {
-                    transition_score = 0;
-                    prev_score = 0;
-                }
-                if (colour_score == -1)
-                {
-                    colour_score = 0;
-                    transition_score = 0;
-                }
-                int score = colour_score + transition_score + prev_score;
-                //Getting the max 
-                if (score > best_score)
-                {
-                    best_score = score;
-                }
-            }
-            //Updating the matrix and ensuring that this colouring is valid 
-            //again
-            if (best_score > max_score && p->colourTables[term_no].colours[j] 
-                != -1 && j < p->colourTables[term_no].colourCount)
-            {
-                max_score = best_score;
-            }
-            best_scores[i][j] = best_score;
-        }
-        prev_term = term_no;
-    }
-    s->score = max_score;
-    return s;
+    return solveProblemPlanned(p, PLANNER_MEMORY_BUDGET, NULL);
 }
 struct solution *solveProblemF(struct problem *p)
+{
+    return solveProblemPlanned(p, PLANNER_MEMORY_BUDGET, NULL);
+}
+struct solution *solveProblemPlanned(struct problem *p, size_t memoryBudget, FILE *statsFile)
 {
     struct solution *s = newSolution(p);
-    int best_scores[p->termCount][4];
-    int max_score = 0;
-    int best_score;
-    int prev_term = 0;
-    int colour;
-    for (int i = 0; i < p->termCount; i++)
+    struct lattice *l = newLattice(p);
+    struct solvePlan plan;
+    planSolve(l, p->termCount, p->part == PART_E, memoryBudget, plannerIdleThreads(), &plan);
+    s->score = solvePlanned(l, p->termTables, p->termCount, s->termColours, &plan);
+    if (statsFile)
     {
-        // Getting the term number of the current word in the term tables
-        int term_no = is_term(p, i);
-        for (int j = 0; j < 4; j++)
-        {
-            best_score = -1;
-            if (i == 0)
-            {
-                best_score = p->colourTables[term_no].scores[j];
-                best_score = (best_score < 0) ? 0 : best_score;
-                best_scores[i][j] = best_score;
-                continue;
-            }
-            for (int k = 0; k < 4; k++)
-            {
-                int transition_score = get_transition(p, term_no, k, j);
-                int colour_score = 0;
-                int prev_score = best_scores[i - 1][k];
-                colour_score = p->colourTables[term_no].scores[j];
-                // Making sure this colour is valid for this term
-                if (p->colourTables[prev_term].colours[k] == -1 ||
-                    (k > p->colourTables[prev_term].colourCount))
-                {
-                    transition_score = 0;
-                    prev_score = 0;
-                }
-                if (colour_score == -1)
-                {
-                    colour_score = 0;
-                    transition_score = 0;
-                }
-                int score = colour_score + transition_score + prev_score;
-                if (score > best_score)
-                {
-                    best_score = score;
-                }
-            }
-            //Reducing the score to find the new best and back tracking through
-            //the bottom of the matrix.
-            if (best_score > max_score && p->colourTables[term_no].colours[j] 
-                != -1 && j < p->colourTables[term_no].colourCount)
-            {
-                max_score = best_score;
-                colour = j;
-            }
-            best_scores[i][j] = best_score;
-        }
-        prev_term = term_no;
-    }
-    // for(int i = 0; i < p->termCount; i++){
-    //     for(int j = 0; j < 4 ; j++){
-    //         printf("%d   ", best_scores[i][j]);
-    //     }
-    //     printf("\n");
-    // }
-    int counter = p->termCount - 1;
-    for (int i = p->termCount - 1; i > 0; i--)
-    {
-        int term_no = is_term(p, i);
-        for (int j = 0; j < 4; j++)
-        {
-            // printf("score : %d\n", colour);
-            if (p->colourTables[term_no].scores[colour] +
-                    get_transition(p, term_no, j, colour) +
-                    best_scores[i - 1][j] ==
-                max_score)
-            {
-                s->termColours[counter] = colour;
-                counter--;
-                colour = j;
-                max_score = best_scores[i - 1][j];
-                // printf(" post : %d \n", best_scores[i - 1][j]);
-                break;
-            }
-        }
+        printSolvePlan(statsFile, &plan);
     }
-    s->termColours[0] = colour;
+    freeLattice(l);
     return s;
 }
-
@@ -36,6 +36,44 @@ struct problem *readProblemE(FILE *textFile, FILE *tableFile,
 struct problem *readProblemF(FILE *textFile, FILE *tableFile, 
     FILE *transTable);
 
+/*
+    Reads only the given table file and transition table, leaving
+    the Part F problem with no text or terms, for callers which
+    tokenize the text themselves as it arrives.
+*/
+struct problem *readProblemTables(FILE *tableFile, FILE *transTable);
+
+/*
+    Same as Problem F, but the tables and transition table are those
+    published to the shared-memory segment of the given name (see
+    segment.h), attached rather than read. A textFile of NULL leaves
+    the problem with no text as readProblemTables does. Returns NULL
+    if the segment can't be attached.
+*/
+struct problem *readProblemShared(FILE *textFile, const char *segmentName);
+
+/*
+    Reads the given text file into the terms of a new Part F problem
+    which borrows the tables, transition table and lattice of the
+    given one rather than reading its own, for many documents sharing
+    one copy. The given problem must outlive it. A textFile of NULL
+    leaves the problem with no text as readProblemTables does.
+*/
+struct problem *readProblemDocument(const struct problem *tables, FILE *textFile);
+
+/*
+    Reads the given text file into the terms of a problem read with
+    no text, by readProblemTables, readProblemShared or
+    readProblemDocument, giving the problem readProblemF would have.
+*/
+void readProblemText(struct problem *p, FILE *textFile);
+
+/*
+    Returns the number of terms the text of the given problem was
+    split into.
+*/
+int problemTermCount(struct problem *p);
+
 /*
     Solves the given problem according to Part A's definition
     and places the solution output into a returned solution value.
@@ -60,13 +98,65 @@ struct solution *solveProblemE(struct problem *p);
 */
 struct solution *solveProblemF(struct problem *p);
 
+/*
+    Solves the given Part E or Part F problem as solveProblemE or
+    solveProblemF do, with the strategy planSolve picks for its size
+    within memoryBudget bytes on the processors which are idle, and
+    prints the plan to statsFile if it is not NULL.
+*/
+struct solution *solveProblemPlanned(struct problem *p, size_t memoryBudget, FILE *statsFile);
+
 /*
     Outputs the given solution to the given file. If colourMode is 1, the
-    sentence in the problem is coloured with the given solution colours.
+    sentence in the problem is coloured with the given solution colours,
+    and if it is COLOUR_MODE_SPANS or COLOUR_MODE_HTML the text is
+    written with runs of a colour in spans (see outputColouring).
 */
 void outputProblem(struct problem *problem, struct solution *solution, FILE *stdout, 
     int colourMode);
 
+/*
+    Outputs a single term as outputProblem does, preceded by a space
+    unless it is the first (index 0). The term is only used if
+    colourMode is 1, otherwise the colour is printed.
+*/
+void outputTerm(FILE *outFile, int index, const char *term, int colour,
+    int colourMode);
+
+/*
+    Writes a single term as outputTerm would print it into the given
+    buffer of size bytes, as snprintf does, returning the length it
+    needs. The term is termLength characters long.
+*/
+int formatTerm(char *buffer, size_t size, int index, const char *term, int termLength,
+    int colour, int colourMode);
+
+/*
+    Colour modes which write the text itself, keeping its whitespace,
+    with each run of neighbouring terms of one colour marked as a
+    single span, in terminal codes or HTML <mark> elements.
+*/
+#define COLOUR_MODE_SPANS 2
+#define COLOUR_MODE_HTML 3
+
+/*
+    Writes the given text of textLength characters, with each run of
+    terms of the same colour on one line marked as a span as colourMode
+    says, into the given buffer if it is not NULL, ending it with a
+    newline if the text has none. In HTML, runs of colour 0 (no
+    highlight) are left as plain text. Returns the length it needs, so
+    calling it with NULL first gives the size of buffer to allocate.
+*/
+size_t formatSpans(char *buffer, const char *text, int textLength, int termCount,
+    const int *termStarts, const int *termEnds, const int *colours, int colourMode);
+
+/*
+    Outputs the given colours of the terms of the given problem on a
+    line as outputProblem does, or in spans over the problem's text if
+    colourMode is COLOUR_MODE_SPANS or COLOUR_MODE_HTML.
+*/
+void outputColouring(FILE *outFile, struct problem *p, const int *colours, int colourMode);
+
 /*
     Frees the given solution and all memory allocated for it.
 */
@@ -11,6 +11,62 @@
         or 
 
         ./problem2f -c table ctt < text
+
+        or
+
+        ./problem2f -p table ctt < text
+
+        or
+
+        ./problem2f [-c] [--stats] table ctt text...
+
+        or
+
+        ./problem2f [-c] [--stats] [--memory MB] table ctt < text
+
+        or
+
+        ./problem2f [-c] --kbest N table ctt < text
+
+        or
+
+        ./problem2f [-c] --marginals float|double table ctt < text
+
+        or
+
+        ./problem2f [-c] --constraints file table ctt < text
+
+        or
+
+        ./problem2f [-c] --beam B table ctt < text
+
+        or
+
+        ./problem2f [-c] --runs table ctt < text
+
+        or
+
+        ./problem2f [-c] [--stats] --narrow table ctt < text
+
+        or
+
+        ./problem2f --publish name table ctt
+
+        or
+
+        ./problem2f [-c] [-p] [--stats] --attach name < text
+
+        or
+
+        ./problem2f [-c] [--stats] --attach name text...
+
+        or
+
+        ./problem2f --unpublish name
+
+        or
+
+        ./problem2f --spans|--html [options] table ctt < text
     
     where table is the colour table in the expected
         format (e.g. test_cases/2f-1-table.txt), ctt
@@ -19,17 +75,108 @@
         file containing input text, for example:
     
         ./problem2f test_cases/2f-1-table.txt test_cases/2f-1-ctt.txt < test_cases/2f-1-text.txt
-    
+
+    A term holding a * is a pattern, the * matching any
+    run of letters, including none, of up to 64 bytes,
+    so "algorithm*" takes "algorithms" but not a word
+    running on 64 letters past "algorithm".
+    Tables whose patterns would need more than 262144
+    DFA states to match together fail to load.
+
     The -c can optionally be included as the first 
     argument to print the colours of each term out
     to the terminal in the assigned colours where the
     colour is available.
+
+    The -p can optionally be included (before or after
+    -c) to read, solve and print the text in a pipeline
+    of threads, printing colours as they are settled
+    rather than after the whole text has been read.
+    With --stats it prints to stderr how many terms were
+    settled as the paths met and how long they waited,
+    and the counters for the whole pipeline in totals.
+    It only reads the text from standard input, so can't
+    be given text files.
+
+    If text files are given after the tables, each is
+    solved as a separate document, spread over worker
+    threads, and its colours printed on its own line.
+    Documents whose terms have the same tables as an
+    earlier one are copied rather than solved again.
+    --stats prints how busy each worker was to stderr.
+    It also prints the CPU time, cycles, instructions,
+    cache misses and branch mispredictions per term of
+    splitting the text and of solving and printing it,
+    where the processor's counters can be read.
+
+    A single document is solved in full, checkpointed or
+    in chunks over idle processors, by its length and
+    --memory MB, the most its back pointers may take
+    (512 by default). --stats prints the plan to stderr,
+    and the counters for splitting, solving and printing,
+    or for solving and printing together with the options
+    below, which print as they solve and so can't be
+    given --memory.
+
+    --kbest N prints the N best colourings, each on its
+    own line after its score.
+
+    --marginals prints each term on its own line with
+    the probability of each colour, taking scores as
+    log-potentials, worked out in float or double.
+
+    --constraints reads lines of pin,term,colour, forcing
+    the term at that index to the colour, and of
+    forbid,prevColour,colour, forbidding that transition,
+    and prints the best colouring which meets them.
+
+    --beam B keeps only the B best colours of each term,
+    for tables with too many colours to solve exactly.
+
+    --runs steps over each run of words without a table
+    at once, for notes where few words have one.
+
+    --narrow solves with scores held in 16 bits, twice as
+    many colours to a vector, for tables of 4, 8 or 16
+    colours with small scores, and in 32 bits otherwise.
+    --stats says which it was.
+
+    Only one of -p, --kbest, --marginals, --constraints,
+    --beam, --runs and --narrow can be given, and neither
+    they nor --memory with text files.
+
+    --publish loads the tables once into the shared-memory
+    segment name (e.g. /highlight-tables) and exits, then
+    --attach name takes the tables from that segment in
+    place of the table files, for many workers sharing one
+    copy. --unpublish name removes the segment.
+
+    --spans prints the text itself, keeping its whitespace,
+    with each run of terms of one colour highlighted as a
+    single span, and --html does the same with <mark>
+    elements for a web page, leaving colour 0 unmarked.
+    Neither works with -p or --marginals, which print
+    terms as they go.
 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <error.h>
+#include <string.h>
+#include <unistd.h>
 #include "problem.h"
+#include "pipeline.h"
+#include "scheduler.h"
+#include "cache.h"
+#include "kbest.h"
+#include "marginals.h"
+#include "constraints.h"
+#include "beam.h"
+#include "runs.h"
+#include "narrow.h"
+#include "segment.h"
+#include "planner.h"
+#include "counters.h"
 
 /* If no -c is provided, the table file is the first argument. */
 #define DEFAULT_ARGV_TABLE_FILE 1
@@ -47,6 +194,27 @@ int main(int argc, char **argv){
     int tableFileArgIndex = DEFAULT_ARGV_TABLE_FILE;
     int transitionFileArgIndex = DEFAULT_ARGV_TRANSITION_FILE;
     int colourMode = 0;
+    int pipelineMode = 0;
+    int statsMode = 0;
+    /* The number of colourings to print, 0 for just the best. */
+    int kbest = 0;
+    /* Whether to print marginals and in which precision. */
+    int marginalsMode = 0;
+    enum marginalPrecision precision = MARGINAL_FLOAT;
+    /* Pinned terms and forbidden transitions, if any were given. */
+    struct latticeConstraints *constraints = NULL;
+    /* The number of colours kept per term, 0 to solve exactly. */
+    int beamWidth = 0;
+    int runsMode = 0;
+    int narrowMode = 0;
+    /* Bytes a single document's solve may use for back pointers. */
+    size_t memoryBudget = PLANNER_MEMORY_BUDGET;
+    int memoryGiven = 0;
+    /* Shared-memory segment to publish the tables to or attach them from. */
+    const char *publishName = NULL;
+    const char *attachName = NULL;
+    /* Processor counters for --stats, read around each phase. */
+    struct perfCounters counters;
 
     if(argc < 3){
         fprintf(stderr, "You only gave %d arguments to the program, \n"
@@ -54,40 +222,232 @@ int main(int argc, char **argv){
             "\t./problem2f wordtable transitiontable < text\n", argc);
         return EXIT_FAILURE;
     } else {
-        /* First argument may be -c. */
-        if(argv[1][0] == '-' && argv[1][1] == 'c'){
-            colourMode = 1;
-            if(argc < 4){
-                fprintf(stderr, "You only gave %d arguments to the program, \n"
-                    "you should run the program with in the form \n"
-                    "\t./problem2f -c wordtable transitiontable < text\n", argc);
+        /* First arguments may be -c, -p or --stats. */
+        while(tableFileArgIndex < argc && argv[tableFileArgIndex][0] == '-'){
+            if(strcmp(argv[tableFileArgIndex], "--stats") == 0){
+                statsMode = 1;
+            } else if(strcmp(argv[tableFileArgIndex], "--spans") == 0){
+                colourMode = COLOUR_MODE_SPANS;
+            } else if(strcmp(argv[tableFileArgIndex], "--html") == 0){
+                colourMode = COLOUR_MODE_HTML;
+            } else if(strcmp(argv[tableFileArgIndex], "--runs") == 0){
+                runsMode = 1;
+            } else if(strcmp(argv[tableFileArgIndex], "--narrow") == 0){
+                narrowMode = 1;
+            } else if(strcmp(argv[tableFileArgIndex], "--publish") == 0 && tableFileArgIndex + 1 < argc){
+                publishName = argv[tableFileArgIndex + 1];
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "--attach") == 0 && tableFileArgIndex + 1 < argc){
+                attachName = argv[tableFileArgIndex + 1];
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "--unpublish") == 0 && tableFileArgIndex + 1 < argc){
+                return unpublishTables(argv[tableFileArgIndex + 1]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+            } else if(strcmp(argv[tableFileArgIndex], "--memory") == 0 && tableFileArgIndex + 1 < argc){
+                double megabytes = atof(argv[tableFileArgIndex + 1]);
+                if(megabytes <= 0){
+                    fprintf(stderr, "Memory budget \"%s\" should be a positive number of MB\n", argv[tableFileArgIndex + 1]);
+                    return EXIT_FAILURE;
+                }
+                memoryBudget = (size_t) (megabytes * 1048576);
+                memoryGiven = 1;
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "--kbest") == 0 && tableFileArgIndex + 1 < argc){
+                kbest = atoi(argv[tableFileArgIndex + 1]);
+                if(kbest <= 0){
+                    fprintf(stderr, "Number of colourings \"%s\" should be a positive number\n", argv[tableFileArgIndex + 1]);
+                    return EXIT_FAILURE;
+                }
+                /* The count is an argument of its own. */
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "--marginals") == 0 && tableFileArgIndex + 1 < argc){
+                marginalsMode = 1;
+                if(strcmp(argv[tableFileArgIndex + 1], "double") == 0){
+                    precision = MARGINAL_DOUBLE;
+                } else if(strcmp(argv[tableFileArgIndex + 1], "float") != 0){
+                    fprintf(stderr, "Unknown precision \"%s\", expected float or double\n", argv[tableFileArgIndex + 1]);
+                    return EXIT_FAILURE;
+                }
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "--beam") == 0 && tableFileArgIndex + 1 < argc){
+                beamWidth = atoi(argv[tableFileArgIndex + 1]);
+                if(beamWidth <= 0){
+                    fprintf(stderr, "Beam width \"%s\" should be a positive number\n", argv[tableFileArgIndex + 1]);
+                    return EXIT_FAILURE;
+                }
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "--constraints") == 0 && tableFileArgIndex + 1 < argc){
+                FILE *constraintFile = fopen(argv[tableFileArgIndex + 1], "r");
+                if(! constraintFile){
+                    fprintf(stderr, "File given as constraint file was \"%s\", which was unable to be opened\n", argv[tableFileArgIndex + 1]);
+                    perror("Reason for file open failure");
+                    return EXIT_FAILURE;
+                }
+                constraints = readConstraints(constraintFile);
+                fclose(constraintFile);
+                if(! constraints){
+                    return EXIT_FAILURE;
+                }
+                tableFileArgIndex++;
+                transitionFileArgIndex++;
+            } else if(strcmp(argv[tableFileArgIndex], "-c") == 0){
+                colourMode = 1;
+            } else if(strcmp(argv[tableFileArgIndex], "-p") == 0){
+                pipelineMode = 1;
+            } else {
+                fprintf(stderr, "Unknown option \"%s\"\n", argv[tableFileArgIndex]);
                 return EXIT_FAILURE;
             }
-            /* If the first argument is -c, the second argument will be the table file */
+            /* Each option moves the table files along by one. */
             tableFileArgIndex++;
-            /* And third will be the colour transition table */
             transitionFileArgIndex++;
         }
-        /* Sanity check - we should have the argument for the tableFile */
-        assert(argc >= (tableFileArgIndex + 1));
-        tableFile = fopen(argv[tableFileArgIndex], "r");
-        /* Ensure the file was able to be successfully opened. */
-        if(! tableFile){
-            fprintf(stderr, "File given as table file was \"%s\", which was unable to be opened\n", argv[tableFileArgIndex]);
-            perror("Reason for file open failure");
+        if(colourMode >= COLOUR_MODE_SPANS && (pipelineMode || marginalsMode)){
+            fprintf(stderr, "--spans and --html need the whole text, so can't be used with -p or --marginals\n");
+            return EXIT_FAILURE;
+        }
+        if(attachName && ! publishName){
+            /* The tables come from the segment, the rest are documents. */
+            transitionFileArgIndex = tableFileArgIndex - 1;
+        } else if(argc < transitionFileArgIndex + 1){
+            fprintf(stderr, "You only gave %d arguments to the program, \n"
+                "you should run the program with in the form \n"
+                "\t./problem2f [-c] [--spans] [--html] [-p] [--stats] [--memory MB] [--kbest N] [--marginals float|double] [--constraints file] [--beam B] [--runs] [--narrow] [--publish name] wordtable transitiontable < text\n\t./problem2f [options] --attach name < text\n", argc);
+            return EXIT_FAILURE;
+        }
+        /* Any arguments after the tables are documents, solved whole. */
+        int documentCount = publishName ? 0 : argc - transitionFileArgIndex - 1;
+        if(pipelineMode && documentCount > 0){
+            fprintf(stderr, "-p reads the text from standard input as it arrives, so can't be used with text files\n");
+            return EXIT_FAILURE;
+        }
+        /* Each of these solves and prints the text its own way, so only one can be given. */
+        int solverCount = pipelineMode + (kbest > 0) + marginalsMode + (beamWidth > 0)
+            + (constraints != NULL) + runsMode + narrowMode;
+        if(solverCount > 1){
+            fprintf(stderr, "Only one of -p, --kbest, --marginals, --beam, --constraints, --runs and --narrow can be given\n");
             return EXIT_FAILURE;
         }
-        assert(argc >= (transitionFileArgIndex + 1));
-        transFile = fopen(argv[transitionFileArgIndex], "r");
-        /* Ensure the file was able to be successfully opened. */
-        if(! transFile){
-            fprintf(stderr, "File given as transition table file was \"%s\", which was unable to be opened\n", argv[transitionFileArgIndex]);
-            perror("Reason for file open failure");
+        if(documentCount > 0 && (solverCount > 0 || memoryGiven)){
+            fprintf(stderr, "Text files are each solved in full, so can't be used with --kbest, --marginals, --beam, --constraints, --runs, --narrow or --memory\n");
             return EXIT_FAILURE;
         }
+        if(memoryGiven && solverCount > 0){
+            fprintf(stderr, "--memory only bounds the planned solve, so can't be used with -p, --kbest, --marginals, --beam, --constraints, --runs or --narrow\n");
+            return EXIT_FAILURE;
+        }
+        if(! attachName || publishName){
+            /* Sanity check - we should have the argument for the tableFile */
+            assert(argc >= (tableFileArgIndex + 1));
+            tableFile = fopen(argv[tableFileArgIndex], "r");
+            /* Ensure the file was able to be successfully opened. */
+            if(! tableFile){
+                fprintf(stderr, "File given as table file was \"%s\", which was unable to be opened\n", argv[tableFileArgIndex]);
+                perror("Reason for file open failure");
+                return EXIT_FAILURE;
+            }
+            assert(argc >= (transitionFileArgIndex + 1));
+            transFile = fopen(argv[transitionFileArgIndex], "r");
+            /* Ensure the file was able to be successfully opened. */
+            if(! transFile){
+                fprintf(stderr, "File given as transition table file was \"%s\", which was unable to be opened\n", argv[transitionFileArgIndex]);
+                perror("Reason for file open failure");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if(publishName){
+        problem = readProblemTables(tableFile, transFile);
+        fclose(tableFile);
+        fclose(transFile);
+        int published = publishTables(problem, publishName);
+        freeProblem(problem);
+        return published == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if(statsMode){
+        openCounters(&counters);
+    }
+
+    if(argc > transitionFileArgIndex + 1){
+        /* Each remaining argument is a document. */
+        int problemCount = argc - transitionFileArgIndex - 1;
+        long long termCount = 0;
+        struct problem **problems = (struct problem **) malloc(sizeof(struct problem *) * problemCount);
+        assert(problems);
+        /* The tables are read or attached once, every document borrows them. */
+        struct problem *tables;
+        if(attachName){
+            tables = readProblemShared(NULL, attachName);
+            if(! tables){
+                return EXIT_FAILURE;
+            }
+        } else {
+            tables = readProblemTables(tableFile, transFile);
+            fclose(tableFile);
+            fclose(transFile);
+        }
+        for(int i = 0; i < problemCount; i++){
+            const char *fileName = argv[transitionFileArgIndex + 1 + i];
+            FILE *documentFile = fopen(fileName, "r");
+            if(! documentFile){
+                fprintf(stderr, "File given as text file was \"%s\", which was unable to be opened\n", fileName);
+                perror("Reason for file open failure");
+                return EXIT_FAILURE;
+            }
+            /* With --stats the text is split separately, to count it alone. */
+            problems[i] = readProblemDocument(tables, statsMode ? NULL : documentFile);
+            if(statsMode){
+                startCounters(&counters);
+                readProblemText(problems[i], documentFile);
+                stopCounters(&counters);
+                termCount += problemTermCount(problems[i]);
+            }
+            fclose(documentFile);
+        }
+        if(statsMode){
+            printCountersHeader(stderr, &counters);
+            printCounters(stderr, "split", &counters, termCount);
+            resetCounters(&counters);
+            startCounters(&counters);
+        }
+        /* Documents with the same tokens share a solve. */
+        struct solutionCache *cache = newSolutionCache(SOLUTION_CACHE_CAPACITY);
+        solveProblemsScheduled(problems, problemCount, (int) sysconf(_SC_NPROCESSORS_ONLN),
+            colourMode, stdout, statsMode ? stderr : NULL, cache);
+        freeSolutionCache(cache);
+        if(statsMode){
+            fflush(stdout);
+            stopCounters(&counters);
+            printCounters(stderr, "solve+print", &counters, termCount);
+            closeCounters(&counters);
+        }
+        for(int i = 0; i < problemCount; i++){
+            freeProblem(problems[i]);
+        }
+        freeProblem(tables);
+        free(problems);
+        return EXIT_SUCCESS;
     }
 
-    problem = readProblemF(textFile, tableFile, transFile);
+    /* With --stats the text is split separately, to count it alone. */
+    int splitAfter = statsMode && ! pipelineMode;
+    if(attachName){
+        problem = readProblemShared((pipelineMode || splitAfter) ? NULL : textFile, attachName);
+        if(! problem){
+            return EXIT_FAILURE;
+        }
+    } else if(pipelineMode || splitAfter){
+        problem = readProblemTables(tableFile, transFile);
+    } else {
+        problem = readProblemF(textFile, tableFile, transFile);
+    }
 
     if(tableFile){
         fclose(tableFile);
@@ -97,10 +457,74 @@ int main(int argc, char **argv){
         fclose(transFile);
     }
 
-    solution = solveProblemF(problem);
+    if(splitAfter){
+        startCounters(&counters);
+        readProblemText(problem, textFile);
+        stopCounters(&counters);
+        printCountersHeader(stderr, &counters);
+        printCounters(stderr, "split", &counters, problemTermCount(problem));
+    }
+
+    if(statsMode){
+        resetCounters(&counters);
+        startCounters(&counters);
+    }
+
+    /* Every solver but the planned one prints as it goes. */
+    int printed = 1;
+    if(pipelineMode){
+        solvePipelined(problem, textFile, stdout, colourMode, statsMode ? stderr : NULL);
+    } else if(kbest > 0){
+        solveProblemKBest(problem, kbest, colourMode, stdout);
+    } else if(marginalsMode){
+        solveProblemMarginals(problem, precision, colourMode, stdout);
+    } else if(beamWidth > 0){
+        solveProblemBeam(problem, beamWidth, colourMode, stdout);
+    } else if(constraints){
+        solveProblemConstrained(problem, constraints, colourMode, stdout);
+        freeConstraints(constraints);
+    } else if(runsMode){
+        solveProblemRuns(problem, colourMode, stdout);
+    } else if(narrowMode){
+        solveProblemNarrow(problem, colourMode, stdout, statsMode ? stderr : NULL);
+    } else {
+        printed = 0;
+    }
+
+    if(printed){
+        if(statsMode){
+            fflush(stdout);
+            stopCounters(&counters);
+            /* The pipeline splits as it goes, its terms are counted in its own stats. */
+            if(pipelineMode){
+                printCountersHeader(stderr, &counters);
+                printCounters(stderr, "pipeline", &counters, 0);
+            } else {
+                printCounters(stderr, "solve+print", &counters, problemTermCount(problem));
+            }
+            closeCounters(&counters);
+        }
+        freeProblem(problem);
+        return EXIT_SUCCESS;
+    }
+
+    solution = solveProblemPlanned(problem, memoryBudget, statsMode ? stderr : NULL);
+    if(statsMode){
+        stopCounters(&counters);
+        printCounters(stderr, "solve", &counters, problemTermCount(problem));
+        resetCounters(&counters);
+        startCounters(&counters);
+    }
 
     outputProblem(problem, solution, stdout, colourMode);
 
+    if(statsMode){
+        fflush(stdout);
+        stopCounters(&counters);
+        printCounters(stderr, "print", &counters, problemTermCount(problem));
+        closeCounters(&counters);
+    }
+
     freeSolution(solution, problem);
 
     freeProblem(problem);
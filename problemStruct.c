@@ -7,10 +7,20 @@
         information.
 */
 
+#include <stdint.h>
+
 struct termColourTable;
 
 struct colourTransitionTable;
 
+struct termMatcher;
+
+struct tableSegment;
+
+struct lattice;
+
+struct vocabulary;
+
 struct termColourTable {
     /* The term the table is for. */
     char *term;
@@ -21,6 +31,8 @@ struct termColourTable {
     int *colours;
     /* The score for each colour. */
     int *scores;
+    /* Whether the term is a pattern with a wildcard (see pattern.h). */
+    int pattern;
 };
 
 struct colourTransitionTable {
@@ -51,14 +63,37 @@ struct problem {
     char *text;
     /* 
         The term broken into tokens. These will
-        be fresh strings if the they are not
-        in the term colour table, if they are
-        in the term colour table, they will be
-        stored at the same place in memory so
-        terms in the term table can be compared 
-        using either strcmp or equality.
+        be the vocabulary's spellings
+        if the they are not in the term colour
+        table, if they are in the term colour
+        table, they will be stored at the same
+        place in memory so terms in the term table
+        can be compared using either strcmp or
+        equality.
     */
     char **terms;
+    /*
+        The id of each token's word in the vocabulary, the same for
+        tokens which are the same word ignoring case.
+    */
+    uint32_t *termIds;
+    /*
+        The words and spellings of the terms, shared with the problem
+        the tables are borrowed from, if any, so ids agree across
+        documents.
+    */
+    struct vocabulary *vocabulary;
+    /* 
+        The index of the term colour table for each token,
+        or -1 where the token has no table.
+    */
+    int *termTables;
+    /* 
+        The span of each token in the original text, from
+        the offset of its first character to one past its last.
+    */
+    int *termStarts;
+    int *termEnds;
 
     /* Which problem part is being solved. */
     enum problemPart part;
@@ -68,6 +103,30 @@ struct problem {
     int termColourTableCount;
     /* The term colour tables, one for each term. */
     struct termColourTable *colourTables;
+    /* 
+        Hash of the loaded tables, two problems with the same
+        tables will have the same snapshot version.
+    */
+    unsigned long long tableVersion;
+    /* Index of the terms of the tables, for the tokenizer. */
+    struct termMatcher *matcher;
+    /*
+        The shared-memory segment the tables above and the transition
+        table are in, or NULL if they were read into this problem.
+    */
+    struct tableSegment *segment;
+    /*
+        The lattice compiled from the tables in the segment, shared by
+        every lattice made for the problem, or NULL to compile one
+        each time.
+    */
+    struct lattice *compiledLattice;
+    /*
+        The problem whose tables, transition table and lattice this one
+        borrows (see readProblemDocument), which frees them, or NULL if
+        they are its own.
+    */
+    const struct problem *tableOwner;
 
     /* Part B onwards. */
     /* 
@@ -0,0 +1,98 @@
+/*
+    Implementation for module which passes items between two
+        threads through a bounded lock-free ring buffer.
+
+    The producer only writes tail and the consumer only writes head,
+    each publishing with a release store that the other side reads
+    with an acquire load, so no locks are needed. A side that can't
+    make progress yields its time slice rather than spinning, as the
+    stages may share a single core.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include "queue.h"
+
+/* Keeps the producer's and consumer's counters on separate cache lines. */
+#define CACHE_LINE 64
+
+struct queue
+{
+    int itemSize;
+    /* Capacity less one, the capacity is a power of two. */
+    unsigned long mask;
+    char *items;
+    /* Set once the producer is done. */
+    atomic_int closed;
+    /* The number of items ever popped, written by the consumer. */
+    _Alignas(CACHE_LINE) atomic_ulong head;
+    /* The number of items ever pushed, written by the producer. */
+    _Alignas(CACHE_LINE) atomic_ulong tail;
+};
+
+struct queue *newQueue(int capacity, int itemSize)
+{
+    struct queue *q = (struct queue *)aligned_alloc(CACHE_LINE, sizeof(struct queue));
+    assert(q);
+    unsigned long size = 1;
+    while (size < (unsigned long)capacity)
+    {
+        size *= 2;
+    }
+    q->itemSize = itemSize;
+    q->mask = size - 1;
+    q->items = (char *)malloc(size * itemSize);
+    assert(q->items);
+    atomic_init(&(q->closed), 0);
+    atomic_init(&(q->head), 0);
+    atomic_init(&(q->tail), 0);
+    return q;
+}
+
+void queuePush(struct queue *q, const void *item)
+{
+    unsigned long tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    while (tail - atomic_load_explicit(&(q->head), memory_order_acquire) > q->mask)
+    {
+        sched_yield();
+    }
+    memcpy(q->items + (tail & q->mask) * q->itemSize, item, q->itemSize);
+    atomic_store_explicit(&(q->tail), tail + 1, memory_order_release);
+}
+
+void queueClose(struct queue *q)
+{
+    atomic_store_explicit(&(q->closed), 1, memory_order_release);
+}
+
+int queuePop(struct queue *q, void *item)
+{
+    unsigned long head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    while (atomic_load_explicit(&(q->tail), memory_order_acquire) == head)
+    {
+        if (atomic_load_explicit(&(q->closed), memory_order_acquire))
+        {
+            /* Items pushed before closing are visible once closed is. */
+            if (atomic_load_explicit(&(q->tail), memory_order_acquire) == head)
+            {
+                return 0;
+            }
+            break;
+        }
+        sched_yield();
+    }
+    memcpy(item, q->items + (head & q->mask) * q->itemSize, q->itemSize);
+    atomic_store_explicit(&(q->head), head + 1, memory_order_release);
+    return 1;
+}
+
+void freeQueue(struct queue *q)
+{
+    if (q)
+    {
+        free(q->items);
+        free(q);
+    }
+}
@@ -0,0 +1,41 @@
+/*
+    Header for module which passes fixed size items from one
+        producer thread to one consumer thread through a bounded
+        lock-free ring buffer.
+*/
+#ifndef QUEUE_H
+#define QUEUE_H 1
+
+struct queue;
+
+/*
+    Creates a queue holding up to capacity items of itemSize bytes
+    each, capacity is rounded up to a power of two.
+*/
+struct queue *newQueue(int capacity, int itemSize);
+
+/*
+    Copies the given item onto the back of the queue, waiting while
+    the queue is full. Only one thread may push.
+*/
+void queuePush(struct queue *q, const void *item);
+
+/*
+    Marks that no more items will be pushed, once the consumer has
+    taken every item already pushed queuePop returns 0.
+*/
+void queueClose(struct queue *q);
+
+/*
+    Copies the item at the front of the queue into item and returns 1,
+    waiting while the queue is empty, or returns 0 if the queue is
+    empty and closed. Only one thread may pop.
+*/
+int queuePop(struct queue *q, void *item);
+
+/*
+    Frees the given queue and all memory allocated for it.
+*/
+void freeQueue(struct queue *q);
+
+#endif
@@ -0,0 +1,414 @@
+/*
+    Implementation for module which solves a Part F problem with each
+        run of words without a table collapsed into a single step.
+
+    Most words of a note have no table, and every step between two of
+    them is the same: the matrix of transitions between the colours
+    such a word allows plus their emissions. A run's first word is
+    stepped into as usual, then the rest of the run is one product
+    with that matrix raised to the run's length less one in max-plus,
+    built from its squares and kept for the next run of that length.
+    The first word's scores are kept so that, once the colour the run
+    ends in is known, the words inside it can be stepped through again
+    with back pointers, taking the same ties as a full pass would.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "runs.h"
+#include "problemStruct.c"
+
+/* Keeps sums of non-allowed scores from drifting towards overflow. */
+#define CLAMP(score) (((score) < LATTICE_NONALLOWED) ? LATTICE_NONALLOWED : (score))
+
+/* Run lengths whose powers are kept, longer ones are built each time. */
+#define CACHEDLENGTHS 4096
+
+struct latticeRuns *newLatticeRuns(struct lattice *l)
+{
+    struct latticeRuns *r = (struct latticeRuns *)malloc(sizeof(struct latticeRuns));
+    assert(r);
+    r->l = l;
+    int colourCount = l->colourCount;
+    r->allowed = l->allowedColours + l->allowedStarts[0];
+    r->allowedCount = l->allowedStarts[1] - l->allowedStarts[0];
+    int allowedCount = r->allowedCount;
+    const int *row = LATTICE_ROW(l, -1);
+
+    r->step = (int *)malloc(sizeof(int) * (allowedCount * allowedCount > 0 ?
+                                           allowedCount * allowedCount : 1));
+    assert(r->step);
+    for (int s = 0; s < allowedCount; s++)
+    {
+        const int *transitions = l->transitions + r->allowed[s] * colourCount;
+        for (int e = 0; e < allowedCount; e++)
+        {
+            int colour = r->allowed[e];
+            r->step[s * allowedCount + e] = CLAMP(transitions[colour] + row[colour]);
+        }
+    }
+    r->squareCount = 0;
+    r->squares = NULL;
+    r->powerCount = 0;
+    r->powers = NULL;
+    r->scratch = NULL;
+    return r;
+}
+
+/* Sets result to the max-plus product of the given allowedCount square matrices. */
+static void multiply(const int *x, const int *y, int allowedCount, int *result)
+{
+    for (int i = 0; i < allowedCount; i++)
+    {
+        int *resultRow = result + i * allowedCount;
+        for (int j = 0; j < allowedCount; j++)
+        {
+            resultRow[j] = LATTICE_NONALLOWED;
+        }
+        for (int k = 0; k < allowedCount; k++)
+        {
+            int from = x[i * allowedCount + k];
+            const int *yRow = y + k * allowedCount;
+            for (int j = 0; j < allowedCount; j++)
+            {
+                int value = from + yRow[j];
+                resultRow[j] = (value > resultRow[j]) ? value : resultRow[j];
+            }
+        }
+        for (int j = 0; j < allowedCount; j++)
+        {
+            resultRow[j] = CLAMP(resultRow[j]);
+        }
+    }
+}
+
+/* Returns the step to the given power (at least 1), building and keeping it if needed. */
+static const int *runPower(struct latticeRuns *r, int length)
+{
+    if (length < r->powerCount && r->powers[length])
+    {
+        return r->powers[length];
+    }
+    int allowedCount = r->allowedCount;
+    size_t matrixSize = sizeof(int) * allowedCount * allowedCount;
+
+    /* Square up to the highest bit of the length. */
+    int squaresNeeded = 1;
+    while ((length >> squaresNeeded) > 0)
+    {
+        squaresNeeded++;
+    }
+    if (squaresNeeded > r->squareCount)
+    {
+        r->squares = (int **)realloc(r->squares, sizeof(int *) * squaresNeeded);
+        assert(r->squares);
+        for (int i = r->squareCount; i < squaresNeeded; i++)
+        {
+            r->squares[i] = (int *)malloc(matrixSize);
+            assert(r->squares[i]);
+            if (i == 0)
+            {
+                memcpy(r->squares[i], r->step, matrixSize);
+            }
+            else
+            {
+                multiply(r->squares[i - 1], r->squares[i - 1], allowedCount, r->squares[i]);
+            }
+        }
+        r->squareCount = squaresNeeded;
+    }
+
+    int *power = (int *)malloc(matrixSize);
+    assert(power);
+    int *product = (int *)malloc(matrixSize);
+    assert(product);
+    int started = 0;
+    for (int i = 0; i < squaresNeeded; i++)
+    {
+        if (!(length & (1 << i)))
+        {
+            continue;
+        }
+        if (!started)
+        {
+            memcpy(power, r->squares[i], matrixSize);
+            started = 1;
+        }
+        else
+        {
+            multiply(power, r->squares[i], allowedCount, product);
+            int *swap = power;
+            power = product;
+            product = swap;
+        }
+    }
+    free(product);
+
+    if (length >= CACHEDLENGTHS)
+    {
+        free(r->scratch);
+        r->scratch = power;
+        return power;
+    }
+    if (length >= r->powerCount)
+    {
+        int powerCount = (r->powerCount == 0) ? 16 : r->powerCount;
+        while (powerCount <= length)
+        {
+            powerCount *= 2;
+        }
+        r->powers = (int **)realloc(r->powers, sizeof(int *) * powerCount);
+        assert(r->powers);
+        for (int i = r->powerCount; i < powerCount; i++)
+        {
+            r->powers[i] = NULL;
+        }
+        r->powerCount = powerCount;
+    }
+    r->powers[length] = power;
+    return power;
+}
+
+/*
+    Sets the scores of each colour toTable allows for a term of toTable
+    following a term of fromTable with previous scores, and back (if
+    not NULL) to the previous colour giving each, as latticeForwardStep
+    does. Only the colours fromTable allows are read and only those
+    toTable allows are set.
+*/
+static inline void stepAllowed(struct lattice *l, const int *previous, int fromTable,
+                               int toTable, int *scores, int *back)
+{
+    int colourCount = l->colourCount;
+    const int *fromColours = l->allowedColours + l->allowedStarts[fromTable + 1];
+    int fromCount = l->allowedStarts[fromTable + 2] - l->allowedStarts[fromTable + 1];
+    const int *toColours = l->allowedColours + l->allowedStarts[toTable + 1];
+    int toCount = l->allowedStarts[toTable + 2] - l->allowedStarts[toTable + 1];
+    const int *row = LATTICE_ROW(l, toTable);
+    for (int b = 0; b < toCount; b++)
+    {
+        int j = toColours[b];
+        int best = LATTICE_NONALLOWED;
+        int bestColour = 0;
+        for (int a = 0; a < fromCount; a++)
+        {
+            int k = fromColours[a];
+            int value = previous[k] + l->transitions[k * colourCount + j];
+            if (value > best)
+            {
+                best = value;
+                bestColour = k;
+            }
+        }
+        scores[j] = CLAMP(best + row[j]);
+        if (back)
+        {
+            back[j] = bestColour;
+        }
+    }
+}
+
+/*
+    Steps the given allowed colours' scores of a run's first word
+    through the next length words of the run one at a time, setting
+    each word's back pointers in back, one row of colourCount per word.
+    Scores needs space for twice the allowed colours.
+*/
+static void replayRun(struct latticeRuns *r, const int *startScores, int length, int *back,
+                      int *scores)
+{
+    int colourCount = r->l->colourCount;
+    int allowedCount = r->allowedCount;
+    int *current = scores;
+    int *next = scores + allowedCount;
+    memcpy(current, startScores, sizeof(int) * allowedCount);
+    for (int t = 0; t < length; t++)
+    {
+        int *wordBack = back + (size_t)t * colourCount;
+        for (int e = 0; e < allowedCount; e++)
+        {
+            /* Strictly greater keeps the lowest previous colour, as latticeSolve does. */
+            int best = LATTICE_NONALLOWED;
+            int bestColour = 0;
+            for (int s = 0; s < allowedCount; s++)
+            {
+                int value = current[s] + r->step[s * allowedCount + e];
+                if (value > best)
+                {
+                    best = value;
+                    bestColour = r->allowed[s];
+                }
+            }
+            next[e] = CLAMP(best);
+            wordBack[r->allowed[e]] = bestColour;
+        }
+        int *swap = current;
+        current = next;
+        next = swap;
+    }
+}
+
+int latticeSolveRuns(struct latticeRuns *r, const int *termTables, int termCount,
+                     int *colours)
+{
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    struct lattice *l = r->l;
+    int colourCount = l->colourCount;
+    int allowedCount = r->allowedCount;
+    int *values = (int *)malloc(sizeof(int) * colourCount * 2);
+    assert(values);
+    int *back = NULL;
+    /* Scores of each run's first word over the allowed colours, in order. */
+    int *runScores = NULL;
+    int runCount = 0;
+    if (colours)
+    {
+        back = (int *)malloc(sizeof(int) * colourCount * termCount);
+        assert(back);
+        /* Every run but the last is followed by a word with a table. */
+        runScores = (int *)malloc(sizeof(int) * (allowedCount * (termCount / 3 + 1) + 2 * allowedCount));
+        assert(runScores);
+    }
+
+    /* Only the colours the current term allows are kept up to date. */
+    int *current = values;
+    int *previous = values + colourCount;
+    latticeStart(l, termTables[0], current);
+    for (int i = 0; i < termCount; i++)
+    {
+        if (i > 0)
+        {
+            int *swap = previous;
+            previous = current;
+            current = swap;
+            stepAllowed(l, previous, termTables[i - 1], termTables[i], current,
+                        back ? back + (size_t)i * colourCount : NULL);
+        }
+        if (termTables[i] != -1)
+        {
+            continue;
+        }
+        int end = i;
+        while (end + 1 < termCount && termTables[end + 1] == -1)
+        {
+            end++;
+        }
+        if (end == i)
+        {
+            continue;
+        }
+
+        /* Jump from the run's first word to its last. */
+        const int *power = runPower(r, end - i);
+        int *startScores = runScores ? runScores + runCount * allowedCount : NULL;
+        for (int s = 0; s < allowedCount && startScores; s++)
+        {
+            startScores[s] = current[r->allowed[s]];
+        }
+        runCount++;
+        int *swap = previous;
+        previous = current;
+        current = swap;
+        for (int e = 0; e < allowedCount; e++)
+        {
+            int best = LATTICE_NONALLOWED;
+            for (int s = 0; s < allowedCount; s++)
+            {
+                int value = previous[r->allowed[s]] + power[s * allowedCount + e];
+                best = (value > best) ? value : best;
+            }
+            current[r->allowed[e]] = CLAMP(best);
+        }
+        i = end;
+    }
+
+    /* Ties go to the lowest colour, the allowed lists are in order. */
+    int lastTable = termTables[termCount - 1];
+    int colour = l->allowedColours[l->allowedStarts[lastTable + 1]];
+    for (int a = l->allowedStarts[lastTable + 1]; a < l->allowedStarts[lastTable + 2]; a++)
+    {
+        if (current[l->allowedColours[a]] > current[colour])
+        {
+            colour = l->allowedColours[a];
+        }
+    }
+    int score = current[colour];
+    /* Space after the runs' scores for replaying them. */
+    int *replayScores = runScores ? runScores + runCount * allowedCount : NULL;
+    for (int i = termCount - 1; colours && i >= 0; i--)
+    {
+        if (termTables[i] == -1 && i > 0 && termTables[i - 1] == -1)
+        {
+            /* The last word of a run, fill in the back pointers inside it. */
+            int start = i - 1;
+            while (start > 0 && termTables[start - 1] == -1)
+            {
+                start--;
+            }
+            runCount--;
+            if (allowedCount == 1)
+            {
+                /* Nothing to choose inside the run. */
+                for (; i > start; i--)
+                {
+                    colours[i] = colour;
+                }
+            }
+            else
+            {
+                replayRun(r, runScores + runCount * allowedCount, i - start,
+                          back + (size_t)(start + 1) * colourCount, replayScores);
+                for (; i > start; i--)
+                {
+                    colours[i] = colour;
+                    colour = back[(size_t)i * colourCount + colour];
+                }
+            }
+        }
+        colours[i] = colour;
+        if (i > 0)
+        {
+            colour = back[(size_t)i * colourCount + colour];
+        }
+    }
+    free(runScores);
+    free(back);
+    free(values);
+    return score;
+}
+
+void solveProblemRuns(struct problem *p, int colourMode, FILE *outFile)
+{
+    struct lattice *l = newLattice(p);
+    struct latticeRuns *r = newLatticeRuns(l);
+    int *colours = (int *)malloc(sizeof(int) * (p->termCount > 0 ? p->termCount : 1));
+    assert(colours);
+    latticeSolveRuns(r, p->termTables, p->termCount, colours);
+    outputColouring(outFile, p, colours, colourMode);
+    free(colours);
+    freeLatticeRuns(r);
+    freeLattice(l);
+}
+
+void freeLatticeRuns(struct latticeRuns *r)
+{
+    if (r)
+    {
+        for (int i = 0; i < r->squareCount; i++)
+        {
+            free(r->squares[i]);
+        }
+        free(r->squares);
+        for (int i = 0; i < r->powerCount; i++)
+        {
+            free(r->powers[i]);
+        }
+        free(r->powers);
+        free(r->scratch);
+        free(r->step);
+        free(r);
+    }
+}
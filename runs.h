@@ -0,0 +1,67 @@
+/*
+    Header for module which solves a Part F problem with each run of
+        words without a table collapsed into a single step, a max-plus
+        power of the step between two such words.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef RUNS_H
+#define RUNS_H 1
+
+/*
+    The step between two words without a table over the colours such
+    a word allows, and its max-plus powers, kept per run length as the
+    solves using them need them. Not safe to share between threads.
+*/
+struct latticeRuns
+{
+    struct lattice *l;
+    /* The colours a word without a table allows, a list in l. */
+    int allowedCount;
+    const int *allowed;
+    /*
+        Score of moving from allowed colour s to allowed colour e and
+        taking e, at [s * allowedCount + e].
+    */
+    int *step;
+    /* step to the power 2^i, for i below squareCount. */
+    int squareCount;
+    int **squares;
+    /* step to the power n, if a run has needed it yet, for n below powerCount. */
+    int powerCount;
+    int **powers;
+    /* Holds powers too long to keep. */
+    int *scratch;
+};
+
+/*
+    Returns the runs of the given lattice, empty until a solve needs
+    a power. The lattice must outlive them.
+*/
+struct latticeRuns *newLatticeRuns(struct lattice *l);
+
+/*
+    Same as latticeSolve, but stepping over each run of two or more
+    words without a table (-1) at once with the power of the step for
+    its length, so the pass costs the same for a run of any length.
+    The colours inside runs are only worked out, one word at a time,
+    if colours is not NULL. Results are identical to latticeSolve
+    unless a score inside a run falls to LATTICE_NONALLOWED.
+*/
+int latticeSolveRuns(struct latticeRuns *r, const int *termTables, int termCount,
+                     int *colours);
+
+/*
+    Outputs the colouring latticeSolveRuns finds for the given Part F
+    problem as outputProblem does.
+*/
+void solveProblemRuns(struct problem *p, int colourMode, FILE *outFile);
+
+/*
+    Frees the given runs and all memory allocated for them, but not
+    their lattice.
+*/
+void freeLatticeRuns(struct latticeRuns *r);
+
+#endif
@@ -0,0 +1,655 @@
+/*
+    Implementation for module which solves many Part F documents
+        across worker threads with work stealing.
+
+    Each worker owns a Chase-Lev deque of tasks, taking from its
+    bottom while idle workers steal from its top. A task is either a
+    whole document, one chunk of a split document, or the join of a
+    split document once all its chunks are done.
+
+    Chunks after the first can't know the scores they start from, so
+    they start from the previous term's emission scores instead. After
+    a few terms the Viterbi scores from any start differ only by a
+    constant, and from then on the back pointers are the same. The
+    join re-solves the start of each chunk from the true scores until
+    they line up with the stored guesses, shifts the chunk's final
+    scores by the difference, and only re-solves the whole chunk if
+    they never line up.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "scheduler.h"
+#include "cache.h"
+#include "hash.h"
+#include "problemStruct.c"
+#include "solutionStruct.c"
+
+/* Terms at the start of each chunk whose guessed scores are kept for the join. */
+#define FIXUP_WINDOW 64
+
+/* Chunk number of the task which joins a split document. */
+#define JOIN_TASK 0x7fffffff
+
+struct deque
+{
+    atomic_llong *tasks;
+    long capacity;
+    atomic_long top;
+    atomic_long bottom;
+};
+
+struct scheduledDocument
+{
+    int chunkCount;
+    /* Chunks still to be solved before the join can run. */
+    atomic_int remaining;
+    /* Back pointers for every term, rows filled in by each chunk. */
+    int *back;
+    /* Guessed scores at the end and over the first terms of each chunk. */
+    int *ends;
+    int *windows;
+};
+
+struct worker
+{
+    struct deque deque;
+    struct schedule *schedule;
+    int index;
+    unsigned int seed;
+    double busy;
+    long tasks;
+    long steals;
+};
+
+struct schedule
+{
+    struct lattice *l;
+    const int *const *termTables;
+    const int *termCounts;
+    int *scores;
+    int **colours;
+    struct scheduledDocument *documents;
+    struct worker *workers;
+    int workerCount;
+    /* Tasks not yet finished, workers stop when this reaches 0. */
+    atomic_long remaining;
+    atomic_long fixupTerms;
+};
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static long long makeTask(int document, int chunk)
+{
+    return ((long long)document << 32) | (unsigned int)chunk;
+}
+
+/* Adds a task to the bottom of the deque, only its owner may do this. */
+static void dequePush(struct deque *d, long long task)
+{
+    long bottom = atomic_load_explicit(&(d->bottom), memory_order_relaxed);
+    assert(bottom - atomic_load_explicit(&(d->top), memory_order_acquire) < d->capacity);
+    atomic_store_explicit(&(d->tasks[bottom % d->capacity]), task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&(d->bottom), bottom + 1, memory_order_relaxed);
+}
+
+/* Takes a task from the bottom of the deque, only its owner may do this. */
+static int dequeTake(struct deque *d, long long *task)
+{
+    long bottom = atomic_load_explicit(&(d->bottom), memory_order_relaxed) - 1;
+    atomic_store_explicit(&(d->bottom), bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&(d->top), memory_order_relaxed);
+    if (top > bottom)
+    {
+        atomic_store_explicit(&(d->bottom), bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+    *task = atomic_load_explicit(&(d->tasks[bottom % d->capacity]), memory_order_relaxed);
+    if (top == bottom)
+    {
+        /* Last task, race any thief for it. */
+        int won = atomic_compare_exchange_strong_explicit(&(d->top), &top, top + 1,
+                                                          memory_order_seq_cst,
+                                                          memory_order_relaxed);
+        atomic_store_explicit(&(d->bottom), bottom + 1, memory_order_relaxed);
+        return won;
+    }
+    return 1;
+}
+
+/* Steals a task from the top of the deque, any worker may do this. */
+static int dequeSteal(struct deque *d, long long *task)
+{
+    long top = atomic_load_explicit(&(d->top), memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&(d->bottom), memory_order_acquire);
+    if (top >= bottom)
+    {
+        return 0;
+    }
+    *task = atomic_load_explicit(&(d->tasks[top % d->capacity]), memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(&(d->top), &top, top + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed);
+}
+
+/* The first term and one past the last term of the given chunk. */
+static void chunkRange(struct schedule *s, int document, int chunk,
+                       int *start, int *end)
+{
+    *start = chunk * SCHEDULER_CHUNK;
+    *end = *start + SCHEDULER_CHUNK;
+    if (chunk == s->documents[document].chunkCount - 1)
+    {
+        *end = s->termCounts[document];
+    }
+}
+
+/* Solves one chunk of a split document from guessed starting scores. */
+static void solveChunk(struct schedule *s, int document, int chunk)
+{
+    struct lattice *l = s->l;
+    struct scheduledDocument *d = &(s->documents[document]);
+    const int *termTables = s->termTables[document];
+    int colourCount = l->colourCount;
+    int start;
+    int end;
+    chunkRange(s, document, chunk, &start, &end);
+
+    int *scores = (int *)malloc(sizeof(int) * colourCount);
+    assert(scores);
+    int *nextScores = (int *)malloc(sizeof(int) * colourCount);
+    assert(nextScores);
+    if (chunk == 0)
+    {
+        /* The first chunk's start is known. */
+        latticeStart(l, termTables[0], scores);
+        start = 1;
+    }
+    else
+    {
+        latticeStart(l, termTables[start - 1], scores);
+    }
+    int *window = d->windows + (size_t)chunk * FIXUP_WINDOW * colourCount;
+    for (int i = start; i < end; i++)
+    {
+        latticeForwardStep(l, scores, termTables[i], nextScores,
+                           d->back ? d->back + (size_t)i * colourCount : NULL);
+        int *swap = scores;
+        scores = nextScores;
+        nextScores = swap;
+        if (chunk > 0 && i - start < FIXUP_WINDOW)
+        {
+            memcpy(window + (i - start) * colourCount, scores, sizeof(int) * colourCount);
+        }
+    }
+    memcpy(d->ends + (size_t)chunk * colourCount, scores, sizeof(int) * colourCount);
+    free(scores);
+    free(nextScores);
+}
+
+/*
+    Returns 1 and sets shift if the given scores allow the same colours
+    and differ by the same amount at each, so every later step picks
+    the same previous colours from either.
+*/
+static int parallelScores(const int *scores, const int *guess, int colourCount,
+                          int *shift)
+{
+    int found = 0;
+    for (int j = 0; j < colourCount; j++)
+    {
+        if ((scores[j] == LATTICE_NONALLOWED) != (guess[j] == LATTICE_NONALLOWED))
+        {
+            return 0;
+        }
+        if (scores[j] == LATTICE_NONALLOWED)
+        {
+            continue;
+        }
+        if (!found)
+        {
+            *shift = scores[j] - guess[j];
+            found = 1;
+        }
+        else if (scores[j] - guess[j] != *shift)
+        {
+            return 0;
+        }
+    }
+    return found;
+}
+
+/* Joins the chunks of a split document and follows its back pointers. */
+static void joinChunks(struct schedule *s, int document)
+{
+    struct lattice *l = s->l;
+    struct scheduledDocument *d = &(s->documents[document]);
+    const int *termTables = s->termTables[document];
+    int colourCount = l->colourCount;
+    int *scores = (int *)malloc(sizeof(int) * colourCount);
+    assert(scores);
+    int *nextScores = (int *)malloc(sizeof(int) * colourCount);
+    assert(nextScores);
+    memcpy(scores, d->ends, sizeof(int) * colourCount);
+    long fixupTerms = 0;
+    for (int chunk = 1; chunk < d->chunkCount; chunk++)
+    {
+        int start;
+        int end;
+        chunkRange(s, document, chunk, &start, &end);
+        const int *window = d->windows + (size_t)chunk * FIXUP_WINDOW * colourCount;
+        const int *guessEnd = d->ends + (size_t)chunk * colourCount;
+        int shift = 0;
+        int lined = 0;
+        for (int i = start; i < end && !lined; i++)
+        {
+            latticeForwardStep(l, scores, termTables[i], nextScores,
+                               d->back ? d->back + (size_t)i * colourCount : NULL);
+            int *swap = scores;
+            scores = nextScores;
+            nextScores = swap;
+            fixupTerms++;
+            if (i - start < FIXUP_WINDOW)
+            {
+                lined = parallelScores(scores, window + (i - start) * colourCount,
+                                       colourCount, &shift);
+            }
+        }
+        if (lined)
+        {
+            for (int j = 0; j < colourCount; j++)
+            {
+                scores[j] = (guessEnd[j] == LATTICE_NONALLOWED) ? LATTICE_NONALLOWED
+                                                                : guessEnd[j] + shift;
+            }
+        }
+    }
+    atomic_fetch_add(&(s->fixupTerms), fixupTerms);
+
+    int termCount = s->termCounts[document];
+    int colour = latticeBestColour(l, scores);
+    s->scores[document] = scores[colour];
+    if (s->colours)
+    {
+        int *colours = s->colours[document];
+        for (int i = termCount - 1; i > 0; i--)
+        {
+            colours[i] = colour;
+            colour = d->back[(size_t)i * colourCount + colour];
+        }
+        colours[0] = colour;
+    }
+    free(scores);
+    free(nextScores);
+}
+
+static void runTask(struct worker *w, long long task)
+{
+    struct schedule *s = w->schedule;
+    int document = (int)(task >> 32);
+    int chunk = (int)(task & 0xffffffff);
+    struct scheduledDocument *d = &(s->documents[document]);
+    if (chunk == JOIN_TASK)
+    {
+        joinChunks(s, document);
+    }
+    else if (d->chunkCount == 1)
+    {
+        s->scores[document] = latticeSolve(s->l, s->termTables[document],
+                                           s->termCounts[document],
+                                           s->colours ? s->colours[document] : NULL);
+    }
+    else
+    {
+        solveChunk(s, document, chunk);
+        /* The worker finishing the last chunk queues the join. */
+        if (atomic_fetch_sub(&(d->remaining), 1) == 1)
+        {
+            dequePush(&(w->deque), makeTask(document, JOIN_TASK));
+        }
+    }
+}
+
+static void *runWorker(void *data)
+{
+    struct worker *w = (struct worker *)data;
+    struct schedule *s = w->schedule;
+    while (atomic_load(&(s->remaining)) > 0)
+    {
+        long long task;
+        int found = dequeTake(&(w->deque), &task);
+        for (int n = 1; !found && n < s->workerCount; n++)
+        {
+            /* Try the other workers from a random one. */
+            int victim = (w->index + n + rand_r(&(w->seed)) % (s->workerCount - 1)) % s->workerCount;
+            if (victim != w->index && dequeSteal(&(s->workers[victim].deque), &task))
+            {
+                found = 1;
+                w->steals++;
+            }
+        }
+        if (!found)
+        {
+            sched_yield();
+            continue;
+        }
+        double start = now();
+        runTask(w, task);
+        w->busy += now() - start;
+        w->tasks++;
+        atomic_fetch_sub(&(s->remaining), 1);
+    }
+    return NULL;
+}
+
+void solveScheduled(struct lattice *l, const int *const *termTables,
+                    const int *termCounts, int documentCount, int workerCount,
+                    int *scores, int **colours, struct schedulerStats *stats)
+{
+    double start = now();
+    if (workerCount < 1)
+    {
+        workerCount = 1;
+    }
+    if (workerCount > SCHEDULER_MAX_WORKERS)
+    {
+        workerCount = SCHEDULER_MAX_WORKERS;
+    }
+    int colourCount = l->colourCount;
+    struct schedule s;
+    s.l = l;
+    s.termTables = termTables;
+    s.termCounts = termCounts;
+    s.scores = scores;
+    s.colours = colours;
+    s.workerCount = workerCount;
+    atomic_init(&(s.fixupTerms), 0);
+    s.documents = (struct scheduledDocument *)malloc(sizeof(struct scheduledDocument) * (documentCount > 0 ? documentCount : 1));
+    assert(s.documents);
+
+    long taskCount = 0;
+    long splitCount = 0;
+    long chunkCount = 0;
+    for (int i = 0; i < documentCount; i++)
+    {
+        struct scheduledDocument *d = &(s.documents[i]);
+        d->chunkCount = 1;
+        d->back = NULL;
+        d->ends = NULL;
+        d->windows = NULL;
+        if (termCounts[i] == 0)
+        {
+            /* Nothing to solve. */
+            scores[i] = 0;
+            d->chunkCount = 0;
+            continue;
+        }
+        if (termCounts[i] > 2 * SCHEDULER_CHUNK)
+        {
+            d->chunkCount = (termCounts[i] + SCHEDULER_CHUNK - 1) / SCHEDULER_CHUNK;
+            if (colours)
+            {
+                d->back = (int *)malloc(sizeof(int) * colourCount * (size_t)termCounts[i]);
+                assert(d->back);
+            }
+            d->ends = (int *)malloc(sizeof(int) * colourCount * d->chunkCount);
+            assert(d->ends);
+            d->windows = (int *)malloc(sizeof(int) * colourCount * FIXUP_WINDOW * d->chunkCount);
+            assert(d->windows);
+            splitCount++;
+            chunkCount += d->chunkCount;
+            /* And one to join the chunks. */
+            taskCount++;
+        }
+        atomic_init(&(d->remaining), d->chunkCount);
+        taskCount += d->chunkCount;
+    }
+    atomic_init(&(s.remaining), taskCount);
+
+    /* Deal the tasks out round robin, workers steal to even out the rest. */
+    s.workers = (struct worker *)malloc(sizeof(struct worker) * workerCount);
+    assert(s.workers);
+    for (int i = 0; i < workerCount; i++)
+    {
+        struct worker *w = &(s.workers[i]);
+        w->deque.capacity = (taskCount > 0) ? taskCount : 1;
+        w->deque.tasks = (atomic_llong *)malloc(sizeof(atomic_llong) * w->deque.capacity);
+        assert(w->deque.tasks);
+        atomic_init(&(w->deque.top), 0);
+        atomic_init(&(w->deque.bottom), 0);
+        w->schedule = &s;
+        w->index = i;
+        w->seed = i + 1;
+        w->busy = 0;
+        w->tasks = 0;
+        w->steals = 0;
+    }
+    int next = 0;
+    for (int i = 0; i < documentCount; i++)
+    {
+        for (int chunk = 0; chunk < s.documents[i].chunkCount; chunk++)
+        {
+            dequePush(&(s.workers[next].deque), makeTask(i, chunk));
+            next = (next + 1) % workerCount;
+        }
+    }
+
+    pthread_t threads[SCHEDULER_MAX_WORKERS];
+    for (int i = 1; i < workerCount; i++)
+    {
+        int created = pthread_create(&(threads[i]), NULL, runWorker, &(s.workers[i]));
+        assert(created == 0);
+    }
+    /* This thread is worker 0. */
+    runWorker(&(s.workers[0]));
+    for (int i = 1; i < workerCount; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (stats)
+    {
+        memset(stats, 0, sizeof(struct schedulerStats));
+        stats->workerCount = workerCount;
+        stats->splitCount = splitCount;
+        stats->chunkCount = chunkCount;
+        stats->fixupTerms = atomic_load(&(s.fixupTerms));
+        for (int i = 0; i < workerCount; i++)
+        {
+            stats->busy[i] = s.workers[i].busy;
+            stats->tasks[i] = s.workers[i].tasks;
+            stats->steals[i] = s.workers[i].steals;
+        }
+    }
+    for (int i = 0; i < workerCount; i++)
+    {
+        free(s.workers[i].deque.tasks);
+    }
+    free(s.workers);
+    for (int i = 0; i < documentCount; i++)
+    {
+        free(s.documents[i].back);
+        free(s.documents[i].ends);
+        free(s.documents[i].windows);
+    }
+    free(s.documents);
+    if (stats)
+    {
+        stats->elapsed = now() - start;
+    }
+}
+
+/*
+    Returns the earlier document in slots with the same tokens as
+    problems[index], or -1 after adding index if there is none. Slots
+    is an open-addressed index at most half full, -1 for empty.
+*/
+static int findRepeat(struct problem **problems, int index, int *slots, int slotCount)
+{
+    struct problem *p = problems[index];
+    unsigned long long hash = hashBytes(hashInt(HASH_SEED, p->termCount), p->termTables,
+                                        sizeof(int) * p->termCount);
+    int mask = slotCount - 1;
+    int slot = (int)(hash & mask);
+    while (slots[slot] >= 0)
+    {
+        struct problem *q = problems[slots[slot]];
+        if (q->termCount == p->termCount &&
+            memcmp(q->termTables, p->termTables, sizeof(int) * p->termCount) == 0)
+        {
+            return slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = index;
+    return -1;
+}
+
+void solveProblemsScheduled(struct problem **problems, int problemCount,
+                            int workerCount, int colourMode, FILE *outFile,
+                            FILE *statsFile, struct solutionCache *cache)
+{
+    if (problemCount == 0)
+    {
+        return;
+    }
+    struct lattice *l = newLattice(problems[0]);
+    const int **termTables = (const int **)malloc(sizeof(int *) * problemCount);
+    assert(termTables);
+    int *termCounts = (int *)malloc(sizeof(int) * problemCount);
+    assert(termCounts);
+    int *scores = (int *)malloc(sizeof(int) * problemCount);
+    assert(scores);
+    int **colours = (int **)malloc(sizeof(int *) * problemCount);
+    assert(colours);
+    int **scheduledColours = (int **)malloc(sizeof(int *) * problemCount);
+    assert(scheduledColours);
+    /* The document each scheduled task is, and the one each repeats. */
+    int *scheduled = (int *)malloc(sizeof(int) * problemCount);
+    assert(scheduled);
+    int *repeats = (int *)malloc(sizeof(int) * problemCount);
+    assert(repeats);
+    int slotCount = 1;
+    while (slotCount < problemCount * 2)
+    {
+        slotCount *= 2;
+    }
+    int *slots = (int *)malloc(sizeof(int) * slotCount);
+    assert(slots);
+    memset(slots, -1, sizeof(int) * slotCount);
+
+    /*
+        With a cache, documents it has seen and documents with the same
+        tokens as an earlier one aren't solved again.
+    */
+    int scheduledCount = 0;
+    int cachedCount = 0;
+    int repeatCount = 0;
+    for (int i = 0; i < problemCount; i++)
+    {
+        assert(problems[i]->tableVersion == problems[0]->tableVersion);
+        int termCount = problems[i]->termCount;
+        colours[i] = (int *)malloc(sizeof(int) * (termCount > 0 ? termCount : 1));
+        assert(colours[i]);
+        repeats[i] = -1;
+        if (cache)
+        {
+            struct solution *cached = solutionCacheLookup(cache, problems[i]);
+            if (cached)
+            {
+                memcpy(colours[i], cached->termColours, sizeof(int) * termCount);
+                scores[i] = cached->score;
+                freeSolution(cached, problems[i]);
+                cachedCount++;
+                continue;
+            }
+            repeats[i] = findRepeat(problems, i, slots, slotCount);
+            if (repeats[i] >= 0)
+            {
+                repeatCount++;
+                continue;
+            }
+        }
+        termTables[scheduledCount] = problems[i]->termTables;
+        termCounts[scheduledCount] = termCount;
+        scheduledColours[scheduledCount] = colours[i];
+        scheduled[scheduledCount] = i;
+        scheduledCount++;
+    }
+
+    struct schedulerStats stats;
+    int *scheduledScores = (int *)malloc(sizeof(int) * problemCount);
+    assert(scheduledScores);
+    solveScheduled(l, termTables, termCounts, scheduledCount, workerCount, scheduledScores,
+                   scheduledColours, &stats);
+    for (int k = 0; k < scheduledCount; k++)
+    {
+        int i = scheduled[k];
+        scores[i] = scheduledScores[k];
+        if (cache)
+        {
+            solutionCacheStore(cache, problems[i], colours[i], scores[i]);
+        }
+    }
+
+    for (int i = 0; i < problemCount; i++)
+    {
+        if (repeats[i] >= 0)
+        {
+            memcpy(colours[i], colours[repeats[i]], sizeof(int) * problems[i]->termCount);
+            scores[i] = scores[repeats[i]];
+            /* The same tables may be other words, which the cache keeps apart. */
+            solutionCacheStore(cache, problems[i], colours[i], scores[i]);
+        }
+        outputColouring(outFile, problems[i], colours[i], colourMode);
+    }
+    for (int i = 0; i < problemCount; i++)
+    {
+        free(colours[i]);
+    }
+    if (statsFile)
+    {
+        if (cache)
+        {
+            fprintf(statsFile, "%d documents, %d from the cache, %d repeating an earlier one, %d solved\n",
+                    problemCount, cachedCount, repeatCount, scheduledCount);
+        }
+        printSchedulerStats(statsFile, &stats);
+    }
+    free(scheduledScores);
+    free(slots);
+    free(repeats);
+    free(scheduled);
+    free(scheduledColours);
+    free(colours);
+    free(scores);
+    free(termCounts);
+    free(termTables);
+    freeLattice(l);
+}
+
+void printSchedulerStats(FILE *outFile, const struct schedulerStats *stats)
+{
+    fprintf(outFile, "%d workers, %.3fs, %ld documents split into %ld chunks, %ld terms re-solved joining them\n",
+            stats->workerCount, stats->elapsed, stats->splitCount, stats->chunkCount,
+            stats->fixupTerms);
+    fprintf(outFile, "%6s %8s %8s %10s %12s\n", "worker", "tasks", "steals", "busy (s)", "utilisation");
+    for (int i = 0; i < stats->workerCount; i++)
+    {
+        double utilisation = (stats->elapsed > 0) ? stats->busy[i] / stats->elapsed : 0;
+        fprintf(outFile, "%6d %8ld %8ld %10.3f %11.1f%%\n", i, stats->tasks[i],
+                stats->steals[i], stats->busy[i], 100 * utilisation);
+    }
+}
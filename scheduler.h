@@ -0,0 +1,68 @@
+/*
+    Header for module which solves many Part F documents across
+        worker threads with work stealing, splitting large documents
+        into chunks that idle workers can take.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H 1
+
+/* The most workers solveScheduled runs. */
+#define SCHEDULER_MAX_WORKERS 64
+
+/* Documents longer than this many terms are split into chunks of this size. */
+#ifndef SCHEDULER_CHUNK
+#define SCHEDULER_CHUNK 16384
+#endif
+
+struct schedulerStats
+{
+    int workerCount;
+    /* Wall time of the whole run in seconds. */
+    double elapsed;
+    /* Documents split into chunks and the chunk tasks they made. */
+    long splitCount;
+    long chunkCount;
+    /* Terms of split documents re-solved when joining chunks. */
+    long fixupTerms;
+    /* For each worker, the time spent running tasks and the tasks run and stolen. */
+    double busy[SCHEDULER_MAX_WORKERS];
+    long tasks[SCHEDULER_MAX_WORKERS];
+    long steals[SCHEDULER_MAX_WORKERS];
+};
+
+/*
+    Solves documentCount documents against the same lattice on up to
+    workerCount threads (including the calling one), where document i
+    is the sequence of termCounts[i] table indices in termTables[i].
+    The optimal score of each document is placed in scores[i] and, if
+    colours is not NULL, its colouring in colours[i], which must have
+    room for termCounts[i] colours. Results match latticeSolve for
+    each document. If stats is not NULL it is filled
+    in with the run's worker utilisation.
+*/
+void solveScheduled(struct lattice *l, const int *const *termTables,
+                    const int *termCounts, int documentCount, int workerCount,
+                    int *scores, int **colours, struct schedulerStats *stats);
+
+struct solutionCache;
+
+/*
+    Solves each of the given Part F problems, which must share the
+    same tables, with solveScheduled and outputs their colourings to
+    outFile one line each, as outputProblem does. If cache is not
+    NULL, documents found in it or with the same tokens as an earlier
+    one are copied rather than solved, and those solved are added to
+    it. If statsFile is not NULL the worker utilisation is printed to
+    it, along with how many documents the cache answered.
+*/
+void solveProblemsScheduled(struct problem **problems, int problemCount,
+                            int workerCount, int colourMode, FILE *outFile,
+                            FILE *statsFile, struct solutionCache *cache);
+
+/* Prints the given stats as a table, one row per worker. */
+void printSchedulerStats(FILE *outFile, const struct schedulerStats *stats);
+
+#endif
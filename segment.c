@@ -0,0 +1,371 @@
+/*
+    Implementation for module which publishes the loaded tables of a
+        problem into a read-only shared-memory segment.
+
+    The segment holds a header followed by copies of the structures a
+    problem points at for its tables, laid out so that every pointer
+    in them is already correct once the segment is mapped at
+    SEGMENT_BASE: the term colour tables then their terms and colour
+    arrays, the colour transition table, the term index and any
+    pattern DFA, then the lattice compiled from them, so solves don't
+    compile their own. An attached process maps the pages read-only
+    and shared, so they are kept once in the page cache however many
+    processes attach, and attaching costs one mmap whatever the size
+    of the tables.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "segment.h"
+#include "matcher.h"
+#include "pattern.h"
+#include "lattice.h"
+#include "problemStruct.c"
+
+/* Marks a table segment of this layout, "HLTABLE" and a layout number. */
+#define SEGMENT_MAGIC 0x484c5441424c4502ULL
+
+/* Everything in the segment starts on a multiple of this. */
+#define SEGMENT_ALIGN 16
+
+struct tableSegment
+{
+    unsigned long long magic;
+    /* Size of the whole segment in bytes. */
+    unsigned long long size;
+    /* Address the segment's pointers were written for. */
+    unsigned long long base;
+    unsigned long long tableVersion;
+    int termColourTableCount;
+    /* Offsets from the start of the segment. */
+    unsigned long long colourTables;
+    unsigned long long colourTransitionTable;
+    unsigned long long matcher;
+    unsigned long long lattice;
+};
+
+/* Reserves size bytes at the end of the segment being laid out, returning their offset. */
+static unsigned long long reserve(unsigned long long *used, unsigned long long size)
+{
+    unsigned long long offset = (*used + SEGMENT_ALIGN - 1) / SEGMENT_ALIGN * SEGMENT_ALIGN;
+    *used = offset + size;
+    return offset;
+}
+
+unsigned long long packTables(struct problem *p, char *block, unsigned long long base)
+{
+    unsigned long long used = 0;
+    unsigned long long headerOffset = reserve(&used, sizeof(struct tableSegment));
+    unsigned long long tablesOffset = reserve(&used, sizeof(struct termColourTable) *
+                                                         p->termColourTableCount);
+    struct tableSegment *header = NULL;
+    struct termColourTable *tables = NULL;
+    if (block)
+    {
+        header = (struct tableSegment *)(block + headerOffset);
+        tables = (struct termColourTable *)(block + tablesOffset);
+    }
+    for (int i = 0; i < p->termColourTableCount; i++)
+    {
+        struct termColourTable *table = &(p->colourTables[i]);
+        size_t termSize = strlen(table->term) + 1;
+        unsigned long long termOffset = reserve(&used, termSize);
+        unsigned long long coloursOffset = reserve(&used, sizeof(int) * table->colourCount);
+        unsigned long long scoresOffset = reserve(&used, sizeof(int) * table->colourCount);
+        if (block)
+        {
+            memcpy(block + termOffset, table->term, termSize);
+            memcpy(block + coloursOffset, table->colours, sizeof(int) * table->colourCount);
+            memcpy(block + scoresOffset, table->scores, sizeof(int) * table->colourCount);
+            tables[i].term = (char *)(uintptr_t)(base + termOffset);
+            tables[i].colourCount = table->colourCount;
+            tables[i].pattern = table->pattern;
+            tables[i].colours = (int *)(uintptr_t)(base + coloursOffset);
+            tables[i].scores = (int *)(uintptr_t)(base + scoresOffset);
+        }
+    }
+
+    struct colourTransitionTable *ctt = p->colourTransitionTable;
+    unsigned long long cttOffset = 0;
+    if (ctt)
+    {
+        cttOffset = reserve(&used, sizeof(struct colourTransitionTable));
+        size_t arraySize = sizeof(int) * ctt->transitionCount;
+        unsigned long long prevColoursOffset = reserve(&used, arraySize);
+        unsigned long long coloursOffset = reserve(&used, arraySize);
+        unsigned long long scoresOffset = reserve(&used, arraySize);
+        if (block)
+        {
+            struct colourTransitionTable *copy = (struct colourTransitionTable *)(block +
+                                                                                 cttOffset);
+            copy->transitionCount = ctt->transitionCount;
+            memcpy(block + prevColoursOffset, ctt->prevColours, arraySize);
+            memcpy(block + coloursOffset, ctt->colours, arraySize);
+            memcpy(block + scoresOffset, ctt->scores, arraySize);
+            copy->prevColours = (int *)(uintptr_t)(base + prevColoursOffset);
+            copy->colours = (int *)(uintptr_t)(base + coloursOffset);
+            copy->scores = (int *)(uintptr_t)(base + scoresOffset);
+        }
+    }
+
+    struct termMatcher *m = p->matcher;
+    unsigned long long matcherOffset = reserve(&used, sizeof(struct termMatcher));
+    size_t slotsSize = sizeof(struct matcherSlot) * m->shardSlots * ((size_t)1 << m->shardBits);
+    unsigned long long slotsOffset = reserve(&used, slotsSize);
+    unsigned long long hasLengthOffset = reserve(&used, m->longestTerm + 1);
+    if (block)
+    {
+        struct termMatcher *copy = (struct termMatcher *)(block + matcherOffset);
+        *copy = *m;
+        memcpy(block + slotsOffset, m->slots, slotsSize);
+        memcpy(block + hasLengthOffset, m->hasLength, m->longestTerm + 1);
+        copy->slots = (struct matcherSlot *)(uintptr_t)(base + slotsOffset);
+        copy->hasLength = (unsigned char *)(uintptr_t)(base + hasLengthOffset);
+    }
+    struct patternDfa *d = m->patterns;
+    if (d)
+    {
+        unsigned long long dfaOffset = reserve(&used, sizeof(struct patternDfa));
+        size_t nextSize = sizeof(int) * d->stateCount * d->classCount;
+        size_t acceptsSize = sizeof(int) * d->stateCount;
+        size_t wideSize = sizeof(int) * d->wideCount;
+        unsigned long long nextOffset = reserve(&used, nextSize);
+        unsigned long long acceptsOffset = reserve(&used, acceptsSize);
+        unsigned long long wideCharactersOffset = reserve(&used, wideSize);
+        unsigned long long wideClassesOffset = reserve(&used, wideSize);
+        if (block)
+        {
+            struct patternDfa *copy = (struct patternDfa *)(block + dfaOffset);
+            *copy = *d;
+            memcpy(block + nextOffset, d->next, nextSize);
+            memcpy(block + acceptsOffset, d->accepts, acceptsSize);
+            memcpy(block + wideCharactersOffset, d->wideCharacters, wideSize);
+            memcpy(block + wideClassesOffset, d->wideClasses, wideSize);
+            copy->next = (int *)(uintptr_t)(base + nextOffset);
+            copy->accepts = (int *)(uintptr_t)(base + acceptsOffset);
+            copy->wideCharacters = (int *)(uintptr_t)(base + wideCharactersOffset);
+            copy->wideClasses = (int *)(uintptr_t)(base + wideClassesOffset);
+            ((struct termMatcher *)(block + matcherOffset))->patterns =
+                (struct patternDfa *)(uintptr_t)(base + dfaOffset);
+        }
+    }
+
+    /* The lattice every solve would otherwise compile for itself. */
+    struct lattice *l = newLattice(p);
+    unsigned long long latticeOffset = reserve(&used, sizeof(struct lattice));
+    size_t emissionsSize = sizeof(int) * l->rowCount * l->colourCount;
+    size_t transitionsSize = sizeof(int) * l->colourCount * l->colourCount;
+    size_t startsSize = sizeof(int) * (l->rowCount + 1);
+    size_t allowedSize = sizeof(int) * l->allowedStarts[l->rowCount];
+    unsigned long long emissionsOffset = reserve(&used, emissionsSize);
+    unsigned long long transitionsOffset = reserve(&used, transitionsSize);
+    unsigned long long startsOffset = reserve(&used, startsSize);
+    unsigned long long allowedOffset = reserve(&used, allowedSize);
+    if (block)
+    {
+        struct lattice *copy = (struct lattice *)(block + latticeOffset);
+        *copy = *l;
+        memcpy(block + emissionsOffset, l->emissions, emissionsSize);
+        memcpy(block + transitionsOffset, l->transitions, transitionsSize);
+        memcpy(block + startsOffset, l->allowedStarts, startsSize);
+        memcpy(block + allowedOffset, l->allowedColours, allowedSize);
+        copy->emissions = (int *)(uintptr_t)(base + emissionsOffset);
+        copy->transitions = (int *)(uintptr_t)(base + transitionsOffset);
+        copy->allowedStarts = (int *)(uintptr_t)(base + startsOffset);
+        copy->allowedColours = (int *)(uintptr_t)(base + allowedOffset);
+        copy->shared = 1;
+
+        header->magic = SEGMENT_MAGIC;
+        header->size = used;
+        header->base = base;
+        header->tableVersion = p->tableVersion;
+        header->termColourTableCount = p->termColourTableCount;
+        header->colourTables = tablesOffset;
+        header->colourTransitionTable = cttOffset;
+        header->matcher = matcherOffset;
+        header->lattice = latticeOffset;
+    }
+    freeLattice(l);
+    return used;
+}
+
+int publishTables(struct problem *p, const char *name)
+{
+    unsigned long long size = packTables(p, NULL, SEGMENT_BASE);
+    /* Start afresh so processes attached to an old segment keep it whole. */
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0)
+    {
+        fprintf(stderr, "Unable to create table segment \"%s\"\n", name);
+        perror("Reason for segment failure");
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        return -1;
+    }
+    char *segment = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map table segment \"%s\"\n", name);
+        perror("Reason for segment failure");
+        shm_unlink(name);
+        return -1;
+    }
+    packTables(p, segment, SEGMENT_BASE);
+    munmap(segment, size);
+    return 0;
+}
+
+/* Moves the given pointer, written for SEGMENT_BASE, to the segment mapped at base. */
+#define RELOCATE(type, pointer, base) \
+    ((pointer) = (type)((char *)(base) + ((uintptr_t)(pointer) - SEGMENT_BASE)))
+
+int attachTables(struct problem *p, const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct tableSegment))
+    {
+        fprintf(stderr, "Unable to open table segment \"%s\"\n", name);
+        perror("Reason for segment failure");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t size = st.st_size;
+    char *segment = (char *)mmap((void *)(uintptr_t)SEGMENT_BASE, size, PROT_READ,
+                                 MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    int relocated = 0;
+    if (segment != MAP_FAILED && (uintptr_t)segment != SEGMENT_BASE)
+    {
+        /* Kernels without MAP_FIXED_NOREPLACE take the address as a hint. */
+        munmap(segment, size);
+        segment = MAP_FAILED;
+        relocated = 1;
+    }
+    else if (segment == MAP_FAILED && errno == EEXIST)
+    {
+        relocated = 1;
+    }
+    if (relocated)
+    {
+        /* Something else is at the base, take private pages to move the pointers. */
+        fprintf(stderr, "Table segment \"%s\" can't be mapped at 0x%llx, taking a private copy\n",
+                name, (unsigned long long)SEGMENT_BASE);
+        segment = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map table segment \"%s\"\n", name);
+        perror("Reason for segment failure");
+        return -1;
+    }
+    struct tableSegment *header = (struct tableSegment *)segment;
+    if (header->magic != SEGMENT_MAGIC || header->size != size || header->base != SEGMENT_BASE)
+    {
+        fprintf(stderr, "\"%s\" is not a table segment\n", name);
+        munmap(segment, size);
+        return -1;
+    }
+
+    if (relocated)
+    {
+        struct termColourTable *tables = (struct termColourTable *)(segment +
+                                                                    header->colourTables);
+        for (int i = 0; i < header->termColourTableCount; i++)
+        {
+            RELOCATE(char *, tables[i].term, segment);
+            RELOCATE(int *, tables[i].colours, segment);
+            RELOCATE(int *, tables[i].scores, segment);
+        }
+        if (header->colourTransitionTable)
+        {
+            struct colourTransitionTable *ctt =
+                (struct colourTransitionTable *)(segment + header->colourTransitionTable);
+            RELOCATE(int *, ctt->prevColours, segment);
+            RELOCATE(int *, ctt->colours, segment);
+            RELOCATE(int *, ctt->scores, segment);
+        }
+        struct termMatcher *m = (struct termMatcher *)(segment + header->matcher);
+        RELOCATE(struct matcherSlot *, m->slots, segment);
+        RELOCATE(unsigned char *, m->hasLength, segment);
+        if (m->patterns)
+        {
+            RELOCATE(struct patternDfa *, m->patterns, segment);
+            RELOCATE(int *, m->patterns->next, segment);
+            RELOCATE(int *, m->patterns->accepts, segment);
+            RELOCATE(int *, m->patterns->wideCharacters, segment);
+            RELOCATE(int *, m->patterns->wideClasses, segment);
+        }
+        struct lattice *l = (struct lattice *)(segment + header->lattice);
+        RELOCATE(int *, l->emissions, segment);
+        RELOCATE(int *, l->transitions, segment);
+        RELOCATE(int *, l->allowedStarts, segment);
+        RELOCATE(int *, l->allowedColours, segment);
+        mprotect(segment, size, PROT_READ);
+    }
+
+    unpackTables(p, segment);
+    p->segment = header;
+    return 0;
+}
+
+void unpackTables(struct problem *p, char *block)
+{
+    struct tableSegment *header = (struct tableSegment *)block;
+    p->termColourTableCount = header->termColourTableCount;
+    p->colourTables = NULL;
+    if (header->termColourTableCount > 0)
+    {
+        p->colourTables = (struct termColourTable *)(block + header->colourTables);
+    }
+    p->colourTransitionTable = NULL;
+    if (header->colourTransitionTable)
+    {
+        p->colourTransitionTable = (struct colourTransitionTable *)(block +
+                                                                   header->colourTransitionTable);
+    }
+    p->matcher = (struct termMatcher *)(block + header->matcher);
+    p->compiledLattice = (struct lattice *)(block + header->lattice);
+    p->tableVersion = header->tableVersion;
+    p->segment = NULL;
+}
+
+void detachTables(struct problem *p)
+{
+    if (p->segment)
+    {
+        munmap(p->segment, p->segment->size);
+        p->segment = NULL;
+        p->termColourTableCount = 0;
+        p->colourTables = NULL;
+        p->colourTransitionTable = NULL;
+        p->matcher = NULL;
+        p->compiledLattice = NULL;
+    }
+}
+
+int unpublishTables(const char *name)
+{
+    if (shm_unlink(name) != 0)
+    {
+        fprintf(stderr, "Unable to remove table segment \"%s\"\n", name);
+        perror("Reason for segment failure");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+    Header for module which publishes the loaded tables of a problem
+        into a read-only shared-memory segment that other processes
+        attach to instead of reading the table files themselves, or
+        into a block of memory for the library to share between
+        threads.
+*/
+#include "problem.h"
+
+#ifndef SEGMENT_H
+#define SEGMENT_H 1
+
+/*
+    Address segments are built to be mapped at, so the pointers in
+    the tables can be used as they are. Attaching elsewhere works but
+    moves the table pointers into a private copy of their pages.
+*/
+#ifndef SEGMENT_BASE
+#define SEGMENT_BASE 0x600000000000ULL
+#endif
+
+/*
+    Packs the term colour tables, their terms, the colour transition
+    table, the term index and the lattice compiled from them of the
+    given problem into the given block of memory, if it is not NULL,
+    with the pointers in them written for the block being at base.
+    Returns the size of the block they need, which must be aligned to
+    16 bytes.
+*/
+unsigned long long packTables(struct problem *p, char *block, unsigned long long base);
+
+/*
+    Sets the tables, transition table, term index, compiled lattice and
+    snapshot version of the given problem to those packed in the given
+    block, which must be at the base it was packed for. The problem
+    doesn't own them, so freeProblem won't free them.
+*/
+void unpackTables(struct problem *p, char *block);
+
+/*
+    Writes the term colour tables, their terms, the colour transition
+    table, the term index and the lattice compiled from them of the
+    given problem into a new POSIX shared-memory object of the given
+    name (e.g. "/highlight-tables"), replacing any object of that name.
+    Processes already attached keep the tables they have. Returns 0, or
+    -1 after printing the reason to stderr.
+*/
+int publishTables(struct problem *p, const char *name);
+
+/*
+    Sets the tables, transition table, term index, compiled lattice and
+    snapshot version of the given problem to those in the shared-memory
+    object of the given name, mapped read-only at SEGMENT_BASE. If
+    something else is mapped there, the tables are copied to private
+    pages and their pointers moved, saying so on stderr, so a process
+    should attach once and share the problem (see readProblemDocument).
+    freeProblem detaches them. Returns 0, or -1 after printing the
+    reason to stderr.
+*/
+int attachTables(struct problem *p, const char *name);
+
+/*
+    Unmaps the tables the given problem attached, leaving it without
+    tables.
+*/
+void detachTables(struct problem *p);
+
+/*
+    Removes the shared-memory object of the given name, processes
+    already attached keep their tables. Returns 0, or -1 after printing
+    the reason to stderr.
+*/
+int unpublishTables(const char *name);
+
+#endif
@@ -0,0 +1,346 @@
+/*
+    Implementation for module which runs the lattice over a semiring
+        chosen at compile time.
+
+    A step is written once, as a macro over the semiring's value type,
+    its zero and its sum; the product is always + as every semiring
+    here works on scores or their logs. An optional second value per
+    colour, carried alongside the first, holds the back pointer for
+    argmax and the number of paths for counting. Previous colours are
+    taken from the lattice's allowed lists, so no semiring checks a
+    colour table for colours a term can't take, and the loop over the
+    next colour runs over contiguous transitions for GCC to vectorise.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include "semiring.h"
+#include "kernels.h"
+
+/* Keeps sums of non-allowed scores from drifting towards overflow. */
+#define CLAMP(score) (((score) < LATTICE_NONALLOWED) ? LATTICE_NONALLOWED : (score))
+#define UNCHANGED(value) (value)
+
+#define MAXPLUS_SUM(best, bestAux, value, aux, k)                                   \
+    if ((value) > (best))                                                           \
+    {                                                                               \
+        (best) = (value);                                                           \
+    }
+#define ARGMAX_SUM(best, bestColour, value, aux, k)                                 \
+    if ((value) > (best))                                                           \
+    {                                                                               \
+        (best) = (value);                                                           \
+        (bestColour) = (k);                                                         \
+    }
+#define COUNTING_SUM(best, bestCount, value, count, k)                              \
+    if ((value) > (best))                                                           \
+    {                                                                               \
+        (best) = (value);                                                           \
+        (bestCount) = (count);                                                      \
+    }                                                                               \
+    else if ((value) == (best))                                                     \
+    {                                                                               \
+        (bestCount) = ((bestCount) + (count) < (bestCount)) ? ULLONG_MAX            \
+                                                            : (bestCount) + (count); \
+    }
+#define LOGSUMEXP_SUM(total, totalAux, value, aux, k) (total) = logAdd((total), (value))
+
+/* Returns log(exp(a) + exp(b)). */
+static inline double logAdd(double a, double b)
+{
+    if (a < b)
+    {
+        double swap = a;
+        a = b;
+        b = swap;
+    }
+    if (b == -INFINITY)
+    {
+        return a;
+    }
+    return a + log1p(exp(b - a));
+}
+
+/*
+    Defines the step and forward pass for semiring S over values of
+    type V, with its zero, a sum SUM(total, totalAux, value, aux, k)
+    adding value reached from colour k into total, and FINISH applied
+    to each value a step leaves. If HAS_AUX, each colour also carries
+    an A, ZERO_AUX where there are no paths and ONE_AUX at the first
+    term or where the caller gives none.
+*/
+#define DEFINE_SEMIRING(S, V, A, HAS_AUX, ZERO, ZERO_AUX, ONE_AUX, SUM, FINISH)    \
+    static inline __attribute__((always_inline)) void                               \
+    step##S(struct lattice *l, const V *values, const A *aux, int fromTable,        \
+            int toTable, int forward, int emit, V *result, A *resultAux)            \
+    {                                                                               \
+        int colourCount = l->colourCount;                                           \
+        int fromStart = 0;                                                          \
+        int fromEnd = colourCount;                                                  \
+        const int *fromColours = NULL;                                              \
+        if (fromTable != SEMIRING_ALL_COLOURS)                                      \
+        {                                                                           \
+            fromStart = l->allowedStarts[fromTable + 1];                            \
+            fromEnd = l->allowedStarts[fromTable + 2];                              \
+            fromColours = l->allowedColours;                                        \
+        }                                                                           \
+        int toStart = 0;                                                            \
+        int toEnd = colourCount;                                                    \
+        const int *toColours = NULL;                                                \
+        if (toTable != SEMIRING_ALL_COLOURS)                                        \
+        {                                                                           \
+            toStart = l->allowedStarts[toTable + 1];                                \
+            toEnd = l->allowedStarts[toTable + 2];                                  \
+            toColours = l->allowedColours;                                          \
+        }                                                                           \
+        for (int j = 0; j < colourCount; j++)                                       \
+        {                                                                           \
+            result[j] = ZERO;                                                       \
+            if (HAS_AUX)                                                            \
+            {                                                                       \
+                resultAux[j] = ZERO_AUX;                                            \
+            }                                                                       \
+        }                                                                           \
+        for (int a = fromStart; a < fromEnd; a++)                                   \
+        {                                                                           \
+            int k = fromColours ? fromColours[a] : a;                               \
+            V from = values[k];                                                     \
+            if (emit && !forward)                                                   \
+            {                                                                       \
+                from += LATTICE_ROW(l, fromTable)[k];                               \
+            }                                                                       \
+            A fromAux = (HAS_AUX && aux) ? aux[k] : ONE_AUX;                        \
+            (void)fromAux;                                                          \
+            /* Row k of the matrix going forward, column k going backward. */       \
+            const int *transitions = l->transitions + (size_t)k * (forward ? colourCount : 1);\
+            size_t stride = forward ? 1 : colourCount;                              \
+            if (toColours)                                                          \
+            {                                                                       \
+                for (int b = toStart; b < toEnd; b++)                               \
+                {                                                                   \
+                    int j = toColours[b];                                           \
+                    V value = from + transitions[j * stride];                       \
+                    SUM(result[j], resultAux[j], value, fromAux, k);                \
+                }                                                                   \
+            }                                                                       \
+            else if (forward)                                                       \
+            {                                                                       \
+                for (int j = 0; j < colourCount; j++)                               \
+                {                                                                   \
+                    V value = from + transitions[j];                                \
+                    SUM(result[j], resultAux[j], value, fromAux, k);                \
+                }                                                                   \
+            }                                                                       \
+            else                                                                    \
+            {                                                                       \
+                for (int j = 0; j < colourCount; j++)                               \
+                {                                                                   \
+                    V value = from + transitions[j * stride];                       \
+                    SUM(result[j], resultAux[j], value, fromAux, k);                \
+                }                                                                   \
+            }                                                                       \
+        }                                                                           \
+        for (int b = toStart; b < toEnd; b++)                                       \
+        {                                                                           \
+            int j = toColours ? toColours[b] : b;                                   \
+            if (emit && forward)                                                    \
+            {                                                                       \
+                result[j] += LATTICE_ROW(l, toTable)[j];                            \
+            }                                                                       \
+            result[j] = FINISH(result[j]);                                          \
+        }                                                                           \
+    }                                                                               \
+                                                                                    \
+    /*                                                                              \
+        Runs the semiring forward over the given terms, leaving the                 \
+        last term's values in last and, if HAS_AUX, its aux in lastAux              \
+        or, with history, every term's aux in turn from history.                    \
+    */                                                                              \
+    KERNEL_CLONES static void                                                       \
+    pass##S(struct lattice *l, const int *termTables, int termCount, V *last,       \
+            A *lastAux, A *history)                                                 \
+    {                                                                               \
+        int colourCount = l->colourCount;                                           \
+        V *values = (V *)malloc(sizeof(V) * colourCount * 2);                       \
+        assert(values);                                                             \
+        A *aux = NULL;                                                              \
+        if (HAS_AUX)                                                                \
+        {                                                                           \
+            aux = (A *)malloc(sizeof(A) * colourCount * 2);                         \
+            assert(aux);                                                            \
+        }                                                                           \
+        V *current = values;                                                        \
+        A *currentAux = history ? history : aux;                                    \
+        const int *row = LATTICE_ROW(l, termTables[0]);                             \
+        for (int j = 0; j < colourCount; j++)                                       \
+        {                                                                           \
+            int allowed = row[j] != LATTICE_NONALLOWED;                             \
+            current[j] = allowed ? (V)row[j] : ZERO;                                \
+            if (HAS_AUX)                                                            \
+            {                                                                       \
+                currentAux[j] = allowed ? ONE_AUX : ZERO_AUX;                       \
+            }                                                                       \
+        }                                                                           \
+        for (int i = 1; i < termCount; i++)                                         \
+        {                                                                           \
+            V *previous = current;                                                  \
+            A *previousAux = currentAux;                                            \
+            current = (current == values) ? values + colourCount : values;          \
+            if (history)                                                            \
+            {                                                                       \
+                currentAux = history + (size_t)i * colourCount;                     \
+            }                                                                       \
+            else if (HAS_AUX)                                                       \
+            {                                                                       \
+                currentAux = (currentAux == aux) ? aux + colourCount : aux;         \
+            }                                                                       \
+            step##S(l, previous, previousAux, termTables[i - 1], termTables[i],     \
+                    1, 1, current, currentAux);                                     \
+        }                                                                           \
+        for (int j = 0; j < colourCount; j++)                                       \
+        {                                                                           \
+            last[j] = current[j];                                                   \
+            if (HAS_AUX && lastAux)                                                 \
+            {                                                                       \
+                lastAux[j] = currentAux[j];                                         \
+            }                                                                       \
+        }                                                                           \
+        free(aux);                                                                  \
+        free(values);                                                               \
+    }
+
+DEFINE_SEMIRING(MaxPlus, int, char, 0, LATTICE_NONALLOWED, 0, 0, MAXPLUS_SUM, CLAMP)
+DEFINE_SEMIRING(Argmax, int, int, 1, LATTICE_NONALLOWED, 0, 0, ARGMAX_SUM, CLAMP)
+DEFINE_SEMIRING(Counting, int, unsigned long long, 1, LATTICE_NONALLOWED, 0, 1,
+                COUNTING_SUM, CLAMP)
+DEFINE_SEMIRING(LogSumExp, double, char, 0, -INFINITY, 0, 0, LOGSUMEXP_SUM, UNCHANGED)
+
+KERNEL_CLONES void
+semiringStepMaxPlus(struct lattice *l, const int *values, int fromTable,
+                    int toTable, int forward, int emit, int *result)
+{
+    stepMaxPlus(l, values, NULL, fromTable, toTable, forward, emit, result, NULL);
+}
+
+KERNEL_CLONES void
+semiringStepArgmax(struct lattice *l, const int *values, int fromTable,
+                   int toTable, int forward, int emit, int *result,
+                   int *colours)
+{
+    stepArgmax(l, values, NULL, fromTable, toTable, forward, emit, result, colours);
+}
+
+KERNEL_CLONES void
+semiringStepCounting(struct lattice *l, const int *values,
+                     const unsigned long long *counts, int fromTable,
+                     int toTable, int forward, int emit, int *result,
+                     unsigned long long *resultCounts)
+{
+    stepCounting(l, values, counts, fromTable, toTable, forward, emit, result,
+                 resultCounts);
+}
+
+void semiringStepLogSumExp(struct lattice *l, const double *values, int fromTable,
+                           int toTable, int forward, int emit, double *result)
+{
+    stepLogSumExp(l, values, NULL, fromTable, toTable, forward, emit, result, NULL);
+}
+
+int latticeScore(struct lattice *l, const int *termTables, int termCount)
+{
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    int *last = (int *)malloc(sizeof(int) * l->colourCount);
+    assert(last);
+    passMaxPlus(l, termTables, termCount, last, NULL, NULL);
+    int score = last[latticeBestColour(l, last)];
+    free(last);
+    return score;
+}
+
+int latticeSolveGeneric(struct lattice *l, const int *termTables,
+                        int termCount, int *colours)
+{
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    if (!colours)
+    {
+        return latticeScore(l, termTables, termCount);
+    }
+    int colourCount = l->colourCount;
+    int *last = (int *)malloc(sizeof(int) * colourCount);
+    assert(last);
+    int *back = (int *)malloc(sizeof(int) * colourCount * termCount);
+    assert(back);
+    passArgmax(l, termTables, termCount, last, NULL, back);
+    int colour = latticeBestColour(l, last);
+    int score = last[colour];
+    for (int i = termCount - 1; i > 0; i--)
+    {
+        colours[i] = colour;
+        colour = back[i * colourCount + colour];
+    }
+    colours[0] = colour;
+    free(back);
+    free(last);
+    return score;
+}
+
+unsigned long long latticeCountBest(struct lattice *l, const int *termTables,
+                                    int termCount, int *score)
+{
+    if (termCount == 0)
+    {
+        if (score)
+        {
+            *score = 0;
+        }
+        return 1;
+    }
+    int colourCount = l->colourCount;
+    int *last = (int *)malloc(sizeof(int) * colourCount);
+    assert(last);
+    unsigned long long *counts = (unsigned long long *)malloc(sizeof(unsigned long long) *
+                                                              colourCount);
+    assert(counts);
+    passCounting(l, termTables, termCount, last, counts, NULL);
+    int best = last[latticeBestColour(l, last)];
+    unsigned long long count = 0;
+    for (int j = 0; j < colourCount; j++)
+    {
+        if (last[j] == best)
+        {
+            count = (count + counts[j] < count) ? ULLONG_MAX : count + counts[j];
+        }
+    }
+    if (score)
+    {
+        *score = best;
+    }
+    free(counts);
+    free(last);
+    return count;
+}
+
+double latticeLogWeight(struct lattice *l, const int *termTables, int termCount)
+{
+    if (termCount == 0)
+    {
+        return 0;
+    }
+    double *last = (double *)malloc(sizeof(double) * l->colourCount);
+    assert(last);
+    passLogSumExp(l, termTables, termCount, last, NULL, NULL);
+    double total = -INFINITY;
+    for (int j = 0; j < l->colourCount; j++)
+    {
+        total = logAdd(total, last[j]);
+    }
+    free(last);
+    return total;
+}
@@ -0,0 +1,65 @@
+/*
+    Header for module which runs the lattice over a semiring chosen
+        at compile time, so the best score, the best path, the number
+        of best paths and the log of the total weight all come from
+        the same steps.
+*/
+#include "lattice.h"
+
+#ifndef SEMIRING_H
+#define SEMIRING_H 1
+
+/* Table index for steps to take every colour of a term. */
+#define SEMIRING_ALL_COLOURS (-2)
+
+/*
+    Each of these is one step of its semiring from the values of one
+    term (of table fromTable) to a neighbouring term (of table toTable),
+    over the colours each allows: going forward, result[j] is the sum
+    over k of values[k] times the transition from k to j, going
+    backward the transition from j to k. If emit is set the later
+    term's emission is included, toTable's going forward and
+    fromTable's going backward, which must then be tables. Colours
+    toTable doesn't allow get the semiring's zero.
+
+    Max-plus sums with max and multiplies with +, giving best scores.
+    Argmax is max-plus which also sets colours[j] to the k giving the
+    best, ties going to the lowest. Counting is max-plus which also
+    carries in counts[j] how many colourings reach that best, counts
+    of NULL meaning one for each. Log-sum-exp sums with log(exp + exp)
+    and multiplies with +.
+*/
+void semiringStepMaxPlus(struct lattice *l, const int *values, int fromTable,
+                         int toTable, int forward, int emit, int *result);
+void semiringStepArgmax(struct lattice *l, const int *values, int fromTable,
+                        int toTable, int forward, int emit, int *result,
+                        int *colours);
+void semiringStepCounting(struct lattice *l, const int *values,
+                          const unsigned long long *counts, int fromTable,
+                          int toTable, int forward, int emit, int *result,
+                          unsigned long long *resultCounts);
+void semiringStepLogSumExp(struct lattice *l, const double *values, int fromTable,
+                           int toTable, int forward, int emit, double *result);
+
+/*
+    Returns the score of the optimal colouring of the given sequence of
+    table indices, as latticeSolve does, without finding the colouring.
+*/
+int latticeScore(struct lattice *l, const int *termTables, int termCount);
+
+/*
+    Returns the number of colourings of the given sequence of table
+    indices which reach the optimal score, stopping at ULLONG_MAX,
+    and sets score (if not NULL) to that score.
+*/
+unsigned long long latticeCountBest(struct lattice *l, const int *termTables,
+                                    int termCount, int *score);
+
+/*
+    Returns the log of the sum over every colouring of the given
+    sequence of table indices of e to the power of its score,
+    computed exactly in the log domain.
+*/
+double latticeLogWeight(struct lattice *l, const int *termTables, int termCount);
+
+#endif
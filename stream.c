@@ -0,0 +1,286 @@
+/*
+    Implementation for module which solves Part F online
+        with convergence detection and a fixed lag.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "stream.h"
+
+/* Initial number of back pointer rows held when the lag is unbounded. */
+#define INITIALROWS 64
+
+/* Scores are shifted back towards zero once the best passes this. */
+#define RENORMALISE_LIMIT (1 << 28)
+
+struct streamSolver
+{
+    struct lattice *l;
+    int lag;
+    streamEmit emit;
+    void *data;
+    /* Best score of each colour for the last term pushed. */
+    int *scores;
+    int *nextScores;
+    /* Amount subtracted from scores to keep them small. */
+    long long offset;
+    /* Ring of back pointer rows, term i uses row i % capacity. */
+    int *rows;
+    int capacity;
+    /* The number of terms pushed and committed. */
+    int seen;
+    int committed;
+    /* Scratch space for tracing paths and committing colours. */
+    int *states;
+    int *nextStates;
+    char *marks;
+    int *colours;
+    struct streamStats stats;
+};
+
+struct streamSolver *newStreamSolver(struct lattice *l, int lag,
+                                     streamEmit emit, void *data)
+{
+    struct streamSolver *s = (struct streamSolver *)malloc(sizeof(struct streamSolver));
+    assert(s);
+    int colourCount = l->colourCount;
+    s->l = l;
+    s->lag = (lag > 0) ? lag : 0;
+    s->emit = emit;
+    s->data = data;
+    s->scores = (int *)malloc(sizeof(int) * colourCount);
+    assert(s->scores);
+    s->nextScores = (int *)malloc(sizeof(int) * colourCount);
+    assert(s->nextScores);
+    s->offset = 0;
+    s->capacity = (s->lag > 0) ? s->lag + 1 : INITIALROWS;
+    s->rows = (int *)malloc(sizeof(int) * colourCount * s->capacity);
+    assert(s->rows);
+    s->seen = 0;
+    s->committed = 0;
+    s->states = (int *)malloc(sizeof(int) * colourCount);
+    assert(s->states);
+    s->nextStates = (int *)malloc(sizeof(int) * colourCount);
+    assert(s->nextStates);
+    s->marks = (char *)malloc(colourCount);
+    assert(s->marks);
+    s->colours = (int *)malloc(sizeof(int) * s->capacity);
+    assert(s->colours);
+    memset(&(s->stats), 0, sizeof(struct streamStats));
+    return s;
+}
+
+/* Gets the back pointer row of the given term. */
+static int *backRow(struct streamSolver *s, int index)
+{
+    return s->rows + (index % s->capacity) * s->l->colourCount;
+}
+
+/* Makes room for the back pointers of every uncommitted term plus one more. */
+static void reserveRows(struct streamSolver *s)
+{
+    if (s->seen - s->committed + 1 <= s->capacity)
+    {
+        return;
+    }
+    int colourCount = s->l->colourCount;
+    int capacity = s->capacity * 2;
+    int *rows = (int *)malloc(sizeof(int) * colourCount * capacity);
+    assert(rows);
+    for (int i = s->committed; i < s->seen; i++)
+    {
+        memcpy(rows + (i % capacity) * colourCount, backRow(s, i),
+               sizeof(int) * colourCount);
+    }
+    free(s->rows);
+    s->rows = rows;
+    s->capacity = capacity;
+    s->colours = (int *)realloc(s->colours, sizeof(int) * capacity);
+    assert(s->colours);
+}
+
+/*
+    Emits the colours of the uncommitted terms up to and including last,
+    following back pointers from the given colour of last.
+*/
+static void commitThrough(struct streamSolver *s, int last, int colour,
+                          long *counter)
+{
+    for (int i = last; i >= s->committed; i--)
+    {
+        s->colours[i - s->committed] = colour;
+        if (i > s->committed)
+        {
+            colour = backRow(s, i)[colour];
+        }
+    }
+    for (int i = s->committed; i <= last; i++)
+    {
+        int latency = s->seen - 1 - i;
+        s->stats.totalLatency += latency;
+        if (latency > s->stats.maxLatency)
+        {
+            s->stats.maxLatency = latency;
+        }
+        if (s->emit)
+        {
+            s->emit(s->data, i, s->colours[i - s->committed]);
+        }
+    }
+    *counter += last - s->committed + 1;
+    s->committed = last + 1;
+}
+
+/* Commits the terms every surviving path agrees on, if any. */
+static void commitConverged(struct streamSolver *s)
+{
+    struct lattice *l = s->l;
+    int count = 0;
+    for (int j = 0; j < l->colourCount; j++)
+    {
+        if (s->scores[j] != LATTICE_NONALLOWED)
+        {
+            s->states[count] = j;
+            count++;
+        }
+    }
+    int row = s->seen - 1;
+    while (count > 1 && row > s->committed)
+    {
+        /* Step every surviving path back a term, merging those that meet. */
+        memset(s->marks, 0, l->colourCount);
+        int *back = backRow(s, row);
+        int nextCount = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int previous = back[s->states[i]];
+            if (!s->marks[previous])
+            {
+                s->marks[previous] = 1;
+                s->nextStates[nextCount] = previous;
+                nextCount++;
+            }
+        }
+        int *swap = s->states;
+        s->states = s->nextStates;
+        s->nextStates = swap;
+        count = nextCount;
+        row--;
+    }
+    if (count == 1)
+    {
+        commitThrough(s, row, s->states[0], &(s->stats.convergedCount));
+    }
+}
+
+/*
+    Commits the oldest uncommitted term to its colour on the best path
+    and drops every surviving path which disagrees.
+*/
+static void commitForced(struct streamSolver *s)
+{
+    struct lattice *l = s->l;
+    int colourCount = l->colourCount;
+    for (int j = 0; j < colourCount; j++)
+    {
+        s->states[j] = j;
+    }
+    for (int row = s->seen - 1; row > s->committed; row--)
+    {
+        int *back = backRow(s, row);
+        for (int j = 0; j < colourCount; j++)
+        {
+            s->states[j] = back[s->states[j]];
+        }
+    }
+    int colour = s->states[latticeBestColour(l, s->scores)];
+    for (int j = 0; j < colourCount; j++)
+    {
+        if (s->states[j] != colour)
+        {
+            s->scores[j] = LATTICE_NONALLOWED;
+        }
+    }
+    commitThrough(s, s->committed, colour, &(s->stats.forcedCount));
+}
+
+void streamPush(struct streamSolver *s, int table)
+{
+    struct lattice *l = s->l;
+    if (s->seen == 0)
+    {
+        latticeStart(l, table, s->scores);
+    }
+    else
+    {
+        reserveRows(s);
+        latticeForwardStep(l, s->scores, table, s->nextScores, backRow(s, s->seen));
+        int *swap = s->scores;
+        s->scores = s->nextScores;
+        s->nextScores = swap;
+    }
+    s->seen++;
+    s->stats.termCount++;
+
+    int best = s->scores[latticeBestColour(l, s->scores)];
+    if (best > RENORMALISE_LIMIT || best < -RENORMALISE_LIMIT)
+    {
+        for (int j = 0; j < l->colourCount; j++)
+        {
+            if (s->scores[j] != LATTICE_NONALLOWED)
+            {
+                s->scores[j] -= best;
+            }
+        }
+        s->offset += best;
+    }
+
+    commitConverged(s);
+    if (s->lag > 0 && s->seen - s->committed > s->lag)
+    {
+        commitForced(s);
+    }
+}
+
+int streamFinish(struct streamSolver *s)
+{
+    if (s->seen == 0)
+    {
+        return 0;
+    }
+    int colour = latticeBestColour(s->l, s->scores);
+    if (s->committed < s->seen)
+    {
+        commitThrough(s, s->seen - 1, colour, &(s->stats.finishedCount));
+    }
+    return (int)(s->offset + s->scores[colour]);
+}
+
+void streamGetStats(struct streamSolver *s, struct streamStats *stats)
+{
+    *stats = s->stats;
+}
+
+void printStreamStats(FILE *outFile, const struct streamStats *stats)
+{
+    double meanLatency = (stats->termCount > 0) ? (double)stats->totalLatency / stats->termCount : 0;
+    fprintf(outFile, "stream: %ld terms, %ld committed on convergence, %ld forced by the lag, %ld at the end\n",
+            stats->termCount, stats->convergedCount, stats->forcedCount, stats->finishedCount);
+    fprintf(outFile, "stream: latency %.2f terms on average, %d at most\n", meanLatency,
+            stats->maxLatency);
+}
+
+void freeStreamSolver(struct streamSolver *s)
+{
+    if (s)
+    {
+        free(s->scores);
+        free(s->nextScores);
+        free(s->rows);
+        free(s->states);
+        free(s->nextStates);
+        free(s->marks);
+        free(s->colours);
+        free(s);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+    Header for module which solves Part F online, taking terms as they
+        arrive and committing colours once every surviving Viterbi path
+        agrees on them, or after a fixed lag.
+*/
+#include <stdio.h>
+#include "lattice.h"
+
+#ifndef STREAM_H
+#define STREAM_H 1
+
+struct streamSolver;
+
+/* Called with the index of each committed term and its colour, in order. */
+typedef void (*streamEmit)(void *data, int index, int colour);
+
+struct streamStats
+{
+    /* The number of terms pushed. */
+    long termCount;
+    /* Terms committed because all surviving paths converged on them. */
+    long convergedCount;
+    /* Terms committed because they fell behind the lag. */
+    long forcedCount;
+    /* Terms committed when the stream was finished. */
+    long finishedCount;
+    /* Total and largest number of terms seen after a term before it was committed. */
+    long totalLatency;
+    int maxLatency;
+};
+
+/*
+    Creates a streaming solver over the given lattice. With a lag of 0
+    terms are only committed on convergence, so the result always
+    matches latticeSolve but memory grows with the longest stretch
+    without convergence. With a positive lag at most lag terms are held,
+    and a term that would exceed it is committed to the colour on the
+    currently best path, with later paths constrained to agree.
+*/
+struct streamSolver *newStreamSolver(struct lattice *l, int lag,
+                                     streamEmit emit, void *data);
+
+/* Adds the next term, given by its table index, to the stream. */
+void streamPush(struct streamSolver *s, int table);
+
+/*
+    Commits all remaining terms and returns the score of the emitted
+    colouring.
+*/
+int streamFinish(struct streamSolver *s);
+
+/* Fills in stats with the commit counts and latencies so far. */
+void streamGetStats(struct streamSolver *s, struct streamStats *stats);
+
+/* Prints the given stats on a line or two of outFile. */
+void printStreamStats(FILE *outFile, const struct streamStats *stats);
+
+/*
+    Frees the given streaming solver, the lattice is left intact.
+*/
+void freeStreamSolver(struct streamSolver *s);
+
+#endif
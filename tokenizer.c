@@ -0,0 +1,264 @@
+/*
+    Implementation for module which splits text into terms.
+
+    A large text is cut into one chunk per thread, each cut moved on
+    past the next whitespace, and every thread finds the terms starting
+    in its chunk as if the text began there. Since the terms found from
+    a position only depend on the next letter, a chunk's terms are the
+    serial ones from the first that starts where the serial terms
+    would. The chunks are joined in order, finding terms one at a time
+    from the end of the joined ones (e.g. after a "Big Oh" cut between
+    its words) until one lines up with the chunk's.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include "tokenizer.h"
+#include "matcher.h"
+#include "fold.h"
+#include "pattern.h"
+#include "problemStruct.c"
+
+/* Number of spans to allocate space for initially. */
+#define INITIALSPANS 64
+
+struct tokenizerChunk
+{
+    struct problem *p;
+    const char *text;
+    int textLength;
+    /* Offsets of the chunk in the text, terms starting in it are the chunk's. */
+    int start;
+    int end;
+    int spanCount;
+    int allocatedSpans;
+    struct termSpan *spans;
+    /* The range of the joined spans to find the strings of. */
+    struct termSpan *joined;
+    char **terms;
+    int first;
+    int last;
+};
+
+int nextTerm(struct problem *p, const char *text, int textLength,
+             int progress, struct termSpan *span)
+{
+    /* This does greedy term matching - this generally follows the specification
+        but also allows for more complex cases (e.g. "Big Oh"). */
+    int bytes;
+    while (progress < textLength && !(foldClassAt(text, textLength, progress, &bytes) & FOLD_LETTER))
+    {
+        progress += bytes;
+    }
+    if (progress >= textLength)
+    {
+        return 0;
+    }
+    int start = progress;
+    int maxLengthGreedyMatch = 0;
+    /* See if any of the terms in the table match, taking the longest. */
+    int nextTable = matchTerm(p->matcher, p->colourTables, text, textLength, start,
+                              &maxLengthGreedyMatch);
+    span->start = start;
+    span->table = nextTable;
+    if (nextTable >= 0)
+    {
+        span->end = start + maxLengthGreedyMatch;
+    }
+    else
+    {
+        /* No match found, take the word. This may consume punctuation,
+            this doesn't really matter. */
+        int end = start;
+        while (end < textLength && !(foldClassAt(text, textLength, end, &bytes) & FOLD_SPACE))
+        {
+            end += bytes;
+        }
+        span->end = end;
+    }
+    return 1;
+}
+
+char *termString(struct problem *p, const char *text, struct termSpan *span)
+{
+    if (!termStringOwned(p, span->table))
+    {
+        return p->colourTables[span->table].term;
+    }
+    char *word = strndup(text + span->start, span->end - span->start);
+    assert(word);
+    return word;
+}
+
+int termStringOwned(struct problem *p, int table)
+{
+    return table < 0 || p->colourTables[table].pattern;
+}
+
+int termLookahead(struct problem *p)
+{
+    int longest = p->matcher->longestTerm;
+    if (p->matcher->patterns && p->matcher->patterns->lookahead > longest)
+    {
+        longest = p->matcher->patterns->lookahead;
+    }
+    /* The character after the term, up to four bytes, is checked for a word boundary. */
+    return longest + 4;
+}
+
+/* Adds the given span to the end of the given array, growing it as needed. */
+static void appendSpan(struct termSpan **spans, int *spanCount, int *allocatedSpans,
+                       const struct termSpan *span)
+{
+    if (*spanCount >= *allocatedSpans)
+    {
+        *allocatedSpans = (*allocatedSpans == 0) ? INITIALSPANS : *allocatedSpans * 2;
+        *spans = (struct termSpan *)realloc(*spans, sizeof(struct termSpan) * *allocatedSpans);
+        assert(*spans);
+    }
+    (*spans)[*spanCount] = *span;
+    (*spanCount)++;
+}
+
+static void *tokenizeChunk(void *arg)
+{
+    struct tokenizerChunk *c = (struct tokenizerChunk *)arg;
+    int progress = c->start;
+    struct termSpan span;
+    while (nextTerm(c->p, c->text, c->textLength, progress, &span) && span.start < c->end)
+    {
+        appendSpan(&(c->spans), &(c->spanCount), &(c->allocatedSpans), &span);
+        progress = span.end;
+    }
+    return NULL;
+}
+
+static void *chunkStrings(void *arg)
+{
+    struct tokenizerChunk *c = (struct tokenizerChunk *)arg;
+    for (int i = c->first; i < c->last; i++)
+    {
+        c->terms[i] = termString(c->p, c->text, &(c->joined[i]));
+    }
+    return NULL;
+}
+
+/* Runs the given function over the chunks, the calling thread taking the first. */
+static void runChunks(void *(*run)(void *), struct tokenizerChunk *chunks, int threadCount)
+{
+    pthread_t threads[TOKENIZER_MAX_THREADS];
+    for (int i = 1; i < threadCount; i++)
+    {
+        int created = pthread_create(&(threads[i]), NULL, run, &(chunks[i]));
+        assert(created == 0);
+    }
+    run(&(chunks[0]));
+    for (int i = 1; i < threadCount; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int findTerms(struct problem *p, const char *text, int textLength, int threadCount,
+              struct termSpan **spans, char ***terms)
+{
+    if (threadCount > textLength / TOKENIZER_MIN_CHUNK)
+    {
+        threadCount = textLength / TOKENIZER_MIN_CHUNK;
+    }
+    if (threadCount > TOKENIZER_MAX_THREADS)
+    {
+        threadCount = TOKENIZER_MAX_THREADS;
+    }
+    if (threadCount < 1)
+    {
+        threadCount = 1;
+    }
+
+    struct tokenizerChunk chunks[TOKENIZER_MAX_THREADS];
+    int cut = 0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        chunks[i].p = p;
+        chunks[i].text = text;
+        chunks[i].textLength = textLength;
+        chunks[i].start = cut;
+        cut = (int)((long long)textLength * (i + 1) / threadCount);
+        if (cut < chunks[i].start)
+        {
+            cut = chunks[i].start;
+        }
+        /* Move the cut on past whitespace, where a term is most likely to start. */
+        while (cut > 0 && cut < textLength &&
+               ((unsigned char)text[cut - 1] >= 0x80 ||
+                !(foldAsciiClasses[(unsigned char)text[cut - 1]] & FOLD_SPACE)))
+        {
+            cut++;
+        }
+        chunks[i].end = cut;
+        chunks[i].spanCount = 0;
+        chunks[i].allocatedSpans = 0;
+        chunks[i].spans = NULL;
+    }
+    runChunks(tokenizeChunk, chunks, threadCount);
+
+    /* Join the chunks, finding the terms again up to where each lines up. */
+    struct termSpan *joined = NULL;
+    int joinedCount = 0;
+    int allocatedJoined = 0;
+    int progress = 0;
+    struct termSpan span;
+    for (int i = 0; i < threadCount; i++)
+    {
+        struct tokenizerChunk *c = &(chunks[i]);
+        int next = 0;
+        while (nextTerm(p, text, textLength, progress, &span) && span.start < c->end)
+        {
+            while (next < c->spanCount && c->spans[next].start < span.start)
+            {
+                next++;
+            }
+            if (next < c->spanCount && c->spans[next].start == span.start)
+            {
+                /* Lined up, the rest of the chunk's terms are the serial ones. */
+                if (joinedCount == 0 && next == 0)
+                {
+                    joined = c->spans;
+                    joinedCount = c->spanCount;
+                    allocatedJoined = c->allocatedSpans;
+                    c->spans = NULL;
+                }
+                for (; c->spans && next < c->spanCount; next++)
+                {
+                    appendSpan(&joined, &joinedCount, &allocatedJoined, &(c->spans[next]));
+                }
+                progress = joined[joinedCount - 1].end;
+                break;
+            }
+            appendSpan(&joined, &joinedCount, &allocatedJoined, &span);
+            progress = span.end;
+        }
+        free(c->spans);
+    }
+
+    if (terms)
+    {
+        *terms = NULL;
+        if (joinedCount > 0)
+        {
+            *terms = (char **)malloc(sizeof(char *) * joinedCount);
+            assert(*terms);
+        }
+        for (int i = 0; i < threadCount; i++)
+        {
+            chunks[i].joined = joined;
+            chunks[i].terms = *terms;
+            chunks[i].first = (int)((long long)joinedCount * i / threadCount);
+            chunks[i].last = (int)((long long)joinedCount * (i + 1) / threadCount);
+        }
+        runChunks(chunkStrings, chunks, threadCount);
+    }
+    *spans = joined;
+    return joinedCount;
+}
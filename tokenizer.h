@@ -0,0 +1,75 @@
+/*
+    Header for module which splits text into terms, greedily
+        matching the longest term in the term colour tables
+        and otherwise taking whitespace-separated words.
+*/
+#include "problem.h"
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H 1
+
+/* The most threads findTerms runs. */
+#define TOKENIZER_MAX_THREADS 64
+
+/* Each thread tokenizes at least this many characters of the text. */
+#ifndef TOKENIZER_MIN_CHUNK
+#define TOKENIZER_MIN_CHUNK (1 << 18)
+#endif
+
+struct termSpan
+{
+    /* Offset of the first character of the term in the text. */
+    int start;
+    /* Offset one past the last character of the term. */
+    int end;
+    /* The index of the matching term colour table, or -1 if none. */
+    int table;
+};
+
+/*
+    Finds the next term in the given UTF-8 text at or after progress
+    using the term colour tables of the given problem. Terms start at
+    a letter of any script and words end at Unicode whitespace.
+    Returns 1 and fills in span if a term was found, or 0 if only
+    punctuation and whitespace remain.
+*/
+int nextTerm(struct problem *p, const char *text, int textLength,
+             int progress, struct termSpan *span);
+
+/*
+    Splits the given text into the terms repeated nextTerm calls from
+    its start would find, setting spans to them (NULL if there are
+    none) and, unless terms is NULL, terms to their termString strings,
+    returning how many there are. The text is split after whitespace
+    across up to threadCount threads (including the calling one), and
+    where a term straddles a split the terms are found again from the
+    end of the previous thread's, so the result is the same for any
+    threadCount.
+*/
+int findTerms(struct problem *p, const char *text, int textLength, int threadCount,
+              struct termSpan **spans, char ***terms);
+
+/*
+    Returns the string for the given span, which is the term in
+    the term colour table if matched, or a freshly allocated copy
+    of the word otherwise, or of the text a pattern matched.
+*/
+char *termString(struct problem *p, const char *text, struct termSpan *span);
+
+/*
+    Whether termString returns a freshly allocated string, which the
+    caller frees, for a term of the given table (-1 for none).
+*/
+int termStringOwned(struct problem *p, int table);
+
+/*
+    Returns the number of characters after a term's start that
+    nextTerm may need to inspect to match a table term, callers
+    re-tokenizing part of a text use this to find the terms an
+    edit may affect. A pattern's wildcards are counted as
+    PATTERN_WILDCARD_LOOKAHEAD characters each, which is as far as
+    matchPattern reads.
+*/
+int termLookahead(struct problem *p);
+
+#endif
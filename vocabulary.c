@@ -0,0 +1,323 @@
+/*
+    Implementation for module which interns the words of a text.
+
+    Words are looked up by their case folding, so a token costs one
+    fold, one hash and one lookup. Most spellings are their own
+    folding and share the word's copy; only those which aren't are
+    looked up a second time, among the other spellings. Both indices
+    are open-addressed and kept at most half full, each slot holding
+    the full hash, the string and the word's id, so a lookup which
+    finds its word touches one slot and one string.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "vocabulary.h"
+#include "hash.h"
+#include "fold.h"
+
+/* Slots in each index to begin with. */
+#define INITIAL_SLOTS 1024
+
+/* The serial of the last vocabulary made. */
+static unsigned long long lastSerial = 0;
+
+struct vocabularyBlock
+{
+    struct vocabularyBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/* Copies length bytes of text and a '\0' into the vocabulary's blocks. */
+static const char *copyString(struct vocabulary *v, const char *text, int length)
+{
+    struct vocabularyBlock *block = v->blocks;
+    if (!block || block->used + length + 1 > block->size)
+    {
+        size_t size = (length + 1 > VOCABULARY_BLOCK) ? (size_t)length + 1 : VOCABULARY_BLOCK;
+        block = (struct vocabularyBlock *)malloc(sizeof(struct vocabularyBlock) + size);
+        assert(block);
+        block->used = 0;
+        block->size = size;
+        block->next = v->blocks;
+        v->blocks = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+/* Returns slotCount slots, all empty. */
+static struct vocabularySlot *newSlots(int slotCount)
+{
+    struct vocabularySlot *slots =
+        (struct vocabularySlot *)calloc(slotCount, sizeof(struct vocabularySlot));
+    assert(slots);
+    return slots;
+}
+
+/*
+    Returns the slot holding the given hash and bytes in the given
+    index, or the empty slot where they belong.
+*/
+static struct vocabularySlot *findSlot(struct vocabularySlot *slots, int slotCount,
+                                       unsigned long long hash, const char *text, int length)
+{
+    int mask = slotCount - 1;
+    int slot = (int)(hash & mask);
+    while (slots[slot].string)
+    {
+        if (slots[slot].hash == hash && slots[slot].length == length &&
+            memcmp(slots[slot].string, text, length) == 0)
+        {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &(slots[slot]);
+}
+
+/* Doubles an index, returning its new slots and setting slotCount. */
+static struct vocabularySlot *growSlots(struct vocabularySlot *slots, int *slotCount)
+{
+    int oldCount = *slotCount;
+    struct vocabularySlot *grown = newSlots(oldCount * 2);
+    int mask = oldCount * 2 - 1;
+    for (int i = 0; i < oldCount; i++)
+    {
+        /* The slots are read in order but written anywhere. */
+        if (i + VOCABULARY_PREFETCH < oldCount)
+        {
+            __builtin_prefetch(&(grown[slots[i + VOCABULARY_PREFETCH].hash & mask]), 1);
+        }
+        if (slots[i].string)
+        {
+            int slot = (int)(slots[i].hash & mask);
+            while (grown[slot].string)
+            {
+                slot = (slot + 1) & mask;
+            }
+            grown[slot] = slots[i];
+        }
+    }
+    free(slots);
+    *slotCount = oldCount * 2;
+    return grown;
+}
+
+struct vocabulary *newVocabulary(void)
+{
+    struct vocabulary *v = (struct vocabulary *)malloc(sizeof(struct vocabulary));
+    assert(v);
+    v->serial = __atomic_add_fetch(&lastSerial, 1, __ATOMIC_RELAXED);
+    v->wordCount = 0;
+    v->spellingCount = 0;
+    v->words = (const char **)malloc(sizeof(const char *) * INITIAL_SLOTS / 2);
+    assert(v->words);
+    v->wordLengths = (int *)malloc(sizeof(int) * INITIAL_SLOTS / 2);
+    assert(v->wordLengths);
+    v->wordSlotCount = INITIAL_SLOTS;
+    v->wordSlots = newSlots(INITIAL_SLOTS);
+    v->spellingSlotCount = INITIAL_SLOTS;
+    v->spellingSlots = newSlots(INITIAL_SLOTS);
+    v->blocks = NULL;
+    return v;
+}
+
+/*
+    Writes the case folding of the length bytes at text to folded,
+    returning whether it's the same as the text.
+*/
+static int foldWord(const char *text, int length, char *folded)
+{
+    /* Case folding keeps every character the same number of bytes. */
+    if (foldIsAscii(text, length))
+    {
+        int same = 1;
+        for (int i = 0; i < length; i++)
+        {
+            folded[i] = foldAsciiCases[(unsigned char)text[i]];
+            same &= (folded[i] == text[i]);
+        }
+        return same;
+    }
+    for (int position = 0; position < length;)
+    {
+        position += foldAt(text, length, position, folded + position);
+    }
+    return memcmp(folded, text, length) == 0;
+}
+
+/*
+    Returns the slot of the given case folded word, with the given
+    hash, adding the word with the next id if it's new.
+*/
+static struct vocabularySlot *internWord(struct vocabulary *v, const char *folded, int length,
+                                         unsigned long long hash)
+{
+    struct vocabularySlot *slot = findSlot(v->wordSlots, v->wordSlotCount, hash, folded, length);
+    if (slot->string)
+    {
+        return slot;
+    }
+    uint32_t id = v->wordCount;
+    /* The arrays hold as many as half the slots. */
+    if (2 * (id + 1) > (uint32_t)v->wordSlotCount)
+    {
+        v->wordSlots = growSlots(v->wordSlots, &(v->wordSlotCount));
+        v->words = (const char **)realloc(v->words,
+                                          sizeof(const char *) * v->wordSlotCount / 2);
+        assert(v->words);
+        v->wordLengths = (int *)realloc(v->wordLengths, sizeof(int) * v->wordSlotCount / 2);
+        assert(v->wordLengths);
+        slot = findSlot(v->wordSlots, v->wordSlotCount, hash, folded, length);
+    }
+    v->words[id] = copyString(v, folded, length);
+    v->wordLengths[id] = length;
+    slot->hash = hash;
+    slot->string = v->words[id];
+    slot->length = length;
+    slot->id = id;
+    v->wordCount++;
+    return slot;
+}
+
+/*
+    Returns the vocabulary's copy of the given spelling of the word with
+    the given id, which isn't its folding, adding it if it's new.
+*/
+static const char *internSpelling(struct vocabulary *v, const char *text, int length,
+                                  uint32_t id)
+{
+    unsigned long long hash = hashBytes(HASH_SEED, text, length);
+    struct vocabularySlot *slot =
+        findSlot(v->spellingSlots, v->spellingSlotCount, hash, text, length);
+    if (slot->string)
+    {
+        return slot->string;
+    }
+    /* The index holds as many as half its slots. */
+    if (2 * (v->spellingCount + 1) > (uint32_t)v->spellingSlotCount)
+    {
+        v->spellingSlots = growSlots(v->spellingSlots, &(v->spellingSlotCount));
+        slot = findSlot(v->spellingSlots, v->spellingSlotCount, hash, text, length);
+    }
+    slot->hash = hash;
+    slot->string = copyString(v, text, length);
+    slot->length = length;
+    slot->id = id;
+    v->spellingCount++;
+    return slot->string;
+}
+
+/* Interns the length bytes at text, whose folding has the given hash. */
+static uint32_t internFolded(struct vocabulary *v, const char *text, int length,
+                             const char *folded, int same, unsigned long long hash,
+                             const char **spelling)
+{
+    struct vocabularySlot *slot = internWord(v, folded, length, hash);
+    if (spelling)
+    {
+        *spelling = same ? slot->string : internSpelling(v, text, length, slot->id);
+    }
+    return slot->id;
+}
+
+uint32_t vocabularyIntern(struct vocabulary *v, const char *text, int length,
+                          const char **spelling)
+{
+    char buffer[256];
+    char *folded = (length <= (int)sizeof(buffer)) ? buffer : (char *)malloc(length);
+    assert(folded);
+    int same = foldWord(text, length, folded);
+    uint32_t id = internFolded(v, text, length, folded, same,
+                               hashBytes(HASH_SEED, folded, length), spelling);
+    if (folded != buffer)
+    {
+        free(folded);
+    }
+    return id;
+}
+
+void vocabularyInternAll(struct vocabulary *v, const char *text, const int *starts,
+                         const int *ends, int count, uint32_t *ids, const char **spellings)
+{
+    /* The hash of every word first, so the slot of each can be fetched ahead. */
+    unsigned long long *hashes =
+        (unsigned long long *)malloc(sizeof(unsigned long long) * (count > 0 ? count : 1));
+    assert(hashes);
+    /* And whether each is its own folding, which most are, so it needn't be folded again. */
+    unsigned char *same = (unsigned char *)malloc(count > 0 ? count : 1);
+    assert(same);
+    char buffer[256];
+    for (int i = 0; i < count; i++)
+    {
+        int length = ends[i] - starts[i];
+        char *folded = (length <= (int)sizeof(buffer)) ? buffer : (char *)malloc(length);
+        assert(folded);
+        same[i] = foldWord(text + starts[i], length, folded);
+        hashes[i] = hashBytes(HASH_SEED, folded, length);
+        if (folded != buffer)
+        {
+            free(folded);
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        /* The slot well ahead, then the string of the slot fetched by now. */
+        int mask = v->wordSlotCount - 1;
+        if (i + 2 * VOCABULARY_PREFETCH < count)
+        {
+            __builtin_prefetch(&(v->wordSlots[hashes[i + 2 * VOCABULARY_PREFETCH] & mask]));
+        }
+        if (i + VOCABULARY_PREFETCH < count)
+        {
+            __builtin_prefetch(v->wordSlots[hashes[i + VOCABULARY_PREFETCH] & mask].string);
+        }
+        const char *word = text + starts[i];
+        int length = ends[i] - starts[i];
+        if (same[i])
+        {
+            ids[i] = internFolded(v, word, length, word, 1, hashes[i], &(spellings[i]));
+            continue;
+        }
+        char *folded = (length <= (int)sizeof(buffer)) ? buffer : (char *)malloc(length);
+        assert(folded);
+        foldWord(word, length, folded);
+        ids[i] = internFolded(v, word, length, folded, 0, hashes[i], &(spellings[i]));
+        if (folded != buffer)
+        {
+            free(folded);
+        }
+    }
+    free(same);
+    free(hashes);
+}
+
+const char *vocabularyWord(const struct vocabulary *v, uint32_t id)
+{
+    assert(id < v->wordCount);
+    return v->words[id];
+}
+
+void freeVocabulary(struct vocabulary *v)
+{
+    if (v)
+    {
+        while (v->blocks)
+        {
+            struct vocabularyBlock *next = v->blocks->next;
+            free(v->blocks);
+            v->blocks = next;
+        }
+        free(v->words);
+        free(v->wordLengths);
+        free(v->wordSlots);
+        free(v->spellingSlots);
+        free(v);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+    Header for module which interns the words of a text, giving each
+        distinct word ignoring case a dense integer id and keeping one
+        copy of each distinct spelling, so tokens can be compared and
+        counted by id rather than by string.
+*/
+#include <stdint.h>
+
+#ifndef VOCABULARY_H
+#define VOCABULARY_H 1
+
+/* Bytes of words and spellings kept together in each block. */
+#ifndef VOCABULARY_BLOCK
+#define VOCABULARY_BLOCK (1 << 16)
+#endif
+
+/* Words vocabularyInternAll looks ahead to fetch their slots. */
+#ifndef VOCABULARY_PREFETCH
+#define VOCABULARY_PREFETCH 8
+#endif
+
+struct vocabularyBlock;
+
+/*
+    An entry in an index, with all a lookup needs so a probe touches
+    the string only when the hash matches. Empty if string is NULL.
+*/
+struct vocabularySlot
+{
+    unsigned long long hash;
+    const char *string;
+    int length;
+    /* The id of the word. */
+    uint32_t id;
+};
+
+struct vocabulary
+{
+    /* Different for every vocabulary made, as ids only mean anything within one. */
+    unsigned long long serial;
+    /* The number of distinct words, which have ids 0 up to it. */
+    uint32_t wordCount;
+    /* The number of distinct spellings of them which aren't their folding. */
+    uint32_t spellingCount;
+    /* Each word case folded, by id. */
+    const char **words;
+    int *wordLengths;
+    /* Open-addressed indices of the words, and the other spellings, by hash. */
+    int wordSlotCount;
+    struct vocabularySlot *wordSlots;
+    int spellingSlotCount;
+    struct vocabularySlot *spellingSlots;
+    /* Room for the strings above, which never move once copied. */
+    struct vocabularyBlock *blocks;
+};
+
+/* Returns an empty vocabulary. */
+struct vocabulary *newVocabulary(void);
+
+/*
+    Returns the id of the word spelled by the length bytes at text,
+    which is the same as that of any other spelling which case folds
+    to the same bytes, adding it if it's new, and sets spelling, if
+    not NULL, to the vocabulary's copy of the spelling, terminated by
+    '\0', which lasts as long as the vocabulary.
+*/
+uint32_t vocabularyIntern(struct vocabulary *v, const char *text, int length,
+                          const char **spelling);
+
+/*
+    Interns the count words of the given text from starts[i] to
+    ends[i] as vocabularyIntern does, setting ids[i] and spellings[i],
+    fetching the slots of words a few ahead so a text of mostly new
+    words doesn't wait on each lookup in turn.
+*/
+void vocabularyInternAll(struct vocabulary *v, const char *text, const int *starts,
+                         const int *ends, int count, uint32_t *ids, const char **spellings);
+
+/* Returns the case folding of the word with the given id. */
+const char *vocabularyWord(const struct vocabulary *v, uint32_t id);
+
+/*
+    Frees the given vocabulary and all memory allocated for it,
+    including the copies of its words and spellings.
+*/
+void freeVocabulary(struct vocabulary *v);
+
+#endif